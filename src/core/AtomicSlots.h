@@ -0,0 +1,97 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace flifcore
+{
+    //! Releases a value of AtomicSlots by deleting it.
+    struct DeleteRelease
+    {
+        template<class T>
+        void operator()(T* value) const
+        {
+            delete value;
+        }
+    };
+
+    /*!
+    * A fixed number of values that are each created once and then read without any lock.
+    *
+    * Threads that find a slot empty create a value and publish() it. The first one wins, the values of the others
+    * are released and they continue with the winner. A published value stays until the slots are destroyed.
+    * Release is called with every value the slots owned, e.g. to delete it or to drop a COM reference.
+    * Thread safe.
+    */
+    template<class T, class Release = DeleteRelease>
+    class AtomicSlots
+    {
+    public:
+        explicit AtomicSlots(size_t count = 0)
+            : _count(count)
+            , _slots(count != 0 ? new std::atomic<T*>[count] : 0)
+        {
+            for(size_t i = 0; i < _count; ++i)
+                _slots[i].store(0, std::memory_order_relaxed);
+        }
+
+        ~AtomicSlots()
+        {
+            for(size_t i = 0; i < _count; ++i)
+            {
+                T* value = _slots[i].load(std::memory_order_acquire);
+                if(value != 0)
+                    Release()(value);
+            }
+        }
+
+        size_t size() const
+        {
+            return _count;
+        }
+
+        //! @return 0 if nothing was published yet. The value lives as long as the slots.
+        T* get(size_t index) const
+        {
+            return _slots[index].load(std::memory_order_acquire);
+        }
+
+        /*!
+        * Takes ownership of value.
+        * @return The value in the slot: value, or the one another thread published first, in which case value is released.
+        */
+        T* publish(size_t index, T* value)
+        {
+            T* expected = 0;
+            if(_slots[index].compare_exchange_strong(expected, value, std::memory_order_acq_rel, std::memory_order_acquire))
+                return value;
+
+            Release()(value);
+            return expected;
+        }
+
+    private:
+        AtomicSlots(const AtomicSlots& other);
+        AtomicSlots& operator=(const AtomicSlots& other);
+
+        size_t _count;
+        std::unique_ptr<std::atomic<T*>[]> _slots;
+    };
+}
\ No newline at end of file
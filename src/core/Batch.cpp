@@ -0,0 +1,360 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "Batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "ByteSource.h"
+#include "ContentHash.h"
+#include "DecodeLimits.h"
+
+namespace flifcore
+{
+    const uint64_t BatchOptions::DEFAULT_MAX_IN_FLIGHT_BYTES;
+
+    RawSink::RawSink(FILE* output)
+        : _output(output)
+    {
+    }
+
+    bool RawSink::write(size_t index, const std::string& filename, const CachedImage& image)
+    {
+        for(const FrameView& frame : image.frames)
+            if(fwrite(frame.pixels, 1, frame.size(), _output) != frame.size())
+                return false;
+        return true;
+    }
+
+    PamSink::PamSink(FILE* output)
+        : _output(output)
+    {
+    }
+
+    bool PamSink::write(size_t index, const std::string& filename, const CachedImage& image)
+    {
+        for(const FrameView& frame : image.frames)
+        {
+            const bool wide = frame.format == PF_RGBA64;
+            if(!wide && frame.format != PF_RGBA32)
+                return false;
+
+            if(fprintf(_output, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL %u\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+                frame.width, frame.height, wide ? 65535u : 255u) < 0)
+            {
+                return false;
+            }
+
+            if(!wide)
+            {
+                if(fwrite(frame.pixels, 1, frame.size(), _output) != frame.size())
+                    return false;
+                continue;
+            }
+
+            // PAM samples are big endian
+            _row.resize(frame.stride());
+            for(uint32_t y = 0; y < frame.height; ++y)
+            {
+                const uint8_t* source = frame.pixels + y * frame.stride();
+                for(size_t i = 0; i < _row.size(); i += 2)
+                {
+                    _row[i] = source[i + 1];
+                    _row[i + 1] = source[i];
+                }
+                if(fwrite(_row.data(), 1, _row.size(), _output) != _row.size())
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    DigestSink::DigestSink(FILE* output)
+        : _output(output)
+    {
+    }
+
+    bool DigestSink::write(size_t index, const std::string& filename, const CachedImage& image)
+    {
+        // sizes included, so the same bytes split into other frames or rows give another hash
+        std::vector<uint64_t> parts;
+        for(const FrameView& frame : image.frames)
+        {
+            parts.push_back(frame.width);
+            parts.push_back(frame.height);
+            parts.push_back(frame.format);
+            parts.push_back(contentHash(frame.pixels, frame.size()));
+        }
+        const uint64_t hash = contentHash(reinterpret_cast<const uint8_t*>(parts.data()), parts.size() * sizeof(parts[0]));
+
+        const uint32_t width = image.frames.empty() ? 0 : image.frames[0].width;
+        const uint32_t height = image.frames.empty() ? 0 : image.frames[0].height;
+        return fprintf(_output, "%016llx  %ux%u  %zu  %s\n", static_cast<unsigned long long>(hash), width, height,
+            image.frames.size(), filename.c_str()) >= 0;
+    }
+
+    void DigestSink::failed(size_t index, const std::string& filename, DecodeStatus status)
+    {
+        fprintf(_output, "%-16s  %s  %s\n", "failed", toString(status), filename.c_str());
+    }
+
+    double BatchStats::filesPerSecond() const
+    {
+        return seconds > 0 ? files / seconds : 0;
+    }
+
+    double BatchStats::megabytesPerSecond() const
+    {
+        return seconds > 0 ? input_bytes / (1024.0 * 1024.0) / seconds : 0;
+    }
+
+    /*!
+    * One call of decodeBatch(). The calling thread reads the files and reserves their decoded size,
+    * the pool decodes them, and whichever thread finishes the next file in list order writes it and those after it.
+    */
+    class BatchRun
+    {
+    public:
+        BatchRun(const std::vector<std::string>& files, BatchSink& sink, const BatchOptions& options)
+            : _files(files)
+            , _sink(sink)
+            , _options(options)
+            , _threads(options.threads != 0 ? options.threads : TaskPool::defaultThreadCount())
+            , _in_flight_bytes(0)
+            , _in_flight_files(0)
+            , _next_write(0)
+            , _stopped(false)
+        {
+        }
+
+        bool run(BatchStats& stats)
+        {
+            typedef std::chrono::steady_clock Clock;
+            const Clock::time_point start = Clock::now();
+
+            // files read ahead of the decodes, this also bounds the open files
+            const size_t max_files = _threads * 2;
+
+            // a decode never holds more than the limits allow, however large the header claims the image is
+            const uint64_t max_decoded_bytes = DecodeLimits::defaults().max_bytes;
+
+            TaskPool pool(_threads);
+            for(size_t index = 0; index < _files.size(); ++index)
+            {
+                FileByteSource source;
+#ifdef _WIN32
+                // mapped files cannot be truncated on Windows
+                source.setUseMapping(true);
+#endif
+                std::shared_ptr<const InputBuffer> input;
+                ImageInfo info;
+                DecodeStatus status = DS_READ_FAILED;
+                if(source.open(_files[index]) && acquireAll(source, input))
+                    status = probeInfo(input->data(), input->size(), info);
+
+                const uint64_t bytes = status == DS_OK ? std::min(ImageCache::decodedBytes(info, _options.format), max_decoded_bytes) : 0;
+                if(!reserve(bytes, max_files))
+                    break;
+
+                if(status != DS_OK)
+                {
+                    Result result;
+                    result.status = status;
+                    complete(index, result);
+                    continue;
+                }
+
+                pool.submit(_options.priority, [this, index, input, bytes]()
+                {
+                    decode(index, input, bytes);
+                });
+            }
+            pool.shutdown();
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            if(!_latencies.empty())
+            {
+                std::sort(_latencies.begin(), _latencies.end());
+                _stats.p50_ms = _latencies[_latencies.size() / 2];
+                _stats.p99_ms = _latencies[_latencies.size() * 99 / 100];
+            }
+            stats = _stats;
+            return !_stopped;
+        }
+
+    private:
+        //! A file between its decode and the sink.
+        struct Result
+        {
+            Result()
+                : status(DS_OK)
+                , reserved_bytes(0)
+                , input_bytes(0)
+                , ms(0)
+            {
+            }
+
+            DecodeStatus status;
+            std::shared_ptr<const CachedImage> image;
+            uint64_t reserved_bytes;
+            uint64_t input_bytes;
+            double ms;
+        };
+
+        /*!
+        * Waits until the file fits in flight. One that is larger than the limit alone waits until nothing else is.
+        * @return False if the batch was stopped.
+        */
+        bool reserve(uint64_t bytes, size_t max_files)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _space.wait(lock, [&]()
+            {
+                return _stopped || (_in_flight_files < max_files &&
+                    (_in_flight_files == 0 || _in_flight_bytes + bytes <= _options.max_in_flight_bytes));
+            });
+
+            if(_stopped)
+                return false;
+
+            _in_flight_files++;
+            _in_flight_bytes += bytes;
+            _stats.peak_in_flight_bytes = std::max(_stats.peak_in_flight_bytes, _in_flight_bytes);
+            return true;
+        }
+
+        void decode(size_t index, const std::shared_ptr<const InputBuffer>& input, uint64_t reserved_bytes)
+        {
+            typedef std::chrono::steady_clock Clock;
+            const Clock::time_point start = Clock::now();
+
+            Result result;
+            result.reserved_bytes = reserved_bytes;
+            result.input_bytes = input->size();
+            try
+            {
+                if(!_stopped)
+                    result.status = decodeAllFrames(input, _options.format, result.image);
+                else
+                    result.status = DS_CANCELLED;
+            }
+            catch(...)
+            {
+                // out of memory, most likely: only this file fails
+                result.status = DS_DECODE_FAILED;
+                result.image.reset();
+            }
+            result.ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+            complete(index, result);
+        }
+
+        void complete(size_t index, Result& result)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _finished.insert(std::make_pair(index, std::move(result)));
+            }
+
+            // a thread that waits here finds its file written by the one before, if that was still writing
+            std::lock_guard<std::mutex> sink_lock(_sink_mutex);
+            for(;;)
+            {
+                Result next;
+                size_t next_index;
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    auto found = _finished.find(_next_write);
+                    if(found == _finished.end())
+                        return;
+
+                    next = std::move(found->second);
+                    _finished.erase(found);
+                    next_index = _next_write;
+                }
+
+                bool keep_going = true;
+                if(!_stopped)
+                {
+                    try
+                    {
+                        if(next.status == DS_OK)
+                            keep_going = _sink.write(next_index, _files[next_index], *next.image);
+                        else
+                            _sink.failed(next_index, _files[next_index], next.status);
+                    }
+                    catch(...)
+                    {
+                        keep_going = false;
+                    }
+                }
+
+                const uint64_t decoded_bytes = next.image ? next.image->bytes() : 0;
+                next.image.reset();
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(!_stopped)
+                {
+                    _stats.files++;
+                    _stats.input_bytes += next.input_bytes;
+                    _stats.decoded_bytes += decoded_bytes;
+                    if(next.status == DS_OK)
+                        _latencies.push_back(next.ms);
+                    else
+                        _stats.failed++;
+                }
+                if(!keep_going)
+                    _stopped = true;
+
+                _next_write++;
+                _in_flight_files--;
+                _in_flight_bytes -= next.reserved_bytes;
+                _space.notify_all();
+            }
+        }
+
+        const std::vector<std::string>& _files;
+        BatchSink& _sink;
+        const BatchOptions& _options;
+        const unsigned int _threads;
+
+        std::mutex _mutex;
+        std::condition_variable _space;
+        uint64_t _in_flight_bytes;
+        size_t _in_flight_files;
+        std::map<size_t, Result> _finished; //!< decoded, waiting for the files before them
+        size_t _next_write;
+        std::atomic<bool> _stopped;
+        BatchStats _stats;
+        std::vector<double> _latencies;
+
+        std::mutex _sink_mutex;
+    };
+
+    bool decodeBatch(const std::vector<std::string>& files, BatchSink& sink, BatchStats& stats, const BatchOptions& options)
+    {
+        BatchRun run(files, sink, options);
+        return run.run(stats);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,155 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Decode.h"
+#include "ImageCache.h"
+#include "TaskPool.h"
+
+namespace flifcore
+{
+    /*!
+    * Receives the decoded files of decodeBatch(), one call at a time and in the order of the file list.
+    */
+    class BatchSink
+    {
+    public:
+        virtual ~BatchSink()
+        {
+        }
+
+        //! @return False stops the batch, e.g. after a failed write.
+        virtual bool write(size_t index, const std::string& filename, const CachedImage& image) = 0;
+
+        //! Files that could not be decoded, instead of write().
+        virtual void failed(size_t index, const std::string& filename, DecodeStatus status)
+        {
+        }
+    };
+
+    /*!
+    * The pixels of all frames, back to back without any header.
+    */
+    class RawSink : public BatchSink
+    {
+    public:
+        explicit RawSink(FILE* output);
+
+        virtual bool write(size_t index, const std::string& filename, const CachedImage& image) override;
+
+    private:
+        FILE* _output;
+    };
+
+    /*!
+    * Each frame as an image of a PAM stream (netpbm P7), RGB_ALPHA with 8 or 16 bits.
+    * Only PF_RGBA32 and PF_RGBA64 frames can be written.
+    */
+    class PamSink : public BatchSink
+    {
+    public:
+        explicit PamSink(FILE* output);
+
+        virtual bool write(size_t index, const std::string& filename, const CachedImage& image) override;
+
+    private:
+        FILE* _output;
+        std::vector<uint8_t> _row;
+    };
+
+    /*!
+    * A line per file with a hash of the decoded pixels, to compare decoder versions without storing images.
+    * Failed files get a line as well, so the lines of two runs match up.
+    */
+    class DigestSink : public BatchSink
+    {
+    public:
+        explicit DigestSink(FILE* output);
+
+        virtual bool write(size_t index, const std::string& filename, const CachedImage& image) override;
+        virtual void failed(size_t index, const std::string& filename, DecodeStatus status) override;
+
+    private:
+        FILE* _output;
+    };
+
+    struct BatchOptions
+    {
+        static const uint64_t DEFAULT_MAX_IN_FLIGHT_BYTES = 512 * 1024 * 1024;
+
+        BatchOptions()
+            : threads(0)
+            , max_in_flight_bytes(DEFAULT_MAX_IN_FLIGHT_BYTES)
+            , format(PF_RGBA32)
+            , priority(TP_PREFETCH)
+        {
+        }
+
+        unsigned int threads; //!< files decoded at once, 0 for TaskPool::defaultThreadCount()
+
+        /*!
+        * Decoded pixels held at once, by decodes and by results waiting for the sink.
+        * A file larger than this is decoded while nothing else is.
+        */
+        uint64_t max_in_flight_bytes;
+
+        PixelFormat format;
+        TaskPriority priority;
+    };
+
+    struct BatchStats
+    {
+        BatchStats()
+            : files(0)
+            , failed(0)
+            , input_bytes(0)
+            , decoded_bytes(0)
+            , peak_in_flight_bytes(0)
+            , seconds(0)
+            , p50_ms(0)
+            , p99_ms(0)
+        {
+        }
+
+        double filesPerSecond() const;
+
+        //! Of the compressed input.
+        double megabytesPerSecond() const;
+
+        size_t files; //!< handed to the sink, including failed ones
+        size_t failed;
+        uint64_t input_bytes;
+        uint64_t decoded_bytes;
+        uint64_t peak_in_flight_bytes;
+        double seconds;
+        double p50_ms; //!< per file, from the start of its decode until it is decoded
+        double p99_ms;
+    };
+
+    /*!
+    * Decodes the files concurrently on an own TaskPool and passes them to the sink in list order.
+    * Files are read from disk by the calling thread, which waits while the in-flight limit is reached.
+    * @return False if the sink stopped the batch. The stats cover the files up to that point.
+    */
+    bool decodeBatch(const std::vector<std::string>& files, BatchSink& sink, BatchStats& stats, const BatchOptions& options = BatchOptions());
+}
\ No newline at end of file
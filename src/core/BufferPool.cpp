@@ -0,0 +1,217 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "BufferPool.h"
+
+namespace flifcore
+{
+    // set once BufferPool::shared() is destroyed, trivially destructible so it can still be read after that
+    static std::atomic<bool> g_shared_pool_destroyed(false);
+
+    /*!
+    * Tells the allocators when the shared pool is gone, before its idle buffers are freed.
+    */
+    struct SharedBufferPool : public BufferPool
+    {
+        ~SharedBufferPool()
+        {
+            g_shared_pool_destroyed = true;
+        }
+    };
+
+    uint8_t* allocateAligned(size_t size)
+    {
+        if(size > static_cast<size_t>(-1) - BufferPool::ALIGNMENT)
+            throw std::bad_alloc();
+
+        // the offset to the start of the heap block goes into the byte before the buffer, it is 1..ALIGNMENT
+        uint8_t* block = static_cast<uint8_t*>(::operator new(size + BufferPool::ALIGNMENT));
+        uint8_t* buffer = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(block) + BufferPool::ALIGNMENT) & ~uintptr_t(BufferPool::ALIGNMENT - 1));
+        buffer[-1] = static_cast<uint8_t>(buffer - block);
+        return buffer;
+    }
+
+    void freeAligned(uint8_t* buffer)
+    {
+        if(buffer == 0)
+            return;
+
+        ::operator delete(buffer - buffer[-1]);
+    }
+
+    uint8_t* allocateFromSharedPool(size_t size)
+    {
+        if(g_shared_pool_destroyed.load(std::memory_order_acquire))
+            return allocateAligned(size);
+        return BufferPool::shared().allocate(size);
+    }
+
+    void deallocateToSharedPool(uint8_t* buffer, size_t size)
+    {
+        if(g_shared_pool_destroyed.load(std::memory_order_acquire))
+        {
+            freeAligned(buffer);
+            return;
+        }
+        BufferPool::shared().deallocate(buffer, size);
+    }
+
+    BufferPool::BufferPool(uint64_t max_idle_bytes)
+        : _max_idle_bytes(max_idle_bytes)
+        , _idle_bytes(0)
+        , _allocations(0)
+        , _reuses(0)
+    {
+    }
+
+    BufferPool::~BufferPool()
+    {
+        clear();
+    }
+
+    BufferPool& BufferPool::shared()
+    {
+        static SharedBufferPool pool;
+        return pool;
+    }
+
+    size_t BufferPool::classSize(size_t size)
+    {
+        const size_t index = classIndex(size);
+        return index < CLASS_COUNT ? classSizeOfIndex(index) : size;
+    }
+
+    size_t BufferPool::classIndex(size_t size)
+    {
+        if(size <= MIN_CLASS_SIZE)
+            return 0;
+        if(size > MAX_CLASS_SIZE)
+            return CLASS_COUNT;
+
+        size_t index = 1;
+        size_t power = MIN_CLASS_SIZE;
+        while(power * 2 < size)
+        {
+            power *= 2;
+            index += 4;
+        }
+
+        // power < size <= 2 * power, in steps of a quarter power
+        const size_t step = power / 4;
+        return index + (size - power + step - 1) / step - 1;
+    }
+
+    size_t BufferPool::classSizeOfIndex(size_t index)
+    {
+        if(index == 0)
+            return MIN_CLASS_SIZE;
+
+        const size_t power = MIN_CLASS_SIZE << ((index - 1) / 4);
+        return power + ((index - 1) % 4 + 1) * (power / 4);
+    }
+
+    uint8_t* BufferPool::allocate(size_t size)
+    {
+        const size_t index = classIndex(size);
+        if(index < CLASS_COUNT)
+        {
+            SizeClass& size_class = _classes[index];
+            std::lock_guard<std::mutex> lock(size_class.mutex);
+            if(!size_class.idle.empty())
+            {
+                uint8_t* buffer = size_class.idle.back();
+                size_class.idle.pop_back();
+                _idle_bytes.fetch_sub(classSizeOfIndex(index));
+                _reuses.fetch_add(1, std::memory_order_relaxed);
+                return buffer;
+            }
+        }
+
+        _allocations.fetch_add(1, std::memory_order_relaxed);
+        return allocateAligned(index < CLASS_COUNT ? classSizeOfIndex(index) : size);
+    }
+
+    void BufferPool::deallocate(uint8_t* buffer, size_t size)
+    {
+        if(buffer == 0)
+            return;
+
+        const size_t index = classIndex(size);
+        if(index < CLASS_COUNT)
+        {
+            const uint64_t bytes = classSizeOfIndex(index);
+            if(_idle_bytes.fetch_add(bytes) + bytes <= _max_idle_bytes.load())
+            {
+                SizeClass& size_class = _classes[index];
+                std::lock_guard<std::mutex> lock(size_class.mutex);
+                size_class.idle.push_back(buffer);
+                return;
+            }
+            _idle_bytes.fetch_sub(bytes);
+        }
+
+        freeAligned(buffer);
+    }
+
+    void BufferPool::setMaxIdleBytes(uint64_t max_idle_bytes)
+    {
+        _max_idle_bytes = max_idle_bytes;
+        trim();
+    }
+
+    uint64_t BufferPool::maxIdleBytes() const
+    {
+        return _max_idle_bytes;
+    }
+
+    void BufferPool::clear()
+    {
+        for(size_t index = 0; index < CLASS_COUNT; ++index)
+        {
+            SizeClass& size_class = _classes[index];
+            std::lock_guard<std::mutex> lock(size_class.mutex);
+            for(uint8_t* buffer : size_class.idle)
+                freeAligned(buffer);
+            _idle_bytes.fetch_sub(uint64_t(size_class.idle.size()) * classSizeOfIndex(index));
+            size_class.idle.clear();
+        }
+    }
+
+    void BufferPool::trim()
+    {
+        // the largest buffers first, they free the most with the fewest calls
+        for(size_t index = CLASS_COUNT; index-- > 0 && _idle_bytes.load() > _max_idle_bytes.load();)
+        {
+            SizeClass& size_class = _classes[index];
+            std::lock_guard<std::mutex> lock(size_class.mutex);
+            while(!size_class.idle.empty() && _idle_bytes.load() > _max_idle_bytes.load())
+            {
+                freeAligned(size_class.idle.back());
+                size_class.idle.pop_back();
+                _idle_bytes.fetch_sub(classSizeOfIndex(index));
+            }
+        }
+    }
+
+    BufferPool::Stats BufferPool::stats() const
+    {
+        Stats stats;
+        stats.allocations = _allocations;
+        stats.reuses = _reuses;
+        stats.idle_bytes = _idle_bytes;
+        return stats;
+    }
+}
\ No newline at end of file
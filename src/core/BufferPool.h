@@ -0,0 +1,160 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace flifcore
+{
+    /*!
+    * Byte buffers that are handed back instead of freed, so decoding thousands of small files does not keep the heap busy.
+    *
+    * Sizes are rounded up to classes of four steps per power of two, so a buffer is at most 25 % larger than asked for
+    * and serves the next request of about the same size. Every buffer starts at a 64 byte boundary, a cache line
+    * and the widest SIMD register. Returned buffers are kept up to a byte limit, beyond that and above the largest
+    * class they go back to the heap. Thread safe, each class has its own lock.
+    */
+    class BufferPool
+    {
+    public:
+        static const size_t ALIGNMENT = 64;
+        static const size_t MIN_CLASS_SIZE = 64;
+        static const size_t MAX_CLASS_SIZE = 64 * 1024 * 1024;
+        static const size_t CLASS_COUNT = 81; //!< 64 bytes and 4 per power of two up to MAX_CLASS_SIZE
+        static const uint64_t DEFAULT_MAX_IDLE_BYTES = 32 * 1024 * 1024;
+
+        explicit BufferPool(uint64_t max_idle_bytes = DEFAULT_MAX_IDLE_BYTES);
+        ~BufferPool();
+
+        //! The pool of this process, used by PoolAllocator.
+        static BufferPool& shared();
+
+        /*!
+        * @return At least size bytes, aligned to ALIGNMENT. Throws std::bad_alloc.
+        */
+        uint8_t* allocate(size_t size);
+
+        //! @param size As given to allocate().
+        void deallocate(uint8_t* buffer, size_t size);
+
+        //! The size allocate() actually reserves.
+        static size_t classSize(size_t size);
+
+        //! 0 turns the pool off, every buffer comes from the heap then. Idle buffers beyond the limit are freed.
+        void setMaxIdleBytes(uint64_t max_idle_bytes);
+        uint64_t maxIdleBytes() const;
+
+        //! Frees all idle buffers.
+        void clear();
+
+        struct Stats
+        {
+            uint64_t allocations; //!< buffers taken from the heap
+            uint64_t reuses;      //!< buffers handed out again
+            uint64_t idle_bytes;
+        };
+
+        Stats stats() const;
+
+    private:
+        BufferPool(const BufferPool& other);
+        BufferPool& operator=(const BufferPool& other);
+
+        struct SizeClass
+        {
+            std::mutex mutex;
+            std::vector<uint8_t*> idle;
+        };
+
+        //! CLASS_COUNT for sizes that are not pooled.
+        static size_t classIndex(size_t size);
+        static size_t classSizeOfIndex(size_t index);
+
+        //! Frees idle buffers until the limit is met.
+        void trim();
+
+        SizeClass _classes[CLASS_COUNT];
+        std::atomic<uint64_t> _max_idle_bytes;
+        std::atomic<uint64_t> _idle_bytes;
+        std::atomic<uint64_t> _allocations;
+        std::atomic<uint64_t> _reuses;
+    };
+
+    /*!
+    * Heap memory aligned to BufferPool::ALIGNMENT, for the pool and for what it does not keep.
+    */
+    uint8_t* allocateAligned(size_t size);
+    void freeAligned(uint8_t* buffer);
+
+    /*!
+    * BufferPool::shared(), or the heap once the shared pool is destroyed at exit.
+    */
+    uint8_t* allocateFromSharedPool(size_t size);
+    void deallocateToSharedPool(uint8_t* buffer, size_t size);
+
+    /*!
+    * Borrows from BufferPool::shared() and hands the memory back on deallocation, for standard containers.
+    * Still works while static objects are destroyed.
+    */
+    template<typename T>
+    class PoolAllocator
+    {
+    public:
+        typedef T value_type;
+
+        PoolAllocator()
+        {
+        }
+
+        template<typename U>
+        PoolAllocator(const PoolAllocator<U>&)
+        {
+        }
+
+        T* allocate(size_t count)
+        {
+            if(count > static_cast<size_t>(-1) / sizeof(T))
+                throw std::bad_alloc();
+            return reinterpret_cast<T*>(allocateFromSharedPool(count * sizeof(T)));
+        }
+
+        void deallocate(T* pointer, size_t count)
+        {
+            deallocateToSharedPool(reinterpret_cast<uint8_t*>(pointer), count * sizeof(T));
+        }
+
+        template<typename U>
+        bool operator==(const PoolAllocator<U>&) const
+        {
+            return true;
+        }
+
+        template<typename U>
+        bool operator!=(const PoolAllocator<U>&) const
+        {
+            return false;
+        }
+    };
+
+    //! Bytes of decoded pixels and row buffers.
+    typedef std::vector<uint8_t, PoolAllocator<uint8_t>> PixelBuffer;
+}
\ No newline at end of file
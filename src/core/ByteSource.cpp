@@ -0,0 +1,205 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ByteSource.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+namespace flifcore
+{
+    bool readAll(ByteSource& source, std::vector<uint8_t>& bytes)
+    {
+        const size_t INITIAL_READ_SIZE = 64 * 1024;
+
+        size_t bytes_filled_counter = bytes.size();
+
+        // Ask for one byte more than announced, so a correct size hint finishes with a single read.
+        // Otherwise the buffer doubles with every read, which keeps the number of reallocations logarithmic.
+        size_t read_size = INITIAL_READ_SIZE;
+        uint64_t remaining = 0;
+        if(source.remainingSize(remaining) && remaining < std::numeric_limits<size_t>::max() - bytes_filled_counter - 1)
+            read_size = static_cast<size_t>(remaining) + 1;
+
+        while(true)
+        {
+            bytes.resize(bytes_filled_counter + read_size);
+
+            size_t actually_read;
+            if(!source.read(bytes.data() + bytes_filled_counter, read_size, actually_read))
+            {
+                bytes.resize(bytes_filled_counter);
+                return false;
+            }
+
+            bytes_filled_counter += actually_read;
+
+            // exit condition: read less than what was requested
+            if(actually_read < read_size)
+            {
+                // remove unused bytes
+                bytes.resize(bytes_filled_counter);
+                return true;
+            }
+
+            if(bytes_filled_counter > std::numeric_limits<size_t>::max() / 2)
+                return false;
+
+            read_size = std::max(bytes_filled_counter, INITIAL_READ_SIZE);
+        }
+    }
+
+    bool acquireAll(ByteSource& source, std::shared_ptr<const InputBuffer>& input)
+    {
+        input = source.mapRemaining();
+        if(input)
+            return true;
+
+        std::vector<uint8_t> bytes;
+        if(!readAll(source, bytes))
+            return false;
+
+        input = std::make_shared<OwnedInputBuffer>(std::move(bytes));
+        return true;
+    }
+
+    //=========================================================================
+
+    MemoryByteSource::MemoryByteSource(const uint8_t* data, size_t size)
+        : _data(data)
+        , _size(size)
+        , _position(0)
+    {
+    }
+
+    bool MemoryByteSource::read(uint8_t* buffer, size_t size, size_t& bytes_read)
+    {
+        bytes_read = std::min(size, _size - _position);
+        memcpy(buffer, _data + _position, bytes_read);
+        _position += bytes_read;
+        return true;
+    }
+
+    bool MemoryByteSource::remainingSize(uint64_t& size)
+    {
+        size = _size - _position;
+        return true;
+    }
+
+    //=========================================================================
+
+    FileByteSource::FileByteSource()
+        : _file(0)
+        , _use_mapping(false)
+    {
+    }
+
+    FileByteSource::~FileByteSource()
+    {
+        if(_file != 0)
+            fclose(_file);
+        _file = 0;
+    }
+
+    bool FileByteSource::open(const std::string& filename)
+    {
+        if(_file != 0)
+            return false;
+
+        _file = fopen(filename.c_str(), "rb");
+        return _file != 0;
+    }
+
+    void FileByteSource::setUseMapping(bool use_mapping)
+    {
+        _use_mapping = use_mapping;
+    }
+
+    bool FileByteSource::isOpen() const
+    {
+        return _file != 0;
+    }
+
+    bool FileByteSource::read(uint8_t* buffer, size_t size, size_t& bytes_read)
+    {
+        bytes_read = 0;
+        if(_file == 0)
+            return false;
+
+        bytes_read = fread(buffer, 1, size, _file);
+        if(bytes_read < size && ferror(_file))
+            return false;
+
+        return true;
+    }
+
+    bool FileByteSource::remainingSize(uint64_t& size)
+    {
+        if(_file == 0)
+            return false;
+
+#ifdef _WIN32
+        struct _stat64 file_stat;
+        if(_fstat64(_fileno(_file), &file_stat) != 0)
+            return false;
+        const int64_t position = _ftelli64(_file);
+#else
+        struct stat file_stat;
+        if(fstat(fileno(_file), &file_stat) != 0)
+            return false;
+        const int64_t position = ftello(_file);
+#endif
+
+        // pipes and devices have no meaningful size
+        if((file_stat.st_mode & S_IFMT) != S_IFREG)
+            return false;
+
+        if(position < 0 || position > file_stat.st_size)
+            return false;
+
+        size = static_cast<uint64_t>(file_stat.st_size - position);
+        return true;
+    }
+
+    std::shared_ptr<const InputBuffer> FileByteSource::mapRemaining()
+    {
+        if(!_use_mapping || _file == 0)
+            return std::shared_ptr<const InputBuffer>();
+
+#ifdef _WIN32
+        const int64_t position = _ftelli64(_file);
+#else
+        const int64_t position = ftello(_file);
+#endif
+        if(position < 0)
+            return std::shared_ptr<const InputBuffer>();
+
+        std::shared_ptr<MappedFile> mapped_file = std::make_shared<MappedFile>();
+        if(!mapped_file->open(_file, static_cast<uint64_t>(position)))
+            return std::shared_ptr<const InputBuffer>();
+
+        // leave the file position where a complete read would have left it
+        if(fseek(_file, 0, SEEK_END) != 0)
+            return std::shared_ptr<const InputBuffer>();
+
+        return mapped_file;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,170 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace flifcore
+{
+    /*!
+    * Immutable block of compressed bytes.
+    * Shared by everyone who needs the complete file, so it is never copied after reading or mapping.
+    */
+    class InputBuffer
+    {
+    public:
+        virtual ~InputBuffer() {}
+
+        virtual const uint8_t* data() const = 0;
+        virtual size_t size() const = 0;
+
+        /*!
+        * Memory mapped buffers can be changed by other processes.
+        * @return false if the underlying file changed since the buffer was created.
+        */
+        virtual bool isUnchanged() const
+        {
+            return true;
+        }
+    };
+
+    /*!
+    * Input buffer which owns its bytes.
+    */
+    class OwnedInputBuffer : public InputBuffer
+    {
+    public:
+        OwnedInputBuffer(std::vector<uint8_t>&& bytes)
+            : _bytes(std::move(bytes))
+        {
+        }
+
+        virtual const uint8_t* data() const override
+        {
+            return _bytes.data();
+        }
+
+        virtual size_t size() const override
+        {
+            return _bytes.size();
+        }
+
+    private:
+        std::vector<uint8_t> _bytes;
+    };
+
+    /*!
+    * Sequential source of compressed bytes.
+    * The platform specific layers (IStream, files, memory) implement this, so the decode core never sees them.
+    */
+    class ByteSource
+    {
+    public:
+        virtual ~ByteSource() {}
+
+        /*!
+        * Reads up to size bytes.
+        * @param bytes_read Number of bytes actually read. Less than size means the end of the source was reached.
+        * @return false if reading failed.
+        */
+        virtual bool read(uint8_t* buffer, size_t size, size_t& bytes_read) = 0;
+
+        /*!
+        * Number of bytes between the current position and the end, if the source knows it.
+        * This is only a hint for allocation, readers must still handle sources which turn out shorter or longer.
+        * Header scans reject chunks which are declared longer than this.
+        * @return false if the size is unknown.
+        */
+        virtual bool remainingSize(uint64_t& size)
+        {
+            return false;
+        }
+
+        /*!
+        * Maps everything from the current position until the end, without copying.
+        * @return 0 if the source is not backed by a mappable file.
+        */
+        virtual std::shared_ptr<const InputBuffer> mapRemaining()
+        {
+            return std::shared_ptr<const InputBuffer>();
+        }
+    };
+
+    /*!
+    * Reads everything from the current position until the end of the source.
+    * If the source knows its size, the buffer is allocated once. Otherwise it grows geometrically.
+    * @return false if reading failed.
+    */
+    bool readAll(ByteSource& source, std::vector<uint8_t>& bytes);
+
+    /*!
+    * Like readAll(), but maps the source if possible.
+    * @return false if reading failed.
+    */
+    bool acquireAll(ByteSource& source, std::shared_ptr<const InputBuffer>& input);
+
+    /*!
+    * Byte source over a memory block which is owned by the caller.
+    */
+    class MemoryByteSource : public ByteSource
+    {
+    public:
+        MemoryByteSource(const uint8_t* data, size_t size);
+
+        virtual bool read(uint8_t* buffer, size_t size, size_t& bytes_read) override;
+        virtual bool remainingSize(uint64_t& size) override;
+
+    private:
+        const uint8_t* _data;
+        size_t _size;
+        size_t _position;
+    };
+
+    /*!
+    * Byte source over a file on disk.
+    */
+    class FileByteSource : public ByteSource
+    {
+    public:
+        FileByteSource();
+        virtual ~FileByteSource();
+
+        bool open(const std::string& filename);
+        bool isOpen() const;
+
+        /*!
+        * Mapping is off by default: on POSIX systems, a file truncated by someone else while a mapping of it is read kills the process.
+        * @param use_mapping If false, mapRemaining() always fails, so readers fall back to copying.
+        */
+        void setUseMapping(bool use_mapping);
+
+        virtual bool read(uint8_t* buffer, size_t size, size_t& bytes_read) override;
+        virtual bool remainingSize(uint64_t& size) override;
+        virtual std::shared_ptr<const InputBuffer> mapRemaining() override;
+
+    private:
+        FileByteSource(const FileByteSource& other);
+        FileByteSource& operator=(const FileByteSource& other);
+
+        FILE* _file;
+        bool _use_mapping;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,239 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "CancelToken.h"
+
+#include <condition_variable>
+#include <limits>
+#include <map>
+#include <thread>
+
+namespace flifcore
+{
+    /*!
+    * Cancels tokens when their deadline is reached.
+    * The thread is started with the first deadline and ends when none is left, so it never runs without a decode waiting.
+    * The hooks tell a DLL that the thread runs, joinThread() waits for it before the DLL goes away.
+    */
+    class DeadlineWatcher
+    {
+    public:
+        DeadlineWatcher()
+            : _running(false)
+            , _stopping(false)
+        {
+        }
+
+        ~DeadlineWatcher()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+                _wake.notify_one();
+            }
+            if(_thread.joinable())
+                _thread.join();
+        }
+
+        static DeadlineWatcher& instance()
+        {
+            static DeadlineWatcher watcher;
+            return watcher;
+        }
+
+        void add(CancelToken* token, CancelToken::Clock::time_point deadline)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            removeLocked(token);
+            _deadlines.insert(std::make_pair(deadline, token));
+
+            if(_running)
+            {
+                _wake.notify_one();
+                return;
+            }
+
+            // a thread that ran out of deadlines does not take the lock again, it is done or about to be
+            if(_thread.joinable())
+                _thread.join();
+            _running = true;
+            if(_started_hook)
+                _started_hook();
+            try
+            {
+                _thread = std::thread(&DeadlineWatcher::run, this);
+            }
+            catch(...)
+            {
+                _running = false;
+                if(_stopped_hook)
+                    _stopped_hook();
+                throw;
+            }
+        }
+
+        void setHooks(std::function<void()> started, std::function<void()> stopped)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _started_hook = std::move(started);
+            _stopped_hook = std::move(stopped);
+        }
+
+        void joinThread()
+        {
+            std::thread finished;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(_running)
+                    return;
+                finished.swap(_thread);
+            }
+            if(finished.joinable())
+                finished.join();
+        }
+
+        void remove(CancelToken* token)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            removeLocked(token);
+
+            // without deadlines the thread ends, instead of sleeping until the one just removed
+            if(_running)
+                _wake.notify_one();
+        }
+
+    private:
+        void removeLocked(CancelToken* token)
+        {
+            for(auto entry = _deadlines.begin(); entry != _deadlines.end();)
+            {
+                if(entry->second == token)
+                    entry = _deadlines.erase(entry);
+                else
+                    ++entry;
+            }
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while(!_deadlines.empty() && !_stopping)
+            {
+                auto first = _deadlines.begin();
+                if(CancelToken::Clock::now() < first->first)
+                {
+                    _wake.wait_until(lock, first->first);
+                    continue;
+                }
+
+                // under the lock, so the token cannot be destroyed in between
+                CancelToken* token = first->second;
+                _deadlines.erase(first);
+                token->cancel();
+            }
+            _running = false;
+            if(_stopped_hook)
+                _stopped_hook();
+        }
+
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::multimap<CancelToken::Clock::time_point, CancelToken*> _deadlines;
+        std::thread _thread;
+        std::function<void()> _started_hook;
+        std::function<void()> _stopped_hook;
+        bool _running;
+        bool _stopping;
+    };
+
+    const CancelToken::Clock::rep CancelToken::NO_DEADLINE = std::numeric_limits<CancelToken::Clock::rep>::max();
+
+    CancelToken::CancelToken()
+        : _cancelled(false)
+        , _deadline(NO_DEADLINE)
+        , _decoder(0)
+    {
+    }
+
+    CancelToken::~CancelToken()
+    {
+        if(_deadline != NO_DEADLINE)
+            DeadlineWatcher::instance().remove(this);
+    }
+
+    void CancelToken::cancel()
+    {
+        _cancelled = true;
+
+        // attach() checks the flag under the same lock, so either it sees the flag or the decoder is aborted here
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_decoder != 0)
+            flif_abort_decoder(_decoder);
+    }
+
+    bool CancelToken::isCancelled() const
+    {
+        if(_cancelled)
+            return true;
+
+        const Clock::rep deadline = _deadline;
+        return deadline != NO_DEADLINE && Clock::now().time_since_epoch().count() >= deadline;
+    }
+
+    void CancelToken::setDeadline(Clock::time_point deadline)
+    {
+        _deadline = deadline.time_since_epoch().count();
+
+        // never called with the own lock held, the watcher takes it when it cancels
+        DeadlineWatcher::instance().add(this, deadline);
+    }
+
+    bool CancelToken::attach(FLIF_DECODER* decoder)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(isCancelled())
+            return false;
+
+        _decoder = decoder;
+        return true;
+    }
+
+    void CancelToken::detach()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _decoder = 0;
+    }
+
+    uint32_t CancelToken::progressCallback(uint32_t quality, int64_t bytes_read, uint8_t decode_over, void* user_data, void* context)
+    {
+        CancelToken* token = static_cast<CancelToken*>(user_data);
+        if(token->isCancelled())
+            token->cancel();
+
+        // called again at the next step, quality goes up to 10000
+        return quality + 1;
+    }
+
+    void CancelToken::setWatcherHooks(std::function<void()> started, std::function<void()> stopped)
+    {
+        DeadlineWatcher::instance().setHooks(std::move(started), std::move(stopped));
+    }
+
+    void CancelToken::joinWatcher()
+    {
+        DeadlineWatcher::instance().joinThread();
+    }
+}
\ No newline at end of file
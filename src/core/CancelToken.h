@@ -0,0 +1,88 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+#include "flifWrapper.h"
+
+namespace flifcore
+{
+    /*!
+    * Lets another thread or a deadline stop a decode, which then fails with DS_CANCELLED.
+    *
+    * A Decoder attaches its running libflif decoder, and cancel() aborts it through flif_abort_decoder().
+    * The progress callback of libflif checks the token as well, and decodes that have not started yet fail right away.
+    * A deadline is watched by a shared thread that only runs while deadlines are pending, see setWatcherHooks().
+    * Once cancelled, a token stays cancelled. Thread safe.
+    */
+    class CancelToken
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        CancelToken();
+        ~CancelToken();
+
+        void cancel();
+
+        //! True after cancel() or once the deadline has passed.
+        bool isCancelled() const;
+
+        //! Cancels at this point in time. Replaces an earlier deadline.
+        void setDeadline(Clock::time_point deadline);
+
+        /*!
+        * For Decoder: the libflif decoder that cancel() aborts, until detach().
+        * @return False if the token is cancelled already, the decode should not start then.
+        */
+        bool attach(FLIF_DECODER* decoder);
+        void detach();
+
+        /*!
+        * For flif_decoder_set_callback(), with the token as user data.
+        * Aborts the decoder if the token was cancelled or the deadline passed.
+        */
+        static uint32_t progressCallback(uint32_t quality, int64_t bytes_read, uint8_t decode_over, void* user_data, void* context);
+
+        /*!
+        * Called when the deadline thread starts and when it runs out of deadlines, each under the same lock,
+        * so they alternate. The thread may still be running when stopped returns, see joinWatcher().
+        */
+        static void setWatcherHooks(std::function<void()> started, std::function<void()> stopped);
+
+        /*!
+        * Waits for a deadline thread that ran out of deadlines, so nothing is left to join when the library is unloaded.
+        * A thread with pending deadlines is left running.
+        */
+        static void joinWatcher();
+
+    private:
+        CancelToken(const CancelToken& other);
+        CancelToken& operator=(const CancelToken& other);
+
+        static const Clock::rep NO_DEADLINE;
+
+        std::mutex _mutex;
+        std::atomic<bool> _cancelled;
+        std::atomic<Clock::rep> _deadline; //!< time_since_epoch().count() of the deadline
+        FLIF_DECODER* _decoder;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,126 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ContentHash.h"
+
+#include <cstring>
+
+namespace flifcore
+{
+    static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+    static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+    static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+    static inline uint64_t rotateLeft(uint64_t value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    // little endian, like the reference implementation on all platforms this plugin runs on
+    static inline uint64_t read64(const uint8_t* data)
+    {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    static inline uint32_t read32(const uint8_t* data)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    static inline uint64_t round(uint64_t accumulator, uint64_t input)
+    {
+        accumulator += input * PRIME2;
+        accumulator = rotateLeft(accumulator, 31);
+        return accumulator * PRIME1;
+    }
+
+    static inline uint64_t mergeRound(uint64_t accumulator, uint64_t value)
+    {
+        accumulator ^= round(0, value);
+        return accumulator * PRIME1 + PRIME4;
+    }
+
+    uint64_t contentHash(const uint8_t* data, size_t size)
+    {
+        const uint8_t* p = data;
+        const uint8_t* const end = data + size;
+        uint64_t hash;
+
+        if(size >= 32)
+        {
+            // four independent lanes, so the multiplications overlap
+            uint64_t v1 = PRIME1 + PRIME2;
+            uint64_t v2 = PRIME2;
+            uint64_t v3 = 0;
+            uint64_t v4 = 0 - PRIME1;
+
+            const uint8_t* const limit = end - 32;
+            do
+            {
+                v1 = round(v1, read64(p));
+                v2 = round(v2, read64(p + 8));
+                v3 = round(v3, read64(p + 16));
+                v4 = round(v4, read64(p + 24));
+                p += 32;
+            }
+            while(p <= limit);
+
+            hash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+            hash = mergeRound(hash, v1);
+            hash = mergeRound(hash, v2);
+            hash = mergeRound(hash, v3);
+            hash = mergeRound(hash, v4);
+        }
+        else
+        {
+            hash = PRIME5;
+        }
+
+        hash += static_cast<uint64_t>(size);
+
+        for(; p + 8 <= end; p += 8)
+        {
+            hash ^= round(0, read64(p));
+            hash = rotateLeft(hash, 27) * PRIME1 + PRIME4;
+        }
+
+        if(p + 4 <= end)
+        {
+            hash ^= uint64_t(read32(p)) * PRIME1;
+            hash = rotateLeft(hash, 23) * PRIME2 + PRIME3;
+            p += 4;
+        }
+
+        for(; p < end; ++p)
+        {
+            hash ^= (*p) * PRIME5;
+            hash = rotateLeft(hash, 11) * PRIME1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= PRIME2;
+        hash ^= hash >> 29;
+        hash *= PRIME3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+}
\ No newline at end of file
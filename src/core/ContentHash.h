@@ -0,0 +1,29 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace flifcore
+{
+    /*!
+    * 64 bit hash of a byte range, the XXH64 algorithm with seed 0. Runs at memory speed, not cryptographic.
+    * Identifies decoded images by their compressed bytes, see ImageCache.
+    */
+    uint64_t contentHash(const uint8_t* data, size_t size);
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "Counters.h"
+
+namespace flifcore
+{
+    Counters& counters()
+    {
+        static Counters instance;
+        return instance;
+    }
+
+    void resetCounters()
+    {
+        Counters& c = counters();
+        c.header_scans.store(0);
+        c.pixel_decodes.store(0);
+        c.frame_extractions.store(0);
+        c.copy_bytes_saved.store(0);
+        c.disk_cache_scans.store(0);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace flifcore
+{
+    /*!
+    * Process wide instrumentation, so tests and benchmarks can check which work was actually done.
+    * Incrementing is a relaxed atomic add, cheap enough to stay enabled in release builds.
+    */
+    struct Counters
+    {
+        Counters()
+            : header_scans(0)
+            , pixel_decodes(0)
+            , frame_extractions(0)
+            , copy_bytes_saved(0)
+            , disk_cache_scans(0)
+        {
+        }
+
+        std::atomic<uint64_t> header_scans;      //!< HeaderScanner runs over complete inputs
+        std::atomic<uint64_t> pixel_decodes;     //!< calls into flif_decoder_decode_memory
+        std::atomic<uint64_t> frame_extractions; //!< frames copied out of libflif images
+        std::atomic<uint64_t> copy_bytes_saved;  //!< frame bytes written to the caller without an intermediate copy
+        std::atomic<uint64_t> disk_cache_scans;  //!< listings of a disk cache directory
+    };
+
+    Counters& counters();
+
+    void resetCounters();
+
+    inline void increment(std::atomic<uint64_t>& counter)
+    {
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
+}
\ No newline at end of file
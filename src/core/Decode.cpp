@@ -0,0 +1,409 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "Decode.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "Resample.h"
+#include "RowBands.h"
+
+namespace flifcore
+{
+    const char* toString(DecodeStatus status)
+    {
+        switch(status)
+        {
+        case DS_OK:
+            return "ok";
+        case DS_READ_FAILED:
+            return "read failed";
+        case DS_DECODE_FAILED:
+            return "decode failed";
+        case DS_FRAME_MISSING:
+            return "frame missing";
+        case DS_SOURCE_CHANGED:
+            return "source changed";
+        case DS_CANCELLED:
+            return "cancelled";
+        case DS_TOO_LARGE:
+            return "too large";
+        }
+        return "unknown";
+    }
+
+    DecodeStatus probeInfo(const uint8_t* data, size_t size, ImageInfo& info)
+    {
+        HeaderScanner scanner;
+        size_t consumed;
+        scanner.feed(data, size, consumed);
+        if(!scanner.hasImageInfo())
+            return DS_DECODE_FAILED;
+
+        info = scanner.imageInfo();
+        return DS_OK;
+    }
+
+    /*!
+    * @param stop_at_image_info Only the main header is needed, not the metadata.
+    */
+    static DecodeStatus scanSourceUntil(ByteSource& source, std::vector<uint8_t>& prefix, HeaderScanner& scanner, bool stop_at_image_info)
+    {
+        // small enough to not pull in much pixel data, large enough to read a typical header at once
+        const size_t MIN_READ_SIZE = 4096;
+        // chunk lengths come from the file, the buffer only grows by what actually arrived
+        const size_t MAX_READ_SIZE = 1024 * 1024;
+
+        auto finished = [&]() {
+            return scanner.result() != HeaderScanner::SR_NEED_MORE ||
+                (stop_at_image_info && scanner.hasImageInfo());
+        };
+
+        // bytes the caller already has
+        if(scanner.bytesScanned() < prefix.size())
+        {
+            size_t consumed;
+            const size_t offset = static_cast<size_t>(scanner.bytesScanned());
+            scanner.feed(prefix.data() + offset, prefix.size() - offset, consumed);
+        }
+
+        uint64_t remaining = 0;
+        const bool remaining_known = source.remainingSize(remaining);
+
+        while(!finished())
+        {
+            const uint64_t minimum = scanner.minimumBytesWanted();
+            const bool too_short = remaining_known && minimum > remaining;
+
+            uint64_t wanted = std::min<uint64_t>(std::max<uint64_t>(minimum, MIN_READ_SIZE), MAX_READ_SIZE);
+            if(remaining_known)
+                wanted = std::min(wanted, remaining);
+
+            const size_t read_size = static_cast<size_t>(wanted);
+            const size_t previous_size = prefix.size();
+            prefix.resize(previous_size + read_size);
+
+            size_t actually_read;
+            if(!source.read(prefix.data() + previous_size, read_size, actually_read))
+            {
+                prefix.resize(previous_size);
+                return DS_READ_FAILED;
+            }
+
+            prefix.resize(previous_size + actually_read);
+            if(remaining_known)
+                remaining -= std::min<uint64_t>(remaining, actually_read);
+
+            size_t consumed;
+            scanner.feed(prefix.data() + previous_size, actually_read, consumed);
+
+            if((actually_read < read_size || too_short) && !finished())
+                return DS_DECODE_FAILED;
+        }
+
+        if(scanner.result() == HeaderScanner::SR_INVALID)
+            return DS_DECODE_FAILED;
+
+        return DS_OK;
+    }
+
+    DecodeStatus probeSource(ByteSource& source, std::vector<uint8_t>& prefix, ImageInfo& info)
+    {
+        HeaderScanner scanner;
+        DecodeStatus status = scanSourceUntil(source, prefix, scanner, true);
+        if(status != DS_OK)
+            return status;
+
+        info = scanner.imageInfo();
+        return DS_OK;
+    }
+
+    DecodeStatus scanSource(ByteSource& source, std::vector<uint8_t>& prefix, HeaderScanner& scanner)
+    {
+        return scanSourceUntil(source, prefix, scanner, false);
+    }
+
+    Decoder::Decoder()
+        : _limits(DecodeLimits::defaults())
+        , _cancel(0)
+        , _decoded(false)
+        , _frame_count(0)
+        , _num_loops(0)
+    {
+    }
+
+    void Decoder::setOptions(const DecodeOptions& options)
+    {
+        _options = options;
+    }
+
+    const DecodeOptions& Decoder::options() const
+    {
+        return _options;
+    }
+
+    void Decoder::setLimits(const DecodeLimits& limits)
+    {
+        _limits = limits;
+    }
+
+    const DecodeLimits& Decoder::limits() const
+    {
+        return _limits;
+    }
+
+    void Decoder::setCancelToken(CancelToken* cancel)
+    {
+        _cancel = cancel;
+    }
+
+    void Decoder::setProgressCallback(const ProgressCallback& callback)
+    {
+        _progress = callback;
+    }
+
+    uint32_t Decoder::progressCallback(uint32_t quality, int64_t bytes_read, uint8_t decode_over, void* user_data, void* context)
+    {
+        Decoder* decoder = static_cast<Decoder*>(user_data);
+        if(decoder->_cancel != 0)
+            CancelToken::progressCallback(quality, bytes_read, decode_over, decoder->_cancel, context);
+
+        if(decoder->_progress && !decode_over)
+            decoder->_progress(decoder->_decoder, context, quality);
+
+        // called again at the next step, quality goes up to 10000
+        return quality + 1;
+    }
+
+    DecodeStatus Decoder::open(const std::shared_ptr<const InputBuffer>& input)
+    {
+        if(!input)
+            return DS_READ_FAILED;
+
+        // a truncated mapping must not be touched at all
+        if(!input->isUnchanged())
+            return DS_SOURCE_CHANGED;
+
+        increment(counters().header_scans);
+
+        HeaderScanner scanner;
+        size_t consumed;
+        scanner.feed(input->data(), input->size(), consumed);
+        if(!scanner.hasImageInfo())
+            return DS_DECODE_FAILED;
+
+        _input = input;
+        _info = scanner.imageInfo();
+        _decoded = false;
+        _frame_count = _info.frame_count;
+        return DS_OK;
+    }
+
+    DecodeStatus Decoder::decodePixels()
+    {
+        if(_decoded)
+            return DS_OK;
+
+        if(!_input)
+            return DS_READ_FAILED;
+
+        if(!_input->isUnchanged())
+            return DS_SOURCE_CHANGED;
+
+        // a file truncated meanwhile reads as zeros behind the end, which may fail the decode as well
+        const DecodeStatus status = decodeMemory(_input->data(), _input->size());
+        if(!_input->isUnchanged())
+            return DS_SOURCE_CHANGED;
+
+        return status;
+    }
+
+    DecodeStatus Decoder::decode(const std::shared_ptr<const InputBuffer>& input)
+    {
+        DecodeStatus status = open(input);
+        if(status != DS_OK)
+            return status;
+
+        return decodePixels();
+    }
+
+    DecodeStatus Decoder::decodeMemory(const uint8_t* data, size_t size)
+    {
+        if(_cancel != 0 && _cancel->isCancelled())
+            return DS_CANCELLED;
+
+        if(_decoder == 0)
+            return DS_DECODE_FAILED;
+
+        // the size the header claims, before libflif allocates any of it
+        ImageInfo info;
+        if(probeInfo(data, size, info) != DS_OK)
+            return DS_DECODE_FAILED;
+
+        uint32_t scale = 1;
+        const bool resize = _options.resize_width != 0 && _options.resize_height != 0;
+        if(info.interlaced)
+        {
+            scale = std::max<uint32_t>(_options.scale, 1);
+            if(resize)
+                scale = std::max(scale, zoomScale(info.width, info.height, _options.resize_width, _options.resize_height));
+        }
+
+        const uint32_t fitting_scale = _limits.fittingScale(info, scale);
+        if(fitting_scale == 0 || (fitting_scale != scale && !_limits.downscale))
+            return DS_TOO_LARGE;
+
+        increment(counters().pixel_decodes);
+
+        // a pooled decoder starts with the default settings, and a failed one is not worth keeping
+        _decoder.setRetainedBytes(std::numeric_limits<uint64_t>::max());
+
+        if(_options.quality < 100)
+            flif_decoder_set_quality(_decoder, _options.quality);
+        if(fitting_scale != scale)
+            flif_decoder_set_scale(_decoder, fitting_scale); // a resize would ask for more
+        else
+        {
+            if(_options.scale > 1)
+                flif_decoder_set_scale(_decoder, _options.scale);
+            if(resize)
+                flif_decoder_set_resize(_decoder, _options.resize_width, _options.resize_height);
+        }
+        if(_options.crop_width != 0 && _options.crop_height != 0)
+        {
+            _decoder.discard();
+            flif_decoder_set_crop(_decoder, _options.crop_x, _options.crop_y,
+                _options.crop_x + _options.crop_width, _options.crop_y + _options.crop_height);
+        }
+
+        // the callback catches deadlines, attach() lets cancel() from other threads abort right away
+        if(_cancel != 0 || _progress)
+            flif_decoder_set_callback(_decoder, &Decoder::progressCallback, this);
+
+        int32_t result = 0;
+        if(_cancel == 0)
+            result = flif_decoder_decode_memory(_decoder, data, size);
+        else if(_cancel->attach(_decoder))
+        {
+            result = flif_decoder_decode_memory(_decoder, data, size);
+            _cancel->detach();
+        }
+
+        if(_cancel != 0 || _progress)
+            flif_decoder_set_callback(_decoder, 0, 0);
+
+        // an aborted decoder has to stay aborted, it is not given back to the pool
+        if(_cancel != 0 && _cancel->isCancelled())
+        {
+            _decoder.discard();
+            _decoder = PooledDecoder();
+            return DS_CANCELLED;
+        }
+
+        if(result == 0)
+            return DS_DECODE_FAILED;
+
+        _decoded = true;
+        _frame_count = flif_decoder_num_images(_decoder);
+        _num_loops = flif_decoder_num_loops(_decoder);
+
+        uint64_t retained_bytes = 0;
+        for(size_t i = 0; i < _frame_count; ++i)
+        {
+            FLIF_IMAGE* image = flif_decoder_get_image(_decoder, i);
+            retained_bytes += uint64_t(flif_image_get_width(image)) * flif_image_get_height(image) * 4;
+        }
+        _decoder.setRetainedBytes(retained_bytes);
+        return DS_OK;
+    }
+
+    void Decoder::releaseImages()
+    {
+        // libflif cannot free single images, only all of them together with the decoder
+        _decoder = PooledDecoder();
+        _decoded = false;
+    }
+
+    bool Decoder::isDecoded() const
+    {
+        return _decoded;
+    }
+
+    const ImageInfo& Decoder::info() const
+    {
+        return _info;
+    }
+
+    const std::shared_ptr<const InputBuffer>& Decoder::input() const
+    {
+        return _input;
+    }
+
+    size_t Decoder::frameCount() const
+    {
+        return _frame_count;
+    }
+
+    int32_t Decoder::numLoops() const
+    {
+        return _num_loops;
+    }
+
+    FLIF_IMAGE* Decoder::image(size_t index) const
+    {
+        if(!_decoded || index >= frameCount())
+            return 0;
+
+        return flif_decoder_get_image(_decoder, index);
+    }
+
+    DecodeStatus Decoder::extractFrame(size_t index, Frame& frame, PixelFormat format)
+    {
+        DecodeStatus status = decodePixels();
+        if(status != DS_OK)
+            return status;
+
+        FLIF_IMAGE* flif_image = image(index);
+        if(flif_image == 0)
+            return DS_FRAME_MISSING;
+
+        flifcore::extractFrame(flif_image, frame, format);
+        return DS_OK;
+    }
+
+    void extractFrame(FLIF_IMAGE* image, Frame& frame, PixelFormat format)
+    {
+        increment(counters().frame_extractions);
+
+        const uint32_t w = flif_image_get_width(image);
+        const uint32_t h = flif_image_get_height(image);
+
+        frame.width = w;
+        frame.height = h;
+        frame.delay_ms = flif_image_get_frame_delay(image);
+        frame.format = format;
+        frame.pixels.resize(frame.stride() * h);
+
+        // rows are independent, large frames are read in bands on several threads
+        RowBands::run(h, frame.pixels.size(), [&](uint32_t begin, uint32_t end)
+        {
+            PixelBuffer scratch;
+            for(uint32_t y = begin; y < end; ++y)
+                readRow(image, y, format, frame.pixels.data() + y * frame.stride(), scratch);
+        });
+    }
+}
\ No newline at end of file
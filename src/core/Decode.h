@@ -0,0 +1,219 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include "flifWrapper.h"
+#include "ByteSource.h"
+#include "CancelToken.h"
+#include "Counters.h"
+#include "DecodeLimits.h"
+#include "DecoderPool.h"
+#include "Frame.h"
+#include "HeaderScanner.h"
+
+namespace flifcore
+{
+    enum DecodeStatus
+    {
+        DS_OK,
+        DS_READ_FAILED,
+        DS_DECODE_FAILED,
+        DS_FRAME_MISSING,
+        DS_SOURCE_CHANGED,
+        DS_CANCELLED,
+        DS_TOO_LARGE //!< over the DecodeLimits, found before anything was allocated
+    };
+
+    const char* toString(DecodeStatus status);
+
+    /*!
+    * Settings passed on to libflif before the pixels are decoded.
+    */
+    struct DecodeOptions
+    {
+        DecodeOptions()
+            : quality(100)
+            , scale(1)
+            , resize_width(0)
+            , resize_height(0)
+            , crop_x(0)
+            , crop_y(0)
+            , crop_width(0)
+            , crop_height(0)
+        {
+        }
+
+        int32_t quality; //!< 0..100, lower values stop earlier in the data of interlaced files
+
+        // Only interlaced files have zoom levels, set the following for them only.
+
+        //! Power of two, decodes the zoom level of ceil(width / scale) x ceil(height / scale).
+        uint32_t scale;
+
+        //! 0 for the full size. Otherwise libflif only decodes the zoom levels needed for at least this size.
+        uint32_t resize_width;
+        uint32_t resize_height;
+
+        //! Rectangle of the full size image to decode, for all files. 0 x 0 for everything.
+        //! libflif skips the pixels outside, the decoded images may be just the rectangle or the full size.
+        uint32_t crop_x;
+        uint32_t crop_y;
+        uint32_t crop_width;
+        uint32_t crop_height;
+    };
+
+    /*!
+    * Reads the main header with the HeaderScanner. No pixels are decoded.
+    * @param size May be just a prefix of the file.
+    */
+    DecodeStatus probeInfo(const uint8_t* data, size_t size, ImageInfo& info);
+
+    /*!
+    * Reads the source until the main header is complete.
+    * @param prefix Receives all bytes read from the source, so the caller can continue from there.
+    */
+    DecodeStatus probeSource(ByteSource& source, std::vector<uint8_t>& prefix, ImageInfo& info);
+
+    /*!
+    * Reads the source until the scanner has passed the metadata. Never reads more than needed for the current chunk
+    * plus a few KB, so large metadata arrives in one read and the pixel data mostly stays in the source.
+    * @param prefix Bytes read from the source so far, starting at the beginning of the file.
+    *               The part behind scanner.bytesScanned() is scanned first, then new bytes are appended.
+    */
+    DecodeStatus scanSource(ByteSource& source, std::vector<uint8_t>& prefix, HeaderScanner& scanner);
+
+    /*!
+    * Decodes a complete FLIF file from memory and hands out its frames.
+    * This is the platform neutral part of all plugin classes.
+    *
+    * Pixels can be decoded lazily: open() only scans the header, and the first call that needs pixels decodes them.
+    * Not thread safe, callers must serialize access.
+    */
+    class Decoder
+    {
+    public:
+        Decoder();
+
+        //! Applies to the next decode.
+        void setOptions(const DecodeOptions& options);
+        const DecodeOptions& options() const;
+
+        /*!
+        * Checked before each decode, against the size the options ask for. DecodeLimits::defaults() until set.
+        * If the limits allow a downscale, the decoded images may be smaller than the options ask for.
+        */
+        void setLimits(const DecodeLimits& limits);
+        const DecodeLimits& limits() const;
+
+        /*!
+        * Lets the token stop the next decodes with DS_CANCELLED. 0 for none.
+        * The token must outlive the decodes.
+        */
+        void setCancelToken(CancelToken* cancel);
+
+        /*!
+        * Called on the decoding thread whenever libflif reports progress, for interlaced files after each pass.
+        * Before it reads flif_decoder_get_image(), the callback has to call flif_decoder_generate_preview() with the context.
+        * It runs inside libflif and must not throw.
+        * Applies to the next decodes, an empty function for none.
+        */
+        typedef std::function<void(FLIF_DECODER* decoder, void* context, uint32_t quality)> ProgressCallback;
+        void setProgressCallback(const ProgressCallback& callback);
+
+        /*!
+        * Scans the header and keeps a reference to the input as long as this decoder lives. No pixels are decoded.
+        * Fails with DS_SOURCE_CHANGED if a mapped file was modified.
+        */
+        DecodeStatus open(const std::shared_ptr<const InputBuffer>& input);
+
+        /*!
+        * Decodes the pixels of the opened input, if that did not happen yet.
+        * Fails with DS_SOURCE_CHANGED if a mapped file was modified before or during decoding.
+        */
+        DecodeStatus decodePixels();
+
+        /*!
+        * open() and decodePixels() in one go.
+        */
+        DecodeStatus decode(const std::shared_ptr<const InputBuffer>& input);
+
+        /*!
+        * The compressed bytes are only needed during this call.
+        * A cancelled decode returns DS_CANCELLED and keeps nothing of the libflif decoder.
+        */
+        DecodeStatus decodeMemory(const uint8_t* data, size_t size);
+
+        /*!
+        * Gives up the libflif decoder with all decoded images, frame count and loops are kept.
+        * The DecoderPool destroys it, or keeps it if the images are small.
+        * Pixels can be decoded again from the kept input. Images handed out before become invalid.
+        */
+        void releaseImages();
+
+        bool isDecoded() const;
+
+        //! Valid after open(), from the header.
+        const ImageInfo& info() const;
+
+        //! The input given to open(), 0 before.
+        const std::shared_ptr<const InputBuffer>& input() const;
+
+        //! Taken from the header until the pixels are decoded, then from libflif.
+        size_t frameCount() const;
+        int32_t numLoops() const;
+
+        /*!
+        * @return The decoded libflif image, owned by this decoder. 0 if index is out of range or nothing is decoded yet.
+        */
+        FLIF_IMAGE* image(size_t index) const;
+
+        /*!
+        * Decodes the pixels first, if necessary.
+        */
+        DecodeStatus extractFrame(size_t index, Frame& frame, PixelFormat format = PF_RGBA32);
+
+    private:
+        Decoder(const Decoder& other);
+        Decoder& operator=(const Decoder& other);
+
+        static uint32_t progressCallback(uint32_t quality, int64_t bytes_read, uint8_t decode_over, void* user_data, void* context);
+
+        PooledDecoder _decoder;
+        DecodeOptions _options;
+        DecodeLimits _limits;
+        CancelToken* _cancel;
+        ProgressCallback _progress;
+        std::shared_ptr<const InputBuffer> _input;
+        ImageInfo _info;
+        bool _decoded;
+        size_t _frame_count;
+        int32_t _num_loops;
+    };
+
+    /*!
+    * Converts a decoded libflif image, row by row while reading it.
+    */
+    void extractFrame(FLIF_IMAGE* image, Frame& frame, PixelFormat format = PF_RGBA32);
+
+    inline PixelFormat choosePixelFormat(const ImageInfo& info)
+    {
+        return choosePixelFormat(info.channels, info.depth);
+    }
+}
\ No newline at end of file
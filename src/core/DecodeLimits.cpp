@@ -0,0 +1,108 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "DecodeLimits.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+
+#include "Environment.h"
+
+namespace flifcore
+{
+    static std::mutex g_defaults_mutex;
+    static bool g_defaults_set = false;
+    static DecodeLimits g_defaults;
+
+    //! @return max if the product does not fit.
+    static uint64_t saturatingMultiply(uint64_t a, uint64_t b)
+    {
+        if(a != 0 && b > std::numeric_limits<uint64_t>::max() / a)
+            return std::numeric_limits<uint64_t>::max();
+        return a * b;
+    }
+
+    static uint64_t zoomLevelPixels(const ImageInfo& info, uint32_t scale)
+    {
+        const uint64_t width = (uint64_t(info.width) + scale - 1) / scale;
+        const uint64_t height = (uint64_t(info.height) + scale - 1) / scale;
+        return saturatingMultiply(width, height);
+    }
+
+    DecodeLimits DecodeLimits::fromEnvironment()
+    {
+        DecodeLimits limits;
+
+        // a typo keeps the default instead of allowing nothing or everything
+        numberFromEnvironment("FLIF_MAX_PIXELS", 1, limits.max_pixels);
+        numberFromEnvironment("FLIF_MAX_DECODE_MB", 1024 * 1024, limits.max_bytes);
+
+        return limits;
+    }
+
+    DecodeLimits DecodeLimits::defaults()
+    {
+        std::lock_guard<std::mutex> lock(g_defaults_mutex);
+        if(!g_defaults_set)
+        {
+            g_defaults = fromEnvironment();
+            g_defaults_set = true;
+        }
+        return g_defaults;
+    }
+
+    void DecodeLimits::setDefaults(const DecodeLimits& limits)
+    {
+        std::lock_guard<std::mutex> lock(g_defaults_mutex);
+        g_defaults = limits;
+        g_defaults_set = true;
+    }
+
+    uint64_t DecodeLimits::decodedBytes(const ImageInfo& info, uint32_t scale)
+    {
+        const uint64_t bytes_per_pixel = info.depth > 8 ? 8 : 4;
+        return saturatingMultiply(saturatingMultiply(zoomLevelPixels(info, scale), bytes_per_pixel), info.frame_count);
+    }
+
+    bool DecodeLimits::fits(const ImageInfo& info, uint32_t scale) const
+    {
+        return zoomLevelPixels(info, scale) <= max_pixels && decodedBytes(info, scale) <= max_bytes;
+    }
+
+    uint32_t DecodeLimits::fittingScale(const ImageInfo& info, uint32_t min_scale) const
+    {
+        uint32_t scale = std::max<uint32_t>(min_scale, 1);
+        if(fits(info, scale))
+            return scale;
+
+        // only interlaced files have zoom levels
+        if(!info.interlaced)
+            return 0;
+
+        // until a single pixel is left
+        while(scale < info.width || scale < info.height)
+        {
+            if(scale > (std::numeric_limits<uint32_t>::max() >> 1))
+                return 0;
+
+            scale <<= 1;
+            if(fits(info, scale))
+                return scale;
+        }
+        return 0;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+#include "HeaderScanner.h"
+
+namespace flifcore
+{
+    /*!
+    * How large an image may get before a decode refuses it, checked against the header before libflif allocates anything.
+    *
+    * A header can claim any size, a few bytes can ask for a 60000 x 60000 image. Over the limits, a decode fails with
+    * DS_TOO_LARGE, or with downscale set, interlaced files are decoded at the largest zoom level that fits.
+    */
+    struct DecodeLimits
+    {
+        //! 16384 x 16384
+        static const uint64_t DEFAULT_MAX_PIXELS = uint64_t(1) << 28;
+        static const uint64_t DEFAULT_MAX_BYTES = sizeof(void*) > 4 ? uint64_t(4) << 30 : uint64_t(512) << 20;
+
+        DecodeLimits()
+            : max_pixels(DEFAULT_MAX_PIXELS)
+            , max_bytes(DEFAULT_MAX_BYTES)
+            , downscale(false)
+        {
+        }
+
+        /*!
+        * The defaults, changed by the environment: FLIF_MAX_PIXELS and FLIF_MAX_DECODE_MB.
+        */
+        static DecodeLimits fromEnvironment();
+
+        //! For decoders that get no own limits. fromEnvironment() until set.
+        static DecodeLimits defaults();
+        static void setDefaults(const DecodeLimits& limits);
+
+        /*!
+        * Memory of all frames decoded as libflif hands them out, 8 or 16 bits for each of the 4 channels.
+        * Saturates instead of overflowing.
+        * @param scale Power of two, the zoom level of ceil(width / scale) x ceil(height / scale).
+        */
+        static uint64_t decodedBytes(const ImageInfo& info, uint32_t scale = 1);
+
+        bool fits(const ImageInfo& info, uint32_t scale = 1) const;
+
+        /*!
+        * The smallest power of two scale at which the image fits, at least min_scale.
+        * @return 0 if it does not fit at any scale, or if it would need one and the file is not interlaced.
+        */
+        uint32_t fittingScale(const ImageInfo& info, uint32_t min_scale = 1) const;
+
+        uint64_t max_pixels; //!< of one frame
+        uint64_t max_bytes;  //!< of all frames, see decodedBytes()
+        bool downscale;      //!< decode interlaced files smaller instead of failing
+    };
+}
\ No newline at end of file
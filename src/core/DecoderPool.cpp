@@ -0,0 +1,159 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "DecoderPool.h"
+
+namespace flifcore
+{
+    DecoderPool::DecoderPool(size_t max_idle)
+        : _max_idle(max_idle)
+        , _created(0)
+        , _reused(0)
+    {
+    }
+
+    DecoderPool& DecoderPool::shared()
+    {
+        static DecoderPool pool;
+        return pool;
+    }
+
+    flifDecoder DecoderPool::acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(!_idle.empty())
+            {
+                flifDecoder decoder = std::move(_idle.back());
+                _idle.pop_back();
+                _reused.fetch_add(1, std::memory_order_relaxed);
+
+                // the settings of the previous user, libflif treats 0 x 0 as no resize
+                flif_decoder_set_quality(decoder, 100);
+                flif_decoder_set_scale(decoder, 1);
+                flif_decoder_set_resize(decoder, 0, 0);
+                flif_decoder_set_callback(decoder, 0, 0);
+                return decoder;
+            }
+        }
+
+        _created.fetch_add(1, std::memory_order_relaxed);
+        return flifDecoder();
+    }
+
+    void DecoderPool::release(flifDecoder decoder, uint64_t retained_bytes)
+    {
+        if(decoder == 0 || retained_bytes > MAX_RETAINED_BYTES)
+            return;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_idle.size() < _max_idle)
+            _idle.push_back(std::move(decoder));
+    }
+
+    void DecoderPool::setMaxIdle(size_t max_idle)
+    {
+        std::vector<flifDecoder> dropped;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _max_idle = max_idle;
+            while(_idle.size() > _max_idle)
+            {
+                dropped.push_back(std::move(_idle.back()));
+                _idle.pop_back();
+            }
+        }
+    }
+
+    size_t DecoderPool::maxIdle() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _max_idle;
+    }
+
+    void DecoderPool::clear()
+    {
+        std::vector<flifDecoder> dropped;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            dropped.swap(_idle);
+        }
+    }
+
+    DecoderPool::Stats DecoderPool::stats() const
+    {
+        Stats stats;
+        stats.created = _created;
+        stats.reused = _reused;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        stats.idle = _idle.size();
+        return stats;
+    }
+
+    //=========================================================================
+
+    PooledDecoder::PooledDecoder(DecoderPool& pool)
+        : _pool(&pool)
+        , _decoder(pool.acquire())
+        , _retained_bytes(0)
+        , _discard(false)
+    {
+    }
+
+    PooledDecoder::~PooledDecoder()
+    {
+        giveBack();
+    }
+
+    PooledDecoder::PooledDecoder(PooledDecoder&& other)
+        : _pool(other._pool)
+        , _decoder(std::move(other._decoder))
+        , _retained_bytes(other._retained_bytes)
+        , _discard(other._discard)
+    {
+    }
+
+    PooledDecoder& PooledDecoder::operator=(PooledDecoder&& other)
+    {
+        if(this == &other)
+            return *this;
+
+        giveBack();
+        _pool = other._pool;
+        _decoder = std::move(other._decoder);
+        _retained_bytes = other._retained_bytes;
+        _discard = other._discard;
+        return *this;
+    }
+
+    void PooledDecoder::setRetainedBytes(uint64_t retained_bytes)
+    {
+        _retained_bytes = retained_bytes;
+    }
+
+    void PooledDecoder::discard()
+    {
+        _discard = true;
+    }
+
+    void PooledDecoder::giveBack()
+    {
+        // a discarded decoder is destroyed with this object, or when it is assigned another one
+        if(!_discard)
+            _pool->release(std::move(_decoder), _retained_bytes);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,120 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "flifWrapper.h"
+
+namespace flifcore
+{
+    /*!
+    * libflif decoders that are handed back instead of destroyed, so opening many small files does not create one each time.
+    *
+    * A decoder keeps its images until the next decode, libflif cannot free them on their own. So only decoders
+    * whose images are small are kept, which bounds the memory of the idle ones. Decoders that had a crop set
+    * are never kept, libflif has no way to reset it. Thread safe.
+    */
+    class DecoderPool
+    {
+    public:
+        static const size_t DEFAULT_MAX_IDLE = 8;
+
+        //! Decoders holding more than this in images are destroyed when they are returned.
+        static const uint64_t MAX_RETAINED_BYTES = 1024 * 1024;
+
+        explicit DecoderPool(size_t max_idle = DEFAULT_MAX_IDLE);
+
+        //! The pool of this process.
+        static DecoderPool& shared();
+
+        /*!
+        * A pooled or a new decoder, with quality, scale and resize at their defaults. 0 if libflif is out of memory.
+        */
+        flifDecoder acquire();
+
+        /*!
+        * Keeps the decoder or destroys it.
+        * @param retained_bytes Estimate of the images the decoder still holds, 0 if it never decoded.
+        */
+        void release(flifDecoder decoder, uint64_t retained_bytes);
+
+        //! 0 turns the pool off.
+        void setMaxIdle(size_t max_idle);
+        size_t maxIdle() const;
+
+        //! Destroys all idle decoders.
+        void clear();
+
+        struct Stats
+        {
+            uint64_t created;
+            uint64_t reused;
+            size_t idle;
+        };
+
+        Stats stats() const;
+
+    private:
+        DecoderPool(const DecoderPool& other);
+        DecoderPool& operator=(const DecoderPool& other);
+
+        mutable std::mutex _mutex;
+        std::vector<flifDecoder> _idle;
+        size_t _max_idle;
+        std::atomic<uint64_t> _created;
+        std::atomic<uint64_t> _reused;
+    };
+
+    /*!
+    * A decoder borrowed from a DecoderPool for the lifetime of this object.
+    */
+    class PooledDecoder
+    {
+    public:
+        explicit PooledDecoder(DecoderPool& pool = DecoderPool::shared());
+        ~PooledDecoder();
+
+        PooledDecoder(PooledDecoder&& other);
+        PooledDecoder& operator=(PooledDecoder&& other);
+
+        //! Call before decoding, so the pool can tell if the decoder is worth keeping.
+        void setRetainedBytes(uint64_t retained_bytes);
+
+        //! The decoder is destroyed instead of returned, for settings that cannot be reset.
+        void discard();
+
+        operator FLIF_DECODER*() const
+        {
+            return _decoder;
+        }
+
+    private:
+        PooledDecoder(const PooledDecoder& other);
+        PooledDecoder& operator=(const PooledDecoder& other);
+
+        void giveBack();
+
+        DecoderPool* _pool;
+        flifDecoder _decoder;
+        uint64_t _retained_bytes;
+        bool _discard;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,575 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "DiskCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <io.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include "ContentHash.h"
+#include "Counters.h"
+#include "Environment.h"
+#include "MappedFile.h"
+
+/*
+Layout of a cache file, all numbers in the byte order of the machine that wrote it:
+
+FileHeader            see below
+FrameRecord           one per frame
+zeros                 up to header_size, a multiple of the page size
+frame pixels          each at a page aligned offset, rows without padding, zeros in between
+*/
+
+namespace flifcore
+{
+    static const char MAGIC[8] = { 'F', 'L', 'I', 'F', 'C', 'A', 'C', 'H' };
+    static const uint32_t VERSION = 1;
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size; //!< bytes before the first frame
+        uint64_t file_size;
+        uint64_t content_hash;
+        uint64_t content_size;
+        uint32_t format;
+        uint32_t variant;
+        uint32_t width;
+        uint32_t height;
+        uint32_t channels;
+        uint32_t depth;
+        uint64_t header_frame_count;
+        uint32_t interlaced;
+        int32_t num_loops;
+        uint32_t frame_count;
+        uint32_t reserved;
+        uint64_t header_hash; //!< contentHash() of header and frame records, with this field 0
+    };
+
+    struct FrameRecord
+    {
+        uint32_t width;
+        uint32_t height;
+        uint32_t delay_ms;
+        uint32_t format;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    static_assert(sizeof(FileHeader) == 96, "the file layout must not depend on the compiler");
+    static_assert(sizeof(FrameRecord) == 32, "the file layout must not depend on the compiler");
+
+    static const char CACHE_EXTENSION[] = ".fdc";
+    static const char TEMPORARY_EXTENSION[] = ".part";
+
+    //! Temporary files this old were left behind by a crashed writer.
+    static const int64_t STALE_TEMPORARY_SECONDS = 60 * 60;
+
+    // unique among the threads of this process, the process id makes it unique on the machine
+    static std::atomic<uint64_t> g_temporary_counter(0);
+
+    static uint64_t alignToPage(uint64_t value)
+    {
+        return (value + DiskCache::PAGE_SIZE - 1) / DiskCache::PAGE_SIZE * DiskCache::PAGE_SIZE;
+    }
+
+    static DiskCache::Path toPath(const std::string& ascii)
+    {
+        return DiskCache::Path(ascii.begin(), ascii.end());
+    }
+
+    static bool endsWith(const DiskCache::Path& name, const char* suffix)
+    {
+        const size_t length = strlen(suffix);
+        return name.size() >= length && std::equal(suffix, suffix + length, name.end() - length);
+    }
+
+    static uint64_t headerHash(FileHeader header, const std::vector<FrameRecord>& records)
+    {
+        header.header_hash = 0;
+        std::vector<uint8_t> bytes(sizeof(header) + records.size() * sizeof(FrameRecord));
+        memcpy(bytes.data(), &header, sizeof(header));
+        if(!records.empty())
+            memcpy(bytes.data() + sizeof(header), records.data(), records.size() * sizeof(FrameRecord));
+        return contentHash(bytes.data(), bytes.size());
+    }
+
+    //=========================================================================
+    // file system access
+
+    struct DirectoryEntry
+    {
+        DiskCache::Path name;
+        uint64_t size;
+        int64_t modification_time; //!< seconds
+    };
+
+#ifdef _WIN32
+
+    static const wchar_t SEPARATOR = L'\\';
+
+    static int64_t fileTimeToSeconds(const FILETIME& time)
+    {
+        return static_cast<int64_t>((uint64_t(time.dwHighDateTime) << 32 | time.dwLowDateTime) / 10000000);
+    }
+
+    static int64_t currentSeconds()
+    {
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        return fileTimeToSeconds(now);
+    }
+
+    static unsigned long processId()
+    {
+        return GetCurrentProcessId();
+    }
+
+    static void createDirectory(const DiskCache::Path& path)
+    {
+        CreateDirectoryW(path.c_str(), 0);
+    }
+
+    static FILE* openForWriting(const DiskCache::Path& path)
+    {
+        return _wfopen(path.c_str(), L"wb");
+    }
+
+    static bool flushToDisk(FILE* file)
+    {
+        return fflush(file) == 0 && _commit(_fileno(file)) == 0;
+    }
+
+    static bool replaceFile(const DiskCache::Path& from, const DiskCache::Path& to)
+    {
+        return MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+    }
+
+    static void removeFile(const DiskCache::Path& path)
+    {
+        DeleteFileW(path.c_str());
+    }
+
+    static void touchFile(const DiskCache::Path& path)
+    {
+        HANDLE file = CreateFileW(path.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        if(file == INVALID_HANDLE_VALUE)
+            return;
+
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        SetFileTime(file, 0, 0, &now);
+        CloseHandle(file);
+    }
+
+    static void listDirectory(const DiskCache::Path& path, std::vector<DirectoryEntry>& entries)
+    {
+        WIN32_FIND_DATAW data;
+        HANDLE find = FindFirstFileW((path + L"\\*").c_str(), &data);
+        if(find == INVALID_HANDLE_VALUE)
+            return;
+
+        do
+        {
+            if(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                continue;
+
+            DirectoryEntry entry;
+            entry.name = data.cFileName;
+            entry.size = uint64_t(data.nFileSizeHigh) << 32 | data.nFileSizeLow;
+            entry.modification_time = fileTimeToSeconds(data.ftLastWriteTime);
+            entries.push_back(entry);
+        }
+        while(FindNextFileW(find, &data));
+
+        FindClose(find);
+    }
+
+#else
+
+    static const char SEPARATOR = '/';
+
+    static int64_t currentSeconds()
+    {
+        return static_cast<int64_t>(time(0));
+    }
+
+    static unsigned long processId()
+    {
+        return static_cast<unsigned long>(getpid());
+    }
+
+    static void createDirectory(const DiskCache::Path& path)
+    {
+        mkdir(path.c_str(), 0755);
+    }
+
+    static FILE* openForWriting(const DiskCache::Path& path)
+    {
+        return fopen(path.c_str(), "wb");
+    }
+
+    static bool flushToDisk(FILE* file)
+    {
+        return fflush(file) == 0 && fsync(fileno(file)) == 0;
+    }
+
+    static bool replaceFile(const DiskCache::Path& from, const DiskCache::Path& to)
+    {
+        return rename(from.c_str(), to.c_str()) == 0;
+    }
+
+    static void removeFile(const DiskCache::Path& path)
+    {
+        unlink(path.c_str());
+    }
+
+    static void touchFile(const DiskCache::Path& path)
+    {
+        utime(path.c_str(), 0);
+    }
+
+    static void listDirectory(const DiskCache::Path& path, std::vector<DirectoryEntry>& entries)
+    {
+        DIR* directory = opendir(path.c_str());
+        if(directory == 0)
+            return;
+
+        while(struct dirent* item = readdir(directory))
+        {
+            DirectoryEntry entry;
+            entry.name = item->d_name;
+
+            struct stat file_stat;
+            if(stat((path + SEPARATOR + entry.name).c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode))
+                continue;
+
+            entry.size = static_cast<uint64_t>(file_stat.st_size);
+            entry.modification_time = static_cast<int64_t>(file_stat.st_mtime);
+            entries.push_back(entry);
+        }
+
+        closedir(directory);
+    }
+
+#endif
+
+    static bool writeBytes(FILE* file, const void* data, size_t size)
+    {
+        return size == 0 || fwrite(data, 1, size, file) == size;
+    }
+
+    static bool writeZeros(FILE* file, uint64_t count)
+    {
+        static const uint8_t zeros[DiskCache::PAGE_SIZE] = {};
+        while(count > 0)
+        {
+            const size_t chunk = static_cast<size_t>(std::min<uint64_t>(count, sizeof(zeros)));
+            if(!writeBytes(file, zeros, chunk))
+                return false;
+            count -= chunk;
+        }
+        return true;
+    }
+
+    //=========================================================================
+
+    DiskCache::DiskCache(const Path& directory, uint64_t max_bytes)
+        : _directory(directory)
+        , _max_bytes(max_bytes)
+        , _bytes(0)
+    {
+        createDirectory(_directory);
+        _bytes = bytesOnDisk();
+    }
+
+    std::shared_ptr<DiskCache> DiskCache::fromEnvironment()
+    {
+#ifdef _WIN32
+        const wchar_t* directory = _wgetenv(L"FLIF_DISK_CACHE_DIR");
+#else
+        const char* directory = getenv("FLIF_DISK_CACHE_DIR");
+#endif
+        if(directory == 0 || directory[0] == 0)
+            return std::shared_ptr<DiskCache>();
+
+        // a typo must not turn the cache into one that evicts everything
+        uint64_t max_bytes = DEFAULT_MAX_BYTES;
+        numberFromEnvironment("FLIF_DISK_CACHE_MB", 1024 * 1024, max_bytes);
+
+        return std::make_shared<DiskCache>(Path(directory), max_bytes);
+    }
+
+    std::shared_ptr<const CachedImage> DiskCache::load(const ImageKey& key, uint32_t variant)
+    {
+        const Path file_name = fileName(key, variant);
+
+        // cache files are replaced by renaming, never truncated, so the mapping cannot lose pages
+        std::shared_ptr<MappedFile> mapped = std::make_shared<MappedFile>();
+        if(!mapped->open(file_name, 0))
+            return std::shared_ptr<const CachedImage>();
+
+        const uint8_t* data = mapped->data();
+        const uint64_t size = mapped->size();
+
+        // everything is checked before a pointer into the file is handed out, a damaged file is deleted
+        bool valid = size >= sizeof(FileHeader);
+        FileHeader header;
+        std::vector<FrameRecord> records;
+        if(valid)
+        {
+            memcpy(&header, data, sizeof(header));
+            valid = memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                header.version == VERSION &&
+                header.file_size == size &&
+                header.header_size % PAGE_SIZE == 0 &&
+                header.header_size <= size &&
+                header.frame_count <= (header.header_size - sizeof(FileHeader)) / sizeof(FrameRecord) &&
+                header.content_hash == key.hash &&
+                header.content_size == key.size &&
+                header.format == uint32_t(key.format) &&
+                header.variant == variant;
+        }
+        if(valid)
+        {
+            records.resize(header.frame_count);
+            if(!records.empty())
+                memcpy(records.data(), data + sizeof(FileHeader), records.size() * sizeof(FrameRecord));
+            valid = headerHash(header, records) == header.header_hash;
+        }
+
+        std::shared_ptr<CachedImage> image = std::make_shared<CachedImage>();
+        for(size_t i = 0; valid && i < records.size(); ++i)
+        {
+            const FrameRecord& record = records[i];
+            FrameView frame;
+            frame.width = record.width;
+            frame.height = record.height;
+            frame.delay_ms = record.delay_ms;
+            frame.format = static_cast<PixelFormat>(record.format);
+            frame.pixels = data + record.offset;
+
+            // consumers index the frames by the header size, a thumbnail is never larger than the image
+            const bool fits_header = variant == 0 ?
+                frame.width == header.width && frame.height == header.height :
+                frame.width <= header.width && frame.height <= header.height;
+
+            valid = fits_header &&
+                record.format <= PF_RGBA64 &&
+                record.offset % PAGE_SIZE == 0 &&
+                record.offset >= header.header_size &&
+                record.offset <= size &&
+                record.size <= size - record.offset &&
+                record.size == uint64_t(frame.width) * frame.height * bytesPerPixel(frame.format);
+
+            image->frames.push_back(frame);
+        }
+
+        if(!valid)
+        {
+            mapped.reset();
+            removeFile(file_name);
+            return std::shared_ptr<const CachedImage>();
+        }
+
+        image->info.width = header.width;
+        image->info.height = header.height;
+        image->info.channels = static_cast<uint8_t>(header.channels);
+        image->info.depth = static_cast<uint8_t>(header.depth);
+        image->info.frame_count = static_cast<size_t>(header.header_frame_count);
+        image->info.interlaced = header.interlaced != 0;
+        image->num_loops = header.num_loops;
+        image->storage = mapped;
+
+        // the modification time is the last use, for trim()
+        touchFile(file_name);
+        return image;
+    }
+
+    bool DiskCache::store(const ImageKey& key, uint32_t variant, const CachedImage& image)
+    {
+        FileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.content_hash = key.hash;
+        header.content_size = key.size;
+        header.format = key.format;
+        header.variant = variant;
+        header.width = image.info.width;
+        header.height = image.info.height;
+        header.channels = image.info.channels;
+        header.depth = image.info.depth;
+        header.header_frame_count = image.info.frame_count;
+        header.interlaced = image.info.interlaced ? 1 : 0;
+        header.num_loops = image.num_loops;
+        header.frame_count = static_cast<uint32_t>(image.frames.size());
+        header.header_size = static_cast<uint32_t>(alignToPage(sizeof(FileHeader) + image.frames.size() * sizeof(FrameRecord)));
+
+        std::vector<FrameRecord> records(image.frames.size());
+        uint64_t offset = header.header_size;
+        for(size_t i = 0; i < records.size(); ++i)
+        {
+            const FrameView& frame = image.frames[i];
+            records[i].width = frame.width;
+            records[i].height = frame.height;
+            records[i].delay_ms = frame.delay_ms;
+            records[i].format = frame.format;
+            records[i].offset = offset;
+            records[i].size = frame.size();
+            offset = alignToPage(offset + frame.size());
+        }
+        header.file_size = records.empty() ? header.header_size : records.back().offset + records.back().size;
+        header.header_hash = headerHash(header, records);
+
+        // complete and on disk before it gets its name
+        const Path temporary = temporaryFileName();
+        FILE* file = openForWriting(temporary);
+        if(file == 0)
+            return false;
+
+        bool ok = writeBytes(file, &header, sizeof(header)) &&
+            writeBytes(file, records.data(), records.size() * sizeof(FrameRecord)) &&
+            writeZeros(file, header.header_size - sizeof(header) - records.size() * sizeof(FrameRecord));
+
+        uint64_t position = header.header_size;
+        for(size_t i = 0; ok && i < records.size(); ++i)
+        {
+            ok = writeZeros(file, records[i].offset - position) &&
+                writeBytes(file, image.frames[i].pixels, static_cast<size_t>(records[i].size));
+            position = records[i].offset + records[i].size;
+        }
+
+        ok = ok && flushToDisk(file);
+        ok = fclose(file) == 0 && ok;
+        ok = ok && replaceFile(temporary, fileName(key, variant));
+
+        if(!ok)
+        {
+            removeFile(temporary);
+            return false;
+        }
+
+        // listing the directory on every store would make filling the thumbnails of a folder quadratic
+        if(_bytes.fetch_add(header.file_size) + header.file_size > _max_bytes)
+            trim();
+        return true;
+    }
+
+    void DiskCache::trim()
+    {
+        increment(counters().disk_cache_scans);
+
+        std::vector<DirectoryEntry> entries;
+        listDirectory(_directory, entries);
+
+        const int64_t now = currentSeconds();
+        std::vector<DirectoryEntry> cache_files;
+        uint64_t total = 0;
+        for(const auto& entry : entries)
+        {
+            if(endsWith(entry.name, CACHE_EXTENSION))
+            {
+                cache_files.push_back(entry);
+                total += entry.size;
+            }
+            else if(endsWith(entry.name, TEMPORARY_EXTENSION) && now - entry.modification_time > STALE_TEMPORARY_SECONDS)
+            {
+                removeFile(_directory + SEPARATOR + entry.name);
+            }
+        }
+
+        if(total <= _max_bytes)
+        {
+            _bytes = total;
+            return;
+        }
+
+        // each deletion leaves a consistent cache, readers that still map a file keep their pages
+        std::sort(cache_files.begin(), cache_files.end(), [](const DirectoryEntry& a, const DirectoryEntry& b)
+        {
+            return a.modification_time < b.modification_time;
+        });
+
+        for(const auto& entry : cache_files)
+        {
+            if(total <= _max_bytes)
+                break;
+
+            removeFile(_directory + SEPARATOR + entry.name);
+            total -= entry.size;
+        }
+        _bytes = total;
+    }
+
+    uint64_t DiskCache::bytesOnDisk() const
+    {
+        std::vector<DirectoryEntry> entries;
+        listDirectory(_directory, entries);
+
+        uint64_t total = 0;
+        for(const auto& entry : entries)
+            if(endsWith(entry.name, CACHE_EXTENSION))
+                total += entry.size;
+        return total;
+    }
+
+    const DiskCache::Path& DiskCache::directory() const
+    {
+        return _directory;
+    }
+
+    uint64_t DiskCache::maxBytes() const
+    {
+        return _max_bytes;
+    }
+
+    DiskCache::Path DiskCache::fileName(const ImageKey& key, uint32_t variant) const
+    {
+        char name[96];
+        snprintf(name, sizeof(name), "%016llx-%llx-%u-%u%s",
+            static_cast<unsigned long long>(key.hash), static_cast<unsigned long long>(key.size),
+            static_cast<unsigned int>(key.format), static_cast<unsigned int>(variant), CACHE_EXTENSION);
+        return _directory + SEPARATOR + toPath(name);
+    }
+
+    DiskCache::Path DiskCache::temporaryFileName() const
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%lu-%llu%s", processId(),
+            static_cast<unsigned long long>(++g_temporary_counter), TEMPORARY_EXTENSION);
+        return _directory + SEPARATOR + toPath(name);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,105 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "ImageCache.h"
+
+namespace flifcore
+{
+    /*!
+    * Decoded images in files of a directory, so they survive the process.
+    *
+    * Each image is one file, named after its key. The file starts with a header page, followed by the frames,
+    * each at a page aligned offset in the format it is used in. A hit maps the file, and the frames of the
+    * CachedImage point right into the mapping, nothing is parsed or copied besides the header.
+    *
+    * Files are written under a temporary name and renamed when complete, so no reader ever sees half a file,
+    * also not after a crash. Hits update the modification time. When the directory exceeds its size limit,
+    * the files with the oldest modification time are deleted, one at a time, which is safe at any point.
+    * The directory is only listed when a store takes it over the limit, by a running total of its size.
+    * Several threads and processes may use the same directory.
+    */
+    class DiskCache
+    {
+    public:
+#ifdef _WIN32
+        typedef std::wstring Path;
+#else
+        typedef std::string Path;
+#endif
+
+        static const uint64_t DEFAULT_MAX_BYTES = 1024ULL * 1024 * 1024;
+
+        //! Frames start at multiples of this.
+        static const size_t PAGE_SIZE = 4096;
+
+        /*!
+        * @param directory Created if it does not exist, its parent must exist.
+        */
+        DiskCache(const Path& directory, uint64_t max_bytes = DEFAULT_MAX_BYTES);
+
+        /*!
+        * Configured by the environment: FLIF_DISK_CACHE_DIR, and optionally FLIF_DISK_CACHE_MB.
+        * @return 0 if no directory is set.
+        */
+        static std::shared_ptr<DiskCache> fromEnvironment();
+
+        /*!
+        * @param variant 0 for all frames at full size. Other values stand for other decodes of the file,
+        *                thumbnails use their maximum size.
+        * @return 0 if the image is not cached, or its file is damaged.
+        */
+        std::shared_ptr<const CachedImage> load(const ImageKey& key, uint32_t variant);
+
+        /*!
+        * Writes the image, and trims once the running total of the directory size exceeds the limit.
+        * @return False if the file could not be written, the cache is unchanged then.
+        */
+        bool store(const ImageKey& key, uint32_t variant, const CachedImage& image);
+
+        /*!
+        * Deletes the oldest files until the directory is within the size limit,
+        * and temporary files that were left behind by crashed writers.
+        */
+        void trim();
+
+        //! Size of all complete files.
+        uint64_t bytesOnDisk() const;
+
+        const Path& directory() const;
+        uint64_t maxBytes() const;
+
+        //! Where the image is stored, whether it exists or not.
+        Path fileName(const ImageKey& key, uint32_t variant) const;
+
+    private:
+        DiskCache(const DiskCache& other);
+        DiskCache& operator=(const DiskCache& other);
+
+        Path temporaryFileName() const;
+
+        Path _directory;
+        uint64_t _max_bytes;
+
+        //! Seeded from bytesOnDisk(), grown by store(), set by trim(). Files of other processes count from the next trim().
+        std::atomic<uint64_t> _bytes;
+    };
+}
\ No newline at end of file
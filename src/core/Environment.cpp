@@ -0,0 +1,44 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "Environment.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+
+namespace flifcore
+{
+    bool numberFromEnvironment(const char* name, uint64_t unit, uint64_t& value)
+    {
+        // strtoull() alone skips spaces, accepts a sign and stops at any suffix
+        const char* text = getenv(name);
+        if(text == 0 || text[0] < '0' || text[0] > '9')
+            return false;
+
+        errno = 0;
+        char* end;
+        const unsigned long long number = strtoull(text, &end, 10);
+        if(*end != 0)
+            return false;
+
+        if(errno == ERANGE || (unit != 0 && number > std::numeric_limits<uint64_t>::max() / unit))
+            value = std::numeric_limits<uint64_t>::max();
+        else
+            value = number * unit;
+        return true;
+    }
+}
\ No newline at end of file
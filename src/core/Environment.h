@@ -0,0 +1,28 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+namespace flifcore
+{
+    /*!
+    * A plain decimal number from the environment, times unit. Too large values saturate instead of overflowing.
+    * @return False if the variable is not set or is no plain decimal number, value is left as it is then.
+    */
+    bool numberFromEnvironment(const char* name, uint64_t unit, uint64_t& value);
+}
\ No newline at end of file
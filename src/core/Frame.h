@@ -0,0 +1,94 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "flifWrapper.h"
+#include "PixelFormat.h"
+
+namespace flifcore
+{
+    /*!
+    * Pixels of one frame in memory owned by someone else, rows without padding.
+    */
+    struct FrameView
+    {
+        FrameView()
+            : width(0)
+            , height(0)
+            , delay_ms(0)
+            , format(PF_RGBA32)
+            , pixels(0)
+        {
+        }
+
+        size_t stride() const
+        {
+            return size_t(width) * bytesPerPixel(format);
+        }
+
+        size_t size() const
+        {
+            return stride() * height;
+        }
+
+        uint32_t width;
+        uint32_t height;
+        uint32_t delay_ms;
+        PixelFormat format;
+        const uint8_t* pixels;
+    };
+
+    /*!
+    * One decoded frame, rows without padding.
+    */
+    struct Frame
+    {
+        Frame()
+            : width(0)
+            , height(0)
+            , delay_ms(0)
+            , format(PF_RGBA32)
+        {
+        }
+
+        size_t stride() const
+        {
+            return size_t(width) * bytesPerPixel(format);
+        }
+
+        //! Valid as long as the pixels are not changed.
+        FrameView view() const
+        {
+            FrameView result;
+            result.width = width;
+            result.height = height;
+            result.delay_ms = delay_ms;
+            result.format = format;
+            result.pixels = pixels.data();
+            return result;
+        }
+
+        uint32_t width;
+        uint32_t height;
+        uint32_t delay_ms;
+        PixelFormat format;
+        PixelBuffer pixels;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,163 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "Decode.h"
+
+namespace flifcore
+{
+    /*!
+    * Hands frames from the thread that decodes them to the thread that shows them, e.g. the thread of a window.
+    *
+    * The producer publishes each frame when it is done, and earlier passes of a frame before the frame itself.
+    * notify is called when the first entry after the last take() arrives, so a window gets one message for any number
+    * of entries and takes them all. An entry that was not taken yet is replaced by a later one with the same index,
+    * so a slow consumer skips passes it could not show anyway. finish() ends the production, e.g. with an error.
+    *
+    * The consumer calls close() when it goes away. Afterwards publish() fails, values are not kept,
+    * and notify is not called anymore, so it may refer to the consumer.
+    * notify runs under the lock of the mailbox: it must be quick and must not call into the mailbox, e.g. post a message.
+    * Thread safe.
+    */
+    template<class T>
+    class FrameMailbox
+    {
+    public:
+        typedef std::function<void()> Notify;
+
+        struct Entry
+        {
+            size_t index;
+            bool final;  //!< false for an earlier pass of the frame
+            T value;
+        };
+
+        explicit FrameMailbox(const Notify& notify)
+            : _notify(notify)
+            , _pending(false)
+            , _finished(false)
+            , _status(DS_OK)
+            , _closed(false)
+        {
+        }
+
+        /*!
+        * A pass is dropped if the frame itself was published already and not taken yet.
+        * @return False after close().
+        */
+        bool publish(size_t index, bool final, T value)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(_closed)
+                return false;
+
+            for(Entry& entry : _entries)
+            {
+                if(entry.index == index)
+                {
+                    if(final || !entry.final)
+                    {
+                        entry.final = final;
+                        entry.value = std::move(value);
+                    }
+                    return true;
+                }
+            }
+
+            Entry entry = { index, final, std::move(value) };
+            _entries.push_back(std::move(entry));
+            notifyLocked();
+            return true;
+        }
+
+        //! No more entries come, status tells whether all frames were published.
+        void finish(DecodeStatus status)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(_closed || _finished)
+                return;
+
+            _finished = true;
+            _status = status;
+            notifyLocked();
+        }
+
+        /*!
+        * Appends the entries published since the last call to entries, in the order they were published.
+        * @return True if finish() was called, status is set then. All entries were taken by then.
+        */
+        bool take(std::vector<Entry>& entries, DecodeStatus& status)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for(Entry& entry : _entries)
+                entries.push_back(std::move(entry));
+            _entries.clear();
+            _pending = false;
+
+            if(_finished)
+                status = _status;
+            return _finished;
+        }
+
+        //! Drops the entries that were not taken. notify is not called anymore once this returns.
+        void close()
+        {
+            std::vector<Entry> dropped;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _closed = true;
+                dropped.swap(_entries);
+            }
+        }
+
+        //! For the producer, to stop early.
+        bool isClosed() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _closed;
+        }
+
+    private:
+        FrameMailbox(const FrameMailbox& other);
+        FrameMailbox& operator=(const FrameMailbox& other);
+
+        void notifyLocked()
+        {
+            if(_pending)
+                return;
+
+            _pending = true;
+            if(_notify)
+                _notify();
+        }
+
+        const Notify _notify;
+        mutable std::mutex _mutex;
+        std::vector<Entry> _entries;
+        bool _pending; //!< notified, but not taken yet
+        bool _finished;
+        DecodeStatus _status;
+        bool _closed;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,286 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "HeaderScanner.h"
+
+#include <algorithm>
+#include <limits>
+
+/*
+Layout of the part that is scanned, see the FLIF specification:
+
+"FLIF"                magic
+1 byte                16 * format + number of channels,
+                      format 3 = still, 4 = still interlaced, 5 = animated, 6 = animated interlaced
+1 byte                '1' = 8 bit, '2' = 16 bit, '0' = custom (given in the second header)
+varint                width - 1
+varint                height - 1
+varint                number of frames - 2, only if animated
+chunks                4 byte name, varint length, content
+1 byte                0, end of the chunks
+
+Varints are big endian with 7 bits per byte, the highest bit is set on all but the last byte.
+*/
+
+namespace flifcore
+{
+    // 9 * 7 bits still fit into 64 bits
+    static const unsigned int MAX_VARINT_BYTES = 9;
+
+    HeaderScanner::HeaderScanner()
+    {
+        reset();
+    }
+
+    void HeaderScanner::reset()
+    {
+        _state = ST_MAGIC;
+        _info = ImageInfo();
+        _animated = false;
+        _chunks.clear();
+        _position = 0;
+        _field.clear();
+        _varint = 0;
+        _varint_bytes = 0;
+        _chunk_remaining = 0;
+    }
+
+    HeaderScanner::Result HeaderScanner::feed(const uint8_t* data, size_t size, size_t& consumed)
+    {
+        consumed = 0;
+
+        while(consumed < size && _state != ST_DONE && _state != ST_INVALID)
+        {
+            // chunk content is skipped in one go
+            if(_state == ST_CHUNK_DATA)
+            {
+                const size_t skip = static_cast<size_t>(std::min<uint64_t>(_chunk_remaining, size - consumed));
+                consumed += skip;
+                _position += skip;
+                _chunk_remaining -= skip;
+                if(_chunk_remaining == 0)
+                    _state = ST_CHUNK_NAME;
+                continue;
+            }
+
+            const uint8_t byte = data[consumed];
+            consumed++;
+            _position++;
+
+            uint64_t value;
+            switch(_state)
+            {
+            case ST_MAGIC:
+                _field.push_back(static_cast<char>(byte));
+                if(_field.size() == 4)
+                {
+                    _state = _field == "FLIF" ? ST_FORMAT : ST_INVALID;
+                    _field.clear();
+                }
+                break;
+
+            case ST_FORMAT:
+            {
+                const int format = byte >> 4;
+                _info.channels = byte & 0x0f;
+                if(format < 3 || format > 6 || _info.channels == 0 || _info.channels > 4)
+                {
+                    _state = ST_INVALID;
+                    break;
+                }
+
+                _info.interlaced = format == 4 || format == 6;
+                _animated = format >= 5;
+                _state = ST_DEPTH;
+                break;
+            }
+
+            case ST_DEPTH:
+                if(byte == '1')
+                    _info.depth = 8;
+                else if(byte == '2' || byte == '0')
+                    _info.depth = 16; // custom depths use at most 16 bits
+                else
+                {
+                    _state = ST_INVALID;
+                    break;
+                }
+                _state = ST_WIDTH;
+                break;
+
+            case ST_WIDTH:
+                if(feedVarint(byte, value))
+                {
+                    if(value >= std::numeric_limits<uint32_t>::max())
+                    {
+                        _state = ST_INVALID;
+                        break;
+                    }
+                    _info.width = static_cast<uint32_t>(value + 1);
+                    _state = ST_HEIGHT;
+                }
+                break;
+
+            case ST_HEIGHT:
+                if(feedVarint(byte, value))
+                {
+                    if(value >= std::numeric_limits<uint32_t>::max())
+                    {
+                        _state = ST_INVALID;
+                        break;
+                    }
+                    _info.height = static_cast<uint32_t>(value + 1);
+                    _info.frame_count = 1;
+                    _state = _animated ? ST_FRAMES : ST_CHUNK_NAME;
+                }
+                break;
+
+            case ST_FRAMES:
+                if(feedVarint(byte, value))
+                {
+                    if(value > std::numeric_limits<size_t>::max() - 2)
+                    {
+                        _state = ST_INVALID;
+                        break;
+                    }
+                    _info.frame_count = static_cast<size_t>(value + 2);
+                    _state = ST_CHUNK_NAME;
+                }
+                break;
+
+            case ST_CHUNK_NAME:
+                // a name never starts with a control character, this is the end marker
+                if(_field.empty() && byte < 32)
+                {
+                    _state = ST_DONE;
+                    break;
+                }
+
+                _field.push_back(static_cast<char>(byte));
+                if(_field.size() == 4)
+                {
+                    MetadataChunk chunk;
+                    chunk.name = _field;
+                    chunk.offset = 0;
+                    chunk.size = 0;
+                    _chunks.push_back(chunk);
+
+                    _field.clear();
+                    _state = ST_CHUNK_SIZE;
+                }
+                break;
+
+            case ST_CHUNK_SIZE:
+                if(feedVarint(byte, value))
+                {
+                    _chunks.back().offset = _position;
+                    _chunks.back().size = value;
+                    _chunk_remaining = value;
+                    _state = value != 0 ? ST_CHUNK_DATA : ST_CHUNK_NAME;
+                }
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        return result();
+    }
+
+    bool HeaderScanner::feedVarint(uint8_t byte, uint64_t& value)
+    {
+        _varint = (_varint << 7) | (byte & 0x7f);
+        _varint_bytes++;
+
+        if(byte & 0x80)
+        {
+            if(_varint_bytes >= MAX_VARINT_BYTES)
+                _state = ST_INVALID;
+            return false;
+        }
+
+        value = _varint;
+        _varint = 0;
+        _varint_bytes = 0;
+        return true;
+    }
+
+    HeaderScanner::Result HeaderScanner::result() const
+    {
+        if(_state == ST_DONE)
+            return SR_DONE;
+        if(_state == ST_INVALID)
+            return SR_INVALID;
+        return SR_NEED_MORE;
+    }
+
+    bool HeaderScanner::hasImageInfo() const
+    {
+        return _state >= ST_CHUNK_NAME && _state != ST_INVALID;
+    }
+
+    const ImageInfo& HeaderScanner::imageInfo() const
+    {
+        return _info;
+    }
+
+    const std::vector<MetadataChunk>& HeaderScanner::metadataChunks() const
+    {
+        return _chunks;
+    }
+
+    bool HeaderScanner::hasMetadataChunk(const std::string& name) const
+    {
+        for(const auto& chunk : _chunks)
+            if(chunk.name == name)
+                return true;
+        return false;
+    }
+
+    uint64_t HeaderScanner::bytesScanned() const
+    {
+        return _position;
+    }
+
+    uint64_t HeaderScanner::minimumBytesWanted() const
+    {
+        // the current field plus the shortest possible rest: one byte per varint and the end marker
+        switch(_state)
+        {
+        case ST_MAGIC:
+            return (4 - _field.size()) + 5;
+        case ST_FORMAT:
+            return 5;
+        case ST_DEPTH:
+            return 4;
+        case ST_WIDTH:
+            return 3;
+        case ST_HEIGHT:
+            return _animated ? 3 : 2;
+        case ST_FRAMES:
+            return 2;
+        case ST_CHUNK_NAME:
+            return _field.empty() ? 1 : (4 - _field.size()) + 2;
+        case ST_CHUNK_SIZE:
+            return 2;
+        case ST_CHUNK_DATA:
+            return _chunk_remaining + 1;
+        default:
+            return 0;
+        }
+    }
+}
\ No newline at end of file
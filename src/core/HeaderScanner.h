@@ -0,0 +1,138 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace flifcore
+{
+    /*!
+    * Everything the FLIF main header tells about an image.
+    */
+    struct ImageInfo
+    {
+        ImageInfo()
+            : width(0)
+            , height(0)
+            , channels(0)
+            , depth(0)
+            , frame_count(0)
+            , interlaced(false)
+        {
+        }
+
+        //! Size of all frames decoded as 8 bit RGBA.
+        uint64_t rgba8Bytes() const
+        {
+            return uint64_t(width) * height * 4 * frame_count;
+        }
+
+        uint32_t width;
+        uint32_t height;
+        uint8_t channels;
+        uint8_t depth; //!< bits per channel
+        size_t frame_count;
+        bool interlaced;
+    };
+
+    /*!
+    * Position of a metadata chunk (iCCP, eXif, eXmp, ...) in the file.
+    * The content is stored as libflif wrote it, i.e. deflate compressed.
+    */
+    struct MetadataChunk
+    {
+        std::string name;
+        uint64_t offset; //!< from the start of the file
+        uint64_t size;
+    };
+
+    /*!
+    * Walks the FLIF main header and the metadata chunks without decoding anything.
+    *
+    * Bytes can be fed in pieces of any size, the scanner keeps its position in between.
+    * It stops at the end of the metadata, right before the second header and the pixel data.
+    */
+    class HeaderScanner
+    {
+    public:
+        enum Result
+        {
+            SR_NEED_MORE,
+            SR_DONE,
+            SR_INVALID
+        };
+
+        HeaderScanner();
+
+        void reset();
+
+        /*!
+        * @param consumed Number of bytes taken from data. Less than size if the scan is done or failed.
+        */
+        Result feed(const uint8_t* data, size_t size, size_t& consumed);
+
+        Result result() const;
+
+        //! True as soon as the main header is complete, the metadata may still be missing.
+        bool hasImageInfo() const;
+        const ImageInfo& imageInfo() const;
+
+        //! The chunks scanned so far, complete once the result is SR_DONE.
+        const std::vector<MetadataChunk>& metadataChunks() const;
+        bool hasMetadataChunk(const std::string& name) const;
+
+        //! Bytes consumed so far. Once done, this is the size of main header plus metadata.
+        uint64_t bytesScanned() const;
+
+        //! The least number of additional bytes that can finish the scan.
+        uint64_t minimumBytesWanted() const;
+
+    private:
+        enum State
+        {
+            ST_MAGIC,
+            ST_FORMAT,
+            ST_DEPTH,
+            ST_WIDTH,
+            ST_HEIGHT,
+            ST_FRAMES,
+            ST_CHUNK_NAME,
+            ST_CHUNK_SIZE,
+            ST_CHUNK_DATA,
+            ST_DONE,
+            ST_INVALID
+        };
+
+        //! @return True if the varint is complete.
+        bool feedVarint(uint8_t byte, uint64_t& value);
+
+        State _state;
+        ImageInfo _info;
+        bool _animated;
+        std::vector<MetadataChunk> _chunks;
+        uint64_t _position;
+
+        // partially read field
+        std::string _field;
+        uint64_t _varint;
+        unsigned int _varint_bytes;
+        uint64_t _chunk_remaining;
+    };
+}
\ No newline at end of file
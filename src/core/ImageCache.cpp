@@ -0,0 +1,373 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ImageCache.h"
+
+#include <chrono>
+#include <limits>
+
+#include "ContentHash.h"
+#include "DiskCache.h"
+
+namespace flifcore
+{
+    uint64_t CachedImage::bytes() const
+    {
+        uint64_t sum = 0;
+        for(const auto& frame : frames)
+            sum += frame.size();
+        return sum;
+    }
+
+    DecodeStatus decodeAllFrames(const std::shared_ptr<const InputBuffer>& input, PixelFormat format, std::shared_ptr<const CachedImage>& image,
+        CancelToken* cancel, const DecodeLimits* limits, const Decoder::ProgressCallback& progress)
+    {
+        Decoder decoder;
+        decoder.setCancelToken(cancel);
+        decoder.setProgressCallback(progress);
+        if(limits != 0)
+            decoder.setLimits(*limits);
+        DecodeStatus status = decoder.decode(input);
+        if(status != DS_OK)
+            return status;
+
+        std::shared_ptr<std::vector<Frame>> buffers = std::make_shared<std::vector<Frame>>(decoder.frameCount());
+        for(size_t i = 0; i < buffers->size(); ++i)
+        {
+            status = decoder.extractFrame(i, (*buffers)[i], format);
+            if(status != DS_OK)
+                return status;
+        }
+
+        std::shared_ptr<CachedImage> decoded = std::make_shared<CachedImage>();
+        decoded->info = decoder.info();
+        decoded->num_loops = decoder.numLoops();
+        for(const Frame& frame : *buffers)
+            decoded->frames.push_back(frame.view());
+        decoded->storage = buffers;
+
+        image = decoded;
+        return DS_OK;
+    }
+
+    ImageCache::ImageCache(uint64_t budget_bytes)
+        : _budget_bytes(budget_bytes)
+        , _bytes(0)
+        , _clock(0)
+        , _next_id(0)
+        , _hits(0)
+        , _misses(0)
+        , _evictions(0)
+        , _disk_hits(0)
+    {
+    }
+
+    ImageCache& ImageCache::shared()
+    {
+        static ImageCache cache;
+        static std::once_flag disk_cache_set;
+        std::call_once(disk_cache_set, []()
+        {
+            cache.setDiskCache(DiskCache::fromEnvironment());
+        });
+        return cache;
+    }
+
+    ImageKey ImageCache::key(const InputBuffer& input, PixelFormat format)
+    {
+        ImageKey key;
+        key.hash = contentHash(input.data(), input.size());
+        key.size = input.size();
+        key.format = format;
+        return key;
+    }
+
+    uint64_t ImageCache::decodedBytes(const ImageInfo& info, PixelFormat format)
+    {
+        return uint64_t(info.width) * info.height * bytesPerPixel(format) * info.frame_count;
+    }
+
+    std::shared_ptr<const CachedImage> ImageCache::find(const ImageKey& key)
+    {
+        Shard& shard = shardFor(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto found = shard.entries.find(key);
+        if(found == shard.entries.end() || !found->second.complete)
+            return std::shared_ptr<const CachedImage>();
+
+        _hits.fetch_add(1, std::memory_order_relaxed);
+        touch(shard, found->second);
+        return found->second.result.get().image;
+    }
+
+    DecodeStatus ImageCache::decode(const std::shared_ptr<const InputBuffer>& input, const ImageKey& key, std::shared_ptr<const CachedImage>& image,
+        CancelToken* cancel, const Decoder::ProgressCallback& progress)
+    {
+        // how often a waiting thread looks at its token
+        const std::chrono::milliseconds CANCEL_POLL_INTERVAL(10);
+
+        Shard& shard = shardFor(key);
+
+        std::promise<Result> promise;
+        std::shared_future<Result> result;
+        uint64_t id = 0;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            auto found = shard.entries.find(key);
+            if(found != shard.entries.end())
+            {
+                _hits.fetch_add(1, std::memory_order_relaxed);
+                if(found->second.complete)
+                    touch(shard, found->second);
+                result = found->second.result;
+            }
+            else
+            {
+                // announce the decode, so other threads wait instead of decoding the same file
+                _misses.fetch_add(1, std::memory_order_relaxed);
+                id = ++_next_id;
+
+                Entry entry;
+                entry.id = id;
+                entry.result = promise.get_future().share();
+                entry.complete = false;
+                entry.bytes = 0;
+                entry.last_use = 0;
+                shard.entries.insert(std::make_pair(key, entry));
+            }
+        }
+
+        if(id == 0)
+        {
+            if(cancel != 0)
+            {
+                while(result.wait_for(CANCEL_POLL_INTERVAL) != std::future_status::ready)
+                {
+                    if(cancel->isCancelled())
+                        return DS_CANCELLED;
+                }
+            }
+
+            const Result& waited = result.get();
+
+            // the entry is gone already, the next round decodes again
+            if(waited.status == DS_CANCELLED && (cancel == 0 || !cancel->isCancelled()))
+                return decode(input, key, image, cancel, progress);
+
+            image = waited.image;
+            return waited.status;
+        }
+
+        Result decoded;
+        try
+        {
+            const std::shared_ptr<DiskCache> disk_cache = diskCache();
+            if(disk_cache)
+                decoded.image = disk_cache->load(key, 0);
+
+            if(decoded.image)
+            {
+                _disk_hits.fetch_add(1, std::memory_order_relaxed);
+                decoded.status = DS_OK;
+            }
+            else
+            {
+                decoded.status = decodeAllFrames(input, key.format, decoded.image, cancel, 0, progress);
+                if(decoded.status == DS_OK && disk_cache)
+                    disk_cache->store(key, 0, *decoded.image);
+            }
+        }
+        catch(...)
+        {
+            // out of memory, most likely: the waiting threads get the same exception, the next call tries again
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                auto found = shard.entries.find(key);
+                if(found != shard.entries.end() && found->second.id == id)
+                    erase(shard, found);
+            }
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+
+        // before the waiting threads see the result, so their next round does not find the entry
+        if(decoded.status == DS_CANCELLED)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto found = shard.entries.find(key);
+            if(found != shard.entries.end() && found->second.id == id)
+                erase(shard, found);
+        }
+        promise.set_value(decoded);
+
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            // clear() may have dropped the entry in between, and another thread may have started a new one
+            auto found = shard.entries.find(key);
+            if(found != shard.entries.end() && found->second.id == id)
+            {
+                const uint64_t bytes = decoded.image ? decoded.image->bytes() : 0;
+                if(decoded.status != DS_OK || !fits(bytes))
+                {
+                    erase(shard, found);
+                }
+                else
+                {
+                    found->second.complete = true;
+                    found->second.bytes = bytes;
+                    shard.lru.push_front(key);
+                    found->second.lru = shard.lru.begin();
+                    found->second.last_use = ++_clock;
+                    _bytes.fetch_add(bytes);
+                }
+            }
+        }
+
+        trim();
+
+        image = decoded.image;
+        return decoded.status;
+    }
+
+    DecodeStatus ImageCache::decode(const std::shared_ptr<const InputBuffer>& input, std::shared_ptr<const CachedImage>& image, CancelToken* cancel,
+        const Decoder::ProgressCallback& progress)
+    {
+        ImageInfo info;
+        DecodeStatus status = probeInfo(input->data(), input->size(), info);
+        if(status != DS_OK)
+            return status;
+
+        return decode(input, key(*input, choosePixelFormat(info)), image, cancel, progress);
+    }
+
+    bool ImageCache::fits(uint64_t bytes) const
+    {
+        return bytes <= _budget_bytes.load();
+    }
+
+    void ImageCache::setBudget(uint64_t budget_bytes)
+    {
+        _budget_bytes = budget_bytes;
+        trim();
+    }
+
+    uint64_t ImageCache::budget() const
+    {
+        return _budget_bytes;
+    }
+
+    void ImageCache::clear()
+    {
+        for(Shard& shard : _shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            while(!shard.entries.empty())
+                erase(shard, shard.entries.begin());
+        }
+    }
+
+    void ImageCache::setDiskCache(const std::shared_ptr<DiskCache>& disk_cache)
+    {
+        std::lock_guard<std::mutex> lock(_disk_mutex);
+        _disk_cache = disk_cache;
+    }
+
+    std::shared_ptr<DiskCache> ImageCache::diskCache() const
+    {
+        std::lock_guard<std::mutex> lock(_disk_mutex);
+        return _disk_cache;
+    }
+
+    ImageCache::Stats ImageCache::stats() const
+    {
+        Stats stats;
+        stats.hits = _hits;
+        stats.misses = _misses;
+        stats.disk_hits = _disk_hits;
+        stats.evictions = _evictions;
+        stats.bytes = _bytes;
+        stats.images = 0;
+        for(const Shard& shard : _shards)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            stats.images += shard.lru.size();
+        }
+        return stats;
+    }
+
+    ImageCache::Shard& ImageCache::shardFor(const ImageKey& key)
+    {
+        // the low bits pick the bucket within the shard
+        return _shards[(key.hash >> 32) % SHARD_COUNT];
+    }
+
+    void ImageCache::touch(Shard& shard, Entry& entry)
+    {
+        entry.last_use = ++_clock;
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry.lru);
+    }
+
+    void ImageCache::erase(Shard& shard, std::unordered_map<ImageKey, Entry, KeyHash>::iterator entry)
+    {
+        if(entry->second.complete)
+        {
+            shard.lru.erase(entry->second.lru);
+            _bytes.fetch_sub(entry->second.bytes);
+        }
+        shard.entries.erase(entry);
+    }
+
+    void ImageCache::trim()
+    {
+        while(_bytes.load() > _budget_bytes.load())
+        {
+            // the oldest entry of each shard is at the end of its list, evict the oldest of those
+            Shard* oldest_shard = 0;
+            uint64_t oldest_use = std::numeric_limits<uint64_t>::max();
+            for(Shard& shard : _shards)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                if(shard.lru.empty())
+                    continue;
+
+                const uint64_t last_use = shard.entries.find(shard.lru.back())->second.last_use;
+                if(last_use < oldest_use)
+                {
+                    oldest_use = last_use;
+                    oldest_shard = &shard;
+                }
+            }
+
+            if(oldest_shard == 0)
+                return;
+
+            // only one lock at a time, the entry may have been used meanwhile, then the next round finds another
+            std::lock_guard<std::mutex> lock(oldest_shard->mutex);
+            if(oldest_shard->lru.empty())
+                continue;
+
+            auto entry = oldest_shard->entries.find(oldest_shard->lru.back());
+            if(entry->second.last_use != oldest_use)
+                continue;
+
+            erase(*oldest_shard, entry);
+            _evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,212 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "Decode.h"
+
+namespace flifcore
+{
+    class DiskCache;
+
+    /*!
+    * Identifies a decoded image: the compressed bytes and the format of the frames.
+    */
+    struct ImageKey
+    {
+        ImageKey()
+            : hash(0)
+            , size(0)
+            , format(PF_RGBA32)
+        {
+        }
+
+        bool operator==(const ImageKey& other) const
+        {
+            return hash == other.hash && size == other.size && format == other.format;
+        }
+
+        uint64_t hash; //!< contentHash() of the whole file
+        uint64_t size; //!< of the whole file
+        PixelFormat format;
+    };
+
+    /*!
+    * All frames of a file, decoded once and never changed afterwards, so any number of threads can read them.
+    */
+    struct CachedImage
+    {
+        CachedImage()
+            : num_loops(0)
+        {
+        }
+
+        //! Memory held by the pixels.
+        uint64_t bytes() const;
+
+        ImageInfo info;
+        int32_t num_loops;
+        std::vector<FrameView> frames; //!< may be fewer than the header promised
+        std::shared_ptr<const void> storage; //!< keeps the pixels alive: decoded buffers or a mapped cache file
+    };
+
+    /*!
+    * Decodes all frames into an own buffer each, without the cache. libflif is released afterwards.
+    * @param limits 0 for DecodeLimits::defaults(). With a downscale, the frames are smaller than the header says.
+    * @param progress See Decoder::setProgressCallback().
+    */
+    DecodeStatus decodeAllFrames(const std::shared_ptr<const InputBuffer>& input, PixelFormat format, std::shared_ptr<const CachedImage>& image,
+        CancelToken* cancel = 0, const DecodeLimits* limits = 0, const Decoder::ProgressCallback& progress = Decoder::ProgressCallback());
+
+    /*!
+    * Decoded images shared by all objects that open the same file, within a byte budget.
+    *
+    * The least recently used images are dropped first. Images that are in use stay alive through their
+    * shared_ptr even after they were dropped. Entries are spread over shards by their hash, each with an own lock,
+    * so threads working on different files rarely wait for each other.
+    * When several threads ask for an image that is not cached yet, one decodes it and the others wait for the result.
+    * With a DiskCache attached, that thread looks there before decoding, and stores what it decoded.
+    * A cancelled decode is not kept, threads that waited for it without being cancelled themselves start over.
+    * Thread safe.
+    */
+    class ImageCache
+    {
+    public:
+        static const uint64_t DEFAULT_BUDGET_BYTES = 256 * 1024 * 1024;
+        static const size_t SHARD_COUNT = 16;
+
+        explicit ImageCache(uint64_t budget_bytes = DEFAULT_BUDGET_BYTES);
+
+        //! The cache of this process, with the disk cache of DiskCache::fromEnvironment().
+        static ImageCache& shared();
+
+        //! Hashes the whole input.
+        static ImageKey key(const InputBuffer& input, PixelFormat format);
+
+        //! Size of all frames of an image with this header.
+        static uint64_t decodedBytes(const ImageInfo& info, PixelFormat format);
+
+        /*!
+        * Only looks into memory.
+        * @return The image if it is cached and completely decoded, 0 otherwise.
+        */
+        std::shared_ptr<const CachedImage> find(const ImageKey& key);
+
+        /*!
+        * Returns the cached image, or decodes all frames of the input and keeps them if they fit into the budget.
+        * @param key From key() for this input.
+        * @param cancel Stops the decode, or the wait for the decode of another thread, with DS_CANCELLED. May be 0.
+        * @param progress Only called if this thread decodes, not for cached images or while waiting for another thread.
+        */
+        DecodeStatus decode(const std::shared_ptr<const InputBuffer>& input, const ImageKey& key, std::shared_ptr<const CachedImage>& image,
+            CancelToken* cancel = 0, const Decoder::ProgressCallback& progress = Decoder::ProgressCallback());
+
+        /*!
+        * The same in the format choosePixelFormat() picks for the image.
+        */
+        DecodeStatus decode(const std::shared_ptr<const InputBuffer>& input, std::shared_ptr<const CachedImage>& image, CancelToken* cancel = 0,
+            const Decoder::ProgressCallback& progress = Decoder::ProgressCallback());
+
+        //! Larger images are decoded but not kept.
+        bool fits(uint64_t bytes) const;
+
+        //! Drops images until the new budget is met.
+        void setBudget(uint64_t budget_bytes);
+        uint64_t budget() const;
+
+        //! Drops all images. Decodes that are running are not kept either.
+        void clear();
+
+        //! @param disk_cache 0 to use none.
+        void setDiskCache(const std::shared_ptr<DiskCache>& disk_cache);
+        std::shared_ptr<DiskCache> diskCache() const;
+
+        struct Stats
+        {
+            uint64_t hits;      //!< including waits for a decode of another thread
+            uint64_t misses;
+            uint64_t disk_hits; //!< misses that were loaded from the disk cache instead of decoded
+            uint64_t evictions;
+            uint64_t bytes;
+            size_t images;
+        };
+
+        Stats stats() const;
+
+    private:
+        ImageCache(const ImageCache& other);
+        ImageCache& operator=(const ImageCache& other);
+
+        struct Result
+        {
+            DecodeStatus status;
+            std::shared_ptr<const CachedImage> image;
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const ImageKey& key) const
+            {
+                return static_cast<size_t>(key.hash ^ (uint64_t(key.format) << 56));
+            }
+        };
+
+        struct Entry
+        {
+            uint64_t id;
+            std::shared_future<Result> result;
+            bool complete;
+            uint64_t bytes;
+            uint64_t last_use;
+            std::list<ImageKey>::iterator lru; //!< only valid once complete
+        };
+
+        struct Shard
+        {
+            mutable std::mutex mutex;
+            std::unordered_map<ImageKey, Entry, KeyHash> entries;
+            std::list<ImageKey> lru; //!< complete entries, most recently used first
+        };
+
+        Shard& shardFor(const ImageKey& key);
+        void touch(Shard& shard, Entry& entry);
+        void erase(Shard& shard, std::unordered_map<ImageKey, Entry, KeyHash>::iterator entry);
+
+        //! Evicts the least recently used images of all shards until the budget is met.
+        void trim();
+
+        Shard _shards[SHARD_COUNT];
+        std::atomic<uint64_t> _budget_bytes;
+        std::atomic<uint64_t> _bytes;
+        std::atomic<uint64_t> _clock;
+        std::atomic<uint64_t> _next_id;
+        std::atomic<uint64_t> _hits;
+        std::atomic<uint64_t> _misses;
+        std::atomic<uint64_t> _evictions;
+        std::atomic<uint64_t> _disk_hits;
+
+        mutable std::mutex _disk_mutex;
+        std::shared_ptr<DiskCache> _disk_cache;
+    };
+}
\ No newline at end of file
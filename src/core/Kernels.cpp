@@ -0,0 +1,199 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "KernelsInternal.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FLIFCORE_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace flifcore
+{
+    //=========================================================================
+    // scalar reference
+
+    /*!
+    * Exact round(x / 255) for x <= 255 * 255, without a division.
+    */
+    static inline uint8_t divideBy255(uint32_t x)
+    {
+        x += 128;
+        return static_cast<uint8_t>((x + (x >> 8)) >> 8);
+    }
+
+    void scalarRgbaToPbgra(const uint8_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        for(size_t i = 0; i < pixel_count; ++i)
+        {
+            const uint8_t r = source[0];
+            const uint8_t g = source[1];
+            const uint8_t b = source[2];
+            const uint8_t a = source[3];
+
+            destination[0] = divideBy255(uint32_t(b) * a);
+            destination[1] = divideBy255(uint32_t(g) * a);
+            destination[2] = divideBy255(uint32_t(r) * a);
+            destination[3] = a;
+
+            source += 4;
+            destination += 4;
+        }
+    }
+
+    void scalarRgba16ToRgba8(const uint16_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        // round(v / 257) is (v + 128) / 257, since 257 is odd there are no ties
+        for(size_t i = 0; i < pixel_count * 4; ++i)
+            destination[i] = static_cast<uint8_t>((uint32_t(source[i]) + 128) / 257);
+    }
+
+    static const Kernels SCALAR_KERNELS = {
+        KI_SCALAR,
+        "scalar",
+        scalarRgbaToPbgra,
+        scalarRgba16ToRgba8
+    };
+
+    //=========================================================================
+    // CPU detection
+
+#ifdef FLIFCORE_X86
+    static void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int registers[4])
+    {
+#ifdef _MSC_VER
+        int values[4];
+        __cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+        for(int i = 0; i < 4; ++i)
+            registers[i] = static_cast<unsigned int>(values[i]);
+#else
+        registers[0] = registers[1] = registers[2] = registers[3] = 0;
+        __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+    }
+
+    static uint64_t xgetbv0()
+    {
+#ifdef _MSC_VER
+        return _xgetbv(0);
+#else
+        unsigned int eax;
+        unsigned int edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (uint64_t(edx) << 32) | eax;
+#endif
+    }
+
+    static bool cpuHasSSE2()
+    {
+        unsigned int registers[4];
+        cpuid(1, 0, registers);
+        return (registers[3] & (1u << 26)) != 0;
+    }
+
+    static bool cpuHasAVX2()
+    {
+        unsigned int registers[4];
+        cpuid(0, 0, registers);
+        if(registers[0] < 7)
+            return false;
+
+        // the OS must save the YMM registers on context switches
+        cpuid(1, 0, registers);
+        const bool osxsave = (registers[2] & (1u << 27)) != 0;
+        const bool avx = (registers[2] & (1u << 28)) != 0;
+        if(!osxsave || !avx || (xgetbv0() & 0x6) != 0x6)
+            return false;
+
+        cpuid(7, 0, registers);
+        return (registers[1] & (1u << 5)) != 0;
+    }
+#endif
+
+    static bool isSupported(KernelIsa isa)
+    {
+        switch(isa)
+        {
+        case KI_SCALAR:
+            return true;
+#ifdef FLIFCORE_X86
+        case KI_SSE2:
+            return cpuHasSSE2();
+        case KI_AVX2:
+            return cpuHasAVX2();
+#else
+        case KI_SSE2:
+        case KI_AVX2:
+            return false;
+#endif
+        case KI_NEON:
+            // only built where NEON is part of the target
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    const Kernels* kernelsFor(KernelIsa isa)
+    {
+        const Kernels* result = 0;
+        switch(isa)
+        {
+        case KI_SCALAR:
+            result = &SCALAR_KERNELS;
+            break;
+        case KI_SSE2:
+            result = sse2Kernels();
+            break;
+        case KI_AVX2:
+            result = avx2Kernels();
+            break;
+        case KI_NEON:
+            result = neonKernels();
+            break;
+        default:
+            break;
+        }
+
+        if(result == 0 || !isSupported(isa))
+            return 0;
+
+        return result;
+    }
+
+    static const Kernels& detectKernels()
+    {
+        const KernelIsa preferred[] = { KI_AVX2, KI_SSE2, KI_NEON };
+        for(KernelIsa isa : preferred)
+        {
+            const Kernels* result = kernelsFor(isa);
+            if(result != 0)
+                return *result;
+        }
+        return SCALAR_KERNELS;
+    }
+
+    const Kernels& kernels()
+    {
+        static const Kernels& selected = detectKernels();
+        return selected;
+    }
+}
\ No newline at end of file
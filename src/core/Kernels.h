@@ -0,0 +1,58 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace flifcore
+{
+    enum KernelIsa
+    {
+        KI_SCALAR,
+        KI_SSE2,
+        KI_AVX2,
+        KI_NEON,
+        KI_COUNT
+    };
+
+    /*!
+    * Pixel conversion routines for one instruction set.
+    * All of them accept source == destination, other overlaps are not allowed.
+    */
+    struct Kernels
+    {
+        KernelIsa isa;
+        const char* name;
+
+        //! Swaps red and blue and premultiplies, each color is round(c * a / 255).
+        void (*rgba_to_pbgra)(const uint8_t* source, uint8_t* destination, size_t pixel_count);
+
+        //! Each channel is round(v * 255 / 65535).
+        void (*rgba16_to_rgba8)(const uint16_t* source, uint8_t* destination, size_t pixel_count);
+    };
+
+    /*!
+    * The fastest kernels for this CPU, detected on first use.
+    */
+    const Kernels& kernels();
+
+    /*!
+    * @return 0 if the kernels are not built in or the CPU does not support them.
+    */
+    const Kernels* kernelsFor(KernelIsa isa);
+}
\ No newline at end of file
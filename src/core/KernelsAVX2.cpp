@@ -0,0 +1,107 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "KernelsInternal.h"
+
+// built with AVX2 code generation, the CPU check happens in kernelsFor
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace flifcore
+{
+    /*!
+    * Four pixels as 16 bit lanes, same steps as the SSE2 version.
+    */
+    static inline __m256i premultiplySwizzle(__m256i v)
+    {
+        const __m256i mask_rgb = _mm256_set_epi16(0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1);
+        const __m256i alpha_255 = _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+
+        __m256i alpha = _mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+        alpha = _mm256_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+        alpha = _mm256_or_si256(_mm256_and_si256(alpha, mask_rgb), alpha_255);
+
+        __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(v, alpha), _mm256_set1_epi16(128));
+        x = _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+
+        x = _mm256_shufflelo_epi16(x, _MM_SHUFFLE(3, 0, 1, 2));
+        return _mm256_shufflehi_epi16(x, _MM_SHUFFLE(3, 0, 1, 2));
+    }
+
+    static void avx2RgbaToPbgra(const uint8_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+
+        size_t i = 0;
+        for(; i + 8 <= pixel_count; i += 8)
+        {
+            // unpack and pack both work within 128 bit lanes, so the pixel order survives
+            const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i * 4));
+            const __m256i lo = premultiplySwizzle(_mm256_unpacklo_epi8(x, zero));
+            const __m256i hi = premultiplySwizzle(_mm256_unpackhi_epi8(x, zero));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 4), _mm256_packus_epi16(lo, hi));
+        }
+
+        scalarRgbaToPbgra(source + i * 4, destination + i * 4, pixel_count - i);
+    }
+
+    static inline __m256i narrow16To8(__m256i v)
+    {
+        const __m256i t = _mm256_adds_epu16(v, _mm256_set1_epi16(128));
+        return _mm256_srli_epi16(_mm256_sub_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    }
+
+    static void avx2Rgba16ToRgba8(const uint16_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        size_t i = 0;
+        for(; i + 8 <= pixel_count; i += 8)
+        {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i * 4));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i * 4 + 16));
+
+            // packing interleaves the 128 bit lanes of a and b, put them back in order
+            const __m256i packed = _mm256_packus_epi16(narrow16To8(a), narrow16To8(b));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 4), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+
+        scalarRgba16ToRgba8(source + i * 4, destination + i * 4, pixel_count - i);
+    }
+
+    static const Kernels AVX2_KERNELS = {
+        KI_AVX2,
+        "AVX2",
+        avx2RgbaToPbgra,
+        avx2Rgba16ToRgba8
+    };
+
+    const Kernels* avx2Kernels()
+    {
+        return &AVX2_KERNELS;
+    }
+}
+
+#else
+
+namespace flifcore
+{
+    const Kernels* avx2Kernels()
+    {
+        return 0;
+    }
+}
+
+#endif
\ No newline at end of file
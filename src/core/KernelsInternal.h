@@ -0,0 +1,34 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+// Shared by the kernel translation units only.
+// The SIMD units are built with extra instruction set flags, so they must not include anything
+// that could emit inline functions the linker might pick for other units.
+
+#include "Kernels.h"
+
+namespace flifcore
+{
+    void scalarRgbaToPbgra(const uint8_t* source, uint8_t* destination, size_t pixel_count);
+    void scalarRgba16ToRgba8(const uint16_t* source, uint8_t* destination, size_t pixel_count);
+
+    //! 0 if not compiled for this target.
+    const Kernels* sse2Kernels();
+    const Kernels* avx2Kernels();
+    const Kernels* neonKernels();
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "KernelsInternal.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+
+#include <arm_neon.h>
+
+namespace flifcore
+{
+    /*!
+    * Exact round(c * a / 255): (x + round(x / 256) + 128) >> 8, the usual NEON idiom.
+    */
+    static inline uint8x16_t premultiply(uint8x16_t c, uint8x16_t a)
+    {
+        const uint16x8_t lo = vmull_u8(vget_low_u8(c), vget_low_u8(a));
+        const uint16x8_t hi = vmull_u8(vget_high_u8(c), vget_high_u8(a));
+        return vcombine_u8(
+            vrshrn_n_u16(vrsraq_n_u16(lo, lo, 8), 8),
+            vrshrn_n_u16(vrsraq_n_u16(hi, hi, 8), 8));
+    }
+
+    static void neonRgbaToPbgra(const uint8_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        size_t i = 0;
+        for(; i + 16 <= pixel_count; i += 16)
+        {
+            const uint8x16x4_t x = vld4q_u8(source + i * 4);
+            uint8x16x4_t y;
+            y.val[0] = premultiply(x.val[2], x.val[3]);
+            y.val[1] = premultiply(x.val[1], x.val[3]);
+            y.val[2] = premultiply(x.val[0], x.val[3]);
+            y.val[3] = x.val[3];
+            vst4q_u8(destination + i * 4, y);
+        }
+
+        scalarRgbaToPbgra(source + i * 4, destination + i * 4, pixel_count - i);
+    }
+
+    static inline uint8x8_t narrow16To8(uint16x8_t v)
+    {
+        const uint16x8_t t = vqaddq_u16(v, vdupq_n_u16(128));
+        return vshrn_n_u16(vsubq_u16(t, vshrq_n_u16(t, 8)), 8);
+    }
+
+    static void neonRgba16ToRgba8(const uint16_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        size_t i = 0;
+        for(; i + 4 <= pixel_count; i += 4)
+        {
+            const uint16x8_t a = vld1q_u16(source + i * 4);
+            const uint16x8_t b = vld1q_u16(source + i * 4 + 8);
+            vst1q_u8(destination + i * 4, vcombine_u8(narrow16To8(a), narrow16To8(b)));
+        }
+
+        scalarRgba16ToRgba8(source + i * 4, destination + i * 4, pixel_count - i);
+    }
+
+    static const Kernels NEON_KERNELS = {
+        KI_NEON,
+        "NEON",
+        neonRgbaToPbgra,
+        neonRgba16ToRgba8
+    };
+
+    const Kernels* neonKernels()
+    {
+        return &NEON_KERNELS;
+    }
+}
+
+#else
+
+namespace flifcore
+{
+    const Kernels* neonKernels()
+    {
+        return 0;
+    }
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,108 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "KernelsInternal.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+namespace flifcore
+{
+    /*!
+    * Two pixels as 16 bit lanes r g b a r g b a.
+    */
+    static inline __m128i premultiplySwizzle(__m128i v)
+    {
+        // multiply the colors with alpha, and alpha with 255 so it stays the same
+        const __m128i mask_rgb = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+        const __m128i alpha_255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+
+        __m128i alpha = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+        alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+        alpha = _mm_or_si128(_mm_and_si128(alpha, mask_rgb), alpha_255);
+
+        // exact division by 255, see divideBy255
+        __m128i x = _mm_add_epi16(_mm_mullo_epi16(v, alpha), _mm_set1_epi16(128));
+        x = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+
+        x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 0, 1, 2));
+        return _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 0, 1, 2));
+    }
+
+    static void sse2RgbaToPbgra(const uint8_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        const __m128i zero = _mm_setzero_si128();
+
+        size_t i = 0;
+        for(; i + 4 <= pixel_count; i += 4)
+        {
+            const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 4));
+            const __m128i lo = premultiplySwizzle(_mm_unpacklo_epi8(x, zero));
+            const __m128i hi = premultiplySwizzle(_mm_unpackhi_epi8(x, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4), _mm_packus_epi16(lo, hi));
+        }
+
+        scalarRgbaToPbgra(source + i * 4, destination + i * 4, pixel_count - i);
+    }
+
+    /*!
+    * round(v / 257) as ((t - (t >> 8)) >> 8) with t = v + 128.
+    * The saturating add keeps t in 16 bits, and still gives 255 for the values it clamps.
+    */
+    static inline __m128i narrow16To8(__m128i v)
+    {
+        const __m128i t = _mm_adds_epu16(v, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_sub_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+
+    static void sse2Rgba16ToRgba8(const uint16_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        size_t i = 0;
+        for(; i + 4 <= pixel_count; i += 4)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 4));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 4 + 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4), _mm_packus_epi16(narrow16To8(a), narrow16To8(b)));
+        }
+
+        scalarRgba16ToRgba8(source + i * 4, destination + i * 4, pixel_count - i);
+    }
+
+    static const Kernels SSE2_KERNELS = {
+        KI_SSE2,
+        "SSE2",
+        sse2RgbaToPbgra,
+        sse2Rgba16ToRgba8
+    };
+
+    const Kernels* sse2Kernels()
+    {
+        return &SSE2_KERNELS;
+    }
+}
+
+#else
+
+namespace flifcore
+{
+    const Kernels* sse2Kernels()
+    {
+        return 0;
+    }
+}
+
+#endif
\ No newline at end of file
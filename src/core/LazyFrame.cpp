@@ -0,0 +1,143 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "LazyFrame.h"
+
+#include <cstring>
+
+#include "RowBands.h"
+
+namespace flifcore
+{
+    LazyFrame::LazyFrame()
+        : _image(0)
+        , _materialized(false)
+        , _copied_directly(false)
+    {
+    }
+
+    DecodeStatus LazyFrame::init(const std::shared_ptr<Decoder>& decoder, size_t index, PixelFormat format)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        DecodeStatus status = decoder->decodePixels();
+        if(status != DS_OK)
+            return status;
+
+        FLIF_IMAGE* image = decoder->image(index);
+        if(image == 0)
+            return DS_FRAME_MISSING;
+
+        _decoder = decoder;
+        _image = image;
+        _frame.width = flif_image_get_width(image);
+        _frame.height = flif_image_get_height(image);
+        _frame.delay_ms = flif_image_get_frame_delay(image);
+        _frame.format = format;
+        _frame.pixels.clear();
+        _materialized = false;
+        _copied_directly = false;
+        return DS_OK;
+    }
+
+    uint32_t LazyFrame::width() const
+    {
+        // set once in init, before the frame is shared
+        return _frame.width;
+    }
+
+    uint32_t LazyFrame::height() const
+    {
+        return _frame.height;
+    }
+
+    uint32_t LazyFrame::delayMs() const
+    {
+        return _frame.delay_ms;
+    }
+
+    PixelFormat LazyFrame::format() const
+    {
+        return _frame.format;
+    }
+
+    DecodeStatus LazyFrame::copyPixels(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint8_t* destination, size_t stride)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        const size_t bytes_per_pixel = bytesPerPixel(_frame.format);
+
+        if(!_materialized)
+        {
+            const bool whole_frame = x == 0 && y == 0 && width == _frame.width && height == _frame.height;
+            if(whole_frame && !_copied_directly)
+            {
+                // straight from libflif into the destination, no intermediate buffer
+                RowBands::run(height, uint64_t(height) * stride, [&](uint32_t begin, uint32_t end)
+                {
+                    PixelBuffer scratch;
+                    for(uint32_t row = begin; row < end; ++row)
+                        readRow(_image, row, _frame.format, destination + row * stride, scratch);
+                });
+
+                _copied_directly = true;
+                counters().copy_bytes_saved.fetch_add(uint64_t(width) * height * bytes_per_pixel, std::memory_order_relaxed);
+                return DS_OK;
+            }
+
+            // needed a second time, or only partly: keep an own copy from now on
+            DecodeStatus status = materializeLocked();
+            if(status != DS_OK)
+                return status;
+        }
+
+        for(uint32_t row = 0; row < height; ++row)
+        {
+            const uint8_t* source_line_start = _frame.pixels.data() + (row + y) * _frame.stride() + x * bytes_per_pixel;
+            memcpy(destination + row * stride, source_line_start, width * bytes_per_pixel);
+        }
+
+        return DS_OK;
+    }
+
+    DecodeStatus LazyFrame::materialize()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return materializeLocked();
+    }
+
+    bool LazyFrame::isMaterialized() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _materialized;
+    }
+
+    DecodeStatus LazyFrame::materializeLocked()
+    {
+        if(_materialized)
+            return DS_OK;
+
+        if(_image == 0)
+            return DS_FRAME_MISSING;
+
+        extractFrame(_image, _frame, _frame.format);
+
+        _materialized = true;
+        _image = 0;
+        _decoder.reset();
+        return DS_OK;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+#include "Decode.h"
+
+namespace flifcore
+{
+    /*!
+    * A frame that copies its pixels out of libflif only when they are needed twice.
+    *
+    * The first copy of the whole frame is converted straight from the libflif image into the destination.
+    * Any other copy materializes the frame into an own buffer first, and from then on the decoder is no longer referenced.
+    * Thread safe.
+    */
+    class LazyFrame
+    {
+    public:
+        LazyFrame();
+
+        /*!
+        * Decodes the pixels of the decoder, if not done yet. The decoder must not be changed afterwards.
+        * @param format All copies are converted to this format.
+        */
+        DecodeStatus init(const std::shared_ptr<Decoder>& decoder, size_t index, PixelFormat format = PF_RGBA32);
+
+        uint32_t width() const;
+        uint32_t height() const;
+        uint32_t delayMs() const;
+        PixelFormat format() const;
+
+        /*!
+        * Copies a rectangle in format(). The rectangle must be inside the frame and stride >= width * bytesPerPixel(format()).
+        */
+        DecodeStatus copyPixels(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint8_t* destination, size_t stride);
+
+        /*!
+        * Copies the pixels into an own buffer and drops the reference to the decoder.
+        */
+        DecodeStatus materialize();
+
+        bool isMaterialized() const;
+
+    private:
+        LazyFrame(const LazyFrame& other);
+        LazyFrame& operator=(const LazyFrame& other);
+
+        DecodeStatus materializeLocked();
+
+        mutable std::mutex _mutex;
+        std::shared_ptr<Decoder> _decoder;
+        FLIF_IMAGE* _image;
+        Frame _frame;
+        bool _materialized;
+        bool _copied_directly;
+    };
+}
\ No newline at end of file
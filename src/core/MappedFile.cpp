@@ -0,0 +1,255 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "MappedFile.h"
+
+#include <limits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace flifcore
+{
+    MappedFile::MappedFile()
+#ifdef _WIN32
+        : _file_handle(INVALID_HANDLE_VALUE)
+        , _mapping_handle(0)
+#else
+        : _fd(-1)
+#endif
+        , _view(0)
+        , _view_size(0)
+        , _offset(0)
+    {
+        _state.size = 0;
+        _state.modification_time = 0;
+        _state.modification_time_fraction = 0;
+    }
+
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+    void MappedFile::close()
+    {
+#ifdef _WIN32
+        if(_view != 0)
+            UnmapViewOfFile(_view);
+        if(_mapping_handle != 0)
+            CloseHandle(_mapping_handle);
+        if(_file_handle != INVALID_HANDLE_VALUE)
+            CloseHandle(_file_handle);
+        _mapping_handle = 0;
+        _file_handle = INVALID_HANDLE_VALUE;
+#else
+        if(_view != 0)
+            munmap(_view, _view_size);
+        if(_fd != -1)
+            ::close(_fd);
+        _fd = -1;
+#endif
+        _view = 0;
+        _view_size = 0;
+        _offset = 0;
+    }
+
+#ifdef _WIN32
+
+    bool MappedFile::open(const std::string& filename, uint64_t offset)
+    {
+        close();
+
+        _file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+        return mapOpenFile(offset);
+    }
+
+    bool MappedFile::open(const std::wstring& filename, uint64_t offset)
+    {
+        close();
+
+        _file_handle = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+        return mapOpenFile(offset);
+    }
+
+    bool MappedFile::open(FILE* file, uint64_t offset)
+    {
+        close();
+
+        HANDLE file_handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file)));
+        if(file_handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        HANDLE duplicate = INVALID_HANDLE_VALUE;
+        if(!DuplicateHandle(GetCurrentProcess(), file_handle, GetCurrentProcess(), &duplicate, 0, FALSE, DUPLICATE_SAME_ACCESS))
+            return false;
+
+        _file_handle = duplicate;
+        return mapOpenFile(offset);
+    }
+
+    bool MappedFile::mapOpenFile(uint64_t offset)
+    {
+        if(_file_handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        if(!readFileState(_state) ||
+            _state.size <= offset ||
+            _state.size > std::numeric_limits<size_t>::max())
+        {
+            close();
+            return false;
+        }
+
+        _mapping_handle = CreateFileMappingW(_file_handle, 0, PAGE_READONLY, 0, 0, 0);
+        if(_mapping_handle == 0)
+        {
+            close();
+            return false;
+        }
+
+        _view = static_cast<uint8_t*>(MapViewOfFile(_mapping_handle, FILE_MAP_READ, 0, 0, 0));
+        if(_view == 0)
+        {
+            close();
+            return false;
+        }
+
+        _view_size = static_cast<size_t>(_state.size);
+        _offset = static_cast<size_t>(offset);
+        return true;
+    }
+
+    bool MappedFile::readFileState(FileState& state) const
+    {
+        BY_HANDLE_FILE_INFORMATION info;
+        if(!GetFileInformationByHandle(_file_handle, &info))
+            return false;
+
+        if(info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            return false;
+
+        state.size = (uint64_t(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+        state.modification_time = (int64_t(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+        state.modification_time_fraction = 0;
+        return true;
+    }
+
+#else
+
+    bool MappedFile::open(const std::string& filename, uint64_t offset)
+    {
+        close();
+
+        _fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        return mapOpenFile(offset);
+    }
+
+    bool MappedFile::open(FILE* file, uint64_t offset)
+    {
+        close();
+
+        // an own descriptor, so the mapping can outlive the FILE
+        _fd = fcntl(fileno(file), F_DUPFD_CLOEXEC, 0);
+        return mapOpenFile(offset);
+    }
+
+    bool MappedFile::mapOpenFile(uint64_t offset)
+    {
+        if(_fd == -1)
+            return false;
+
+        if(!readFileState(_state) ||
+            _state.size <= offset ||
+            _state.size > std::numeric_limits<size_t>::max())
+        {
+            close();
+            return false;
+        }
+
+        void* view = mmap(0, static_cast<size_t>(_state.size), PROT_READ, MAP_SHARED, _fd, 0);
+        if(view == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+
+        _view = static_cast<uint8_t*>(view);
+        _view_size = static_cast<size_t>(_state.size);
+        _offset = static_cast<size_t>(offset);
+
+        // the decoder reads front to back
+        posix_madvise(_view, _view_size, POSIX_MADV_SEQUENTIAL);
+        return true;
+    }
+
+    bool MappedFile::readFileState(FileState& state) const
+    {
+        struct stat file_stat;
+        if(fstat(_fd, &file_stat) != 0)
+            return false;
+
+        if(!S_ISREG(file_stat.st_mode))
+            return false;
+
+        state.size = static_cast<uint64_t>(file_stat.st_size);
+#ifdef __APPLE__
+        state.modification_time = file_stat.st_mtimespec.tv_sec;
+        state.modification_time_fraction = file_stat.st_mtimespec.tv_nsec;
+#else
+        state.modification_time = file_stat.st_mtim.tv_sec;
+        state.modification_time_fraction = file_stat.st_mtim.tv_nsec;
+#endif
+        return true;
+    }
+
+#endif
+
+    const uint8_t* MappedFile::data() const
+    {
+        return _view + _offset;
+    }
+
+    size_t MappedFile::size() const
+    {
+        return _view_size - _offset;
+    }
+
+    bool MappedFile::isUnchanged() const
+    {
+        if(_view == 0)
+            return false;
+
+        FileState current;
+        if(!readFileState(current))
+            return false;
+
+        return current.size == _state.size &&
+            current.modification_time == _state.modification_time &&
+            current.modification_time_fraction == _state.modification_time_fraction;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include "ByteSource.h"
+
+namespace flifcore
+{
+    /*!
+    * Read-only memory mapping of a file, from an offset until the end.
+    *
+    * The mapping stays valid as long as this object exists, even if the file is closed or deleted.
+    * It does not protect against other processes changing the file:
+    * On Windows, a mapped file cannot be truncated, but it can still be written to.
+    * On POSIX systems, touching pages behind a truncated end raises SIGBUS, which kills the process.
+    * So only map files that nobody truncates while the mapping is read, and call isUnchanged() before handing the bytes
+    * to code that may read all of them.
+    */
+    class MappedFile : public InputBuffer
+    {
+    public:
+        MappedFile();
+        virtual ~MappedFile();
+
+        bool open(const std::string& filename, uint64_t offset);
+        bool open(FILE* file, uint64_t offset);
+#ifdef _WIN32
+        bool open(const std::wstring& filename, uint64_t offset);
+#endif
+
+        virtual const uint8_t* data() const override;
+        virtual size_t size() const override;
+
+        /*!
+        * Compares size and modification time with the values from the time of mapping.
+        */
+        virtual bool isUnchanged() const override;
+
+    private:
+        MappedFile(const MappedFile& other);
+        MappedFile& operator=(const MappedFile& other);
+
+        struct FileState
+        {
+            uint64_t size;
+            int64_t modification_time;
+            int64_t modification_time_fraction;
+        };
+
+        void close();
+        bool mapOpenFile(uint64_t offset);
+        bool readFileState(FileState& state) const;
+
+#ifdef _WIN32
+        void* _file_handle;
+        void* _mapping_handle;
+#else
+        int _fd;
+#endif
+        uint8_t* _view;
+        size_t _view_size;
+        size_t _offset;
+        FileState _state;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,133 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "PixelFormat.h"
+
+#include "Kernels.h"
+
+namespace flifcore
+{
+    const char* toString(PixelFormat format)
+    {
+        switch(format)
+        {
+        case PF_RGBA32:
+            return "RGBA32";
+        case PF_GRAY8:
+            return "Gray8";
+        case PF_BGR24:
+            return "BGR24";
+        case PF_PBGRA32:
+            return "PBGRA32";
+        case PF_RGBA64:
+            return "RGBA64";
+        }
+        return "unknown";
+    }
+
+    size_t bytesPerPixel(PixelFormat format)
+    {
+        switch(format)
+        {
+        case PF_RGBA32:
+            return 4;
+        case PF_GRAY8:
+            return 1;
+        case PF_BGR24:
+            return 3;
+        case PF_PBGRA32:
+            return 4;
+        case PF_RGBA64:
+            return 8;
+        }
+        return 0;
+    }
+
+    PixelFormat choosePixelFormat(uint8_t channels, uint8_t depth)
+    {
+        if(depth > 8)
+            return PF_RGBA64;
+
+        if(channels == 1)
+            return PF_GRAY8;
+
+        if(channels == 3)
+            return PF_BGR24;
+
+        return PF_PBGRA32;
+    }
+
+    void readRow(FLIF_IMAGE* image, uint32_t row, PixelFormat format, uint8_t* destination, PixelBuffer& scratch)
+    {
+        const size_t width = flif_image_get_width(image);
+
+        switch(format)
+        {
+        case PF_RGBA32:
+            flif_image_read_row_RGBA8(image, row, destination, width * 4);
+            break;
+
+        case PF_GRAY8:
+            flif_image_read_row_GRAY8(image, row, destination, width);
+            break;
+
+        case PF_BGR24:
+            // the only format smaller than what libflif writes
+            scratch.resize(width * 4);
+            flif_image_read_row_RGBA8(image, row, scratch.data(), scratch.size());
+            convertRGBAToBGR(scratch.data(), destination, width);
+            break;
+
+        case PF_PBGRA32:
+            // same size, convert in place
+            flif_image_read_row_RGBA8(image, row, destination, width * 4);
+            convertRGBAToPBGRA(destination, destination, width);
+            break;
+
+        case PF_RGBA64:
+            flif_image_read_row_RGBA16(image, row, destination, width * 8);
+            break;
+        }
+    }
+
+    void convertRGBAToPBGRA(const uint8_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        kernels().rgba_to_pbgra(source, destination, pixel_count);
+    }
+
+    void convertRGBA16ToRGBA8(const uint16_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        kernels().rgba16_to_rgba8(source, destination, pixel_count);
+    }
+
+    void convertRGBAToBGR(const uint8_t* source, uint8_t* destination, size_t pixel_count)
+    {
+        // front to back, so in place works: destination never overtakes source
+        for(size_t i = 0; i < pixel_count; ++i)
+        {
+            const uint8_t r = source[0];
+            const uint8_t g = source[1];
+            const uint8_t b = source[2];
+
+            destination[0] = b;
+            destination[1] = g;
+            destination[2] = r;
+
+            source += 4;
+            destination += 3;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "BufferPool.h"
+#include "flifWrapper.h"
+
+namespace flifcore
+{
+    /*!
+    * Output formats, named like their WIC counterparts. Channels are in memory order, 16 bit values in native byte order.
+    */
+    enum PixelFormat
+    {
+        PF_RGBA32,  //!< libflif's own format, straight alpha
+        PF_GRAY8,
+        PF_BGR24,
+        PF_PBGRA32, //!< premultiplied alpha, what Direct2D and Explorer draw without conversion
+        PF_RGBA64
+    };
+
+    const char* toString(PixelFormat format);
+
+    size_t bytesPerPixel(PixelFormat format);
+
+    /*!
+    * The smallest format that holds the image without loss, preferring what consumers use directly:
+    * 16 bit: RGBA64, gray: Gray8, opaque color: BGR24, with alpha: PBGRA32.
+    */
+    PixelFormat choosePixelFormat(uint8_t channels, uint8_t depth);
+
+    /*!
+    * Reads one row of a libflif image and converts it on the fly.
+    * @param destination At least width * bytesPerPixel(format) bytes.
+    * @param scratch Reused between calls to avoid allocations.
+    */
+    void readRow(FLIF_IMAGE* image, uint32_t row, PixelFormat format, uint8_t* destination, PixelBuffer& scratch);
+
+    /*!
+    * RGBA8 to premultiplied BGRA8, each color is round(c * a / 255). source and destination may be the same.
+    */
+    void convertRGBAToPBGRA(const uint8_t* source, uint8_t* destination, size_t pixel_count);
+
+    /*!
+    * RGBA16 to RGBA8, each channel is round(v * 255 / 65535).
+    */
+    void convertRGBA16ToRGBA8(const uint16_t* source, uint8_t* destination, size_t pixel_count);
+
+    /*!
+    * RGBA8 to BGR8, alpha is dropped. source and destination may be the same.
+    */
+    void convertRGBAToBGR(const uint8_t* source, uint8_t* destination, size_t pixel_count);
+}
\ No newline at end of file
@@ -0,0 +1,195 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "RegionCache.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace flifcore
+{
+    DecodeStatus decodeRegion(const std::shared_ptr<const InputBuffer>& input, size_t index,
+        uint32_t x, uint32_t y, uint32_t width, uint32_t height, PixelFormat format, Frame& region)
+    {
+        Decoder decoder;
+        DecodeStatus status = decoder.open(input);
+        if(status != DS_OK)
+            return status;
+
+        const ImageInfo& info = decoder.info();
+        if(width == 0 || height == 0 || width > info.width || height > info.height ||
+            x > info.width - width || y > info.height - height)
+            return DS_DECODE_FAILED;
+
+        DecodeOptions options;
+        options.crop_x = x;
+        options.crop_y = y;
+        options.crop_width = width;
+        options.crop_height = height;
+        decoder.setOptions(options);
+
+        status = decoder.decodePixels();
+        if(status != DS_OK)
+            return status;
+
+        FLIF_IMAGE* image = decoder.image(index);
+        if(image == 0)
+            return DS_FRAME_MISSING;
+
+        // the image is either the rectangle alone or the full size with only the rectangle decoded
+        const uint32_t image_width = flif_image_get_width(image);
+        const uint32_t image_height = flif_image_get_height(image);
+        uint32_t offset_x = 0;
+        uint32_t offset_y = 0;
+        if(image_width == info.width && image_height == info.height)
+        {
+            offset_x = x;
+            offset_y = y;
+        }
+        else if(image_width < width || image_height < height)
+        {
+            return DS_DECODE_FAILED;
+        }
+
+        increment(counters().frame_extractions);
+
+        region.width = width;
+        region.height = height;
+        region.delay_ms = flif_image_get_frame_delay(image);
+        region.format = format;
+        region.pixels.resize(region.stride() * height);
+
+        const size_t bytes_per_pixel = bytesPerPixel(format);
+        PixelBuffer row(size_t(image_width) * bytes_per_pixel);
+        PixelBuffer scratch;
+        for(uint32_t row_index = 0; row_index < height; ++row_index)
+        {
+            uint8_t* destination = region.pixels.data() + row_index * region.stride();
+            if(offset_x == 0 && image_width == width)
+            {
+                readRow(image, offset_y + row_index, format, destination, scratch);
+            }
+            else
+            {
+                readRow(image, offset_y + row_index, format, row.data(), scratch);
+                memcpy(destination, row.data() + offset_x * bytes_per_pixel, region.stride());
+            }
+        }
+
+        return DS_OK;
+    }
+
+    RegionCache::RegionCache(const std::shared_ptr<const InputBuffer>& input, size_t index, uint32_t width, uint32_t height,
+        PixelFormat format, uint64_t budget_bytes)
+        : _input(input)
+        , _index(index)
+        , _width(width)
+        , _height(height)
+        , _format(format)
+        , _budget_bytes(budget_bytes)
+        , _cached_bytes(0)
+        , _hits(0)
+        , _misses(0)
+    {
+    }
+
+    DecodeStatus RegionCache::copyPixels(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint8_t* destination, size_t stride)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto found = std::find_if(_regions.begin(), _regions.end(), [&](const Region& region)
+        {
+            return x >= region.x && y >= region.y &&
+                x + width <= region.x + region.frame.width &&
+                y + height <= region.y + region.frame.height;
+        });
+
+        if(found != _regions.end())
+        {
+            _hits++;
+            _regions.splice(_regions.begin(), _regions, found);
+        }
+        else
+        {
+            _misses++;
+
+            // half the size as margin on each side, clamped to the image
+            const uint32_t margin_x = width / 2;
+            const uint32_t margin_y = height / 2;
+            Region region;
+            region.x = x - std::min(x, margin_x);
+            region.y = y - std::min(y, margin_y);
+            const uint32_t region_width = std::min(x + width + margin_x, _width) - region.x;
+            const uint32_t region_height = std::min(y + height + margin_y, _height) - region.y;
+
+            DecodeStatus status = decodeRegion(_input, _index, region.x, region.y, region_width, region_height, _format, region.frame);
+            if(status != DS_OK)
+                return status;
+
+            _cached_bytes += region.frame.pixels.size();
+            _regions.push_front(std::move(region));
+
+            // the new region always stays, even above the budget
+            while(_regions.size() > 1 && _cached_bytes > _budget_bytes)
+            {
+                _cached_bytes -= _regions.back().frame.pixels.size();
+                _regions.pop_back();
+            }
+        }
+
+        const Region& region = _regions.front();
+        const size_t bytes_per_pixel = bytesPerPixel(_format);
+        for(uint32_t row = 0; row < height; ++row)
+        {
+            const uint8_t* source_line_start = region.frame.pixels.data() +
+                (y - region.y + row) * region.frame.stride() + (x - region.x) * bytes_per_pixel;
+            memcpy(destination + row * stride, source_line_start, width * bytes_per_pixel);
+        }
+
+        return DS_OK;
+    }
+
+    void RegionCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _regions.clear();
+        _cached_bytes = 0;
+    }
+
+    size_t RegionCache::regionCount() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _regions.size();
+    }
+
+    uint64_t RegionCache::cachedBytes() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _cached_bytes;
+    }
+
+    uint64_t RegionCache::hits() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _hits;
+    }
+
+    uint64_t RegionCache::misses() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _misses;
+    }
+}
\ No newline at end of file
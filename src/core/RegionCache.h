@@ -0,0 +1,90 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "Decode.h"
+
+namespace flifcore
+{
+    /*!
+    * Decodes only a rectangle of a frame, with the crop of libflif.
+    * The rectangle must be inside the image.
+    */
+    DecodeStatus decodeRegion(const std::shared_ptr<const InputBuffer>& input, size_t index,
+        uint32_t x, uint32_t y, uint32_t width, uint32_t height, PixelFormat format, Frame& region);
+
+    /*!
+    * Copies rectangles of one frame without decoding all of it.
+    *
+    * A miss decodes the rectangle plus a margin of half its size on each side, so a viewer that pans or
+    * copies a window in bands finds the next rectangle already decoded. The regions are kept until they
+    * exceed the byte budget, the least recently used ones are dropped first.
+    * Thread safe.
+    */
+    class RegionCache
+    {
+    public:
+        static const uint64_t DEFAULT_BUDGET_BYTES = 64 * 1024 * 1024;
+
+        /*!
+        * @param width, height Full size of the frame.
+        */
+        RegionCache(const std::shared_ptr<const InputBuffer>& input, size_t index, uint32_t width, uint32_t height,
+            PixelFormat format, uint64_t budget_bytes = DEFAULT_BUDGET_BYTES);
+
+        /*!
+        * Same contract as LazyFrame::copyPixels().
+        */
+        DecodeStatus copyPixels(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint8_t* destination, size_t stride);
+
+        //! Drops all regions.
+        void clear();
+
+        size_t regionCount() const;
+        uint64_t cachedBytes() const;
+        uint64_t hits() const;
+        uint64_t misses() const;
+
+    private:
+        RegionCache(const RegionCache& other);
+        RegionCache& operator=(const RegionCache& other);
+
+        struct Region
+        {
+            uint32_t x;
+            uint32_t y;
+            Frame frame;
+        };
+
+        std::shared_ptr<const InputBuffer> _input;
+        size_t _index;
+        uint32_t _width;
+        uint32_t _height;
+        PixelFormat _format;
+        uint64_t _budget_bytes;
+
+        mutable std::mutex _mutex;
+        std::list<Region> _regions; //!< most recently used first
+        uint64_t _cached_bytes;
+        uint64_t _hits;
+        uint64_t _misses;
+    };
+}
\ No newline at end of file
@@ -0,0 +1,150 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "Resample.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace flifcore
+{
+    void fitSize(uint32_t width, uint32_t height, uint32_t max_width, uint32_t max_height, uint32_t& fit_width, uint32_t& fit_height)
+    {
+        fit_width = width;
+        fit_height = height;
+
+        if(width == 0 || height == 0)
+            return;
+
+        // the side that has to shrink more decides
+        if(width > max_width || height > max_height)
+        {
+            if(uint64_t(width) * max_height >= uint64_t(height) * max_width)
+            {
+                fit_width = max_width;
+                fit_height = static_cast<uint32_t>((uint64_t(height) * max_width + width / 2) / width);
+            }
+            else
+            {
+                fit_height = max_height;
+                fit_width = static_cast<uint32_t>((uint64_t(width) * max_height + height / 2) / height);
+            }
+        }
+
+        fit_width = std::max<uint32_t>(fit_width, 1);
+        fit_height = std::max<uint32_t>(fit_height, 1);
+    }
+
+    /*!
+    * Source range [first, last) covered by destination index i, at least one pixel.
+    */
+    static inline void sourceRange(uint32_t i, uint32_t source_size, uint32_t destination_size, uint32_t& first, uint32_t& last)
+    {
+        first = static_cast<uint32_t>(uint64_t(i) * source_size / destination_size);
+        last = static_cast<uint32_t>(uint64_t(i + 1) * source_size / destination_size);
+        last = std::max(last, first + 1);
+    }
+
+    uint32_t zoomScale(uint32_t width, uint32_t height, uint32_t target_width, uint32_t target_height)
+    {
+        // beyond the larger side every zoom level is a single pixel
+        const uint64_t largest = std::max(width, height);
+
+        uint64_t scale = 1;
+        while(scale * 2 <= largest &&
+            (width + scale * 2 - 1) / (scale * 2) >= target_width &&
+            (height + scale * 2 - 1) / (scale * 2) >= target_height)
+        {
+            scale *= 2;
+        }
+
+        return static_cast<uint32_t>(scale);
+    }
+
+    /*!
+    * The box filter for 8 and 16 bit channels.
+    */
+    template<typename T>
+    static void filterBox(const Frame& source, size_t channels, Frame& result)
+    {
+        const uint32_t width = result.width;
+        const uint32_t height = result.height;
+
+        // per destination column: first source column and number of columns
+        std::vector<uint32_t> column_first(width);
+        std::vector<uint32_t> column_count(width);
+        for(uint32_t x = 0; x < width; ++x)
+        {
+            uint32_t first, last;
+            sourceRange(x, source.width, width, first, last);
+            column_first[x] = first;
+            column_count[x] = last - first;
+        }
+
+        std::vector<uint64_t> sums(size_t(width) * channels);
+
+        for(uint32_t y = 0; y < height; ++y)
+        {
+            uint32_t first_row, last_row;
+            sourceRange(y, source.height, height, first_row, last_row);
+
+            std::fill(sums.begin(), sums.end(), 0);
+            for(uint32_t sy = first_row; sy < last_row; ++sy)
+            {
+                const T* row = reinterpret_cast<const T*>(source.pixels.data() + sy * source.stride());
+                uint64_t* sum = sums.data();
+                for(uint32_t x = 0; x < width; ++x)
+                {
+                    const T* pixel = row + column_first[x] * channels;
+                    for(uint32_t sx = 0; sx < column_count[x]; ++sx)
+                        for(size_t c = 0; c < channels; ++c)
+                            sum[c] += *pixel++;
+                    sum += channels;
+                }
+            }
+
+            T* out = reinterpret_cast<T*>(result.pixels.data() + y * result.stride());
+            const uint64_t rows = last_row - first_row;
+            for(uint32_t x = 0; x < width; ++x)
+            {
+                const uint64_t count = rows * column_count[x];
+                for(size_t c = 0; c < channels; ++c)
+                    out[x * channels + c] = static_cast<T>((sums[x * channels + c] + count / 2) / count);
+            }
+        }
+    }
+
+    bool downscaleBox(const Frame& source, uint32_t width, uint32_t height, Frame& destination)
+    {
+        if(width == 0 || height == 0 || source.width == 0 || source.height == 0)
+            return false;
+
+        Frame result;
+        result.width = width;
+        result.height = height;
+        result.delay_ms = source.delay_ms;
+        result.format = source.format;
+        result.pixels.resize(result.stride() * height);
+
+        if(source.format == PF_RGBA64)
+            filterBox<uint16_t>(source, 4, result);
+        else
+            filterBox<uint8_t>(source, bytesPerPixel(source.format), result);
+
+        destination = std::move(result);
+        return true;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+#include "Frame.h"
+
+namespace flifcore
+{
+    /*!
+    * The largest size with the aspect ratio of width x height that fits into max_width x max_height.
+    * Never larger than the image itself and never 0 in either direction.
+    */
+    void fitSize(uint32_t width, uint32_t height, uint32_t max_width, uint32_t max_height, uint32_t& fit_width, uint32_t& fit_height);
+
+    /*!
+    * The largest power of two scale whose FLIF zoom level is still at least target_width x target_height.
+    * A zoom level at scale s is ceil(width / s) x ceil(height / s).
+    */
+    uint32_t zoomScale(uint32_t width, uint32_t height, uint32_t target_width, uint32_t target_height);
+
+    /*!
+    * Scales with a box filter: each destination pixel is the rounded mean of the source pixels it covers.
+    * Enlarging repeats pixels. Channels are averaged independently, so colors with alpha should be premultiplied.
+    * @return False for an empty source or destination.
+    */
+    bool downscaleBox(const Frame& source, uint32_t width, uint32_t height, Frame& destination);
+}
\ No newline at end of file
@@ -0,0 +1,150 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "RowBands.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+#include "TaskPool.h"
+
+namespace flifcore
+{
+    const uint64_t RowBands::DEFAULT_MIN_BYTES;
+    const uint32_t RowBands::MIN_BAND_ROWS;
+    const uint32_t RowBands::BANDS_PER_THREAD;
+
+    std::atomic<unsigned int> RowBands::_max_threads(0);
+    std::atomic<uint64_t> RowBands::_min_bytes(RowBands::DEFAULT_MIN_BYTES);
+
+    /*!
+    * Shared by the calling thread and the helpers. Helpers that start after all bands are taken only return,
+    * so they may outlive the call, but never touch body then.
+    */
+    struct BandState
+    {
+        const RowBands::Body* body;
+        uint32_t rows;
+        uint32_t band_rows;
+        uint32_t band_count;
+        std::atomic<uint32_t> next;
+        std::atomic<uint32_t> done;
+
+        std::mutex mutex;
+        std::condition_variable all_done;
+        std::exception_ptr error;
+    };
+
+    static void runBands(BandState& state)
+    {
+        for(;;)
+        {
+            const uint32_t band = state.next++;
+            if(band >= state.band_count)
+                return;
+
+            const uint32_t begin = band * state.band_rows;
+            try
+            {
+                (*state.body)(begin, std::min(state.rows, begin + state.band_rows));
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if(!state.error)
+                    state.error = std::current_exception();
+            }
+
+            if(++state.done == state.band_count)
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.all_done.notify_all();
+            }
+        }
+    }
+
+    void RowBands::run(uint32_t rows, uint64_t bytes, const Body& body)
+    {
+        const unsigned int thread_count = threads();
+        if(thread_count < 2 || bytes < minBytes() || rows < 2 * MIN_BAND_ROWS)
+        {
+            body(0, rows);
+            return;
+        }
+
+        std::shared_ptr<BandState> state = std::make_shared<BandState>();
+        const uint32_t wanted_bands = std::min<uint32_t>(rows / MIN_BAND_ROWS, thread_count * BANDS_PER_THREAD);
+        state->body = &body;
+        state->rows = rows;
+        state->band_rows = (rows + wanted_bands - 1) / wanted_bands;
+        state->band_count = (rows + state->band_rows - 1) / state->band_rows;
+        state->next = 0;
+        state->done = 0;
+
+        // someone waits for the frame, so the helpers go before thumbnails and prefetching
+        // if the pool is busy, this thread does the bands alone
+        const unsigned int helpers = std::min<unsigned int>(thread_count, state->band_count) - 1;
+        for(unsigned int i = 0; i < helpers; ++i)
+        {
+            TaskPool::shared().submit(TP_INTERACTIVE, [state]()
+            {
+                runBands(*state);
+            });
+        }
+
+        runBands(*state);
+
+        // only bands already taken by running helpers are left, so this cannot wait for a queued task
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->all_done.wait(lock, [&]()
+        {
+            return state->done == state->band_count;
+        });
+
+        if(state->error)
+            std::rethrow_exception(state->error);
+    }
+
+    void RowBands::setMaxThreads(unsigned int threads)
+    {
+        _max_threads = threads;
+    }
+
+    unsigned int RowBands::maxThreads()
+    {
+        return _max_threads;
+    }
+
+    unsigned int RowBands::threads()
+    {
+        const unsigned int max_threads = _max_threads;
+        return max_threads != 0 ? max_threads : TaskPool::shared().maxThreads();
+    }
+
+    void RowBands::setMinBytes(uint64_t bytes)
+    {
+        _min_bytes = bytes;
+    }
+
+    uint64_t RowBands::minBytes()
+    {
+        return _min_bytes;
+    }
+}
\ No newline at end of file
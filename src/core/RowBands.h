@@ -0,0 +1,68 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+namespace flifcore
+{
+    /*!
+    * Runs work on the rows of a large frame in bands, in parallel on the calling thread and the shared TaskPool.
+    * Frames below a size threshold stay on the calling thread, for them starting threads costs more than it saves.
+    */
+    class RowBands
+    {
+    public:
+        //! About a 1000x1000 frame at 4 bytes per pixel.
+        static const uint64_t DEFAULT_MIN_BYTES = 4 * 1024 * 1024;
+
+        //! Bands are not made smaller than this.
+        static const uint32_t MIN_BAND_ROWS = 16;
+
+        //! Bands per thread, so a thread that starts late or gets slow rows does not hold up the others.
+        static const uint32_t BANDS_PER_THREAD = 4;
+
+        typedef std::function<void(uint32_t begin, uint32_t end)> Body;
+
+        /*!
+        * Calls body for consecutive bands [begin, end) that together cover [0, rows), and returns when all are done.
+        * The first exception thrown by body is rethrown, after the other bands are done.
+        * @param bytes Size of the output, compared against minBytes().
+        */
+        static void run(uint32_t rows, uint64_t bytes, const Body& body);
+
+        /*!
+        * Number of threads working on one frame, including the calling one. 0, the default, is one per thread of the pool.
+        * More than the pool has only queue up helpers that find the bands taken already.
+        */
+        static void setMaxThreads(unsigned int threads);
+        static unsigned int maxThreads();
+
+        //! Threads used for one frame, maxThreads() or the size of the pool.
+        static unsigned int threads();
+
+        static void setMinBytes(uint64_t bytes);
+        static uint64_t minBytes();
+
+    private:
+        static std::atomic<unsigned int> _max_threads;
+        static std::atomic<uint64_t> _min_bytes;
+    };
+}
\ No newline at end of file
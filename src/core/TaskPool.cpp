@@ -0,0 +1,303 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#include "TaskPool.h"
+
+#include <algorithm>
+
+namespace flifcore
+{
+    // the pool and worker of the current thread, to tell tasks from outside callers
+    static thread_local const TaskPool* t_pool = 0;
+    static thread_local void* t_worker = 0;
+
+    const unsigned int TaskPool::DEFAULT_MAX_THREADS;
+
+    TaskPool::TaskPool(unsigned int max_threads)
+        : _max_threads(std::max(1u, max_threads))
+        , _workers(new Worker[std::max(1u, max_threads)])
+        , _started(0)
+        , _sleeping(0)
+        , _stopping(false)
+        , _queued(0)
+        , _active(0)
+        , _executed(0)
+        , _stolen(0)
+    {
+    }
+
+    TaskPool::~TaskPool()
+    {
+        shutdown();
+    }
+
+    TaskPool& TaskPool::shared()
+    {
+        static TaskPool pool;
+        return pool;
+    }
+
+    unsigned int TaskPool::defaultThreadCount()
+    {
+        return std::max(1u, std::min(std::thread::hardware_concurrency(), DEFAULT_MAX_THREADS));
+    }
+
+    unsigned int TaskPool::maxThreads() const
+    {
+        return _max_threads;
+    }
+
+    void TaskPool::submit(TaskPriority priority, Task task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_activity_mutex);
+            if(_active++ == 0 && _busy_hook)
+                _busy_hook();
+        }
+
+        try
+        {
+            Worker* worker = t_pool == this ? static_cast<Worker*>(t_worker) : 0;
+
+            // counted first, so no thread goes to sleep while the task is on its way into a queue
+            _queued++;
+            if(worker != 0)
+            {
+                try
+                {
+                    std::lock_guard<std::mutex> lock(worker->mutex);
+                    worker->queues[priority].push_back(std::move(task));
+                }
+                catch(...)
+                {
+                    _queued--;
+                    throw;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(worker == 0)
+            {
+                try
+                {
+                    _queues[priority].push_back(std::move(task));
+                }
+                catch(...)
+                {
+                    _queued--;
+                    throw;
+                }
+            }
+
+            if(_sleeping != 0)
+                _wake.notify_one();
+            else if(_started < _max_threads)
+                startWorkerLocked();
+        }
+        catch(...)
+        {
+            finished();
+            throw;
+        }
+    }
+
+    bool TaskPool::isWorkerThread() const
+    {
+        return t_pool == this;
+    }
+
+    bool TaskPool::isIdle() const
+    {
+        std::lock_guard<std::mutex> lock(_activity_mutex);
+        return _active == 0;
+    }
+
+    void TaskPool::waitIdle()
+    {
+        std::unique_lock<std::mutex> lock(_activity_mutex);
+        _idle.wait(lock, [this]()
+        {
+            return _active == 0;
+        });
+    }
+
+    void TaskPool::shutdown()
+    {
+        std::lock_guard<std::mutex> shutdown_lock(_shutdown_mutex);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+            _wake.notify_all();
+        }
+
+        // threads started meanwhile for tasks from outside drain the queues as well
+        for(unsigned int i = 0;; ++i)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(i >= _started)
+                    break;
+            }
+            if(_workers[i].thread.joinable())
+                _workers[i].thread.join();
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _started = 0;
+        _stopping = false;
+
+        // submitted after the last thread looked
+        if(_queued != 0)
+            startWorkerLocked();
+    }
+
+    void TaskPool::setActivityHooks(std::function<void()> busy, std::function<void()> idle)
+    {
+        std::lock_guard<std::mutex> lock(_activity_mutex);
+        _busy_hook = std::move(busy);
+        _idle_hook = std::move(idle);
+
+        // keeps the calls balanced
+        if(_active != 0 && _busy_hook)
+            _busy_hook();
+    }
+
+    TaskPool::Stats TaskPool::stats() const
+    {
+        Stats stats;
+        stats.executed = _executed.load(std::memory_order_relaxed);
+        stats.stolen = _stolen.load(std::memory_order_relaxed);
+        stats.threads = _started.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void TaskPool::startWorkerLocked()
+    {
+        Worker* worker = &_workers[_started];
+        worker->thread = std::thread(&TaskPool::workerLoop, this, worker);
+
+        // other threads steal from the worker from now on
+        _started++;
+    }
+
+    void TaskPool::workerLoop(Worker* worker)
+    {
+        t_pool = this;
+        t_worker = worker;
+
+        Task task;
+        for(;;)
+        {
+            if(take(worker, task))
+            {
+                try
+                {
+                    task();
+                }
+                catch(...)
+                {
+                }
+
+                // whatever the task holds is released before the pool may count as idle
+                task = Task();
+                _executed++;
+                finished();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            if(_queued != 0)
+                continue;
+            if(_stopping)
+                break;
+
+            _sleeping++;
+            _wake.wait(lock);
+            _sleeping--;
+        }
+
+        t_pool = 0;
+        t_worker = 0;
+    }
+
+    bool TaskPool::take(Worker* worker, Task& task)
+    {
+        if(_queued == 0)
+            return false;
+
+        const unsigned int started = _started;
+        for(int priority = 0; priority < TASK_PRIORITY_COUNT; ++priority)
+        {
+            // the newest own task first, its data was just touched by the task that submitted it
+            {
+                std::lock_guard<std::mutex> lock(worker->mutex);
+                std::deque<Task>& queue = worker->queues[priority];
+                if(!queue.empty())
+                {
+                    task = std::move(queue.back());
+                    queue.pop_back();
+                    _queued--;
+                    return true;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                std::deque<Task>& queue = _queues[priority];
+                if(!queue.empty())
+                {
+                    task = std::move(queue.front());
+                    queue.pop_front();
+                    _queued--;
+                    return true;
+                }
+            }
+
+            // the oldest task of another thread, the one it will get to last
+            for(unsigned int i = 0; i < started; ++i)
+            {
+                Worker& other = _workers[i];
+                if(&other == worker)
+                    continue;
+
+                std::lock_guard<std::mutex> lock(other.mutex);
+                std::deque<Task>& queue = other.queues[priority];
+                if(!queue.empty())
+                {
+                    task = std::move(queue.front());
+                    queue.pop_front();
+                    _queued--;
+                    _stolen++;
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    void TaskPool::finished()
+    {
+        std::lock_guard<std::mutex> lock(_activity_mutex);
+        if(--_active == 0)
+        {
+            if(_idle_hook)
+                _idle_hook();
+            _idle.notify_all();
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,176 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace flifcore
+{
+    /*!
+    * Which work runs first when more is queued than there are threads, highest first.
+    */
+    enum TaskPriority
+    {
+        TP_INTERACTIVE, //!< someone looks at it right now, e.g. the preview pane
+        TP_THUMBNAIL,
+        TP_PROPERTY, //!< properties and metadata
+        TP_PREFETCH //!< speculative, nobody waits for it yet
+    };
+
+    static const int TASK_PRIORITY_COUNT = TP_PREFETCH + 1;
+
+    /*!
+    * Threads shared by all work of the process, so a folder full of files does not start a decode per file at once.
+    *
+    * Threads are started on demand, up to a maximum, and stay until shutdown(). Tasks submitted from outside go to
+    * a queue all threads take from. Tasks submitted by a task go to the queue of its thread, which takes its own newest
+    * task first, while idle threads steal the oldest ones. Within that, a higher priority always goes first.
+    * Thread safe.
+    */
+    class TaskPool
+    {
+    public:
+        typedef std::function<void()> Task;
+
+        static const unsigned int DEFAULT_MAX_THREADS = 8;
+
+        explicit TaskPool(unsigned int max_threads = defaultThreadCount());
+
+        //! Runs the queued tasks, then stops the threads.
+        ~TaskPool();
+
+        //! The pool of this process.
+        static TaskPool& shared();
+
+        //! One per hardware thread, but not more than DEFAULT_MAX_THREADS.
+        static unsigned int defaultThreadCount();
+
+        unsigned int maxThreads() const;
+
+        /*!
+        * Queues the task. Exceptions thrown by it are dropped, use run() to get them.
+        */
+        void submit(TaskPriority priority, Task task);
+
+        /*!
+        * Queues the function.
+        * @return Its result, or the exception it threw.
+        */
+        template<class Function>
+        auto run(TaskPriority priority, Function function) -> std::future<decltype(function())>
+        {
+            typedef decltype(function()) Result;
+            std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::move(function));
+            std::future<Result> result = task->get_future();
+            submit(priority, [task]()
+            {
+                (*task)();
+            });
+            return result;
+        }
+
+        /*!
+        * Runs the function on the pool and waits for it, so it queues up behind work of higher priority.
+        * A task of this pool runs it right away, waiting for the others could block all threads.
+        */
+        template<class Function>
+        auto runAndWait(TaskPriority priority, Function function) -> decltype(function())
+        {
+            if(isWorkerThread())
+                return function();
+
+            return run(priority, std::move(function)).get();
+        }
+
+        //! True on a thread of this pool.
+        bool isWorkerThread() const;
+
+        //! True if no task is queued or running.
+        bool isIdle() const;
+
+        //! Blocks until no task is queued or running. Not from a task.
+        void waitIdle();
+
+        /*!
+        * Runs the queued tasks, including those they submit, then stops and joins all threads.
+        * The pool can be used again afterwards, new tasks start new threads. Not from a task.
+        */
+        void shutdown();
+
+        /*!
+        * Called when the first task is queued and when the last one is done, each under the same lock,
+        * so they alternate. The threads may still be running when the idle hook returns, see shutdown().
+        * If tasks are queued already, busy is called right away.
+        */
+        void setActivityHooks(std::function<void()> busy, std::function<void()> idle);
+
+        struct Stats
+        {
+            uint64_t executed;
+            uint64_t stolen; //!< taken from the queue of another thread
+            unsigned int threads; //!< started since the last shutdown()
+        };
+
+        Stats stats() const;
+
+    private:
+        TaskPool(const TaskPool& other);
+        TaskPool& operator=(const TaskPool& other);
+
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<Task> queues[TASK_PRIORITY_COUNT];
+            std::thread thread;
+        };
+
+        void startWorkerLocked();
+        void workerLoop(Worker* worker);
+        bool take(Worker* worker, Task& task);
+        void finished();
+
+        const unsigned int _max_threads;
+        std::unique_ptr<Worker[]> _workers; //!< the first _started ones have a thread
+
+        mutable std::mutex _mutex;
+        std::condition_variable _wake;
+        std::deque<Task> _queues[TASK_PRIORITY_COUNT]; //!< tasks submitted from outside
+        std::atomic<unsigned int> _started;
+        unsigned int _sleeping;
+        bool _stopping;
+        std::atomic<size_t> _queued;
+
+        mutable std::mutex _activity_mutex;
+        std::condition_variable _idle;
+        size_t _active; //!< queued and running
+        std::function<void()> _busy_hook;
+        std::function<void()> _idle_hook;
+
+        std::mutex _shutdown_mutex;
+        std::atomic<uint64_t> _executed;
+        std::atomic<uint64_t> _stolen;
+    };
+}
\ No newline at end of file
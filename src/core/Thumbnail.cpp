@@ -0,0 +1,284 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "Thumbnail.h"
+
+#include "DiskCache.h"
+#include "Resample.h"
+
+namespace flifcore
+{
+    static DecodeStatus decodeFitted(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, bool reduced, CancelToken* cancel, Frame& thumbnail)
+    {
+        if(max_size == 0)
+            return DS_DECODE_FAILED;
+
+        Decoder decoder;
+        decoder.setCancelToken(cancel);
+        DecodeStatus status = decoder.open(input);
+        if(status != DS_OK)
+            return status;
+
+        uint32_t width, height;
+        fitSize(decoder.info().width, decoder.info().height, max_size, max_size, width, height);
+
+        if(reduced && decoder.info().interlaced && (width < decoder.info().width || height < decoder.info().height))
+        {
+            DecodeOptions options;
+            options.resize_width = width;
+            options.resize_height = height;
+            decoder.setOptions(options);
+        }
+
+        Frame frame;
+        status = decoder.extractFrame(0, frame, PF_PBGRA32);
+        if(status != DS_OK)
+            return status;
+
+        if(frame.width == width && frame.height == height)
+        {
+            thumbnail = std::move(frame);
+            return DS_OK;
+        }
+
+        if(!downscaleBox(frame, width, height, thumbnail))
+            return DS_DECODE_FAILED;
+
+        return DS_OK;
+    }
+
+    DecodeStatus decodeThumbnail(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, Frame& thumbnail, CancelToken* cancel)
+    {
+        return decodeFitted(input, max_size, true, cancel, thumbnail);
+    }
+
+    DecodeStatus decodeThumbnailFull(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, Frame& thumbnail, CancelToken* cancel)
+    {
+        return decodeFitted(input, max_size, false, cancel, thumbnail);
+    }
+
+    DecodeStatus decodeThumbnailCached(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, DiskCache* disk_cache,
+        std::shared_ptr<const CachedImage>& thumbnail, CancelToken* cancel)
+    {
+        ImageKey key;
+        if(disk_cache != 0)
+        {
+            key = ImageCache::key(*input, PF_PBGRA32);
+            thumbnail = disk_cache->load(key, max_size);
+            if(thumbnail)
+                return DS_OK;
+        }
+
+        std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+        DecodeStatus status = decodeThumbnail(input, max_size, *frame, cancel);
+        if(status != DS_OK)
+            return status;
+
+        std::shared_ptr<CachedImage> decoded = std::make_shared<CachedImage>();
+        probeInfo(input->data(), input->size(), decoded->info);
+        decoded->frames.push_back(frame->view());
+        decoded->storage = frame;
+
+        if(disk_cache != 0)
+            disk_cache->store(key, max_size, *decoded);
+
+        thumbnail = decoded;
+        return DS_OK;
+    }
+
+    DecodeStatus decodePreview(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, int32_t quality, Frame& preview, CancelToken* cancel)
+    {
+        Decoder decoder;
+        decoder.setCancelToken(cancel);
+        DecodeStatus status = decoder.open(input);
+        if(status != DS_OK)
+            return status;
+
+        if(decoder.info().interlaced)
+        {
+            uint32_t width = decoder.info().width;
+            uint32_t height = decoder.info().height;
+            if(max_size != 0)
+                fitSize(width, height, max_size, max_size, width, height);
+
+            DecodeOptions options;
+            options.quality = quality;
+            if(width < decoder.info().width || height < decoder.info().height)
+            {
+                options.resize_width = width;
+                options.resize_height = height;
+            }
+            decoder.setOptions(options);
+        }
+
+        return decoder.extractFrame(0, preview, PF_PBGRA32);
+    }
+
+    /*!
+    * Makes the decoder copy its latest pass into latest_pass, for a decode that may be stopped at the deadline.
+    */
+    static void keepLatestPass(Decoder& decoder, CancelToken::Clock::time_point deadline, Frame& latest_pass)
+    {
+        typedef CancelToken::Clock Clock;
+
+        // Keeping every pass would copy the whole image each time. A pass takes about twice as long as the one before,
+        // so only a pass after which the next one probably misses the deadline is kept, plus the first one.
+        Clock::time_point previous_pass = Clock::now();
+        decoder.setProgressCallback([deadline, previous_pass, &latest_pass](FLIF_DECODER* flif_decoder, void* context, uint32_t quality) mutable
+        {
+            const Clock::time_point now = Clock::now();
+            const Clock::duration pass_time = now - previous_pass;
+            previous_pass = now;
+
+            if(!latest_pass.pixels.empty() && now + 2 * pass_time < deadline)
+                return;
+
+            try
+            {
+                flif_decoder_generate_preview(context);
+                FLIF_IMAGE* image = flif_decoder_get_image(flif_decoder, 0);
+                if(image != 0)
+                    extractFrame(image, latest_pass, PF_PBGRA32);
+            }
+            catch(...)
+            {
+                // out of memory: continue with the pass kept before, if any
+            }
+        });
+    }
+
+    DecodeStatus decodeWithDeadline(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, CancelToken::Clock::time_point deadline,
+        Frame& frame, bool& partial)
+    {
+        partial = false;
+
+        CancelToken cancel;
+        cancel.setDeadline(deadline);
+
+        Decoder decoder;
+        decoder.setCancelToken(&cancel);
+        DecodeStatus status = decoder.open(input);
+        if(status != DS_OK)
+            return status;
+
+        uint32_t width = decoder.info().width;
+        uint32_t height = decoder.info().height;
+        if(max_size != 0)
+            fitSize(width, height, max_size, max_size, width, height);
+
+        // other files have no passes that could be shown
+        Frame latest_pass;
+        if(decoder.info().interlaced)
+        {
+            if(width < decoder.info().width || height < decoder.info().height)
+            {
+                DecodeOptions options;
+                options.resize_width = width;
+                options.resize_height = height;
+                decoder.setOptions(options);
+            }
+            keepLatestPass(decoder, deadline, latest_pass);
+        }
+
+        Frame decoded;
+        status = decoder.extractFrame(0, decoded, PF_PBGRA32);
+        if(status == DS_CANCELLED && !latest_pass.pixels.empty())
+        {
+            partial = true;
+            decoded = std::move(latest_pass);
+        }
+        else if(status != DS_OK)
+            return status;
+
+        if(decoded.width == width && decoded.height == height)
+        {
+            frame = std::move(decoded);
+            return DS_OK;
+        }
+
+        if(!downscaleBox(decoded, width, height, frame))
+            return DS_DECODE_FAILED;
+
+        return DS_OK;
+    }
+
+    Decoder::ProgressCallback firstFramePasses(PixelFormat format, const PassCallback& pass)
+    {
+        typedef CancelToken::Clock Clock;
+
+        Clock::time_point next_pass = Clock::time_point::min();
+        return [format, pass, next_pass](FLIF_DECODER* flif_decoder, void* context, uint32_t quality) mutable
+        {
+            const Clock::time_point start = Clock::now();
+            if(start < next_pass)
+                return;
+
+            try
+            {
+                flif_decoder_generate_preview(context);
+                FLIF_IMAGE* image = flif_decoder_get_image(flif_decoder, 0);
+                if(image == 0)
+                    return;
+
+                Frame frame;
+                extractFrame(image, frame, format);
+                pass(frame.view());
+            }
+            catch(...)
+            {
+                // out of memory: maybe the next pass fits
+            }
+
+            const Clock::time_point end = Clock::now();
+            next_pass = end + PASS_COST_FACTOR * (end - start);
+        };
+    }
+
+    DecodeStatus decodeScaled(const std::shared_ptr<const InputBuffer>& input, size_t index, uint32_t width, uint32_t height, PixelFormat format, Frame& frame)
+    {
+        Decoder decoder;
+        DecodeStatus status = decoder.open(input);
+        if(status != DS_OK)
+            return status;
+
+        const ImageInfo& info = decoder.info();
+        if(width == 0 || height == 0 || width > info.width || height > info.height)
+            return DS_DECODE_FAILED;
+
+        if(info.interlaced)
+        {
+            DecodeOptions options;
+            options.scale = zoomScale(info.width, info.height, width, height);
+            decoder.setOptions(options);
+        }
+
+        Frame decoded;
+        status = decoder.extractFrame(index, decoded, format);
+        if(status != DS_OK)
+            return status;
+
+        if(decoded.width == width && decoded.height == height)
+        {
+            frame = std::move(decoded);
+            return DS_OK;
+        }
+
+        if(!downscaleBox(decoded, width, height, frame))
+            return DS_DECODE_FAILED;
+
+        return DS_OK;
+    }
+}
\ No newline at end of file
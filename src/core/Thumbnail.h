@@ -0,0 +1,95 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <memory>
+
+#include "Decode.h"
+#include "ImageCache.h"
+
+namespace flifcore
+{
+    /*!
+    * Decodes the first frame at a size that fits into max_size x max_size, keeping the aspect ratio. Never enlarges.
+    *
+    * Interlaced files are decoded only up to the zoom level needed for that size, which skips most of the data.
+    * Other files have to be decoded completely. Either way, the result is box filtered to the exact size.
+    * The thumbnail is premultiplied BGRA, so the filter does not pull in the color of transparent pixels.
+    * @param cancel Stops the decode with DS_CANCELLED. May be 0.
+    */
+    DecodeStatus decodeThumbnail(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, Frame& thumbnail, CancelToken* cancel = 0);
+
+    /*!
+    * The same without the reduced decode, for comparison.
+    */
+    DecodeStatus decodeThumbnailFull(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, Frame& thumbnail, CancelToken* cancel = 0);
+
+    /*!
+    * decodeThumbnail() through the disk cache, if there is one. A hit is a mapped file, nothing is decoded.
+    * Only with a disk cache the whole input is read, for the key.
+    * @param disk_cache May be 0.
+    */
+    DecodeStatus decodeThumbnailCached(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, DiskCache* disk_cache,
+        std::shared_ptr<const CachedImage>& thumbnail, CancelToken* cancel = 0);
+
+    /*!
+    * A quick, low fidelity version of the first frame, for showing something while the full decode runs.
+    *
+    * For interlaced files libflif stops after the zoom level that is at least about max_size (0 for the full size)
+    * and, with quality below 100, after that part of the data. The size is whatever that zoom level has, nothing is resampled.
+    * Other files can only be decoded completely, which is not faster than the full decode.
+    */
+    DecodeStatus decodePreview(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, int32_t quality, Frame& preview,
+        CancelToken* cancel = 0);
+
+    /*!
+    * Decodes the first frame at a size that fits into max_size x max_size (0 for the full size), but not beyond the deadline.
+    *
+    * Interlaced files come in passes of growing detail. If the deadline hits before the last one, the latest
+    * completed pass is enlarged to the size and returned with partial set. Without a completed pass,
+    * e.g. for files that are not interlaced, the result is DS_CANCELLED.
+    * The frame is premultiplied BGRA, like the thumbnail.
+    */
+    DecodeStatus decodeWithDeadline(const std::shared_ptr<const InputBuffer>& input, uint32_t max_size, CancelToken::Clock::time_point deadline,
+        Frame& frame, bool& partial);
+
+    /*!
+    * What firstFramePasses() hands out. The frame is only valid during the call.
+    */
+    typedef std::function<void(const FrameView& pass)> PassCallback;
+
+    //! Passes take at most about 1 / (PASS_COST_FACTOR + 1) of the decoding thread.
+    const int PASS_COST_FACTOR = 4;
+
+    /*!
+    * A progress callback for Decoder::setProgressCallback() that hands each pass of the first frame to pass,
+    * for showing it while the decode goes on. Only interlaced files have passes.
+    *
+    * Copying a pass out of libflif holds up the decode, so a pass is skipped while less than PASS_COST_FACTOR
+    * times the time the last copy and call of pass took has gone by since then. The first pass is never skipped.
+    * Exceptions from pass are swallowed, the decode does not stop because a pass could not be shown.
+    */
+    Decoder::ProgressCallback firstFramePasses(PixelFormat format, const PassCallback& pass);
+
+    /*!
+    * Decodes a frame at width x height, at most the full size.
+    *
+    * Interlaced files are decoded at the smallest zoom level that is still at least that large, see zoomScale(),
+    * others completely. A box filter makes up the rest, for interlaced files that is less than a factor of two.
+    */
+    DecodeStatus decodeScaled(const std::shared_ptr<const InputBuffer>& input, size_t index, uint32_t width, uint32_t height, PixelFormat format, Frame& frame);
+}
\ No newline at end of file
@@ -44,6 +44,12 @@ public:
 
     flifDecoder& operator=(flifDecoder&& other)
     {
+        if(this == &other)
+            return *this;
+
+        if(_decoder != 0)
+            flif_destroy_decoder(_decoder);
+
         _decoder = other._decoder;
         other._decoder = 0;
         return *this;
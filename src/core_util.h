@@ -0,0 +1,237 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <wincodec.h>
+#include <algorithm>
+#include <climits>
+
+#include <Shlwapi.h>
+
+#include "util.h"
+#include "ByteSource.h"
+#include "MappedFile.h"
+#include "Decode.h"
+#include "DiskCache.h"
+#include "ImageCache.h"
+#include "RowBands.h"
+#include "TaskPool.h"
+#include "Thumbnail.h"
+
+/*!
+* Adapter from IStream to the byte source of the decode core.
+* Remembers the HRESULT of a failed read, so it can be passed on to the caller.
+*/
+class StreamByteSource : public flifcore::ByteSource
+{
+public:
+    StreamByteSource(IStream* stream)
+        : _stream(stream)
+        , _error(S_OK)
+    {
+    }
+
+    virtual bool read(uint8_t* buffer, size_t size, size_t& bytes_read) override
+    {
+        bytes_read = 0;
+
+        ULONG actually_read;
+        HRESULT hr = _stream->Read(buffer, static_cast<ULONG>(std::min<size_t>(size, ULONG_MAX)), &actually_read);
+        if(FAILED(hr))
+        {
+            _error = hr;
+            return false;
+        }
+
+        // not handling funky return codes, just the documented ones
+        if(hr != S_OK && hr != S_FALSE)
+        {
+            _error = E_UNEXPECTED;
+            return false;
+        }
+
+        bytes_read = actually_read;
+        return true;
+    }
+
+    virtual bool remainingSize(uint64_t& size) override
+    {
+        STATSTG stat;
+        if(FAILED(_stream->Stat(&stat, STATFLAG_NONAME)))
+            return false;
+
+        LARGE_INTEGER no_move;
+        no_move.QuadPart = 0;
+        ULARGE_INTEGER position;
+        if(FAILED(_stream->Seek(no_move, STREAM_SEEK_CUR, &position)))
+            return false;
+
+        if(position.QuadPart > stat.cbSize.QuadPart)
+            return false;
+
+        size = stat.cbSize.QuadPart - position.QuadPart;
+        return true;
+    }
+
+    /*!
+    * Streams opened on a file (SHCreateStreamOnFile, the shell) report the file name.
+    * The file is only mapped if it still matches the stream in size and modification time.
+    */
+    virtual std::shared_ptr<const flifcore::InputBuffer> mapRemaining() override
+    {
+        STATSTG stat;
+        if(FAILED(_stream->Stat(&stat, STATFLAG_DEFAULT)))
+            return std::shared_ptr<const flifcore::InputBuffer>();
+
+        std::wstring filename;
+        if(stat.pwcsName != 0)
+        {
+            filename = stat.pwcsName;
+            CoTaskMemFree(stat.pwcsName);
+        }
+
+        if(filename.empty() || PathIsRelativeW(filename.c_str()))
+            return std::shared_ptr<const flifcore::InputBuffer>();
+
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        if(!GetFileAttributesExW(filename.c_str(), GetFileExInfoStandard, &attributes))
+            return std::shared_ptr<const flifcore::InputBuffer>();
+
+        if(attributes.nFileSizeHigh != stat.cbSize.HighPart ||
+            attributes.nFileSizeLow != stat.cbSize.LowPart ||
+            CompareFileTime(&attributes.ftLastWriteTime, &stat.mtime) != 0)
+        {
+            return std::shared_ptr<const flifcore::InputBuffer>();
+        }
+
+        LARGE_INTEGER no_move;
+        no_move.QuadPart = 0;
+        ULARGE_INTEGER position;
+        if(FAILED(_stream->Seek(no_move, STREAM_SEEK_CUR, &position)))
+            return std::shared_ptr<const flifcore::InputBuffer>();
+
+        std::shared_ptr<flifcore::MappedFile> mapped_file = std::make_shared<flifcore::MappedFile>();
+        if(!mapped_file->open(filename, position.QuadPart))
+            return std::shared_ptr<const flifcore::InputBuffer>();
+
+        // leave the stream position where a complete read would have left it
+        LARGE_INTEGER end = { 0 };
+        _stream->Seek(end, STREAM_SEEK_END, 0);
+
+        return mapped_file;
+    }
+
+    HRESULT error() const
+    {
+        return _error;
+    }
+
+private:
+    IStream* _stream;
+    HRESULT _error;
+};
+
+/*!
+* Maps the stream if it is backed by a file, otherwise reads all of it.
+*/
+inline HRESULT acquireStream(IStream* stream, std::shared_ptr<const flifcore::InputBuffer>& input)
+{
+    StreamByteSource source(stream);
+    if(!flifcore::acquireAll(source, input))
+        return FAILED(source.error()) ? source.error() : E_FAIL;
+
+    return S_OK;
+}
+
+inline const WICPixelFormatGUID& toWICPixelFormat(flifcore::PixelFormat format)
+{
+    switch(format)
+    {
+    case flifcore::PF_GRAY8:
+        return GUID_WICPixelFormat8bppGray;
+    case flifcore::PF_BGR24:
+        return GUID_WICPixelFormat24bppBGR;
+    case flifcore::PF_PBGRA32:
+        return GUID_WICPixelFormat32bppPBGRA;
+    case flifcore::PF_RGBA64:
+        return GUID_WICPixelFormat64bppRGBA;
+    case flifcore::PF_RGBA32:
+        break;
+    }
+    return GUID_WICPixelFormat32bppRGBA;
+}
+
+/*!
+* @return False if the format is none of the formats in flifcore::PixelFormat.
+*/
+inline bool fromWICPixelFormat(const WICPixelFormatGUID& wic_format, flifcore::PixelFormat& format)
+{
+    for(auto candidate : { flifcore::PF_RGBA32, flifcore::PF_GRAY8, flifcore::PF_BGR24, flifcore::PF_PBGRA32, flifcore::PF_RGBA64 })
+    {
+        if(IsEqualGUID(wic_format, toWICPixelFormat(candidate)))
+        {
+            format = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+* Copies a frame into a new WIC bitmap, in the WIC format that matches the frame.
+*/
+inline HRESULT createWICBitmapSource(const flifcore::FrameView& frame, IWICBitmapSource** bitmap_source)
+{
+    if(bitmap_source == 0)
+        return E_INVALIDARG;
+
+    ComPtr<IWICImagingFactory> factory;
+    HRESULT hr = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, reinterpret_cast<LPVOID*>(factory.ptrptr()));
+    if(FAILED(hr))
+        return hr;
+
+    // WIC copies the buffer
+    ComPtr<IWICBitmap> bitmap;
+    hr = factory->CreateBitmapFromMemory(frame.width, frame.height, toWICPixelFormat(frame.format),
+        static_cast<UINT>(frame.stride()), static_cast<UINT>(frame.size()), const_cast<BYTE*>(frame.pixels), bitmap.ptrptr());
+    if(FAILED(hr))
+        return hr;
+
+    return bitmap->QueryInterface(IID_IWICBitmapSource, reinterpret_cast<void**>(bitmap_source));
+}
+
+inline HRESULT toHRESULT(flifcore::DecodeStatus status)
+{
+    switch(status)
+    {
+    case flifcore::DS_OK:
+        return S_OK;
+    case flifcore::DS_READ_FAILED:
+        return STG_E_READFAULT;
+    case flifcore::DS_DECODE_FAILED:
+        return E_FAIL;
+    case flifcore::DS_FRAME_MISSING:
+        return WINCODEC_ERR_FRAMEMISSING;
+    case flifcore::DS_SOURCE_CHANGED:
+        return WINCODEC_ERR_STREAMREAD;
+    case flifcore::DS_CANCELLED:
+        return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+    case flifcore::DS_TOO_LARGE:
+        return WINCODEC_ERR_IMAGESIZEOUTOFRANGE;
+    }
+    return E_UNEXPECTED;
+}
\ No newline at end of file
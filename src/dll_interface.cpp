@@ -18,13 +18,17 @@ limitations under the License.
 #include <Windows.h>
 #include <wincodec.h>
 #include <shlobj.h> // SHChangeNotify
+#include <mutex>
 
 #include "util.h"
 #include "plugin_guids.h"
 #include "flifBitmapDecoder.h"
 #include "flifPropertyHandler.h"
 #include "flifPreviewHandler.h"
+#include "flifThumbnailProvider.h"
 #include "ClassFactory.h"
+#include "CancelToken.h"
+#include "TaskPool.h"
 
 /*!
 * Global ref count of all object instances.
@@ -49,6 +53,21 @@ void DllRelease()
     InterlockedDecrement(&g_dll_object_ref_count);
 }
 
+/*!
+* Queued and running tasks of the shared pool count as objects of this DLL, so it is not unloaded under them.
+* The same goes for the deadline thread of CancelToken. Set before the first object exists, every task and deadline comes from one.
+* @see DllCanUnloadNow
+*/
+static void setActivityHooks()
+{
+    static std::once_flag hooks_set;
+    std::call_once(hooks_set, []()
+    {
+        flifcore::TaskPool::shared().setActivityHooks(DllAddRef, DllRelease);
+        flifcore::CancelToken::setWatcherHooks(DllAddRef, DllRelease);
+    });
+}
+
 HINSTANCE g_module_handle = 0;
 
 std::wstring getThisLibraryPath()
@@ -100,6 +119,7 @@ STDAPI DllRegisterServer()
         flifBitmapDecoder::registerClass(reg);
         flifPropertyHandler::registerClass(reg);
         flifPreviewHandler::registerClass(reg);
+        flifThumbnailProvider::registerClass(reg);
 
         if(!reg.getErrors().empty())
         {
@@ -122,6 +142,7 @@ STDAPI DllUnregisterServer()
         flifBitmapDecoder::unregisterClass(reg);
         flifPropertyHandler::unregisterClass(reg);
         flifPreviewHandler::unregisterClass(reg);
+        flifThumbnailProvider::unregisterClass(reg);
 
         if(!reg.getErrors().empty())
         {
@@ -141,6 +162,8 @@ STDAPI DllGetClassObject(REFCLSID clsid, REFIID iid, LPVOID *ppv)
         if (ppv == 0)
             return E_INVALIDARG;
 
+        setActivityHooks();
+
         if(IsEqualGUID(clsid, CLSID_flifBitmapDecoder))
         {
             ComPtr<ClassFactory<flifBitmapDecoder>> cf(new ClassFactory<flifBitmapDecoder>());
@@ -156,6 +179,11 @@ STDAPI DllGetClassObject(REFCLSID clsid, REFIID iid, LPVOID *ppv)
             ComPtr<ClassFactory<flifPreviewHandler>> cf(new ClassFactory<flifPreviewHandler>());
             return cf->QueryInterface(iid, ppv);
         }
+        if (IsEqualGUID(clsid, CLSID_flifThumbnailProvider))
+        {
+            ComPtr<ClassFactory<flifThumbnailProvider>> cf(new ClassFactory<flifThumbnailProvider>());
+            return cf->QueryInterface(iid, ppv);
+        }
 
         return CLASS_E_CLASSNOTAVAILABLE;
 
@@ -166,6 +194,14 @@ STDAPI DllCanUnloadNow()
 {
     CUSTOM_TRY
 
+        if(g_dll_object_ref_count != 0)
+            return S_FALSE;
+
+        // no task is left, but the threads of the pool may still be on their way out of the last one,
+        // and the deadline thread out of its last deadline. Joining them at DLL_PROCESS_DETACH could deadlock on the loader lock.
+        flifcore::TaskPool::shared().shutdown();
+        flifcore::CancelToken::joinWatcher();
+
         if(g_dll_object_ref_count == 0)
             return S_OK;
         else
@@ -16,10 +16,40 @@ limitations under the License.
 
 #include "flifBitmapDecoder.h"
 #include "plugin_guids.h"
+#include "core_util.h"
+
+/*!
+* Longer side of the thumbnails returned by GetThumbnail. Explorer asks the thumbnail provider for its own sizes.
+*/
+static const uint32_t THUMBNAIL_SIZE = 256;
+
+/*!
+* GetPreview decodes interlaced files only up to the zoom level for about this size.
+*/
+static const uint32_t PREVIEW_SIZE = 1024;
+
+/*!
+* A preview is meant to be fast. After this time GetPreview returns the passes decoded so far, or waits for the first one.
+*/
+static const std::chrono::milliseconds PREVIEW_TIME_BUDGET(250);
+
+/*!
+* Above this decoded size, all frames are copied out of libflif at once and the libflif images are released.
+* libflif keeps its images in a larger format than 8 bit RGBA, so keeping both would roughly double the memory.
+*/
+static const uint64_t MEMORY_BUDGET_BYTES = 256 * 1024 * 1024;
+
+/*!
+* Copies of at most this part of a frame that is not decoded yet only decode the rectangle, see RegionCache.
+*/
+static const uint64_t REGION_MAX_FRACTION = 4;
 
 flifBitmapFrameDecode::flifBitmapFrameDecode()
-: _width(0)
-, _height(0)
+    : _width(0)
+    , _height(0)
+    , _format(flifcore::PF_RGBA32)
+    , _index(0)
+    , _frame_ready(false)
 {
     DllAddRef();
 }
@@ -38,6 +68,8 @@ STDMETHODIMP flifBitmapFrameDecode::QueryInterface(REFIID iid, void** ppvObject)
         *ppvObject = static_cast<IWICBitmapFrameDecode*>(this);
     else if (IsEqualGUID(iid, IID_IWICBitmapSource))
         *ppvObject = static_cast<IWICBitmapSource*>(this);
+    else if (IsEqualGUID(iid, IID_IWICBitmapSourceTransform))
+        *ppvObject = static_cast<IWICBitmapSourceTransform*>(this);
     else
     {
         *ppvObject = 0;
@@ -69,7 +101,7 @@ HRESULT STDMETHODCALLTYPE flifBitmapFrameDecode::GetPixelFormat(WICPixelFormatGU
         if(pPixelFormat == 0)
             return E_INVALIDARG;
 
-        *pPixelFormat = GUID_WICPixelFormat32bppRGBA;
+        *pPixelFormat = toWICPixelFormat(_format);
         return S_OK;
 
     CUSTOM_CATCH_RETURN_HRESULT
@@ -98,57 +130,94 @@ HRESULT STDMETHODCALLTYPE flifBitmapFrameDecode::CopyPalette(IWICPalette* pIPale
     CUSTOM_CATCH_RETURN_HRESULT
 }
 
-HRESULT STDMETHODCALLTYPE flifBitmapFrameDecode::CopyPixels(const WICRect* rect_to_copy, UINT cbStride, UINT cbBufferSize, BYTE* pbBuffer)
+/*!
+* Checks the arguments of both CopyPixels methods.
+* @param width, height Size of the image that the rect refers to.
+* @param copy Receives the rect to copy, the whole image if rect_to_copy is 0.
+*/
+static HRESULT checkCopyArguments(const WICRect* rect_to_copy, UINT width, UINT height, UINT bytesPerPixel, UINT cbStride, UINT cbBufferSize, WICRect& copy)
 {
-    CUSTOM_TRY
-
-        UINT copy_x = 0;
-        UINT copy_y = 0;
-        UINT copy_width = _width;
-        UINT copy_height = _height;
-        if(rect_to_copy != 0)
+    copy.X = 0;
+    copy.Y = 0;
+    copy.Width = width;
+    copy.Height = height;
+    if(rect_to_copy != 0)
+    {
+        // negative numbers?
+        if (rect_to_copy->X < 0 ||
+            rect_to_copy->Y < 0 ||
+            rect_to_copy->Width < 0 ||
+            rect_to_copy->Height < 0)
         {
-            // negative numbers?
-            if (rect_to_copy->X < 0 ||
-                rect_to_copy->Y < 0 ||
-                rect_to_copy->Width < 0 ||
-                rect_to_copy->Height < 0)
-            {
-                return E_INVALIDARG;
-            }
-
-            copy_x = rect_to_copy->X;
-            copy_y = rect_to_copy->Y;
-            copy_width = rect_to_copy->Width;
-            copy_height = rect_to_copy->Height;
+            return E_INVALIDARG;
         }
 
-        // copy rect out of bounds?
+        copy = *rect_to_copy;
+    }
 
-        if (copy_x + copy_width > _width ||
-            copy_y + copy_height > _height)
-            return E_INVALIDARG;
+    // copy rect out of bounds?
 
-        UINT bytesPerPixel = 4;
+    if (UINT(copy.X) + UINT(copy.Width) > width ||
+        UINT(copy.Y) + UINT(copy.Height) > height)
+        return E_INVALIDARG;
 
-        // stride too small?
-        if(cbStride / bytesPerPixel < copy_width)
-            return E_INVALIDARG;
+    // stride too small?
+    if(cbStride == 0 || cbStride / bytesPerPixel < UINT(copy.Width))
+        return E_INVALIDARG;
+
+    // buffer too small?
+    if(cbBufferSize / cbStride < UINT(copy.Height))
+        return WINCODEC_ERR_INSUFFICIENTBUFFER;
+
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE flifBitmapFrameDecode::CopyPixels(const WICRect* rect_to_copy, UINT cbStride, UINT cbBufferSize, BYTE* pbBuffer)
+{
+    CUSTOM_TRY
+
+        UINT bytesPerPixel = static_cast<UINT>(flifcore::bytesPerPixel(_format));
 
-        // buffer too small?
-        if(cbBufferSize / cbStride < copy_height)
-            return WINCODEC_ERR_INSUFFICIENTBUFFER;
+        WICRect copy;
+        HRESULT hr = checkCopyArguments(rect_to_copy, _width, _height, bytesPerPixel, cbStride, cbBufferSize, copy);
+        if(FAILED(hr))
+            return hr;
 
         // all parameters are ok, copy without further checks
-        for(UINT y = 0; y < copy_height; ++y)
+        std::shared_ptr<const flifcore::CachedImage> cached;
         {
-            flifRGBA* src_line_start = _pixels.data() + (y + copy_y) * _width;
-            BYTE* dst_line_start = pbBuffer + y * cbStride;
+            std::lock_guard<CriticalSection> lock(_cs_frame);
 
-            memcpy(dst_line_start, src_line_start, copy_width * bytesPerPixel);
+            // another object of this process may have decoded the file meanwhile
+            if(!_frame_ready)
+                useCachedImage(flifcore::ImageCache::shared().find(_key));
+
+            // a viewer zoomed into a large image: decode only around the rectangle until the whole frame is needed
+            const bool small_rect = uint64_t(copy.Width) * copy.Height * REGION_MAX_FRACTION <= uint64_t(_width) * _height;
+            if(!_frame_ready && small_rect)
+                return toHRESULT(_regions->copyPixels(copy.X, copy.Y, copy.Width, copy.Height, pbBuffer, cbStride));
+
+            hr = prepareFrame();
+            if(FAILED(hr))
+                return hr;
+
+            cached = _cached;
         }
 
-        return S_OK;
+        if(cached)
+        {
+            const flifcore::FrameView& frame = cached->frames[_index];
+            for(INT y = 0; y < copy.Height; ++y)
+            {
+                memcpy(pbBuffer + y * cbStride,
+                    frame.pixels + (copy.Y + y) * frame.stride() + copy.X * bytesPerPixel,
+                    copy.Width * bytesPerPixel);
+            }
+            return S_OK;
+        }
+
+        // the first copy of the whole frame goes straight from libflif into pbBuffer
+        return toHRESULT(_frame.copyPixels(copy.X, copy.Y, copy.Width, copy.Height, pbBuffer, cbStride));
 
     CUSTOM_CATCH_RETURN_HRESULT
 }
@@ -180,7 +249,124 @@ HRESULT STDMETHODCALLTYPE flifBitmapFrameDecode::GetThumbnail( IWICBitmapSource*
 {
     CUSTOM_TRY
 
-        return WINCODEC_ERR_CODECNOTHUMBNAIL;
+        if(thumbnail == 0)
+            return E_INVALIDARG;
+
+        // the thumbnail shows the first frame
+        if(_index != 0 || !_input)
+            return WINCODEC_ERR_CODECNOTHUMBNAIL;
+
+        std::shared_ptr<const flifcore::CachedImage> image;
+        HRESULT hr = toHRESULT(flifcore::TaskPool::shared().runAndWait(flifcore::TP_THUMBNAIL, [&]()
+        {
+            return flifcore::decodeThumbnailCached(_input, THUMBNAIL_SIZE, flifcore::ImageCache::shared().diskCache().get(), image);
+        }));
+        if(FAILED(hr))
+            return hr;
+
+        return createWICBitmapSource(image->frames[0], thumbnail);
+
+    CUSTOM_CATCH_RETURN_HRESULT
+}
+
+// IWICBitmapSourceTransform methods
+HRESULT STDMETHODCALLTYPE flifBitmapFrameDecode::CopyPixels(const WICRect* prc, UINT uiWidth, UINT uiHeight, WICPixelFormatGUID* pguidDstFormat,
+    WICBitmapTransformOptions dstTransform, UINT nStride, UINT cbBufferSize, BYTE* pbBuffer)
+{
+    CUSTOM_TRY
+
+        if(pguidDstFormat == 0 || pbBuffer == 0)
+            return E_INVALIDARG;
+
+        // see DoesSupportTransform
+        if(dstTransform != WICBitmapTransformRotate0)
+            return E_INVALIDARG;
+
+        flifcore::PixelFormat format;
+        if(!fromWICPixelFormat(*pguidDstFormat, format))
+            return WINCODEC_ERR_UNSUPPORTEDPIXELFORMAT;
+
+        // only sizes from GetClosestSize
+        if(uiWidth == 0 || uiHeight == 0 || uiWidth > _width || uiHeight > _height)
+            return E_INVALIDARG;
+
+        // nothing to transform, keep the direct copy of the frame
+        if(uiWidth == _width && uiHeight == _height && format == _format)
+            return CopyPixels(prc, nStride, cbBufferSize, pbBuffer);
+
+        // the rect is in the coordinates of the scaled frame
+        const UINT bytesPerPixel = static_cast<UINT>(flifcore::bytesPerPixel(format));
+        WICRect copy;
+        HRESULT hr = checkCopyArguments(prc, uiWidth, uiHeight, bytesPerPixel, nStride, cbBufferSize, copy);
+        if(FAILED(hr))
+            return hr;
+
+        std::lock_guard<CriticalSection> lock(_cs_scaled);
+
+        if(_scaled.pixels.empty() || _scaled.width != uiWidth || _scaled.height != uiHeight || _scaled.format != format)
+        {
+            // decodes only the zoom level needed for this size
+            hr = toHRESULT(flifcore::decodeScaled(_input, _index, uiWidth, uiHeight, format, _scaled));
+            if(FAILED(hr))
+            {
+                _scaled = flifcore::Frame();
+                return hr;
+            }
+        }
+
+        for(INT y = 0; y < copy.Height; ++y)
+        {
+            memcpy(pbBuffer + y * nStride,
+                _scaled.pixels.data() + (copy.Y + y) * _scaled.stride() + copy.X * bytesPerPixel,
+                copy.Width * bytesPerPixel);
+        }
+
+        return S_OK;
+
+    CUSTOM_CATCH_RETURN_HRESULT
+}
+
+HRESULT STDMETHODCALLTYPE flifBitmapFrameDecode::GetClosestSize(UINT* puiWidth, UINT* puiHeight)
+{
+    CUSTOM_TRY
+
+        if(puiWidth == 0 || puiHeight == 0)
+            return E_INVALIDARG;
+
+        // any size up to the full one: the next zoom level plus a box filter
+        *puiWidth = std::max<UINT>(1, std::min<UINT>(*puiWidth, _width));
+        *puiHeight = std::max<UINT>(1, std::min<UINT>(*puiHeight, _height));
+        return S_OK;
+
+    CUSTOM_CATCH_RETURN_HRESULT
+}
+
+HRESULT STDMETHODCALLTYPE flifBitmapFrameDecode::GetClosestPixelFormat(WICPixelFormatGUID* pguidDstFormat)
+{
+    CUSTOM_TRY
+
+        if(pguidDstFormat == 0)
+            return E_INVALIDARG;
+
+        flifcore::PixelFormat format;
+        if(!fromWICPixelFormat(*pguidDstFormat, format))
+            *pguidDstFormat = toWICPixelFormat(_format);
+
+        return S_OK;
+
+    CUSTOM_CATCH_RETURN_HRESULT
+}
+
+HRESULT STDMETHODCALLTYPE flifBitmapFrameDecode::DoesSupportTransform(WICBitmapTransformOptions dstTransform, BOOL* pfIsSupported)
+{
+    CUSTOM_TRY
+
+        if(pfIsSupported == 0)
+            return E_INVALIDARG;
+
+        // no rotating or flipping, WIC does that
+        *pfIsSupported = dstTransform == WICBitmapTransformRotate0;
+        return S_OK;
 
     CUSTOM_CATCH_RETURN_HRESULT
 }
@@ -188,31 +374,150 @@ HRESULT STDMETHODCALLTYPE flifBitmapFrameDecode::GetThumbnail( IWICBitmapSource*
 /*!
 * Init function. Call directly after construction, and before the interface is handed over to other modules.
 */
-void flifBitmapFrameDecode::extractFrame(const flifDecoder& decoder, int index)
+HRESULT flifBitmapFrameDecode::init(const std::shared_ptr<flifcore::Decoder>& decoder, size_t index)
+{
+    // size and format are fixed here, pixels are converted on demand by the thread safe LazyFrame
+    // the format follows the image, so the usual consumers need no extra format converter
+
+    _input = decoder->input();
+    _index = index;
+    _format = flifcore::choosePixelFormat(decoder->info());
+
+    HRESULT hr = toHRESULT(_frame.init(decoder, index, _format));
+    if(FAILED(hr))
+        return hr;
+
+    _width = _frame.width();
+    _height = _frame.height();
+    _frame_ready = true;
+    return S_OK;
+}
+
+/*!
+* Init function for still images, instead of init(). Nothing is decoded yet, the size is taken from the header.
+* Small rectangles are decoded on their own, the first larger copy decodes the whole frame with an own decoder.
+*/
+void flifBitmapFrameDecode::initDeferred(const std::shared_ptr<const flifcore::InputBuffer>& input, const flifcore::ImageInfo& info, const flifcore::ImageKey& key)
+{
+    _input = input;
+    _key = key;
+    _index = 0;
+    _format = flifcore::choosePixelFormat(info);
+    _width = info.width;
+    _height = info.height;
+    _frame_ready = false;
+    _regions.reset(new flifcore::RegionCache(input, 0, info.width, info.height, _format));
+}
+
+/*!
+* Init function for frames of an image from the ImageCache, instead of init().
+*/
+HRESULT flifBitmapFrameDecode::initCached(const std::shared_ptr<const flifcore::InputBuffer>& input, const std::shared_ptr<const flifcore::CachedImage>& image, size_t index)
+{
+    if(index >= image->frames.size())
+        return WINCODEC_ERR_FRAMEMISSING;
+
+    const flifcore::FrameView& frame = image->frames[index];
+    _input = input;
+    _index = index;
+    _format = frame.format;
+    _width = frame.width;
+    _height = frame.height;
+    _cached = image;
+    _frame_ready = true;
+    return S_OK;
+}
+
+/*!
+* Takes the frame from a cached image. Call with _cs_frame locked.
+* @return False if image is 0 or misses the frame.
+*/
+bool flifBitmapFrameDecode::useCachedImage(const std::shared_ptr<const flifcore::CachedImage>& image)
+{
+    if(!image || _index >= image->frames.size())
+        return false;
+
+    // copyPixels() checks the rectangle against the header size only
+    const flifcore::FrameView& frame = image->frames[_index];
+    if(frame.width != _width || frame.height != _height || frame.format != _format)
+        return false;
+
+    _cached = image;
+    _frame_ready = true;
+    if(_regions)
+        _regions->clear();
+    return true;
+}
+
+/*!
+* Decodes the whole frame of a deferred frame, if not done yet. Call with _cs_frame locked.
+*/
+HRESULT flifBitmapFrameDecode::prepareFrame()
 {
-    // this function is the only place where the members are changed
-    // and it is only called immediately after construction
-    // therefore, the frame data is immutable and needs need locks for multithread access
+    if(_frame_ready)
+        return S_OK;
+
+    // through the cache, so other objects opening the same file get the pixels for free
+    if(flifcore::ImageCache::shared().fits(uint64_t(_width) * _height * flifcore::bytesPerPixel(_format)))
+    {
+        std::shared_ptr<const flifcore::CachedImage> image;
+        HRESULT hr = toHRESULT(flifcore::TaskPool::shared().runAndWait(flifcore::TP_INTERACTIVE, [&]()
+        {
+            return flifcore::ImageCache::shared().decode(_input, _key, image);
+        }));
+        if(FAILED(hr))
+            return hr;
+
+        return useCachedImage(image) ? S_OK : WINCODEC_ERR_FRAMEMISSING;
+    }
+
+    std::shared_ptr<flifcore::Decoder> decoder = std::make_shared<flifcore::Decoder>();
+    HRESULT hr = toHRESULT(decoder->decode(_input));
+    if(FAILED(hr))
+        return hr;
+
+    hr = toHRESULT(_frame.init(decoder, _index, _format));
+    if(FAILED(hr))
+        return hr;
+
+    // the frame is the only user of this decoder, see MEMORY_BUDGET_BYTES
+    if(decoder->info().rgba8Bytes() > MEMORY_BUDGET_BYTES)
+    {
+        hr = toHRESULT(_frame.materialize());
+        if(FAILED(hr))
+            return hr;
+    }
 
-    FLIF_IMAGE* image = flif_decoder_get_image(decoder, index);
-    if(image == 0)
-        return;
+    _frame_ready = true;
+    _regions->clear();
+    return S_OK;
+}
 
-    uint32_t w = flif_image_get_width(image);
-    uint32_t h = flif_image_get_height(image);
+/*!
+* Copies the pixels out of libflif, so the decoder can release its images.
+*/
+HRESULT flifBitmapFrameDecode::materialize()
+{
+    std::lock_guard<CriticalSection> lock(_cs_frame);
+
+    HRESULT hr = prepareFrame();
+    if(FAILED(hr))
+        return hr;
 
-    _width = w;
-    _height = h;
-    _pixels.resize(w*h);
+    // cached frames are own buffers already
+    if(_cached)
+        return S_OK;
 
-    for(uint32_t y = 0; y < h; ++y)
-        flif_image_read_row_RGBA8(image, y, _pixels.data() + y*w, w*4);
+    return toHRESULT(_frame.materialize());
 }
 
 //=============================================================================
 
 flifBitmapDecoder::flifBitmapDecoder()
     : _initialized(false)
+    , _decoder(std::make_shared<flifcore::Decoder>())
+    , _frame_count(0)
+    , _decoder_used(false)
 {
     DllAddRef();
 }
@@ -265,22 +570,31 @@ HRESULT STDMETHODCALLTYPE flifBitmapDecoder::Initialize(IStream* stream, WICDeco
 
         std::lock_guard<CriticalSection> lock(_cs_init_data);
 
-        if(_decoder == 0)
-            return E_FAIL;
-
         // already initialized?
-        if(_initialized)
+        if(_initialized.load(std::memory_order_acquire))
             return E_FAIL;
-        
-        std::vector<BYTE> bytes;
-        HRESULT hr = streamReadAll(stream, bytes);
+
+        // the decoder keeps the input alive, so a mapped file stays mapped as long as this object exists
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        HRESULT hr = acquireStream(stream, input);
         if(FAILED(hr))
             return hr;
 
-        if(flif_decoder_decode_memory(_decoder, bytes.data(), bytes.size()) == 0)
-            return E_FAIL;
+        // only the header for now, pixels are decoded when the first frame is requested
+        hr = toHRESULT(_decoder->open(input));
+        if(FAILED(hr))
+            return hr;
+
+        // not even a zoom level of one pixel per frame fits, this also bounds the frame count
+        const flifcore::ImageInfo& info = _decoder->info();
+        if(info.frame_count > UINT_MAX || flifcore::DecodeLimits::defaults().fittingScale(info) == 0)
+            return WINCODEC_ERR_IMAGESIZEOUTOFRANGE;
 
-        _initialized = true;
+        _frame_count = static_cast<UINT>(info.frame_count);
+        _frames.reset(new FrameSlots(_frame_count));
+
+        // publishes the members above to the methods that do not lock
+        _initialized.store(true, std::memory_order_release);
 
         return S_OK;
 
@@ -342,7 +656,36 @@ HRESULT STDMETHODCALLTYPE flifBitmapDecoder::GetPreview(IWICBitmapSource** bitma
 {
     CUSTOM_TRY
 
-        return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+        if(bitmap_source == 0)
+            return E_INVALIDARG;
+
+        if(!_initialized.load(std::memory_order_acquire))
+            return WINCODEC_ERR_NOTINITIALIZED;
+
+        // only interlaced files can stop early, anything else takes as long as the full decode
+        if(!_decoder->info().interlaced)
+            return WINCODEC_ERR_UNSUPPORTEDOPERATION;
+
+        const std::shared_ptr<const flifcore::InputBuffer>& input = _decoder->input();
+
+        // the coarse zoom level alone is fast, large files may still need more than the budget for it
+        flifcore::Frame frame;
+        HRESULT hr = toHRESULT(flifcore::TaskPool::shared().runAndWait(flifcore::TP_INTERACTIVE, [&]()
+        {
+            // the budget starts when the decode does, not while the task waits in the queue
+            bool partial;
+            const flifcore::CancelToken::Clock::time_point deadline = flifcore::CancelToken::Clock::now() + PREVIEW_TIME_BUDGET;
+            flifcore::DecodeStatus status = flifcore::decodeWithDeadline(input, PREVIEW_SIZE, deadline, frame, partial);
+
+            // no pass within the budget: a preview late is better than none, the coarse zoom level is still the fastest
+            if(status == flifcore::DS_CANCELLED)
+                status = flifcore::decodePreview(input, PREVIEW_SIZE, 100, frame);
+            return status;
+        }));
+        if(FAILED(hr))
+            return hr;
+
+        return createWICBitmapSource(frame.view(), bitmap_source);
 
     CUSTOM_CATCH_RETURN_HRESULT
 }
@@ -364,7 +707,24 @@ HRESULT STDMETHODCALLTYPE flifBitmapDecoder::GetThumbnail(IWICBitmapSource** thu
 {
     CUSTOM_TRY
 
-        return WINCODEC_ERR_CODECNOTHUMBNAIL;
+        if(thumbnail == 0)
+            return E_INVALIDARG;
+
+        if(!_initialized.load(std::memory_order_acquire))
+            return WINCODEC_ERR_NOTINITIALIZED;
+
+        const std::shared_ptr<const flifcore::InputBuffer>& input = _decoder->input();
+
+        // an own reduced decode, independent of the full size frames
+        std::shared_ptr<const flifcore::CachedImage> image;
+        HRESULT hr = toHRESULT(flifcore::TaskPool::shared().runAndWait(flifcore::TP_THUMBNAIL, [&]()
+        {
+            return flifcore::decodeThumbnailCached(input, THUMBNAIL_SIZE, flifcore::ImageCache::shared().diskCache().get(), image);
+        }));
+        if(FAILED(hr))
+            return hr;
+
+        return createWICBitmapSource(image->frames[0], thumbnail);
 
     CUSTOM_CATCH_RETURN_HRESULT
 }
@@ -373,44 +733,174 @@ HRESULT STDMETHODCALLTYPE flifBitmapDecoder::GetFrameCount(UINT* count)
 {
     CUSTOM_TRY
 
-        std::lock_guard<CriticalSection> lock(_cs_init_data);
+        if(count == 0)
+            return E_INVALIDARG;
 
-        // check limits before truncating value
-        size_t n = flif_decoder_num_images(_decoder);
-        if(n > UINT_MAX)
-            return E_FAIL;
+        if(!_initialized.load(std::memory_order_acquire))
+            return WINCODEC_ERR_NOTINITIALIZED;
 
-        *count = static_cast<UINT>(n);
+        // from the header, does not need the pixels
+        *count = _frame_count;
         return S_OK;
 
     CUSTOM_CATCH_RETURN_HRESULT
 }
 
-HRESULT STDMETHODCALLTYPE flifBitmapDecoder::GetFrame(UINT index, IWICBitmapFrameDecode** bitmap_frame)
+/*!
+* Publishes the frame unless another thread was faster.
+* @param published Receives the frame that is in the slot now.
+*/
+void flifBitmapDecoder::publishFrame(UINT index, const ComPtr<flifBitmapFrameDecode>& frame, flifBitmapFrameDecode*& published)
 {
-    CUSTOM_TRY
+    // the reference of the slot, dropped again by the slot if the frame is not taken
+    frame->AddRef();
+    published = _frames->publish(index, frame.get());
+}
 
-        std::lock_guard<CriticalSection> lock(_cs_init_data);
+/*!
+* Memory budget mode: decode once, copy all frames, then release libflif.
+* Call with _cs_decoder locked.
+*/
+HRESULT flifBitmapDecoder::materializeAllFrames()
+{
+    HRESULT hr = toHRESULT(_decoder->decodePixels());
+    if(FAILED(hr))
+        return hr;
 
-        if(index >= flif_decoder_num_images(_decoder))
-            return WINCODEC_ERR_FRAMEMISSING;
+    // the header may promise more frames than the data holds
+    const size_t frame_count = std::min<size_t>(_decoder->frameCount(), _frame_count);
+
+    for(UINT i = 0; i < frame_count; ++i)
+    {
+        flifBitmapFrameDecode* frame = _frames->get(i);
+        if(frame == 0)
+        {
+            ComPtr<flifBitmapFrameDecode> created(new flifBitmapFrameDecode());
+            hr = created->init(_decoder, i);
+            if(FAILED(hr))
+                return hr;
+
+            publishFrame(i, created, frame);
+        }
+
+        // frames published by other threads meanwhile come from the cache, they have own buffers already
+        hr = frame->materialize();
+        if(FAILED(hr))
+            return hr;
+    }
+
+    // no frame references the libflif images anymore
+    _decoder->releaseImages();
+    return S_OK;
+}
 
-        if(_frames.size() < flif_decoder_num_images(_decoder))
-            _frames.resize(flif_decoder_num_images(_decoder));
+/*!
+* Creates and publishes the frame, for the first GetFrame of this index.
+* Several threads may do so at the same time, only one frame is published.
+* Only frames that read from the shared decoder are created one at a time.
+*/
+HRESULT flifBitmapDecoder::createFrame(UINT index, flifBitmapFrameDecode*& published)
+{
+    // fixed since Initialize
+    const flifcore::ImageInfo& info = _decoder->info();
+    const std::shared_ptr<const flifcore::InputBuffer>& input = _decoder->input();
 
-        if(_frames[index].get() == 0)
+    if(!_decoder_used.load(std::memory_order_acquire))
+    {
+        // the whole input is hashed once, decoded images are shared through the cache with the other objects of this process
+        const flifcore::PixelFormat format = flifcore::choosePixelFormat(info);
+        std::call_once(_key_once, [&]()
         {
-            // lazy init for each requested frame
+            _key = flifcore::ImageCache::key(*input, format);
+        });
+
+        std::shared_ptr<const flifcore::CachedImage> cached = flifcore::ImageCache::shared().find(_key);
+
+        // animations are decoded at once anyway, threads asking for other frames meanwhile wait for the same decode
+        if(!cached && _frame_count > 1 &&
+            flifcore::ImageCache::shared().fits(flifcore::ImageCache::decodedBytes(info, format)))
+        {
+            HRESULT hr = toHRESULT(flifcore::TaskPool::shared().runAndWait(flifcore::TP_INTERACTIVE, [&]()
+            {
+                return flifcore::ImageCache::shared().decode(input, _key, cached);
+            }));
+            if(FAILED(hr))
+                return hr;
+        }
 
+        if(cached)
+        {
             ComPtr<flifBitmapFrameDecode> frame(new flifBitmapFrameDecode());
-            frame->extractFrame(_decoder, index);
+            HRESULT hr = frame->initCached(input, cached, index);
+            if(FAILED(hr))
+                return hr;
 
-            _frames[index] = std::move(frame);
+            publishFrame(index, frame, published);
+            return S_OK;
         }
 
-        _frames[index]->QueryInterface(IID_IWICBitmapFrameDecode, reinterpret_cast<void**>(bitmap_frame));
+        if(_frame_count == 1)
+        {
+            // a still image needs no shared decoder, the frame decodes what is copied
+            ComPtr<flifBitmapFrameDecode> frame(new flifBitmapFrameDecode());
+            frame->initDeferred(input, info, _key);
+            publishFrame(index, frame, published);
+            return S_OK;
+        }
+    }
+
+    std::lock_guard<CriticalSection> lock(_cs_decoder);
+    _decoder_used.store(true, std::memory_order_release);
+
+    // created by another thread while this one waited
+    published = _frames->get(index);
+    if(published != 0)
         return S_OK;
 
+    if(info.rgba8Bytes() > MEMORY_BUDGET_BYTES)
+    {
+        HRESULT hr = materializeAllFrames();
+        if(FAILED(hr))
+            return hr;
+
+        published = _frames->get(index);
+        return published != 0 ? S_OK : WINCODEC_ERR_FRAMEMISSING;
+    }
+
+    // the first one also decodes the pixels, later ones only convert on demand and in parallel
+    ComPtr<flifBitmapFrameDecode> frame(new flifBitmapFrameDecode());
+    HRESULT hr = frame->init(_decoder, index);
+    if(FAILED(hr))
+        return hr;
+
+    publishFrame(index, frame, published);
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE flifBitmapDecoder::GetFrame(UINT index, IWICBitmapFrameDecode** bitmap_frame)
+{
+    CUSTOM_TRY
+
+        if(bitmap_frame == 0)
+            return E_INVALIDARG;
+
+        if(!_initialized.load(std::memory_order_acquire))
+            return WINCODEC_ERR_NOTINITIALIZED;
+
+        if(index >= _frame_count)
+            return WINCODEC_ERR_FRAMEMISSING;
+
+        // once a frame is published, no lock is taken
+        flifBitmapFrameDecode* frame = _frames->get(index);
+        if(frame == 0)
+        {
+            HRESULT hr = createFrame(index, frame);
+            if(FAILED(hr))
+                return hr;
+        }
+
+        return frame->QueryInterface(IID_IWICBitmapFrameDecode, reinterpret_cast<void**>(bitmap_frame));
+
     CUSTOM_CATCH_RETURN_HRESULT
 }
 
@@ -425,46 +915,12 @@ HRESULT flifBitmapDecoder::checkStreamIsFLIF(IStream* stream)
     if(bytes_read < 4)
         return WINCODEC_ERR_BADHEADER;
 
-    if(memcpy(buffer, "FLIF", 4) != 0)
+    if(memcmp(buffer, "FLIF", 4) != 0)
         return WINCODEC_ERR_BADHEADER;
 
     return S_OK;
 }
 
-HRESULT flifBitmapDecoder::streamReadAll(IStream* stream, std::vector<BYTE>& bytes)
-{
-    const size_t GROWTH_STEP = 10000;
-
-    size_t bytes_filled_counter = 0;
-
-    while(true)
-    {
-        bytes.resize(bytes.size() + GROWTH_STEP);
-
-        ULONG actually_read;
-        HRESULT hr = stream->Read(bytes.data() + bytes_filled_counter, GROWTH_STEP, &actually_read);
-        if(FAILED(hr))
-            return hr;
-
-        // exit condition: read less than what was requested
-        if(actually_read < GROWTH_STEP)
-        {
-            // not handling funky return codes, just the documented ones
-            if(hr != S_OK && hr != S_FALSE)
-                return E_UNEXPECTED;
-
-            // remove unused bytes
-            bytes.resize(bytes_filled_counter + actually_read);
-            return S_OK;
-        }
-
-        bytes_filled_counter += actually_read;
-    }
-
-    // For completeness. Because both success and fail are handled in the while-loop, this line can never be reached.
-    return E_UNEXPECTED;
-}
-
 void flifBitmapDecoder::registerClass(RegistryManager& reg)
 {
     {
@@ -480,8 +936,9 @@ void flifBitmapDecoder::registerClass(RegistryManager& reg)
         reg.writeDWORD(k, L"SupportLossless ", 1);
         reg.writeDWORD(k, L"SupportMultiframe", 0);
     }
+    for(auto format : { flifcore::PF_GRAY8, flifcore::PF_BGR24, flifcore::PF_PBGRA32, flifcore::PF_RGBA64 })
     {
-        auto k = reg.key(HKEY_CLASSES_ROOT, L"CLSID\\" + to_wstring(CLSID_flifBitmapDecoder) + L"\\Formats\\" + to_wstring(GUID_WICPixelFormat32bppRGBA));
+        auto k = reg.key(HKEY_CLASSES_ROOT, L"CLSID\\" + to_wstring(CLSID_flifBitmapDecoder) + L"\\Formats\\" + to_wstring(toWICPixelFormat(format)));
         reg.writeString(k, L"", L"");
     }
     {
@@ -522,10 +979,6 @@ void flifBitmapDecoder::registerClass(RegistryManager& reg)
         reg.writeString(k, L"", L"{FFE2A43C-56B9-4bf5-9A79-CC6D4285608A}");
     }
 
-    {
-        auto k = reg.key(HKEY_CLASSES_ROOT, L".flif\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}");
-        reg.writeString(k, L"", L"{C7657C4A-9F68-40fa-A4DF-96BC08EB3551}");
-    }
     {
         auto k = reg.key(HKEY_CLASSES_ROOT, L".flif\\ShellEx\\ContextMenuHandlers\\ShellImagePreview");
         reg.writeString(k, L"", L"{FFE2A43C-56B9-4bf5-9A79-CC6D4285608A}");
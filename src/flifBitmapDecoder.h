@@ -17,12 +17,19 @@ limitations under the License.
 #pragma once
 
 #include <wincodec.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 #include "util.h"
 #include "RegistryManager.h"
-#include "flifWrapper.h"
+#include "AtomicSlots.h"
+#include "Decode.h"
+#include "ImageCache.h"
+#include "LazyFrame.h"
+#include "RegionCache.h"
 
-class flifBitmapFrameDecode : public IWICBitmapFrameDecode
+class flifBitmapFrameDecode : public IWICBitmapFrameDecode, public IWICBitmapSourceTransform
 {
 public:
     flifBitmapFrameDecode();
@@ -45,14 +52,41 @@ public:
     virtual HRESULT STDMETHODCALLTYPE GetColorContexts(UINT cCount, IWICColorContext** color_contexts, UINT* actual_count) override;
     virtual HRESULT STDMETHODCALLTYPE GetThumbnail( IWICBitmapSource** thumbnail) override;
 
-    void extractFrame(const flifDecoder& decoder, int index);
+    // IWICBitmapSourceTransform methods
+    virtual HRESULT STDMETHODCALLTYPE CopyPixels(const WICRect* prc, UINT uiWidth, UINT uiHeight, WICPixelFormatGUID* pguidDstFormat,
+        WICBitmapTransformOptions dstTransform, UINT nStride, UINT cbBufferSize, BYTE* pbBuffer) override;
+    virtual HRESULT STDMETHODCALLTYPE GetClosestSize(UINT* puiWidth, UINT* puiHeight) override;
+    virtual HRESULT STDMETHODCALLTYPE GetClosestPixelFormat(WICPixelFormatGUID* pguidDstFormat) override;
+    virtual HRESULT STDMETHODCALLTYPE DoesSupportTransform(WICBitmapTransformOptions dstTransform, BOOL* pfIsSupported) override;
+
+    HRESULT init(const std::shared_ptr<flifcore::Decoder>& decoder, size_t index);
+    void initDeferred(const std::shared_ptr<const flifcore::InputBuffer>& input, const flifcore::ImageInfo& info, const flifcore::ImageKey& key);
+    HRESULT initCached(const std::shared_ptr<const flifcore::InputBuffer>& input, const std::shared_ptr<const flifcore::CachedImage>& image, size_t index);
+    HRESULT materialize();
 
 private:
+    HRESULT prepareFrame();
+    bool useCachedImage(const std::shared_ptr<const flifcore::CachedImage>& image);
+
     ComRefCountImpl _ref_count;
 
-    uint32_t _width;
-    uint32_t _height;
-    std::vector<flifRGBA> _pixels;
+    // fixed by init, before the frame is shared
+    UINT _width;
+    UINT _height;
+    flifcore::PixelFormat _format;
+    std::shared_ptr<const flifcore::InputBuffer> _input; //!< for thumbnails, scaled and region decoding
+    size_t _index;
+
+    CriticalSection _cs_frame;
+    bool _frame_ready; //!< false until a deferred frame needs the full decode
+    flifcore::ImageKey _key;
+    std::shared_ptr<const flifcore::CachedImage> _cached; //!< shared with other objects, used instead of _frame if set
+    flifcore::LazyFrame _frame;
+    std::unique_ptr<flifcore::RegionCache> _regions; //!< for small rectangles copied before that
+
+    // the last scaled frame, viewers usually copy it in several bands
+    CriticalSection _cs_scaled;
+    flifcore::Frame _scaled;
 };
 
 /*!
@@ -87,13 +121,33 @@ public:
     static void unregisterClass(RegistryManager& reg);
 
     static HRESULT checkStreamIsFLIF(IStream* stream);
-    static HRESULT streamReadAll(IStream* stream, std::vector<BYTE>& bytes);
 
 private:
+    //! Drops the reference that a slot holds.
+    struct ReleaseFrame
+    {
+        void operator()(flifBitmapFrameDecode* frame) const
+        {
+            frame->Release();
+        }
+    };
+    typedef flifcore::AtomicSlots<flifBitmapFrameDecode, ReleaseFrame> FrameSlots;
+
+    HRESULT createFrame(UINT index, flifBitmapFrameDecode*& published);
+    void publishFrame(UINT index, const ComPtr<flifBitmapFrameDecode>& frame, flifBitmapFrameDecode*& published);
+    HRESULT materializeAllFrames();
+
     ComRefCountImpl _ref_count;
 
-    CriticalSection _cs_init_data;
-    bool _initialized;
-    flifDecoder _decoder;
-    std::vector<ComPtr<flifBitmapFrameDecode>> _frames;
+    CriticalSection _cs_init_data; //!< serializes Initialize
+    std::atomic<bool> _initialized; //!< once set, the following members do not change anymore and are read without a lock
+    std::shared_ptr<flifcore::Decoder> _decoder; //!< shared with the frames, which read pixels straight from it
+    UINT _frame_count; //!< from the header
+    std::unique_ptr<FrameSlots> _frames; //!< each created once, by the first GetFrame for it
+
+    CriticalSection _cs_decoder; //!< decoding and releasing the pixels of _decoder
+    std::atomic<bool> _decoder_used; //!< frames read from _decoder, the ImageCache is not asked anymore
+
+    std::once_flag _key_once;
+    flifcore::ImageKey _key; //!< of the input in the ImageCache, hashed on the first GetFrame that needs it
 };
\ No newline at end of file
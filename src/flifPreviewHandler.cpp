@@ -15,13 +15,16 @@ limitations under the License.
 */
 
 #include "flifPreviewHandler.h"
-#include "flifBitmapDecoder.h" // streamReadAll()
 #include "plugin_guids.h"
+#include "core_util.h"
 #include <algorithm>
 #include <limits>
 
 const WCHAR PREVIEW_WINDOW_CLASSNAME[] = L"flifPreviewHandler";
 
+// posted by the worker of DoPreview() when there are frames to take
+const UINT WM_PREVIEW_FRAMES = WM_APP + 1;
+
 /**
 * Boilerplate code for reacting to WM_HSCROLL/WM_VSCROLL events.
 * @return Updated scrollbar position
@@ -122,6 +125,12 @@ static LRESULT CALLBACK WND_PROC_FLIF_PREVIEW_HANDLER(HWND hWnd, UINT message, W
             handler->showFrameFromScrollBar(scroll_pos);
         }
         break;
+    case WM_PREVIEW_FRAMES:
+        {
+            flifPreviewHandler* handler = reinterpret_cast<flifPreviewHandler*>(GetWindowLongPtrW(hWnd, GWLP_USERDATA));
+            handler->takeFrames();
+        }
+        return 0;
     case WM_CTLCOLORSTATIC:
         // no background color to avoid flickering during animation
         return reinterpret_cast<LRESULT>(GetStockObject(NULL_BRUSH));
@@ -147,18 +156,29 @@ flifPreviewHandler::flifPreviewHandler()
     , _play_state(PS_STOP)
     , _elapsed_millis_until_pause(0)
     , _current_frame(-1)
+    , _frames_complete(false)
 {
     DllAddRef();
 }
 
 flifPreviewHandler::~flifPreviewHandler()
 {
+    if (_cancel)
+        _cancel->cancel();
     destroyPreviewWindowData();
     DllRelease();
 }
 
 void flifPreviewHandler::destroyPreviewWindowData()
 {
+    // the worker stops publishing, and posting to the window that goes away below
+    if (_mailbox)
+    {
+        _mailbox->close();
+        _mailbox.reset();
+    }
+    _frames_complete = false;
+
     if (_preview_window)
     {
         _preview_window = 0;
@@ -254,13 +274,87 @@ HRESULT STDMETHODCALLTYPE flifPreviewHandler::SetRect(const RECT* prc)
     CUSTOM_CATCH_RETURN_HRESULT
 }
 
-static HBITMAP createDibSectionFromFlifImage(FLIF_IMAGE* image)
+/*!
+* Blends straight alpha onto white.
+*/
+static inline uint8_t blendOnWhite(uint8_t color, uint8_t alpha)
 {
-    uint32_t w = flif_image_get_width(image);
-    uint32_t h = flif_image_get_height(image);
+    return static_cast<uint8_t>((color * alpha + 255 * (255 - alpha) + 127) / 255);
+}
+
+/*!
+* Converts one row of a decoded frame to 24 bit BGR.
+*
+* Currently the widget which displays the image doesn't support alpha.
+* So the image is blended with a white background.
+* Otherwise the color values at translucent pixels will be random.
+*/
+static void convertRowToBGR(const flifcore::FrameView& frame, uint32_t y, uint8_t* line_start)
+{
+    const uint8_t* source = frame.pixels + y * frame.stride();
+    const uint32_t w = frame.width;
+
+    switch (frame.format)
+    {
+    case flifcore::PF_GRAY8:
+        for (uint32_t x = 0; x < w; ++x)
+        {
+            line_start[x * 3] = source[x];
+            line_start[x * 3 + 1] = source[x];
+            line_start[x * 3 + 2] = source[x];
+        }
+        break;
+    case flifcore::PF_BGR24:
+        memcpy(line_start, source, w * 3);
+        break;
+    case flifcore::PF_PBGRA32:
+        // premultiplied, so blending is adding the uncovered part of the background
+        for (uint32_t x = 0; x < w; ++x)
+        {
+            const uint8_t uncovered = 255 - source[x * 4 + 3];
+            line_start[x * 3] = source[x * 4] + uncovered;
+            line_start[x * 3 + 1] = source[x * 4 + 1] + uncovered;
+            line_start[x * 3 + 2] = source[x * 4 + 2] + uncovered;
+        }
+        break;
+    case flifcore::PF_RGBA32:
+        for (uint32_t x = 0; x < w; ++x)
+        {
+            const uint8_t alpha = source[x * 4 + 3];
+            line_start[x * 3 + 2] = blendOnWhite(source[x * 4], alpha);
+            line_start[x * 3 + 1] = blendOnWhite(source[x * 4 + 1], alpha);
+            line_start[x * 3] = blendOnWhite(source[x * 4 + 2], alpha);
+        }
+        break;
+    case flifcore::PF_RGBA64:
+    {
+        // the display has 8 bits per channel anyway. Rounded to 8 bits in pieces that fit on the stack.
+        const uint32_t PIECE_SIZE = 256;
+        uint8_t rgba[PIECE_SIZE * 4];
+        const uint16_t* source16 = reinterpret_cast<const uint16_t*>(source);
+        for (uint32_t start = 0; start < w; start += PIECE_SIZE)
+        {
+            const uint32_t count = std::min(w - start, PIECE_SIZE);
+            flifcore::convertRGBA16ToRGBA8(source16 + start * 4, rgba, count);
+
+            uint8_t* destination = line_start + start * 3;
+            for (uint32_t x = 0; x < count; ++x)
+            {
+                const uint8_t alpha = rgba[x * 4 + 3];
+                destination[x * 3 + 2] = blendOnWhite(rgba[x * 4], alpha);
+                destination[x * 3 + 1] = blendOnWhite(rgba[x * 4 + 1], alpha);
+                destination[x * 3] = blendOnWhite(rgba[x * 4 + 2], alpha);
+            }
+        }
+        break;
+    }
+    }
+}
 
-    std::vector<uint8_t> line;
-    line.resize(w * 4);
+static HBITMAP createDibSectionFromFrame(const flifcore::FrameView& frame)
+{
+    uint32_t w = frame.width;
+    uint32_t h = frame.height;
 
     BITMAPINFO bmi;
     ZeroMemory(&bmi, sizeof(bmi));
@@ -286,37 +380,14 @@ static HBITMAP createDibSectionFromFlifImage(FLIF_IMAGE* image)
             if (GetObject(result, sizeof(bitmap_data), &bitmap_data))
             {
                 uint8_t* bits_start = reinterpret_cast<uint8_t*>(bitmap_data.bmBits);
+                const size_t bitmap_stride = bitmap_data.bmWidthBytes;
 
-                for (uint32_t y = 0; y < h; ++y)
+                // the blend of large scans is split across cores
+                flifcore::RowBands::run(h, uint64_t(h) * bitmap_stride, [&](uint32_t begin, uint32_t end)
                 {
-                    flif_image_read_row_RGBA8(image, y, line.data(), line.size());
-
-                    uint8_t* line_start = bits_start + y * bitmap_data.bmWidthBytes;
-
-                    for (uint32_t x = 0; x < w; ++x)
-                    {
-                        uint8_t red   = line[x * 4];
-                        uint8_t green = line[x * 4 + 1];
-                        uint8_t blue  = line[x * 4 + 2];
-                        uint8_t alpha = line[x * 4 + 3];
-
-                        uint8_t bg_red   = 255;
-                        uint8_t bg_green = 255;
-                        uint8_t bg_blue  = 255;
-
-                        // Currently the widget which displays the image doesn't support alpha.
-                        // So blend the image with a background color.
-                        // Otherwise the color values at translucent pixels will be random.
-
-                        uint16_t red_blended   = red   * alpha + bg_red   * (255 - alpha);
-                        uint16_t green_blended = green * alpha + bg_green * (255 - alpha);
-                        uint16_t blue_blended  = blue  * alpha + bg_blue  * (255 - alpha);
-
-                        line_start[x * 3 + 2] = red_blended / 256;
-                        line_start[x * 3 + 1] = green_blended / 256;
-                        line_start[x * 3]     = blue_blended / 256;
-                    }
-                }
+                    for (uint32_t y = begin; y < end; ++y)
+                        convertRowToBGR(frame, y, bits_start + y * bitmap_stride);
+                });
             }
         }
 
@@ -326,6 +397,59 @@ static HBITMAP createDibSectionFromFlifImage(FLIF_IMAGE* image)
     return 0;
 }
 
+/*!
+* Runs on the task pool: decodes all frames and publishes them as bitmaps, in order, so the window can show the first one
+* while the others are converted. Passes of the first frame of interlaced files come before that.
+* Never touches the handler, which may be gone by then.
+*/
+static flifcore::DecodeStatus decodePreviewFrames(const std::shared_ptr<const flifcore::InputBuffer>& input, const flifcore::ImageInfo& info,
+    flifcore::CancelToken* cancel, PreviewMailbox& mailbox)
+{
+    const flifcore::PixelFormat format = flifcore::choosePixelFormat(info);
+
+    flifcore::Decoder::ProgressCallback progress;
+    if (info.interlaced)
+    {
+        progress = flifcore::firstFramePasses(format, [&mailbox](const flifcore::FrameView& pass)
+        {
+            PreviewFrame frame = { createDibSectionFromFrame(pass), std::chrono::milliseconds(0), 0 };
+            if (frame.bitmap)
+                mailbox.publish(0, false, std::move(frame));
+        });
+    }
+
+    // shared with the other objects of this process that open the same file, e.g. Explorer's decoder
+    std::shared_ptr<const flifcore::CachedImage> image;
+    flifcore::DecodeStatus status = flifcore::ImageCache::shared().decode(input, image, cancel, progress);
+
+    // too large for the limits: a smaller zoom level of an interlaced file still fills the preview window
+    if (status == flifcore::DS_TOO_LARGE)
+    {
+        flifcore::DecodeLimits limits = flifcore::DecodeLimits::defaults();
+        limits.downscale = true;
+        status = flifcore::decodeAllFrames(input, format, image, cancel, &limits, progress);
+    }
+
+    if (status != flifcore::DS_OK)
+        return status;
+
+    if (image->frames.empty())
+        return flifcore::DS_FRAME_MISSING;
+
+    for (size_t i = 0; i < image->frames.size(); ++i)
+    {
+        if (cancel->isCancelled())
+            return flifcore::DS_CANCELLED;
+
+        const flifcore::FrameView& decoded = image->frames[i];
+        PreviewFrame frame = { createDibSectionFromFrame(decoded), std::chrono::milliseconds(decoded.delay_ms), image->num_loops };
+        if (!mailbox.publish(i, true, std::move(frame)))
+            return flifcore::DS_CANCELLED;
+    }
+
+    return flifcore::DS_OK;
+}
+
 /**
 * Creates an icon programmatically.
 *
@@ -411,42 +535,19 @@ HRESULT STDMETHODCALLTYPE flifPreviewHandler::DoPreview()
         // deletes the incomplete preview window data if anything fails in this function (also in case of exceptions)
         PreviewWindowDataDeleter deleter(*this);
 
-        std::vector<BYTE> bytes;
-        HRESULT hr = flifBitmapDecoder::streamReadAll(_stream.get(), bytes);
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        HRESULT hr = acquireStream(_stream.get(), input);
         if (FAILED(hr))
             return hr;
 
-        flifDecoder decoder;
-        if (!decoder)
-            return E_FAIL;
-
-        if (!flif_decoder_decode_memory(decoder, bytes.data(), bytes.size()))
-            return E_FAIL;
-
-        _num_loops = flif_decoder_num_loops(decoder);
-
-        if (flif_decoder_num_images(decoder) == 0)
-            return E_FAIL;
-
-        for (size_t i = 0, end = flif_decoder_num_images(decoder); i < end; ++i)
-        {
-            FLIF_IMAGE* image = flif_decoder_get_image(decoder, i);
-            if (!image)
-                return E_FAIL;
-
-            _frame_width = flif_image_get_width(image);
-            _frame_height = flif_image_get_height(image);
-            _frame_delays.push_back(std::chrono::milliseconds(flif_image_get_frame_delay(image)));
-
-            HBITMAP bitmap = createDibSectionFromFlifImage(image);
-            _frame_bitmaps.push_back(bitmap);
-        }
+        // the header is enough for the layout, the frames follow from a worker while the window is already shown
+        flifcore::ImageInfo info;
+        hr = toHRESULT(flifcore::probeInfo(input->data(), input->size(), info));
+        if (FAILED(hr))
+            return hr;
 
-        _loop_time = std::chrono::milliseconds(0);
-        for (auto delay : _frame_delays)
-        {
-            _loop_time += std::chrono::milliseconds(delay);
-        }
+        _frame_width = info.width;
+        _frame_height = info.height;
 
         WNDCLASSEXW wcex;
 
@@ -512,7 +613,7 @@ HRESULT STDMETHODCALLTYPE flifPreviewHandler::DoPreview()
             return HRESULT_FROM_WIN32(last_error);
         }
 
-        if (_frame_bitmaps.size() > 1)
+        if (info.frame_count > 1)
         {
             _play_button = CreateWindowW(L"BUTTON",
                 L"",
@@ -545,6 +646,9 @@ HRESULT STDMETHODCALLTYPE flifPreviewHandler::DoPreview()
 
             SendMessage(_play_button, BM_SETIMAGE, IMAGE_ICON, reinterpret_cast<LPARAM>(_play_icon.get()));
 
+            // until all frames are there, see takeFrames()
+            EnableWindow(_play_button, FALSE);
+
             _frame_scrollbar = CreateWindowW(L"SCROLLBAR",
                 L"",
                 WS_CHILD | WS_VISIBLE | SBS_HORZ,
@@ -564,16 +668,36 @@ HRESULT STDMETHODCALLTYPE flifPreviewHandler::DoPreview()
                 return HRESULT_FROM_WIN32(last_error);
             }
 
-            SetScrollRange(_frame_scrollbar, SB_CTL, 0, _frame_bitmaps.size(), FALSE /*redraw*/);
+            SetScrollRange(_frame_scrollbar, SB_CTL, 0, static_cast<int>(std::min<size_t>(info.frame_count, std::numeric_limits<int>::max())), FALSE /*redraw*/);
         }
 
         updateLayout();
 
+        ShowWindow(_preview_window, SW_SHOW);
 
-        if (!_frame_bitmaps.empty())
-            setCurrentFrame(0, true);
+        // the worker never touches this object, only what it captures
+        HWND window = _preview_window;
+        _mailbox = std::make_shared<PreviewMailbox>([window]()
+        {
+            PostMessageW(window, WM_PREVIEW_FRAMES, 0, 0);
+        });
 
-        ShowWindow(_preview_window, SW_SHOW);
+        // the user is looking at the pane, so this goes before the thumbnails and properties of the folder
+        std::shared_ptr<PreviewMailbox> mailbox = _mailbox;
+        std::shared_ptr<flifcore::CancelToken> cancel = _cancel;
+        flifcore::TaskPool::shared().submit(flifcore::TP_INTERACTIVE, [input, info, cancel, mailbox]()
+        {
+            flifcore::DecodeStatus status = flifcore::DS_DECODE_FAILED;
+            try
+            {
+                status = decodePreviewFrames(input, info, cancel.get(), *mailbox);
+            }
+            catch (...)
+            {
+                // out of memory, most likely: the frames that arrived stay
+            }
+            mailbox->finish(status);
+        });
 
         // everything successful, disarm deleter
         deleter.should_delete = false;
@@ -588,9 +712,12 @@ HRESULT STDMETHODCALLTYPE flifPreviewHandler::DoPreview()
 HRESULT STDMETHODCALLTYPE flifPreviewHandler::Unload()
 {
     CUSTOM_TRY
+        if (_cancel)
+            _cancel->cancel();
         destroyPreviewWindowData();
 
         // throw away initialization parameters, too
+        _cancel.reset();
         _parent_window = 0;
         _parent_window_rect = { 0, 0, 0, 0 };
         _stream.reset(0);
@@ -639,6 +766,7 @@ HRESULT STDMETHODCALLTYPE flifPreviewHandler::Initialize(IStream *pstream, DWORD
             return E_FAIL; // already initialized
 
         _stream.reset(pstream);
+        _cancel = std::make_shared<flifcore::CancelToken>();
         return S_OK;
     CUSTOM_CATCH_RETURN_HRESULT
 }
@@ -690,6 +818,9 @@ void flifPreviewHandler::setPlayState(PlayState state)
 
 void flifPreviewHandler::togglePlayState()
 {
+    if (!_frames_complete)
+        return;
+
     setPlayState(_play_state != PS_PLAY ? PS_PLAY : PS_PAUSE);
 }
 
@@ -757,6 +888,56 @@ void flifPreviewHandler::showFrameFromScrollBar(size_t frame)
     }
 }
 
+void flifPreviewHandler::takeFrames()
+{
+    if (!_mailbox)
+        return;
+
+    std::vector<PreviewMailbox::Entry> entries;
+    flifcore::DecodeStatus status = flifcore::DS_DECODE_FAILED;
+    const bool finished = _mailbox->take(entries, status);
+
+    for (PreviewMailbox::Entry& entry : entries)
+    {
+        if (entry.index >= _frame_bitmaps.size())
+        {
+            _frame_bitmaps.resize(entry.index + 1);
+            _frame_delays.resize(entry.index + 1);
+        }
+
+        // a pass is replaced by the next one, but only deleted after the control got that one
+        win::Bitmap replaced = std::move(_frame_bitmaps[entry.index]);
+        _frame_bitmaps[entry.index] = std::move(entry.value.bitmap);
+        _frame_delays[entry.index] = entry.value.delay;
+        _num_loops = entry.value.num_loops;
+
+        const size_t shown = _current_frame != size_t(-1) ? _current_frame : 0;
+        if (entry.index == shown)
+        {
+            _current_frame = -1; // the same frame, but another bitmap
+            setCurrentFrame(entry.index, true);
+        }
+    }
+
+    // an incomplete animation is not played, the frames that arrived can still be scrolled through
+    if (finished && status == flifcore::DS_OK && !_frames_complete)
+    {
+        _frames_complete = true;
+
+        _loop_time = std::chrono::milliseconds(0);
+        for (auto delay : _frame_delays)
+        {
+            _loop_time += std::chrono::milliseconds(delay);
+        }
+
+        if (_play_button)
+        {
+            SetScrollRange(_frame_scrollbar, SB_CTL, 0, static_cast<int>(std::min<size_t>(_frame_bitmaps.size(), std::numeric_limits<int>::max())), TRUE /*redraw*/);
+            EnableWindow(_play_button, TRUE);
+        }
+    }
+}
+
 void flifPreviewHandler::updateLayout()
 {
     const int total_w = _parent_window_rect.right - _parent_window_rect.left;
@@ -19,11 +19,26 @@ limitations under the License.
 #define NOMINMAX
 #include <Shobjidl.h>
 #include <chrono>
+#include <memory>
 
 #include "util.h"
+#include "CancelToken.h"
+#include "FrameMailbox.h"
 #include "window_util.h"
 #include "RegistryManager.h"
 
+/*!
+* A frame of the preview, converted to a bitmap by the worker that decoded it.
+*/
+struct PreviewFrame
+{
+    win::Bitmap bitmap;
+    std::chrono::milliseconds delay;
+    int32_t num_loops;
+};
+
+typedef flifcore::FrameMailbox<PreviewFrame> PreviewMailbox;
+
 class flifPreviewHandler : public IPreviewHandler, public IInitializeWithStream
 {
 public:
@@ -59,6 +74,9 @@ public:
     void showNextFrame();
     void showFrameFromScrollBar(size_t frame);
 
+    //! Shows what the worker of DoPreview() published since the last call.
+    void takeFrames();
+
     static void registerClass(RegistryManager& reg);
     static void unregisterClass(RegistryManager& reg);
 private:
@@ -72,6 +90,7 @@ private:
     RECT _parent_window_rect;
 
     ComPtr<IStream> _stream;
+    std::shared_ptr<flifcore::CancelToken> _cancel; //!< for the decodes of _stream, Unload() cancels them
 
     // PREVIEW WINDOW DATA: only valid between DoPreview() and Unload()
     ATOM _registered_class;
@@ -94,6 +113,9 @@ private:
     std::chrono::time_point<std::chrono::high_resolution_clock> _play_start_time;
     std::chrono::milliseconds _elapsed_millis_until_pause; //<! remember the progress in case pause is called
     size_t _current_frame;
+
+    std::shared_ptr<PreviewMailbox> _mailbox; //!< from the worker that decodes the frames
+    bool _frames_complete;                    //!< all frames arrived, the animation can play
     // PREVIEW WINDOW DATA END
 
     /**
@@ -18,6 +18,7 @@ limitations under the License.
 #include "plugin_guids.h"
 #include "flifWrapper.h"
 #include "flifMetadataQueryReader.h"
+#include "core_util.h"
 
 #include <Propkey.h>
 #include <propvarutil.h>
@@ -246,7 +247,22 @@ HRESULT STDMETHODCALLTYPE flifPropertyHandler::Commit(void)
 }
 
 /*!
-* @param stream Input stream
+* @return S_OK if the decoder is ready, S_FALSE if more data is needed.
+*/
+HRESULT tryDecoding(const std::vector<BYTE>& buffer, FLIF_DECODER* decoder)
+{
+    // only the decode goes to the pool, the stream is read on the calling thread
+    const bool decoded = flifcore::TaskPool::shared().runAndWait(flifcore::TP_PROPERTY, [&]()
+    {
+        return flif_decoder_decode_memory(decoder, buffer.data(), buffer.size()) != 0 &&
+            flif_decoder_num_images(decoder) != 0;
+    });
+
+    return decoded ? S_OK : S_FALSE;
+}
+
+/*!
+* @param source Input stream
 * @param chunk_size The maximum amount of bytes that will be read from the stream
 * @param buffer Keeps the read bytes for another run
 * @param decoder Valid if the function returns S_OK
@@ -254,25 +270,21 @@ HRESULT STDMETHODCALLTYPE flifPropertyHandler::Commit(void)
 *         S_FALSE if there is more data.
 *         An error code if the reading or decoding failed.
 */
-HRESULT readChunkAndTryDecoding(IStream *stream, size_t chunk_size, std::vector<BYTE>& buffer, flifDecoder& decoder)
+HRESULT readChunkAndTryDecoding(StreamByteSource& source, size_t chunk_size, std::vector<BYTE>& buffer, FLIF_DECODER* decoder)
 {
     const size_t previous_size = buffer.size();
     buffer.resize(buffer.size() + chunk_size);
 
-    ULONG actually_read;
-    const HRESULT read_result = stream->Read(buffer.data() + previous_size, static_cast<ULONG>(chunk_size), &actually_read);
-    if(FAILED(read_result))
-        return read_result;
+    size_t actually_read;
+    if(!source.read(buffer.data() + previous_size, chunk_size, actually_read))
+        return source.error();
 
-    const bool end_of_stream = read_result == S_FALSE;
+    const bool end_of_stream = actually_read < chunk_size;
 
     buffer.resize(previous_size + actually_read);
 
-    if (flif_decoder_decode_memory(decoder, buffer.data(), buffer.size()) != 0 &&
-        flif_decoder_num_images(decoder) != 0)
-    {
+    if(tryDecoding(buffer, decoder) == S_OK)
         return S_OK;
-    }
 
     if(end_of_stream)
         return E_FAIL;
@@ -292,75 +304,107 @@ HRESULT STDMETHODCALLTYPE flifPropertyHandler::Initialize(IStream *stream, DWORD
         if(FAILED(hr))
             return hr;
 
+        StreamByteSource source(stream);
         std::vector<BYTE> read_buffer;
-        flifDecoder decoder;
-        if(decoder == 0)
-            return E_FAIL;
 
-        while(true)
-        {
-            // read enough of the file to have a complete header (potentially with metadata)
-            // since there is no API to read just the header, multiple tries are necessary to be safe for all images
+        // walk header and metadata chunks once, no pixels are decoded for that
 
-            HRESULT try_decode_result = readChunkAndTryDecoding(stream, 20480, read_buffer, decoder);
-            if(FAILED(try_decode_result))
-                return try_decode_result;
+        flifcore::HeaderScanner scanner;
+        hr = toHRESULT(flifcore::scanSource(source, read_buffer, scanner));
+        if(FAILED(hr))
+            return FAILED(source.error()) ? source.error() : hr;
 
-            if(try_decode_result == S_FALSE)
-                continue;
+        const flifcore::ImageInfo& info = scanner.imageInfo();
 
-            FLIF_IMAGE* image = flif_decoder_get_image(decoder, 0);
-            if(image == 0)
-                return E_FAIL;
+        _width = info.width;
+        _height = info.height;
+        _bitdepth = info.depth * info.channels;
 
-            _width = flif_image_get_width(image);
-            _height = flif_image_get_height(image);
-            _bitdepth = flif_image_get_depth(image) * flif_image_get_nb_channels(image);
+        // fill prop cache
 
-            // fill prop cache
+        ScopedPropVariant prop_width;
+        HRESULT init_result = InitPropVariantFromInt32(_width, &prop_width);
+        if(SUCCEEDED(init_result))
+            _prop_cache->SetValueAndState(PKEY_Image_HorizontalSize, &prop_width, PSC_NORMAL);
 
-            ScopedPropVariant prop_width;
-            HRESULT init_result = InitPropVariantFromInt32(_width, &prop_width);
-            if(SUCCEEDED(init_result))
-                _prop_cache->SetValueAndState(PKEY_Image_HorizontalSize, &prop_width, PSC_NORMAL);
+        ScopedPropVariant prop_height;
+        init_result = InitPropVariantFromInt32(_height, &prop_height);
+        if(SUCCEEDED(init_result))
+            _prop_cache->SetValueAndState(PKEY_Image_VerticalSize, &prop_height, PSC_NORMAL);
 
-            ScopedPropVariant prop_height;
-            init_result = InitPropVariantFromInt32(_height, &prop_height);
-            if(SUCCEEDED(init_result))
-                _prop_cache->SetValueAndState(PKEY_Image_VerticalSize, &prop_height, PSC_NORMAL);
+        ScopedPropVariant prop_dimensions;
+        init_result = InitPropVariantFromString((std::to_wstring(_width) + L" x " + std::to_wstring(_height)).data(), &prop_dimensions);
+        if(SUCCEEDED(init_result))
+            _prop_cache->SetValueAndState(PKEY_Image_Dimensions, &prop_dimensions, PSC_NORMAL);
 
-            ScopedPropVariant prop_dimensions;
-            init_result = InitPropVariantFromString((std::to_wstring(_width) + L" x " + std::to_wstring(_height)).data(), &prop_dimensions);
-            if(SUCCEEDED(init_result))
-                _prop_cache->SetValueAndState(PKEY_Image_Dimensions, &prop_dimensions, PSC_NORMAL);
+        ScopedPropVariant prop_bitdepth;
+        init_result = InitPropVariantFromInt32(_bitdepth, &prop_bitdepth);
+        if(SUCCEEDED(init_result))
+            _prop_cache->SetValueAndState(PKEY_Image_BitDepth, &prop_bitdepth, PSC_NORMAL);
 
-            ScopedPropVariant prop_bitdepth;
-            init_result = InitPropVariantFromInt32(_bitdepth, &prop_bitdepth);
-            if(SUCCEEDED(init_result))
-                _prop_cache->SetValueAndState(PKEY_Image_BitDepth, &prop_bitdepth, PSC_NORMAL);
+        // only EXIF and XMP are mapped to properties
+        if(!scanner.hasMetadataChunk("eXif") && !scanner.hasMetadataChunk("eXmp"))
+        {
+            _is_initialized = true;
+            return S_OK;
+        }
 
-            ScopedCoInitialize coinit;
+        // the chunks are compressed, so libflif has to unpack them through a decoded image
 
-            ComPtr<IWICMetadataQueryReader> query_reader;
-            hr = createMetadataQueryReaderFromFLIF(image, query_reader);
-            if(SUCCEEDED(hr))
+        // a few bytes of header can claim any size: over the limits, interlaced files are unpacked at a zoom level that fits,
+        // other files keep just the header properties
+        const uint32_t scale = flifcore::DecodeLimits::defaults().fittingScale(info);
+        if(scale == 0)
+        {
+            _is_initialized = true;
+            return S_OK;
+        }
+
+        // Explorer asks for the properties of every file in a folder, so the decoder comes from the pool
+        flifcore::PooledDecoder decoder;
+        if(decoder == 0)
+            return E_FAIL;
+        decoder.setRetainedBytes(info.rgba8Bytes() / (uint64_t(scale) * scale));
+
+        // the pixels are thrown away, so stop decoding as early as possible
+        flif_decoder_set_quality(decoder, 0);
+        if(scale > 1)
+            flif_decoder_set_scale(decoder, scale);
+
+        // read_buffer already holds all metadata, libflif may still want some of the pixel data behind it
+        HRESULT try_decode_result = tryDecoding(read_buffer, decoder);
+        while(try_decode_result == S_FALSE)
+        {
+            // growing geometrically keeps the number of decode attempts logarithmic in the file size
+            try_decode_result = readChunkAndTryDecoding(source, std::max<size_t>(read_buffer.size(), 20480), read_buffer, decoder);
+        }
+
+        if(FAILED(try_decode_result))
+            return try_decode_result;
+
+        FLIF_IMAGE* image = flif_decoder_get_image(decoder, 0);
+        if(image == 0)
+            return E_FAIL;
+
+        ScopedCoInitialize coinit;
+
+        ComPtr<IWICMetadataQueryReader> query_reader;
+        hr = createMetadataQueryReaderFromFLIF(image, query_reader);
+        if(SUCCEEDED(hr))
+        {
+            for(const auto& prop : SUPPORTED_METADATA_PROPERTIES)
             {
-                for(const auto& prop : SUPPORTED_METADATA_PROPERTIES)
-                {
-                    NameFromPropertyKey canonical_name(prop);
+                NameFromPropertyKey canonical_name(prop);
 
-                    if(SUCCEEDED(canonical_name.result))
-                    {
-                        ScopedPropVariant value;
-                        hr = query_reader->GetMetadataByName(canonical_name.name, &value);
+                if(SUCCEEDED(canonical_name.result))
+                {
+                    ScopedPropVariant value;
+                    hr = query_reader->GetMetadataByName(canonical_name.name, &value);
 
-                        if(SUCCEEDED(hr) && value.vt != VT_EMPTY)
-                            _prop_cache->SetValueAndState(prop, &value, PSC_NORMAL);
-                    }
+                    if(SUCCEEDED(hr) && value.vt != VT_EMPTY)
+                        _prop_cache->SetValueAndState(prop, &value, PSC_NORMAL);
                 }
             }
-
-            break;
         }
 
         _is_initialized = true;
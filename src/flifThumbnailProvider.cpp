@@ -0,0 +1,150 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "flifThumbnailProvider.h"
+#include "plugin_guids.h"
+#include "core_util.h"
+
+flifThumbnailProvider::flifThumbnailProvider()
+{
+    DllAddRef();
+}
+
+flifThumbnailProvider::~flifThumbnailProvider()
+{
+    DllRelease();
+}
+
+STDMETHODIMP flifThumbnailProvider::QueryInterface(REFIID iid, void** ppvObject)
+{
+    if(ppvObject == 0)
+        return E_INVALIDARG;
+
+    if (IsEqualGUID(iid, IID_IUnknown) || IsEqualGUID(iid, IID_IThumbnailProvider))
+        *ppvObject = static_cast<IThumbnailProvider*>(this);
+    else if (IsEqualGUID(iid, IID_IInitializeWithStream))
+        *ppvObject = static_cast<IInitializeWithStream*>(this);
+    else
+    {
+        *ppvObject = 0;
+        return E_NOINTERFACE;
+    }
+
+    AddRef();
+    return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE flifThumbnailProvider::Initialize(IStream* stream, DWORD grfMode)
+{
+    CUSTOM_TRY
+
+        if(stream == 0)
+            return E_INVALIDARG;
+
+        std::lock_guard<CriticalSection> lock(_cs_init);
+        if(_input)
+            return HRESULT_FROM_WIN32(ERROR_ALREADY_INITIALIZED);
+
+        // a file is only mapped, the thumbnail decode reads just the first part of it
+        return acquireStream(stream, _input);
+
+    CUSTOM_CATCH_RETURN_HRESULT
+}
+
+/*!
+* Top-down 32 bit DIB section with the premultiplied BGRA pixels, as Explorer expects for WTSAT_ARGB.
+*/
+static HBITMAP createDibSection(const flifcore::FrameView& frame)
+{
+    BITMAPINFO bmi;
+    ZeroMemory(&bmi, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = frame.width;
+    bmi.bmiHeader.biHeight = -static_cast<int>(frame.height);
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    void* bits = 0;
+    HBITMAP result = CreateDIBSection(0, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+    if(result == 0 || bits == 0)
+        return result;
+
+    // rows of 32 bit pixels need no padding
+    memcpy(bits, frame.pixels, static_cast<size_t>(frame.size()));
+    return result;
+}
+
+HRESULT STDMETHODCALLTYPE flifThumbnailProvider::GetThumbnail(UINT cx, HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha)
+{
+    CUSTOM_TRY
+
+        if(phbmp == 0 || pdwAlpha == 0 || cx == 0)
+            return E_INVALIDARG;
+
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        {
+            std::lock_guard<CriticalSection> lock(_cs_init);
+            input = _input;
+        }
+
+        if(!input)
+            return E_ILLEGAL_METHOD_CALL;
+
+        // Explorer asks from many threads at once, the pool bounds the decodes and lets the preview pane go first
+        std::shared_ptr<const flifcore::CachedImage> thumbnail;
+        HRESULT hr = toHRESULT(flifcore::TaskPool::shared().runAndWait(flifcore::TP_THUMBNAIL, [&]()
+        {
+            return flifcore::decodeThumbnailCached(input, cx, flifcore::ImageCache::shared().diskCache().get(), thumbnail);
+        }));
+        if(FAILED(hr))
+            return hr;
+
+        HBITMAP bitmap = createDibSection(thumbnail->frames[0]);
+        if(bitmap == 0)
+            return E_OUTOFMEMORY;
+
+        *phbmp = bitmap;
+        *pdwAlpha = WTSAT_ARGB;
+        return S_OK;
+
+    CUSTOM_CATCH_RETURN_HRESULT
+}
+
+void flifThumbnailProvider::registerClass(RegistryManager& reg)
+{
+    {
+        auto k = reg.key(HKEY_CLASSES_ROOT, L"CLSID\\" + to_wstring(CLSID_flifThumbnailProvider));
+        reg.writeString(k, L"", L"FLIF Thumbnail Provider");
+    }
+    {
+        auto k = reg.key(HKEY_CLASSES_ROOT, L"CLSID\\" + to_wstring(CLSID_flifThumbnailProvider) + L"\\InprocServer32");
+        reg.writeString(k, L"", getThisLibraryPath());
+        reg.writeString(k, L"ThreadingModel", L"Apartment");
+    }
+    {
+        // replaces the generic WIC based thumbnail handler, which decodes the whole image
+        auto k = reg.key(HKEY_CLASSES_ROOT, L".flif\\ShellEx\\{e357fccd-a995-4576-b01f-234630154e96}");
+        reg.writeString(k, L"", to_wstring(CLSID_flifThumbnailProvider));
+    }
+}
+
+void flifThumbnailProvider::unregisterClass(RegistryManager& reg)
+{
+    reg.removeTree(reg.key(HKEY_CLASSES_ROOT, L"CLSID\\" + to_wstring(CLSID_flifThumbnailProvider)));
+
+    // the .flif key is removed by flifBitmapDecoder
+}
\ No newline at end of file
@@ -0,0 +1,54 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <Shobjidl.h>
+#include <thumbcache.h>
+
+#include "util.h"
+#include "RegistryManager.h"
+#include "ByteSource.h"
+
+/*!
+* Thumbnails for Explorer. Decodes only as much of the file as the requested size needs.
+*/
+class flifThumbnailProvider : public IInitializeWithStream, public IThumbnailProvider
+{
+public:
+    flifThumbnailProvider();
+    virtual ~flifThumbnailProvider();
+
+    // IUnknown methods
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, void** ppvObject) override;
+    virtual ULONG STDMETHODCALLTYPE AddRef() override { return _ref_count.addRef(); }
+    virtual ULONG STDMETHODCALLTYPE Release() override { return _ref_count.releaseRef(this); }
+
+    // IThumbnailProvider methods
+    virtual HRESULT STDMETHODCALLTYPE GetThumbnail(UINT cx, HBITMAP* phbmp, WTS_ALPHATYPE* pdwAlpha) override;
+
+    // IInitializeWithStream methods
+    virtual HRESULT STDMETHODCALLTYPE Initialize(IStream* pstream, DWORD grfMode) override;
+
+    static void registerClass(RegistryManager& reg);
+    static void unregisterClass(RegistryManager& reg);
+
+private:
+    ComRefCountImpl _ref_count;
+
+    CriticalSection _cs_init;
+    std::shared_ptr<const flifcore::InputBuffer> _input;
+};
\ No newline at end of file
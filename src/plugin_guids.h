@@ -18,5 +18,9 @@ DEFINE_GUID(CLSID_flifPreviewHandler, 0xaaf07142, 0x52e9, 0x4cc6, 0xbd, 0x48, 0x
 // {063284DD-84E0-4781-B253-6E03A20DE20A}
 DEFINE_GUID(APPID_flifPreviewHandler, 0x63284dd, 0x84e0, 0x4781, 0xb2, 0x53, 0x6e, 0x3, 0xa2, 0xd, 0xe2, 0xa);
 
+// Class ID of the thumbnail provider (flifThumbnailProvider)
+// {666FC244-6D25-41F7-BBFE-F456E072E3AA}
+DEFINE_GUID(CLSID_flifThumbnailProvider, 0x666fc244, 0x6d25, 0x41f7, 0xbb, 0xfe, 0xf4, 0x56, 0xe0, 0x72, 0xe3, 0xaa);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,2602 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// Tests for the portable decode core. Runs on every platform with libflif.
+
+// std headers
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <limits>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include "flif.h"
+#include "AtomicSlots.h"
+#include "Batch.h"
+#include "ByteSource.h"
+#include "MappedFile.h"
+#include "PixelFormat.h"
+#include "Kernels.h"
+#include "BufferPool.h"
+#include "CancelToken.h"
+#include "ContentHash.h"
+#include "Counters.h"
+#include "Decode.h"
+#include "DecodeLimits.h"
+#include "DecoderPool.h"
+#include "DiskCache.h"
+#include "FrameMailbox.h"
+#include "HeaderScanner.h"
+#include "ImageCache.h"
+#include "LazyFrame.h"
+#include "RegionCache.h"
+#include "Resample.h"
+#include "RowBands.h"
+#include "TaskPool.h"
+#include "Thumbnail.h"
+
+void debug_out(const std::string& message)
+{
+    printf("%s\n", message.data());
+    fflush(stdout);
+}
+
+#define MY_ASSERT(condition, message) \
+    if((condition)) { \
+        std::string message2 = __FILE__ + std::string("(") + std::to_string(__LINE__) + "): " + (message); \
+        debug_out(message2);\
+        fflush(stdout);\
+        return 1; \
+    }
+
+//=============================================================================
+// helpers
+
+/*!
+* Encodes a generated RGBA image with libflif.
+* @param metadata_size If not 0, eXif and eXmp chunks of about this size are attached.
+*/
+std::vector<uint8_t> createFlif(uint32_t width, uint32_t height, uint32_t frames, size_t metadata_size = 0, bool interlaced = false)
+{
+    std::vector<uint8_t> result;
+
+    FLIF_ENCODER* encoder = flif_create_encoder();
+    if(encoder == 0)
+        return result;
+
+    flif_encoder_set_interlaced(encoder, interlaced ? 1 : 0);
+
+    std::vector<flifRGBA> row(width);
+    for(uint32_t f = 0; f < frames; ++f)
+    {
+        FLIF_IMAGE* image = flif_create_image(width, height);
+        for(uint32_t y = 0; y < height; ++y)
+        {
+            for(uint32_t x = 0; x < width; ++x)
+            {
+                row[x].r = uint8_t(x + f);
+                row[x].g = uint8_t(y);
+                row[x].b = uint8_t(x ^ y);
+                row[x].a = 255;
+            }
+            flif_image_write_row_RGBA8(image, y, row.data(), row.size() * sizeof(flifRGBA));
+        }
+
+        if(f == 0 && metadata_size != 0)
+        {
+            std::vector<unsigned char> metadata(metadata_size);
+            for(size_t i = 0; i < metadata.size(); ++i)
+                metadata[i] = static_cast<unsigned char>(i * 13);
+
+            flif_image_set_metadata(image, "eXif", metadata.data(), metadata.size());
+            flif_image_set_metadata(image, "eXmp", metadata.data(), metadata.size() / 2);
+        }
+
+        // the encoder takes ownership of the image
+        flif_encoder_add_image(encoder, image);
+    }
+
+    void* buffer = 0;
+    size_t buffer_size = 0;
+    if(flif_encoder_encode_memory(encoder, &buffer, &buffer_size) != 0)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(buffer);
+        result.assign(bytes, bytes + buffer_size);
+        flif_free_memory(buffer);
+    }
+
+    flif_destroy_encoder(encoder);
+    return result;
+}
+
+bool writeFile(const std::string& filename, const std::vector<uint8_t>& bytes)
+{
+    FILE* file = fopen(filename.c_str(), "wb");
+    if(file == 0)
+        return false;
+
+    const bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && ok;
+}
+
+/*!
+* Claims a wrong size, readers must not rely on it.
+*/
+class WrongSizeByteSource : public flifcore::MemoryByteSource
+{
+public:
+    WrongSizeByteSource(const uint8_t* data, size_t size, uint64_t claimed_size)
+        : flifcore::MemoryByteSource(data, size)
+        , _claimed_size(claimed_size)
+    {}
+
+    virtual bool remainingSize(uint64_t& size) override
+    {
+        size = _claimed_size;
+        return true;
+    }
+
+private:
+    uint64_t _claimed_size;
+};
+
+/*!
+* Does not know its size, like a pipe.
+*/
+class UnsizedByteSource : public flifcore::MemoryByteSource
+{
+public:
+    UnsizedByteSource(const uint8_t* data, size_t size)
+        : flifcore::MemoryByteSource(data, size)
+    {}
+
+    virtual bool remainingSize(uint64_t& size) override
+    {
+        return false;
+    }
+};
+
+//=============================================================================
+// tests
+
+int test_read_all()
+{
+    debug_out("test_read_all");
+
+    std::vector<uint8_t> data(300000);
+    for(size_t i = 0; i < data.size(); ++i)
+        data[i] = uint8_t(i * 7);
+
+    {
+        flifcore::MemoryByteSource source(data.data(), data.size());
+        std::vector<uint8_t> bytes;
+        MY_ASSERT(!flifcore::readAll(source, bytes), "readAll failed");
+        MY_ASSERT(bytes != data, "sized read differs");
+    }
+
+    const uint64_t wrong_sizes[] = { 0, 1, 1000, data.size() - 1, data.size() + 1, data.size() * 3 };
+    for(uint64_t claimed : wrong_sizes)
+    {
+        WrongSizeByteSource source(data.data(), data.size(), claimed);
+        std::vector<uint8_t> bytes;
+        MY_ASSERT(!flifcore::readAll(source, bytes), "readAll failed");
+        MY_ASSERT(bytes != data, "read with wrong size hint differs: " + std::to_string(claimed));
+    }
+
+    {
+        flifcore::MemoryByteSource source(data.data(), 0);
+        std::vector<uint8_t> bytes;
+        MY_ASSERT(!flifcore::readAll(source, bytes), "readAll failed");
+        MY_ASSERT(!bytes.empty(), "empty source");
+    }
+
+    return 0;
+}
+
+int test_mapped_file()
+{
+    debug_out("test_mapped_file");
+
+    const std::string filename = "core_test_mapped.flif";
+    const std::vector<uint8_t> flif = createFlif(64, 48, 1);
+    MY_ASSERT(flif.empty(), "encoding failed");
+    MY_ASSERT(!writeFile(filename, flif), "writing test file failed");
+
+    // mapped and read input are equal, and only the first one is a mapping
+    std::shared_ptr<const flifcore::InputBuffer> mapped;
+    {
+        flifcore::FileByteSource source;
+        MY_ASSERT(!source.open(filename), "open failed");
+        source.setUseMapping(true);
+        MY_ASSERT(!flifcore::acquireAll(source, mapped), "acquireAll failed");
+    }
+    MY_ASSERT(dynamic_cast<const flifcore::MappedFile*>(mapped.get()) == 0, "file was not mapped");
+    MY_ASSERT(mapped->size() != flif.size(), "mapping has wrong size");
+    MY_ASSERT(memcmp(mapped->data(), flif.data(), flif.size()) != 0, "mapping has wrong content");
+    MY_ASSERT(!mapped->isUnchanged(), "untouched mapping reported as changed");
+
+    // mapping is opt-in
+    {
+        flifcore::FileByteSource source;
+        MY_ASSERT(!source.open(filename), "open failed");
+        std::shared_ptr<const flifcore::InputBuffer> copied;
+        MY_ASSERT(!flifcore::acquireAll(source, copied), "acquireAll failed");
+        MY_ASSERT(dynamic_cast<const flifcore::MappedFile*>(copied.get()) != 0, "file was mapped by default");
+        MY_ASSERT(copied->size() != flif.size(), "copy has wrong size");
+    }
+
+    // the mapping outlives the byte source
+    flifcore::Decoder decoder;
+    MY_ASSERT(decoder.decode(mapped) != flifcore::DS_OK, "decoding the mapping failed");
+    MY_ASSERT(decoder.frameCount() != 1, "wrong frame count");
+
+#ifndef _WIN32
+    // Windows does not allow to truncate mapped files, so the rest only applies to POSIX
+
+    // same size, other content: detected by the modification time
+    {
+        std::vector<uint8_t> other = flif;
+        other.back() ^= 0xff;
+        MY_ASSERT(!writeFile(filename, other), "rewriting test file failed");
+
+        // make sure the time differs, even on file systems with coarse timestamps
+        struct timeval times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+        MY_ASSERT(utimes(filename.c_str(), times) != 0, "utimes failed");
+
+        MY_ASSERT(mapped->isUnchanged(), "changed content not detected");
+
+        flifcore::Decoder changed_decoder;
+        MY_ASSERT(changed_decoder.decode(mapped) != flifcore::DS_SOURCE_CHANGED, "decoding a changed file must fail");
+    }
+
+    // truncated: the decoder must refuse to touch the mapping
+    {
+        flifcore::FileByteSource source;
+        MY_ASSERT(!source.open(filename), "open failed");
+        source.setUseMapping(true);
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        MY_ASSERT(!flifcore::acquireAll(source, input), "acquireAll failed");
+
+        MY_ASSERT(truncate(filename.c_str(), 10) != 0, "truncate failed");
+        MY_ASSERT(input->isUnchanged(), "truncation not detected");
+
+        flifcore::Decoder truncated_decoder;
+        MY_ASSERT(truncated_decoder.decode(input) != flifcore::DS_SOURCE_CHANGED, "decoding a truncated file must fail");
+    }
+
+    // truncated while libflif reads it: the default source took a copy, the decode does not notice
+    {
+        const std::string large_filename = "core_test_truncated.flif";
+        const std::vector<uint8_t> large = createFlif(512, 512, 4);
+        MY_ASSERT(large.empty(), "encoding failed");
+        MY_ASSERT(!writeFile(large_filename, large), "writing test file failed");
+
+        flifcore::FileByteSource source;
+        MY_ASSERT(!source.open(large_filename), "open failed");
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        MY_ASSERT(!flifcore::acquireAll(source, input), "acquireAll failed");
+
+        // the stub reports progress after each frame, the later frames are then behind the end
+        bool truncated = false;
+        flifcore::Decoder truncating_decoder;
+        truncating_decoder.setProgressCallback([&](FLIF_DECODER* flif_decoder, void* context, uint32_t quality)
+        {
+            if(!truncated)
+                truncated = truncate(large_filename.c_str(), 4096) == 0;
+        });
+        MY_ASSERT(truncating_decoder.decode(input) != flifcore::DS_OK, "decoding the copy failed");
+        MY_ASSERT(!truncated, "truncate failed");
+        MY_ASSERT(truncating_decoder.frameCount() != 4, "frames of the copy lost");
+
+        input.reset();
+        remove(large_filename.c_str());
+    }
+
+    // frames decoded before the change are still intact
+    flifcore::Frame frame;
+    MY_ASSERT(decoder.extractFrame(0, frame) != flifcore::DS_OK, "extracting frame failed");
+    MY_ASSERT(frame.width != 64 || frame.height != 48, "wrong frame size");
+    MY_ASSERT(frame.pixels[5 * 4] != 5 || frame.pixels[64 * 3 * 4 + 1] != 3, "wrong pixel values");
+#endif
+
+    mapped.reset();
+    remove(filename.c_str());
+    return 0;
+}
+
+int test_probe()
+{
+    debug_out("test_probe");
+
+    const std::vector<uint8_t> flif = createFlif(300, 200, 3);
+    MY_ASSERT(flif.empty(), "encoding failed");
+
+    {
+        flifcore::ImageInfo info;
+        MY_ASSERT(flifcore::probeInfo(flif.data(), flif.size(), info) != flifcore::DS_OK, "probing failed");
+        MY_ASSERT(info.width != 300 || info.height != 200, "wrong dimensions");
+        MY_ASSERT(info.channels != 4 || info.depth != 8, "wrong bit depth");
+        MY_ASSERT(info.frame_count != 3, "wrong frame count");
+    }
+
+    // the header alone is enough, the pixel data is not needed
+    {
+        flifcore::MemoryByteSource source(flif.data(), flif.size());
+        std::vector<uint8_t> prefix;
+        flifcore::ImageInfo info;
+        MY_ASSERT(flifcore::probeSource(source, prefix, info) != flifcore::DS_OK, "probing the source failed");
+        MY_ASSERT(info.width != 300 || info.height != 200, "wrong dimensions");
+        MY_ASSERT(prefix.size() >= flif.size(), "probing read the whole file");
+        MY_ASSERT(memcmp(prefix.data(), flif.data(), prefix.size()) != 0, "prefix differs from the input");
+    }
+
+    // a truncated header is an error, not a hang
+    {
+        flifcore::MemoryByteSource source(flif.data(), 6);
+        std::vector<uint8_t> prefix;
+        flifcore::ImageInfo info;
+        MY_ASSERT(flifcore::probeSource(source, prefix, info) != flifcore::DS_DECODE_FAILED, "truncated header accepted");
+        MY_ASSERT(prefix.size() != 6, "truncated prefix has wrong size");
+    }
+
+    return 0;
+}
+
+/*!
+* Compares everything the scanners found.
+*/
+bool sameScan(const flifcore::HeaderScanner& a, const flifcore::HeaderScanner& b)
+{
+    if(a.result() != b.result() || a.bytesScanned() != b.bytesScanned())
+        return false;
+
+    const flifcore::ImageInfo& info_a = a.imageInfo();
+    const flifcore::ImageInfo& info_b = b.imageInfo();
+    if(info_a.width != info_b.width || info_a.height != info_b.height ||
+        info_a.channels != info_b.channels || info_a.depth != info_b.depth ||
+        info_a.frame_count != info_b.frame_count || info_a.interlaced != info_b.interlaced)
+    {
+        return false;
+    }
+
+    if(a.metadataChunks().size() != b.metadataChunks().size())
+        return false;
+
+    for(size_t i = 0; i < a.metadataChunks().size(); ++i)
+    {
+        const flifcore::MetadataChunk& chunk_a = a.metadataChunks()[i];
+        const flifcore::MetadataChunk& chunk_b = b.metadataChunks()[i];
+        if(chunk_a.name != chunk_b.name || chunk_a.offset != chunk_b.offset || chunk_a.size != chunk_b.size)
+            return false;
+    }
+
+    return true;
+}
+
+int test_header_scanner()
+{
+    debug_out("test_header_scanner");
+
+    const std::vector<uint8_t> flif = createFlif(300, 200, 3, 70000);
+    MY_ASSERT(flif.empty(), "encoding failed");
+
+    flifcore::HeaderScanner reference;
+    size_t consumed;
+    MY_ASSERT(reference.feed(flif.data(), flif.size(), consumed) != flifcore::HeaderScanner::SR_DONE, "scanning failed");
+
+    const size_t header_size = static_cast<size_t>(reference.bytesScanned());
+    MY_ASSERT(consumed != header_size, "consumed bytes differ from scanned bytes");
+    MY_ASSERT(header_size >= flif.size(), "scanner ran into the pixel data");
+    MY_ASSERT(flif[header_size - 1] != 0, "scan does not end at the end marker");
+
+    // the scanner agrees with libflif
+    {
+        const flifcore::ImageInfo& info = reference.imageInfo();
+        MY_ASSERT(info.width != 300 || info.height != 200, "wrong dimensions");
+        MY_ASSERT(info.frame_count != 3, "wrong frame count");
+
+        flifInfo flif_info(flif_read_info_from_memory(flif.data(), flif.size()));
+        MY_ASSERT(flif_info == 0, "libflif could not read the header");
+        MY_ASSERT(info.channels != flif_info_get_nb_channels(flif_info), "wrong number of channels");
+        MY_ASSERT(info.depth != flif_info_get_depth(flif_info), "wrong depth");
+    }
+
+    MY_ASSERT(!reference.hasMetadataChunk("eXif") || !reference.hasMetadataChunk("eXmp"), "metadata chunks missing");
+    for(const auto& chunk : reference.metadataChunks())
+        MY_ASSERT(chunk.size == 0 || chunk.offset + chunk.size > header_size, "chunk outside of the header: " + chunk.name);
+
+    // truncated: never done, never asks for more than actually missing
+    for(size_t size = 0; size < header_size; ++size)
+    {
+        flifcore::HeaderScanner scanner;
+        MY_ASSERT(scanner.feed(flif.data(), size, consumed) != flifcore::HeaderScanner::SR_NEED_MORE, "truncated input not detected: " + std::to_string(size));
+        MY_ASSERT(consumed != size, "truncated input not consumed: " + std::to_string(size));
+
+        const uint64_t wanted = scanner.minimumBytesWanted();
+        MY_ASSERT(wanted == 0 || wanted > header_size - size, "wrong number of wanted bytes: " + std::to_string(size));
+    }
+
+    // split at every position of the main header and the chunk names, the data is skipped anyway
+    for(size_t split = 0; split <= std::min<size_t>(header_size, 64); ++split)
+    {
+        flifcore::HeaderScanner scanner;
+        scanner.feed(flif.data(), split, consumed);
+        scanner.feed(flif.data() + split, flif.size() - split, consumed);
+        MY_ASSERT(!sameScan(scanner, reference), "scan split at " + std::to_string(split) + " differs");
+    }
+
+    // one byte at a time
+    {
+        flifcore::HeaderScanner scanner;
+        for(size_t i = 0; i < flif.size() && scanner.result() == flifcore::HeaderScanner::SR_NEED_MORE; ++i)
+            scanner.feed(flif.data() + i, 1, consumed);
+        MY_ASSERT(!sameScan(scanner, reference), "byte by byte scan differs");
+    }
+
+    // invalid input
+    {
+        const uint8_t wrong_magic[] = { 'F', 'L', 'I', 'X', 0x34, '1', 0, 0, 0 };
+        const uint8_t wrong_format[] = { 'F', 'L', 'I', 'F', 0x24, '1', 0, 0, 0 };
+        const uint8_t long_varint[] = { 'F', 'L', 'I', 'F', 0x34, '1', 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0 };
+
+        flifcore::HeaderScanner scanner;
+        MY_ASSERT(scanner.feed(wrong_magic, sizeof(wrong_magic), consumed) != flifcore::HeaderScanner::SR_INVALID, "wrong magic accepted");
+        scanner.reset();
+        MY_ASSERT(scanner.feed(wrong_format, sizeof(wrong_format), consumed) != flifcore::HeaderScanner::SR_INVALID, "wrong format accepted");
+        scanner.reset();
+        MY_ASSERT(scanner.feed(long_varint, sizeof(long_varint), consumed) != flifcore::HeaderScanner::SR_INVALID, "overlong varint accepted");
+    }
+
+    // reading from a source: the pixel data stays where it is
+    {
+        flifcore::MemoryByteSource source(flif.data(), flif.size());
+        std::vector<uint8_t> prefix;
+        flifcore::HeaderScanner scanner;
+        MY_ASSERT(flifcore::scanSource(source, prefix, scanner) != flifcore::DS_OK, "scanning the source failed");
+        MY_ASSERT(!sameScan(scanner, reference), "source scan differs");
+        MY_ASSERT(prefix.size() > header_size + 4096, "read too far into the pixel data");
+        MY_ASSERT(memcmp(prefix.data(), flif.data(), prefix.size()) != 0, "prefix differs from the input");
+    }
+
+    // continuing with bytes the caller already has
+    {
+        const size_t already_read = 9;
+        flifcore::MemoryByteSource source(flif.data() + already_read, flif.size() - already_read);
+        std::vector<uint8_t> prefix(flif.begin(), flif.begin() + already_read);
+        flifcore::HeaderScanner scanner;
+        MY_ASSERT(flifcore::scanSource(source, prefix, scanner) != flifcore::DS_OK, "continued scan failed");
+        MY_ASSERT(!sameScan(scanner, reference), "continued scan differs");
+    }
+
+    // truncated source
+    {
+        flifcore::MemoryByteSource source(flif.data(), header_size - 1);
+        std::vector<uint8_t> prefix;
+        flifcore::HeaderScanner scanner;
+        MY_ASSERT(flifcore::scanSource(source, prefix, scanner) != flifcore::DS_DECODE_FAILED, "truncated source accepted");
+    }
+
+    // a chunk declared much longer than the file must not allocate its declared length
+    {
+        std::vector<uint8_t> oversized = { 'F', 'L', 'I', 'F', 0x34, '1', 0, 0, 'e', 'X', 'i', 'f', 0xff, 0xff, 0xff, 0xff, 0x7f };
+        oversized.resize(oversized.size() + 100000, 0x55);
+
+        const size_t max_prefix = 2 * 1024 * 1024;
+        {
+            flifcore::MemoryByteSource source(oversized.data(), oversized.size());
+            std::vector<uint8_t> prefix;
+            flifcore::HeaderScanner scanner;
+            MY_ASSERT(flifcore::scanSource(source, prefix, scanner) != flifcore::DS_DECODE_FAILED, "oversized chunk accepted");
+            MY_ASSERT(prefix.capacity() > max_prefix, "oversized chunk allocated with a known size");
+        }
+        {
+            UnsizedByteSource source(oversized.data(), oversized.size());
+            std::vector<uint8_t> prefix;
+            flifcore::HeaderScanner scanner;
+            MY_ASSERT(flifcore::scanSource(source, prefix, scanner) != flifcore::DS_DECODE_FAILED, "oversized chunk accepted without a size");
+            MY_ASSERT(prefix.capacity() > max_prefix, "oversized chunk allocated without a size");
+        }
+        {
+            WrongSizeByteSource source(oversized.data(), oversized.size(), uint64_t(1) << 40);
+            std::vector<uint8_t> prefix;
+            flifcore::HeaderScanner scanner;
+            MY_ASSERT(flifcore::scanSource(source, prefix, scanner) != flifcore::DS_DECODE_FAILED, "oversized chunk accepted with a wrong size");
+            MY_ASSERT(prefix.capacity() > max_prefix, "oversized chunk allocated with a wrong size");
+        }
+    }
+
+    return 0;
+}
+
+int test_lazy_decode()
+{
+    debug_out("test_lazy_decode");
+
+    const std::vector<uint8_t> flif = createFlif(40, 30, 3);
+    MY_ASSERT(flif.empty(), "encoding failed");
+    std::shared_ptr<const flifcore::InputBuffer> input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif));
+
+    flifcore::resetCounters();
+    const flifcore::Counters& counters = flifcore::counters();
+
+    // what the bitmap decoder does for Initialize, GetFrameCount and GetContainerFormat
+    flifcore::Decoder decoder;
+    MY_ASSERT(decoder.open(input) != flifcore::DS_OK, "open failed");
+    MY_ASSERT(decoder.frameCount() != 3, "wrong frame count from the header");
+    MY_ASSERT(decoder.info().width != 40 || decoder.info().height != 30, "wrong size from the header");
+    MY_ASSERT(decoder.isDecoded(), "open decoded pixels");
+    MY_ASSERT(decoder.image(0) != 0, "image available before decoding");
+    MY_ASSERT(counters.header_scans != 1, "header not scanned exactly once");
+    MY_ASSERT(counters.pixel_decodes != 0, "metadata calls decoded pixels");
+
+    // the first frame request decodes everything, later ones reuse it
+    flifcore::Frame frame;
+    MY_ASSERT(decoder.extractFrame(1, frame) != flifcore::DS_OK, "extracting frame 1 failed");
+    MY_ASSERT(frame.width != 40 || frame.pixels[3 * 4] != 4, "wrong content of frame 1");
+    MY_ASSERT(counters.pixel_decodes != 1, "first frame request did not decode exactly once");
+
+    MY_ASSERT(decoder.extractFrame(0, frame) != flifcore::DS_OK, "extracting frame 0 failed");
+    MY_ASSERT(decoder.extractFrame(2, frame) != flifcore::DS_OK, "extracting frame 2 failed");
+    MY_ASSERT(decoder.extractFrame(3, frame) != flifcore::DS_FRAME_MISSING, "frame behind the end exists");
+    MY_ASSERT(counters.pixel_decodes != 1, "frames decoded again");
+    MY_ASSERT(counters.frame_extractions != 3, "wrong number of extracted frames");
+
+    // no pixel decode for a broken header either
+    const uint8_t not_flif[] = { 'P', 'N', 'G', ' ', 0, 0, 0, 0 };
+    flifcore::Decoder broken;
+    MY_ASSERT(broken.open(std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(not_flif, not_flif + sizeof(not_flif)))) != flifcore::DS_DECODE_FAILED, "broken header accepted");
+    MY_ASSERT(broken.extractFrame(0, frame) == flifcore::DS_OK, "broken decoder returned a frame");
+    MY_ASSERT(counters.pixel_decodes != 1, "broken header decoded pixels");
+
+    return 0;
+}
+
+int test_lazy_frame()
+{
+    debug_out("test_lazy_frame");
+
+    const uint32_t width = 50;
+    const uint32_t height = 20;
+    const std::vector<uint8_t> flif = createFlif(width, height, 2);
+    MY_ASSERT(flif.empty(), "encoding failed");
+
+    std::shared_ptr<flifcore::Decoder> decoder = std::make_shared<flifcore::Decoder>();
+    MY_ASSERT(decoder->open(std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif))) != flifcore::DS_OK, "open failed");
+
+    flifcore::resetCounters();
+    const flifcore::Counters& counters = flifcore::counters();
+
+    // padded rows, the padding must stay untouched
+    const size_t stride = width * 4 + 12;
+    std::vector<uint8_t> buffer(stride * height, 0xcd);
+
+    flifcore::LazyFrame frame;
+    MY_ASSERT(frame.init(decoder, 1) != flifcore::DS_OK, "init failed");
+    MY_ASSERT(frame.width() != width || frame.height() != height, "wrong size");
+
+    // first full copy: straight from libflif
+    MY_ASSERT(frame.copyPixels(0, 0, width, height, buffer.data(), stride) != flifcore::DS_OK, "direct copy failed");
+    MY_ASSERT(frame.isMaterialized(), "direct copy materialized the frame");
+    MY_ASSERT(counters.copy_bytes_saved != uint64_t(width) * height * 4, "saved bytes not counted");
+    MY_ASSERT(counters.frame_extractions != 0, "direct copy extracted the frame");
+    MY_ASSERT(buffer[3 * 4] != 4 || buffer[stride * 7 + 1] != 7, "wrong pixel values");
+    MY_ASSERT(buffer[width * 4] != 0xcd || buffer[stride - 1] != 0xcd, "padding overwritten");
+
+    // second copy: from an own buffer, the decoder is no longer needed
+    std::vector<uint8_t> second(stride * height, 0xcd);
+    MY_ASSERT(frame.copyPixels(0, 0, width, height, second.data(), stride) != flifcore::DS_OK, "second copy failed");
+    MY_ASSERT(!frame.isMaterialized(), "second copy did not materialize the frame");
+    MY_ASSERT(second != buffer, "second copy differs");
+
+    // a partial first copy materializes at once
+    flifcore::LazyFrame partial;
+    MY_ASSERT(partial.init(decoder, 0) != flifcore::DS_OK, "init failed");
+    std::vector<uint8_t> rect(3 * 4 * 2);
+    MY_ASSERT(partial.copyPixels(10, 5, 3, 2, rect.data(), 3 * 4) != flifcore::DS_OK, "partial copy failed");
+    MY_ASSERT(!partial.isMaterialized(), "partial copy did not materialize the frame");
+    MY_ASSERT(rect[0] != 10 || rect[1] != 5 || rect[3 * 4 + 1] != 6, "wrong partial content");
+
+    MY_ASSERT(decoder.use_count() != 1, "materialized frames still reference the decoder");
+
+    return 0;
+}
+
+int test_release_images()
+{
+    debug_out("test_release_images");
+
+    const std::vector<uint8_t> flif = createFlif(30, 20, 4);
+    MY_ASSERT(flif.empty(), "encoding failed");
+
+    std::shared_ptr<flifcore::Decoder> decoder = std::make_shared<flifcore::Decoder>();
+    MY_ASSERT(decoder->decode(std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif))) != flifcore::DS_OK, "decoding failed");
+
+    std::vector<std::unique_ptr<flifcore::LazyFrame>> frames;
+    for(size_t i = 0; i < decoder->frameCount(); ++i)
+    {
+        frames.emplace_back(new flifcore::LazyFrame());
+        MY_ASSERT(frames.back()->init(decoder, i) != flifcore::DS_OK, "init failed");
+        MY_ASSERT(frames.back()->materialize() != flifcore::DS_OK, "materialize failed");
+    }
+
+    decoder->releaseImages();
+    MY_ASSERT(decoder->isDecoded(), "still decoded after release");
+    MY_ASSERT(decoder->image(0) != 0, "image still available after release");
+    MY_ASSERT(decoder->frameCount() != 4, "frame count lost");
+
+    // the frames do not need libflif anymore
+    std::vector<uint8_t> buffer(30 * 20 * 4);
+    for(size_t i = 0; i < frames.size(); ++i)
+    {
+        MY_ASSERT(frames[i]->copyPixels(0, 0, 30, 20, buffer.data(), 30 * 4) != flifcore::DS_OK, "copy after release failed");
+        MY_ASSERT(buffer[5 * 4] != 5 + i, "wrong content after release");
+    }
+
+    // pixels can be decoded again from the kept input
+    flifcore::Frame frame;
+    MY_ASSERT(decoder->extractFrame(3, frame) != flifcore::DS_OK, "decoding again failed");
+    MY_ASSERT(frame.pixels[5 * 4] != 8, "wrong content after decoding again");
+
+    return 0;
+}
+
+int test_pixel_format()
+{
+    debug_out("test_pixel_format");
+
+    MY_ASSERT(flifcore::choosePixelFormat(1, 8) != flifcore::PF_GRAY8, "gray");
+    MY_ASSERT(flifcore::choosePixelFormat(3, 8) != flifcore::PF_BGR24, "opaque color");
+    MY_ASSERT(flifcore::choosePixelFormat(4, 8) != flifcore::PF_PBGRA32, "color with alpha");
+    MY_ASSERT(flifcore::choosePixelFormat(1, 16) != flifcore::PF_RGBA64, "16 bit gray");
+    MY_ASSERT(flifcore::choosePixelFormat(4, 16) != flifcore::PF_RGBA64, "16 bit color");
+
+    // premultiplying: every combination of color and alpha
+    std::vector<uint8_t> rgba(256 * 256 * 4);
+    for(uint32_t a = 0; a < 256; ++a)
+    {
+        for(uint32_t c = 0; c < 256; ++c)
+        {
+            uint8_t* pixel = rgba.data() + (a * 256 + c) * 4;
+            pixel[0] = uint8_t(c);
+            pixel[1] = uint8_t(255 - c);
+            pixel[2] = uint8_t(c / 2);
+            pixel[3] = uint8_t(a);
+        }
+    }
+
+    auto premultiplied = [](uint32_t c, uint32_t a) {
+        return uint8_t((c * a * 2 + 255) / 510);
+    };
+
+    std::vector<uint8_t> pbgra(rgba.size());
+    flifcore::convertRGBAToPBGRA(rgba.data(), pbgra.data(), 256 * 256);
+    for(size_t i = 0; i < 256 * 256; ++i)
+    {
+        const uint8_t* in = rgba.data() + i * 4;
+        const uint8_t* out = pbgra.data() + i * 4;
+        MY_ASSERT(out[0] != premultiplied(in[2], in[3]) ||
+            out[1] != premultiplied(in[1], in[3]) ||
+            out[2] != premultiplied(in[0], in[3]) ||
+            out[3] != in[3], "wrong premultiplied value at " + std::to_string(i));
+    }
+
+    std::vector<uint8_t> in_place = rgba;
+    flifcore::convertRGBAToPBGRA(in_place.data(), in_place.data(), 256 * 256);
+    MY_ASSERT(in_place != pbgra, "in place premultiplying differs");
+
+    std::vector<uint8_t> bgr(256 * 256 * 3);
+    flifcore::convertRGBAToBGR(rgba.data(), bgr.data(), 256 * 256);
+    for(size_t i = 0; i < 256 * 256; ++i)
+        MY_ASSERT(bgr[i * 3] != rgba[i * 4 + 2] || bgr[i * 3 + 1] != rgba[i * 4 + 1] || bgr[i * 3 + 2] != rgba[i * 4], "wrong BGR value at " + std::to_string(i));
+
+    in_place = rgba;
+    flifcore::convertRGBAToBGR(in_place.data(), in_place.data(), 256 * 256);
+    MY_ASSERT(!std::equal(bgr.begin(), bgr.end(), in_place.begin()), "in place BGR differs");
+
+    return 0;
+}
+
+int test_kernels()
+{
+    debug_out("test_kernels");
+
+    const flifcore::Kernels* scalar = flifcore::kernelsFor(flifcore::KI_SCALAR);
+    MY_ASSERT(scalar == 0, "no scalar kernels");
+    MY_ASSERT(flifcore::kernelsFor(flifcore::kernels().isa) != &flifcore::kernels(), "dispatched kernels not available");
+    debug_out(std::string("dispatched: ") + flifcore::kernels().name);
+
+    // odd sizes hit the scalar tails, 4099 all loop widths
+    std::vector<size_t> sizes;
+    for(size_t i = 0; i < 68; ++i)
+        sizes.push_back(i);
+    sizes.push_back(4099);
+
+    uint32_t seed = 12345;
+    auto random = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return seed >> 16;
+    };
+
+    for(int isa = flifcore::KI_SSE2; isa < flifcore::KI_COUNT; ++isa)
+    {
+        const flifcore::Kernels* simd = flifcore::kernelsFor(flifcore::KernelIsa(isa));
+        if(simd == 0)
+            continue;
+
+        const std::string name = simd->name;
+        debug_out("comparing " + name);
+
+        for(size_t count : sizes)
+        {
+            std::vector<uint8_t> rgba(count * 4);
+            std::vector<uint16_t> rgba16(count * 4);
+            for(size_t i = 0; i < rgba.size(); ++i)
+            {
+                rgba[i] = uint8_t(random());
+                rgba16[i] = uint16_t(random());
+            }
+
+            // extremes at the start, so also short runs see them
+            for(size_t i = 0; i < std::min<size_t>(rgba.size(), 8); ++i)
+            {
+                rgba[i] = (i & 1) ? 255 : 0;
+                rgba16[i] = (i & 1) ? 65535 : 0;
+            }
+
+            std::vector<uint8_t> expected(rgba.size());
+            std::vector<uint8_t> actual(rgba.size());
+
+            scalar->rgba_to_pbgra(rgba.data(), expected.data(), count);
+            simd->rgba_to_pbgra(rgba.data(), actual.data(), count);
+            MY_ASSERT(actual != expected, name + " PBGRA differs, " + std::to_string(count) + " pixels");
+
+            actual = rgba;
+            simd->rgba_to_pbgra(actual.data(), actual.data(), count);
+            MY_ASSERT(actual != expected, name + " in place PBGRA differs, " + std::to_string(count) + " pixels");
+
+            scalar->rgba16_to_rgba8(rgba16.data(), expected.data(), count);
+            simd->rgba16_to_rgba8(rgba16.data(), actual.data(), count);
+            MY_ASSERT(actual != expected, name + " RGBA16 differs, " + std::to_string(count) + " pixels");
+        }
+
+        // every 16 bit value and every color/alpha combination
+        std::vector<uint16_t> all16(65536);
+        for(size_t i = 0; i < all16.size(); ++i)
+            all16[i] = uint16_t(i);
+
+        std::vector<uint8_t> expected(all16.size());
+        std::vector<uint8_t> actual(all16.size());
+        scalar->rgba16_to_rgba8(all16.data(), expected.data(), all16.size() / 4);
+        simd->rgba16_to_rgba8(all16.data(), actual.data(), all16.size() / 4);
+        MY_ASSERT(actual != expected, name + " RGBA16 differs on the full range");
+
+        std::vector<uint8_t> all8(256 * 256 * 4);
+        for(size_t i = 0; i < 256 * 256; ++i)
+        {
+            all8[i * 4] = uint8_t(i);
+            all8[i * 4 + 1] = uint8_t(255 - i);
+            all8[i * 4 + 2] = uint8_t(i * 7);
+            all8[i * 4 + 3] = uint8_t(i >> 8);
+        }
+
+        expected.resize(all8.size());
+        actual.resize(all8.size());
+        scalar->rgba_to_pbgra(all8.data(), expected.data(), 256 * 256);
+        simd->rgba_to_pbgra(all8.data(), actual.data(), 256 * 256);
+        MY_ASSERT(actual != expected, name + " PBGRA differs on the full range");
+    }
+
+    // the scalar reference against plain arithmetic
+    for(uint32_t v = 0; v < 65536; v += 4)
+    {
+        const uint16_t in[4] = { uint16_t(v), uint16_t(v + 1), uint16_t(v + 2), uint16_t(v + 3) };
+        uint8_t out[4];
+        scalar->rgba16_to_rgba8(in, out, 1);
+        for(int i = 0; i < 4; ++i)
+            MY_ASSERT(out[i] != uint8_t((in[i] * 255u * 2 + 65535) / (65535 * 2)), "wrong 16 to 8 bit value at " + std::to_string(in[i]));
+    }
+
+    return 0;
+}
+
+int test_extract_formats()
+{
+    debug_out("test_extract_formats");
+
+    const uint32_t width = 37;
+    const uint32_t height = 11;
+    const std::vector<uint8_t> flif = createFlif(width, height, 1);
+    MY_ASSERT(flif.empty(), "encoding failed");
+
+    std::shared_ptr<flifcore::Decoder> decoder = std::make_shared<flifcore::Decoder>();
+    MY_ASSERT(decoder->decode(std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif))) != flifcore::DS_OK, "decoding failed");
+
+    flifcore::Frame rgba;
+    MY_ASSERT(decoder->extractFrame(0, rgba) != flifcore::DS_OK, "extracting RGBA failed");
+    MY_ASSERT(rgba.format != flifcore::PF_RGBA32 || rgba.pixels.size() != width * height * 4, "wrong RGBA frame");
+
+    const flifcore::PixelFormat formats[] = { flifcore::PF_GRAY8, flifcore::PF_BGR24, flifcore::PF_PBGRA32, flifcore::PF_RGBA64 };
+    for(flifcore::PixelFormat format : formats)
+    {
+        const std::string name = flifcore::toString(format);
+        const size_t bpp = flifcore::bytesPerPixel(format);
+
+        flifcore::Frame frame;
+        MY_ASSERT(decoder->extractFrame(0, frame, format) != flifcore::DS_OK, "extracting failed: " + name);
+        MY_ASSERT(frame.format != format || frame.stride() != width * bpp || frame.pixels.size() != width * height * bpp, "wrong layout: " + name);
+
+        std::vector<uint8_t> expected(frame.pixels.size());
+        for(uint32_t y = 0; y < height; ++y)
+        {
+            const uint8_t* source = rgba.pixels.data() + y * rgba.stride();
+            uint8_t* destination = expected.data() + y * frame.stride();
+            switch(format)
+            {
+            case flifcore::PF_GRAY8:
+                flif_image_read_row_GRAY8(decoder->image(0), y, destination, width);
+                break;
+            case flifcore::PF_BGR24:
+                flifcore::convertRGBAToBGR(source, destination, width);
+                break;
+            case flifcore::PF_PBGRA32:
+                flifcore::convertRGBAToPBGRA(source, destination, width);
+                break;
+            case flifcore::PF_RGBA64:
+                // the lower byte depends on how libflif scales, the upper one must match
+                for(uint32_t i = 0; i < width * 4; ++i)
+                {
+                    uint16_t value;
+                    memcpy(&value, frame.pixels.data() + y * frame.stride() + i * 2, 2);
+                    MY_ASSERT((value >> 8) != source[i], "wrong 16 bit value");
+                    memcpy(destination + i * 2, &value, 2);
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        MY_ASSERT(frame.pixels.size() != expected.size() || !std::equal(expected.begin(), expected.end(), frame.pixels.begin()), "wrong content: " + name);
+
+        // the direct path of LazyFrame converts the same way
+        flifcore::LazyFrame lazy;
+        MY_ASSERT(lazy.init(decoder, 0, format) != flifcore::DS_OK, "init failed: " + name);
+        std::vector<uint8_t> direct(frame.pixels.size());
+        MY_ASSERT(lazy.copyPixels(0, 0, width, height, direct.data(), frame.stride()) != flifcore::DS_OK, "direct copy failed: " + name);
+        MY_ASSERT(direct != expected, "direct copy differs: " + name);
+
+        std::vector<uint8_t> rect(2 * bpp);
+        MY_ASSERT(lazy.copyPixels(5, 3, 2, 1, rect.data(), rect.size()) != flifcore::DS_OK, "partial copy failed: " + name);
+        MY_ASSERT(memcmp(rect.data(), expected.data() + 3 * frame.stride() + 5 * bpp, rect.size()) != 0, "partial copy differs: " + name);
+    }
+
+    return 0;
+}
+
+int test_thumbnail()
+{
+    debug_out("test_thumbnail");
+
+    uint32_t w, h;
+    flifcore::fitSize(4000, 3000, 256, 256, w, h);
+    MY_ASSERT(w != 256 || h != 192, "wrong landscape fit");
+    flifcore::fitSize(1000, 4000, 256, 256, w, h);
+    MY_ASSERT(w != 64 || h != 256, "wrong portrait fit");
+    flifcore::fitSize(100, 50, 256, 256, w, h);
+    MY_ASSERT(w != 100 || h != 50, "small images must not be enlarged");
+    flifcore::fitSize(100000, 1, 256, 256, w, h);
+    MY_ASSERT(w != 256 || h != 1, "a side must not become 0");
+
+    // box filter: 2x2 blocks of known values
+    flifcore::Frame source;
+    source.width = 4;
+    source.height = 2;
+    source.format = flifcore::PF_GRAY8;
+    source.pixels = { 0, 10, 100, 101, 20, 30, 255, 255 };
+
+    flifcore::Frame scaled;
+    MY_ASSERT(!flifcore::downscaleBox(source, 2, 1, scaled), "downscaling failed");
+    MY_ASSERT(scaled.width != 2 || scaled.height != 1 || scaled.pixels.size() != 2, "wrong scaled size");
+    MY_ASSERT(scaled.pixels[0] != 15 || scaled.pixels[1] != 178, "wrong box filter values");
+
+    // 16 bit channels
+    const uint16_t values16[] = { 0, 1000, 65535, 10, 2, 1001, 65535, 20 };
+    source.width = 2;
+    source.height = 1;
+    source.format = flifcore::PF_RGBA64;
+    source.pixels.resize(sizeof(values16));
+    memcpy(source.pixels.data(), values16, sizeof(values16));
+    MY_ASSERT(!flifcore::downscaleBox(source, 1, 1, scaled), "16 bit downscaling failed");
+    uint16_t scaled16[4];
+    memcpy(scaled16, scaled.pixels.data(), sizeof(scaled16));
+    MY_ASSERT(scaled16[0] != 1 || scaled16[1] != 1001 || scaled16[2] != 65535 || scaled16[3] != 15, "wrong 16 bit box filter values");
+
+    // enlarging repeats pixels
+    MY_ASSERT(!flifcore::downscaleBox(source, 4, 2, scaled), "enlarging failed");
+    MY_ASSERT(memcmp(scaled.pixels.data() + 3 * 8, values16 + 4, 8) != 0, "wrong enlarged value");
+
+    const uint32_t width = 300;
+    const uint32_t height = 200;
+    for(int interlaced = 0; interlaced < 2; ++interlaced)
+    {
+        const std::vector<uint8_t> flif = createFlif(width, height, 2, 0, interlaced != 0);
+        MY_ASSERT(flif.empty(), "encoding failed");
+        auto input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif));
+
+        flifcore::Frame reduced;
+        MY_ASSERT(flifcore::decodeThumbnail(input, 64, reduced) != flifcore::DS_OK, "thumbnail failed");
+        MY_ASSERT(reduced.width != 64 || reduced.height != 43, "wrong thumbnail size");
+        MY_ASSERT(reduced.format != flifcore::PF_PBGRA32 || reduced.pixels.size() != 64 * 43 * 4, "wrong thumbnail format");
+
+        flifcore::Frame full;
+        MY_ASSERT(flifcore::decodeThumbnailFull(input, 64, full) != flifcore::DS_OK, "full thumbnail failed");
+        MY_ASSERT(full.width != reduced.width || full.height != reduced.height, "thumbnail sizes differ");
+
+        // green is the source row, zoom levels are subsampled, so the reduced decode may be off by up to two thumbnail rows
+        const int tolerance = int(2 * height / full.height);
+        for(uint32_t y = 0; y < full.height; ++y)
+        {
+            const int difference = int(full.pixels[y * full.stride() + 1]) - int(reduced.pixels[y * reduced.stride() + 1]);
+            MY_ASSERT(std::abs(difference) > tolerance, "thumbnail content differs in row " + std::to_string(y));
+        }
+
+        // small enough already
+        flifcore::Frame same;
+        MY_ASSERT(flifcore::decodeThumbnail(input, 1000, same) != flifcore::DS_OK, "unscaled thumbnail failed");
+        MY_ASSERT(same.width != width || same.height != height, "thumbnail was scaled");
+    }
+
+    return 0;
+}
+
+int test_preview()
+{
+    debug_out("test_preview");
+
+    const uint32_t width = 300;
+    const uint32_t height = 200;
+    for(int interlaced = 0; interlaced < 2; ++interlaced)
+    {
+        const std::vector<uint8_t> flif = createFlif(width, height, 1, 0, interlaced != 0);
+        MY_ASSERT(flif.empty(), "encoding failed");
+        auto input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif));
+
+        flifcore::Decoder decoder;
+        flifcore::Frame full;
+        MY_ASSERT(decoder.decode(input) != flifcore::DS_OK || decoder.extractFrame(0, full, flifcore::PF_PBGRA32) != flifcore::DS_OK, "full decode failed");
+
+        // no limits is the full decode
+        flifcore::Frame preview;
+        MY_ASSERT(flifcore::decodePreview(input, 0, 100, preview) != flifcore::DS_OK, "unlimited preview failed");
+        MY_ASSERT(preview.pixels != full.pixels, "unlimited preview differs");
+
+        MY_ASSERT(flifcore::decodePreview(input, 64, 100, preview) != flifcore::DS_OK, "preview failed");
+        MY_ASSERT(preview.format != flifcore::PF_PBGRA32, "wrong preview format");
+        if(interlaced)
+        {
+            // a zoom level, at least as large as asked for
+            MY_ASSERT(preview.width >= width || preview.height >= height, "preview not reduced");
+            MY_ASSERT(preview.width < 64 || preview.height < 43, "preview too small");
+        }
+        else
+            MY_ASSERT(preview.width != width || preview.height != height, "non-interlaced files have no zoom levels");
+
+        MY_ASSERT(flifcore::decodePreview(input, 64, 30, preview) != flifcore::DS_OK, "low quality preview failed");
+    }
+
+    return 0;
+}
+
+int test_scaled_decode()
+{
+    debug_out("test_scaled_decode");
+
+    MY_ASSERT(flifcore::zoomScale(4000, 3000, 4000, 3000) != 1, "full size needs scale 1");
+    MY_ASSERT(flifcore::zoomScale(4000, 3000, 1000, 750) != 4, "exact quarter");
+    MY_ASSERT(flifcore::zoomScale(4000, 3000, 1001, 750) != 2, "slightly more than a quarter");
+    MY_ASSERT(flifcore::zoomScale(4001, 3001, 1001, 751) != 4, "zoom levels round up");
+    MY_ASSERT(flifcore::zoomScale(4000, 3000, 1, 1) != 2048, "single pixel");
+    MY_ASSERT(flifcore::zoomScale(1, 1, 1, 1) != 1, "single pixel image");
+    MY_ASSERT(flifcore::zoomScale(0xffffffff, 0xffffffff, 1, 1) != 0x80000000, "huge image");
+
+    const uint32_t width = 301;
+    const uint32_t height = 200;
+    for(int interlaced = 0; interlaced < 2; ++interlaced)
+    {
+        const std::vector<uint8_t> flif = createFlif(width, height, 2, 0, interlaced != 0);
+        MY_ASSERT(flif.empty(), "encoding failed");
+        auto input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif));
+
+        flifcore::Decoder decoder;
+        MY_ASSERT(decoder.decode(input) != flifcore::DS_OK, "full decode failed");
+
+        // full size is the plain decode, in every format
+        const flifcore::PixelFormat formats[] = { flifcore::PF_RGBA32, flifcore::PF_GRAY8, flifcore::PF_BGR24, flifcore::PF_PBGRA32, flifcore::PF_RGBA64 };
+        for(flifcore::PixelFormat format : formats)
+        {
+            flifcore::Frame full;
+            flifcore::Frame scaled;
+            MY_ASSERT(decoder.extractFrame(1, full, format) != flifcore::DS_OK, "extracting failed");
+            MY_ASSERT(flifcore::decodeScaled(input, 1, width, height, format, scaled) != flifcore::DS_OK, "unscaled decode failed");
+            MY_ASSERT(scaled.format != format || scaled.pixels != full.pixels, std::string("unscaled decode differs: ") + flifcore::toString(format));
+        }
+
+        const uint32_t sizes[][2] = { { 151, 100 }, { 76, 50 }, { 38, 25 }, { 100, 80 }, { 1, 1 } };
+        for(const auto& size : sizes)
+        {
+            const std::string name = std::to_string(size[0]) + "x" + std::to_string(size[1]);
+
+            flifcore::Frame scaled;
+            MY_ASSERT(flifcore::decodeScaled(input, 1, size[0], size[1], flifcore::PF_PBGRA32, scaled) != flifcore::DS_OK, "scaled decode failed: " + name);
+            MY_ASSERT(scaled.width != size[0] || scaled.height != size[1] || scaled.pixels.size() != scaled.stride() * size[1], "wrong scaled size: " + name);
+
+            // green is the source row, compare the middle of each row with a box filter of the full image
+            flifcore::Frame full;
+            flifcore::Frame reference;
+            MY_ASSERT(decoder.extractFrame(1, full, flifcore::PF_PBGRA32) != flifcore::DS_OK, "extracting failed");
+            MY_ASSERT(!flifcore::downscaleBox(full, size[0], size[1], reference), "reference failed");
+
+            const int tolerance = int(2 * height / size[1]) + 1;
+            for(uint32_t y = 0; y < size[1]; ++y)
+            {
+                const size_t offset = y * scaled.stride() + (size[0] / 2) * 4 + 1;
+                const int difference = int(scaled.pixels[offset]) - int(reference.pixels[offset]);
+                MY_ASSERT(std::abs(difference) > tolerance, "scaled content differs: " + name + ", row " + std::to_string(y));
+            }
+        }
+
+        flifcore::Frame scaled;
+        MY_ASSERT(flifcore::decodeScaled(input, 1, width + 1, height, flifcore::PF_RGBA32, scaled) == flifcore::DS_OK, "enlarging must fail");
+        MY_ASSERT(flifcore::decodeScaled(input, 1, 0, 1, flifcore::PF_RGBA32, scaled) == flifcore::DS_OK, "empty size must fail");
+        MY_ASSERT(flifcore::decodeScaled(input, 2, 10, 10, flifcore::PF_RGBA32, scaled) != flifcore::DS_FRAME_MISSING, "missing frame");
+    }
+
+    return 0;
+}
+
+int test_region_cache()
+{
+    debug_out("test_region_cache");
+
+    const uint32_t width = 301;
+    const uint32_t height = 200;
+    const std::vector<uint8_t> flif = createFlif(width, height, 2);
+    MY_ASSERT(flif.empty(), "encoding failed");
+    auto input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif));
+
+    flifcore::Decoder decoder;
+    flifcore::Frame full;
+    MY_ASSERT(decoder.decode(input) != flifcore::DS_OK || decoder.extractFrame(1, full, flifcore::PF_BGR24) != flifcore::DS_OK, "full decode failed");
+
+    // a region is exactly that part of the full frame
+    const auto rectDiffers = [&](uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint8_t* pixels, size_t stride)
+    {
+        for(uint32_t row = 0; row < h; ++row)
+            if(memcmp(pixels + row * stride, full.pixels.data() + (y + row) * full.stride() + x * 3, w * 3) != 0)
+                return true;
+        return false;
+    };
+
+    flifcore::Frame region;
+    MY_ASSERT(flifcore::decodeRegion(input, 1, 100, 80, 40, 30, flifcore::PF_BGR24, region) != flifcore::DS_OK, "region decode failed");
+    MY_ASSERT(region.width != 40 || region.height != 30 || region.pixels.size() != 40 * 30 * 3, "wrong region size");
+    MY_ASSERT(rectDiffers(100, 80, 40, 30, region.pixels.data(), region.stride()), "region content differs");
+
+    MY_ASSERT(flifcore::decodeRegion(input, 1, 290, 0, 12, 1, flifcore::PF_BGR24, region) == flifcore::DS_OK, "region outside must fail");
+    MY_ASSERT(flifcore::decodeRegion(input, 1, 0, 0, 0, 1, flifcore::PF_BGR24, region) == flifcore::DS_OK, "empty region must fail");
+    MY_ASSERT(flifcore::decodeRegion(input, 2, 0, 0, 1, 1, flifcore::PF_BGR24, region) != flifcore::DS_FRAME_MISSING, "missing frame");
+
+    flifcore::RegionCache cache(input, 1, width, height, flifcore::PF_BGR24);
+    flifcore::resetCounters();
+    const flifcore::Counters& counters = flifcore::counters();
+
+    // padded rows, the padding must stay untouched
+    const size_t stride = 40 * 3 + 5;
+    std::vector<uint8_t> buffer(stride * 30, 0xcd);
+    MY_ASSERT(cache.copyPixels(100, 80, 40, 30, buffer.data(), stride) != flifcore::DS_OK, "first copy failed");
+    MY_ASSERT(rectDiffers(100, 80, 40, 30, buffer.data(), stride) || buffer[stride - 1] != 0xcd, "first copy differs");
+    MY_ASSERT(cache.misses() != 1 || cache.hits() != 0 || counters.pixel_decodes != 1, "first copy not decoded");
+
+    // panning by less than the margin stays in the decoded region
+    MY_ASSERT(cache.copyPixels(115, 70, 40, 30, buffer.data(), stride) != flifcore::DS_OK, "overlapping copy failed");
+    MY_ASSERT(rectDiffers(115, 70, 40, 30, buffer.data(), stride), "overlapping copy differs");
+    MY_ASSERT(cache.hits() != 1 || counters.pixel_decodes != 1, "overlapping copy decoded again");
+
+    // at the border the margin is clamped
+    MY_ASSERT(cache.copyPixels(width - 40, height - 30, 40, 30, buffer.data(), stride) != flifcore::DS_OK, "border copy failed");
+    MY_ASSERT(rectDiffers(width - 40, height - 30, 40, 30, buffer.data(), stride), "border copy differs");
+    MY_ASSERT(cache.misses() != 2 || cache.regionCount() != 2, "border copy not decoded");
+    MY_ASSERT(cache.copyPixels(100, 80, 40, 30, buffer.data(), stride) != flifcore::DS_OK || cache.hits() != 2, "first region lost");
+
+    // a budget for one region keeps only the most recent one
+    flifcore::RegionCache small(input, 1, width, height, flifcore::PF_BGR24, 80 * 60 * 3);
+    MY_ASSERT(small.copyPixels(0, 0, 40, 30, buffer.data(), stride) != flifcore::DS_OK, "copy failed");
+    MY_ASSERT(small.copyPixels(200, 150, 40, 30, buffer.data(), stride) != flifcore::DS_OK, "copy failed");
+    MY_ASSERT(small.regionCount() != 1 || small.cachedBytes() > 80 * 60 * 3, "budget exceeded");
+    MY_ASSERT(small.copyPixels(0, 0, 40, 30, buffer.data(), stride) != flifcore::DS_OK || small.misses() != 3, "evicted region still cached");
+
+    cache.clear();
+    MY_ASSERT(cache.regionCount() != 0 || cache.cachedBytes() != 0, "clear failed");
+
+    return 0;
+}
+
+int test_content_hash()
+{
+    debug_out("test_content_hash");
+
+    // reference values of XXH64 with seed 0, covering the tail and the 32 byte loop
+    const struct { const char* text; uint64_t hash; } vectors[] = {
+        { "", 0xEF46DB3751D8E999ULL },
+        { "a", 0xD24EC4F1A98C6E5BULL },
+        { "abc", 0x44BC2CF5AD770999ULL },
+        { "Nobody inspects the spammish repetition", 0xFBCEA83C8A378BF1ULL },
+    };
+    for(const auto& v : vectors)
+    {
+        const uint64_t hash = flifcore::contentHash(reinterpret_cast<const uint8_t*>(v.text), strlen(v.text));
+        MY_ASSERT(hash != v.hash, std::string("wrong hash: ") + v.text);
+    }
+
+    // a single changed byte changes the hash, wherever it is
+    std::vector<uint8_t> data(1000);
+    for(size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<uint8_t>(i * 7);
+    const uint64_t original = flifcore::contentHash(data.data(), data.size());
+    for(size_t i : { size_t(0), size_t(31), size_t(500), size_t(999) })
+    {
+        data[i] ^= 1;
+        MY_ASSERT(flifcore::contentHash(data.data(), data.size()) == original, "changed byte not noticed at " + std::to_string(i));
+        data[i] ^= 1;
+    }
+
+    return 0;
+}
+
+int test_image_cache()
+{
+    debug_out("test_image_cache");
+
+    const std::vector<uint8_t> flif_a = createFlif(30, 20, 2);
+    const std::vector<uint8_t> flif_b = createFlif(31, 20, 1);
+    MY_ASSERT(flif_a.empty() || flif_b.empty(), "encoding failed");
+    auto input_a = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif_a));
+    auto input_b = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif_b));
+
+    const flifcore::ImageKey key_a = flifcore::ImageCache::key(*input_a, flifcore::PF_PBGRA32);
+    const flifcore::ImageKey key_b = flifcore::ImageCache::key(*input_b, flifcore::PF_PBGRA32);
+    MY_ASSERT(key_a == key_b, "different files, same key");
+    MY_ASSERT(!(key_a == flifcore::ImageCache::key(*input_a, flifcore::PF_PBGRA32)), "same file, different key");
+
+    // room for exactly one of the two images
+    const uint64_t bytes_a = 30 * 20 * 4 * 2;
+    flifcore::ImageCache cache(bytes_a);
+    flifcore::resetCounters();
+    const flifcore::Counters& counters = flifcore::counters();
+
+    MY_ASSERT(cache.find(key_a), "found before decoding");
+
+    std::shared_ptr<const flifcore::CachedImage> image;
+    MY_ASSERT(cache.decode(input_a, key_a, image) != flifcore::DS_OK, "decode failed");
+    MY_ASSERT(image->frames.size() != 2 || image->bytes() != bytes_a || image->info.width != 30, "wrong image");
+    MY_ASSERT(image->frames[1].format != flifcore::PF_PBGRA32 || image->frames[1].pixels[3 * 4 + 2] != 3 + 1, "wrong pixels");
+
+    // the second object opening the file decodes nothing
+    std::shared_ptr<const flifcore::CachedImage> again;
+    MY_ASSERT(cache.decode(input_a, key_a, again) != flifcore::DS_OK || again != image, "not shared");
+    MY_ASSERT(cache.find(key_a) != image, "find missed");
+    MY_ASSERT(counters.pixel_decodes != 1, "decoded again");
+
+    flifcore::ImageCache::Stats stats = cache.stats();
+    MY_ASSERT(stats.hits != 2 || stats.misses != 1 || stats.images != 1 || stats.bytes != bytes_a, "wrong stats");
+
+    // the other image pushes the first one out, which stays valid for its users
+    std::shared_ptr<const flifcore::CachedImage> other;
+    MY_ASSERT(cache.decode(input_b, key_b, other) != flifcore::DS_OK, "decode failed");
+    MY_ASSERT(cache.find(key_a), "evicted image still found");
+    MY_ASSERT(cache.find(key_b) != other, "new image not found");
+    MY_ASSERT(image->frames[1].pixels[3 * 4 + 2] != 3 + 1, "evicted image changed");
+    stats = cache.stats();
+    MY_ASSERT(stats.evictions != 1 || stats.images != 1 || stats.bytes != other->bytes(), "wrong stats after eviction");
+
+    // too large for the budget: decoded, but not kept
+    cache.setBudget(100);
+    MY_ASSERT(cache.stats().images != 0 || cache.stats().bytes != 0, "budget not applied");
+    MY_ASSERT(cache.decode(input_a, key_a, image) != flifcore::DS_OK || !image || cache.find(key_a), "large image kept");
+
+    // failures are not cached
+    cache.setBudget(flifcore::ImageCache::DEFAULT_BUDGET_BYTES);
+    std::vector<uint8_t> broken_flif = flif_a;
+    broken_flif[0] = 'X';
+    auto broken = std::make_shared<flifcore::OwnedInputBuffer>(std::move(broken_flif));
+    const flifcore::ImageKey key_broken = flifcore::ImageCache::key(*broken, flifcore::PF_PBGRA32);
+    MY_ASSERT(cache.decode(broken, key_broken, image) == flifcore::DS_OK, "broken file decoded");
+    MY_ASSERT(cache.decode(broken, key_broken, image) == flifcore::DS_OK || cache.stats().images != 0, "failure cached");
+
+    // the format follows the image without a key
+    MY_ASSERT(cache.decode(input_b, image) != flifcore::DS_OK || image->frames[0].format != flifcore::PF_PBGRA32, "wrong format");
+    cache.clear();
+    MY_ASSERT(cache.stats().images != 0 || cache.stats().bytes != 0, "clear failed");
+
+    return 0;
+}
+
+int test_image_cache_threads()
+{
+    debug_out("test_image_cache_threads");
+
+    // more files than fit, so hits, misses, evictions and waits for other threads all happen at once
+    const size_t file_count = 12;
+    std::vector<std::shared_ptr<const flifcore::InputBuffer>> inputs;
+    std::vector<flifcore::ImageKey> keys;
+    for(size_t i = 0; i < file_count; ++i)
+    {
+        const std::vector<uint8_t> flif = createFlif(40 + uint32_t(i), 30, 1 + uint32_t(i % 3));
+        MY_ASSERT(flif.empty(), "encoding failed");
+        inputs.push_back(std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif)));
+        keys.push_back(flifcore::ImageCache::key(*inputs.back(), flifcore::PF_RGBA32));
+    }
+
+    flifcore::ImageCache cache(4 * 50 * 30 * 4 * 3);
+
+    const int thread_count = 8;
+    const int iterations = 400;
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < thread_count; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            uint32_t random = 12345 + t;
+            for(int i = 0; i < iterations; ++i)
+            {
+                random = random * 1103515245 + 12345;
+                const size_t file = (random >> 16) % file_count;
+
+                std::shared_ptr<const flifcore::CachedImage> image;
+                if(cache.decode(inputs[file], keys[file], image) != flifcore::DS_OK ||
+                    image->info.width != 40 + file ||
+                    image->frames.size() != 1 + file % 3)
+                {
+                    failures++;
+                    continue;
+                }
+
+                // red is x + frame, every thread must see the same complete pixels
+                const flifcore::FrameView& frame = image->frames.back();
+                if(frame.pixels[5 * 4] != 5 + image->frames.size() - 1 || frame.pixels[(29 * frame.width + 2) * 4 + 1] != 29)
+                    failures++;
+
+                if(i % 50 == 0)
+                    cache.setBudget(cache.budget());
+                if(t == 0 && i == iterations / 2)
+                    cache.clear();
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+
+    MY_ASSERT(failures != 0, "wrong images: " + std::to_string(failures));
+
+    const flifcore::ImageCache::Stats stats = cache.stats();
+    MY_ASSERT(stats.bytes > cache.budget(), "budget exceeded");
+    MY_ASSERT(stats.hits + stats.misses != uint64_t(thread_count) * iterations, "lost requests");
+    MY_ASSERT(stats.hits == 0 || stats.evictions == 0, "no hits or no evictions");
+
+    uint64_t bytes = 0;
+    for(size_t i = 0; i < file_count; ++i)
+    {
+        std::shared_ptr<const flifcore::CachedImage> image = cache.find(keys[i]);
+        if(image)
+            bytes += image->bytes();
+    }
+    MY_ASSERT(bytes != stats.bytes, "bytes out of sync with the images");
+
+    return 0;
+}
+
+//! The cache only creates ASCII names.
+std::string narrowPath(const flifcore::DiskCache::Path& path)
+{
+    std::string result;
+    for(auto c : path)
+        result.push_back(static_cast<char>(c));
+    return result;
+}
+
+//! Empty value to remove the variable.
+void setEnvironment(const char* name, const char* value)
+{
+#ifdef _WIN32
+    _putenv_s(name, value);
+#else
+    if(value[0] == 0)
+        unsetenv(name);
+    else
+        setenv(name, value, 1);
+#endif
+}
+
+int test_disk_cache()
+{
+    debug_out("test_disk_cache");
+
+    const std::string directory_name = "core_test_disk_cache";
+    const flifcore::DiskCache::Path directory(directory_name.begin(), directory_name.end());
+
+    const std::vector<uint8_t> flif_a = createFlif(30, 20, 2);
+    const std::vector<uint8_t> flif_b = createFlif(31, 20, 1);
+    const std::vector<uint8_t> flif_c = createFlif(32, 20, 1);
+    MY_ASSERT(flif_a.empty() || flif_b.empty() || flif_c.empty(), "encoding failed");
+    auto input_a = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif_a));
+    auto input_b = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif_b));
+    auto input_c = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif_c));
+    const flifcore::ImageKey key_a = flifcore::ImageCache::key(*input_a, flifcore::PF_PBGRA32);
+    const flifcore::ImageKey key_b = flifcore::ImageCache::key(*input_b, flifcore::PF_PBGRA32);
+    const flifcore::ImageKey key_c = flifcore::ImageCache::key(*input_c, flifcore::PF_PBGRA32);
+
+    flifcore::resetCounters();
+    const flifcore::Counters& counters = flifcore::counters();
+
+    // an image cache with the disk decodes, the next one maps what the first one stored
+    std::shared_ptr<const flifcore::CachedImage> decoded;
+    {
+        flifcore::ImageCache cache;
+        cache.setDiskCache(std::make_shared<flifcore::DiskCache>(directory));
+        MY_ASSERT(cache.decode(input_a, key_a, decoded) != flifcore::DS_OK, "decode failed");
+        MY_ASSERT(cache.stats().disk_hits != 0, "disk hit in an empty directory");
+    }
+    MY_ASSERT(counters.pixel_decodes != 1, "wrong number of decodes");
+
+    std::shared_ptr<const flifcore::CachedImage> loaded;
+    {
+        flifcore::ImageCache cache;
+        cache.setDiskCache(std::make_shared<flifcore::DiskCache>(directory));
+        MY_ASSERT(cache.decode(input_a, key_a, loaded) != flifcore::DS_OK, "loading failed");
+        MY_ASSERT(cache.stats().disk_hits != 1, "no disk hit");
+    }
+    MY_ASSERT(counters.pixel_decodes != 1, "decoded despite the disk cache");
+
+    MY_ASSERT(loaded->frames.size() != 2 || loaded->num_loops != decoded->num_loops ||
+        loaded->info.width != 30 || loaded->info.frame_count != 2, "wrong image");
+    for(size_t i = 0; i < 2; ++i)
+    {
+        const flifcore::FrameView& frame = loaded->frames[i];
+        MY_ASSERT(reinterpret_cast<uintptr_t>(frame.pixels) % flifcore::DiskCache::PAGE_SIZE != 0, "frame not page aligned");
+        MY_ASSERT(frame.format != flifcore::PF_PBGRA32 || frame.delay_ms != decoded->frames[i].delay_ms, "wrong frame");
+        MY_ASSERT(memcmp(frame.pixels, decoded->frames[i].pixels, static_cast<size_t>(frame.size())) != 0, "wrong pixels");
+    }
+
+    flifcore::DiskCache disk(directory);
+    MY_ASSERT(disk.load(key_a, 1), "other variant found");
+    MY_ASSERT(!disk.load(key_a, 0), "not found");
+
+    // a damaged file is a miss, and is gone afterwards
+    {
+        FILE* file = fopen(narrowPath(disk.fileName(key_a, 0)).c_str(), "r+b");
+        MY_ASSERT(file == 0, "cache file missing");
+        fseek(file, 48, SEEK_SET);
+        fputc(0x55, file);
+        fclose(file);
+    }
+    MY_ASSERT(disk.load(key_a, 0), "damaged file loaded");
+    MY_ASSERT(disk.bytesOnDisk() != 0, "damaged file not deleted");
+
+    // frames that do not match the header size are a miss as well
+    {
+        flifcore::CachedImage mismatched = *decoded;
+        mismatched.info.width = 29;
+        MY_ASSERT(!disk.store(key_c, 0, mismatched), "store failed");
+        MY_ASSERT(disk.load(key_c, 0), "frames narrower than the header loaded");
+
+        mismatched.info.width = 31;
+        MY_ASSERT(!disk.store(key_c, 0, mismatched), "store failed");
+        MY_ASSERT(disk.load(key_c, 0), "frames wider than the header loaded");
+
+        mismatched.info.width = 29;
+        MY_ASSERT(!disk.store(key_c, 16, mismatched), "store failed");
+        MY_ASSERT(disk.load(key_c, 16), "variant larger than the header loaded");
+        MY_ASSERT(disk.bytesOnDisk() != 0, "mismatched files not deleted");
+    }
+
+    // thumbnails are a variant of their own
+    std::shared_ptr<const flifcore::CachedImage> thumbnail;
+    MY_ASSERT(flifcore::decodeThumbnailCached(input_b, 16, &disk, thumbnail) != flifcore::DS_OK, "thumbnail failed");
+    MY_ASSERT(thumbnail->frames.size() != 1 || thumbnail->frames[0].width != 16, "wrong thumbnail");
+    const uint64_t decodes = counters.pixel_decodes;
+    MY_ASSERT(flifcore::decodeThumbnailCached(input_b, 16, &disk, thumbnail) != flifcore::DS_OK, "thumbnail failed");
+    MY_ASSERT(counters.pixel_decodes != decodes || thumbnail->frames[0].height != 10, "thumbnail not cached");
+
+    // stores within the limit do not list the directory, one that goes over does
+    {
+        flifcore::DiskCache roomy(directory);
+        flifcore::resetCounters();
+        MY_ASSERT(!roomy.store(key_b, 0, *decoded) || !roomy.store(key_c, 0, *decoded), "store failed");
+        MY_ASSERT(flifcore::counters().disk_cache_scans != 0, "directory listed below the limit");
+
+        flifcore::DiskCache full(directory, roomy.bytesOnDisk());
+        MY_ASSERT(!full.store(key_a, 0, *decoded), "store failed");
+        MY_ASSERT(flifcore::counters().disk_cache_scans != 1, "directory not trimmed over the limit");
+        MY_ASSERT(full.bytesOnDisk() > full.maxBytes(), "size limit exceeded");
+    }
+
+    // the size limit: with room for two files, storing a third one deletes the least recently used
+    flifcore::DiskCache limited(directory, 0);
+    limited.trim();
+    MY_ASSERT(limited.bytesOnDisk() != 0, "trim to 0 left files");
+
+    MY_ASSERT(!disk.store(key_a, 0, *decoded), "store failed");
+    const uint64_t file_size = disk.bytesOnDisk();
+    MY_ASSERT(file_size != 2 * flifcore::DiskCache::PAGE_SIZE + decoded->frames[1].size(), "wrong file size");
+
+    flifcore::DiskCache two_files(directory, 2 * file_size);
+    MY_ASSERT(!two_files.store(key_b, 0, *decoded) || !two_files.store(key_c, 0, *decoded), "store failed");
+    MY_ASSERT(two_files.bytesOnDisk() > two_files.maxBytes(), "size limit exceeded");
+
+#ifndef _WIN32
+    // timestamps have a resolution of seconds, so they are set explicitly
+    {
+        const std::string name_a = narrowPath(two_files.fileName(key_a, 0));
+        const std::string name_b = narrowPath(two_files.fileName(key_b, 0));
+        const std::string name_c = narrowPath(two_files.fileName(key_c, 0));
+        MY_ASSERT(access(name_c.c_str(), F_OK) != 0, "newest file evicted");
+
+        struct timeval old_times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+        struct timeval older_times[2] = { { 900000000, 0 }, { 900000000, 0 } };
+        MY_ASSERT(utimes(name_c.c_str(), older_times) != 0, "utimes failed");
+        if(access(name_a.c_str(), F_OK) == 0)
+            MY_ASSERT(utimes(name_a.c_str(), old_times) != 0, "utimes failed");
+        if(access(name_b.c_str(), F_OK) == 0)
+            MY_ASSERT(utimes(name_b.c_str(), old_times) != 0, "utimes failed");
+
+        // a hit makes the file the most recently used one
+        MY_ASSERT(!two_files.load(key_c, 0), "not found");
+        MY_ASSERT(!two_files.store(key_a, 0, *decoded), "store failed");
+        MY_ASSERT(access(name_c.c_str(), F_OK) != 0 || access(name_a.c_str(), F_OK) != 0, "used file evicted");
+        MY_ASSERT(access(name_b.c_str(), F_OK) == 0, "least recently used file kept");
+
+        // temporary files of crashed writers are removed once they are old, never those still being written
+        const std::string stale = directory_name + "/1-1.part";
+        const std::string fresh = directory_name + "/1-2.part";
+        MY_ASSERT(!writeFile(stale, flif_a) || !writeFile(fresh, flif_a), "writing temporary files failed");
+        MY_ASSERT(utimes(stale.c_str(), old_times) != 0, "utimes failed");
+        two_files.trim();
+        MY_ASSERT(access(stale.c_str(), F_OK) == 0, "stale temporary file kept");
+        MY_ASSERT(access(fresh.c_str(), F_OK) != 0, "fresh temporary file removed");
+        remove(fresh.c_str());
+    }
+#endif
+
+    // the size from the environment: saturated, and ignored if it is no number
+    {
+        setEnvironment("FLIF_DISK_CACHE_DIR", directory_name.c_str());
+        const struct { const char* megabytes; uint64_t max_bytes; } sizes[] = {
+            { "3", 3 * 1024 * 1024 },
+            { "0", 0 },
+            { "99999999999999999999", std::numeric_limits<uint64_t>::max() },
+            { "17592186044417", std::numeric_limits<uint64_t>::max() },
+            { "abc", flifcore::DiskCache::DEFAULT_MAX_BYTES },
+            { "-1", flifcore::DiskCache::DEFAULT_MAX_BYTES },
+            { "12MB", flifcore::DiskCache::DEFAULT_MAX_BYTES },
+            { "", flifcore::DiskCache::DEFAULT_MAX_BYTES },
+        };
+        for(const auto& size : sizes)
+        {
+            setEnvironment("FLIF_DISK_CACHE_MB", size.megabytes);
+            const std::shared_ptr<flifcore::DiskCache> configured = flifcore::DiskCache::fromEnvironment();
+            MY_ASSERT(!configured, "no cache from the environment");
+            MY_ASSERT(configured->maxBytes() != size.max_bytes, std::string("wrong size for FLIF_DISK_CACHE_MB=") + size.megabytes);
+        }
+        setEnvironment("FLIF_DISK_CACHE_DIR", "");
+    }
+
+    limited.trim();
+    MY_ASSERT(limited.bytesOnDisk() != 0, "cleanup failed");
+#ifdef _WIN32
+    _rmdir(directory_name.c_str());
+#else
+    rmdir(directory_name.c_str());
+#endif
+    return 0;
+}
+
+int test_buffer_pool()
+{
+    debug_out("test_buffer_pool");
+
+    // four classes per power of two
+    MY_ASSERT(flifcore::BufferPool::classSize(1) != 64 || flifcore::BufferPool::classSize(64) != 64, "wrong smallest class");
+    MY_ASSERT(flifcore::BufferPool::classSize(65) != 80 || flifcore::BufferPool::classSize(100) != 112 ||
+        flifcore::BufferPool::classSize(128) != 128 || flifcore::BufferPool::classSize(129) != 160, "wrong class size");
+    for(size_t size = 1; size < 1000000; size = size * 3 / 2 + 1)
+    {
+        const size_t class_size = flifcore::BufferPool::classSize(size);
+        MY_ASSERT(class_size < size || (size > 64 && class_size > size + size / 4), "class too small or too large");
+    }
+    const size_t unpooled = flifcore::BufferPool::MAX_CLASS_SIZE + 1;
+    MY_ASSERT(flifcore::BufferPool::classSize(unpooled) != unpooled, "unpooled size rounded");
+
+    // a returned buffer serves the next request of its class
+    flifcore::BufferPool pool(1000);
+    uint8_t* first = pool.allocate(100);
+    MY_ASSERT(reinterpret_cast<uintptr_t>(first) % flifcore::BufferPool::ALIGNMENT != 0, "not aligned");
+    memset(first, 0xab, 112);
+    pool.deallocate(first, 100);
+    uint8_t* second = pool.allocate(97);
+    MY_ASSERT(second != first, "buffer not reused");
+    flifcore::BufferPool::Stats stats = pool.stats();
+    MY_ASSERT(stats.allocations != 1 || stats.reuses != 1 || stats.idle_bytes != 0, "wrong stats");
+
+    // only up to the idle limit is kept
+    std::vector<uint8_t*> buffers;
+    for(int i = 0; i < 10; ++i)
+        buffers.push_back(pool.allocate(200));
+    for(uint8_t* buffer : buffers)
+        pool.deallocate(buffer, 200);
+    MY_ASSERT(pool.stats().idle_bytes != 4 * 224, "wrong number of idle buffers");
+    pool.setMaxIdleBytes(300);
+    MY_ASSERT(pool.stats().idle_bytes != 224, "idle limit not applied");
+    pool.deallocate(second, 97);
+    pool.clear();
+    MY_ASSERT(pool.stats().idle_bytes != 0, "clear failed");
+
+    // too large for a class: straight from and back to the heap
+    uint8_t* large = pool.allocate(unpooled);
+    pool.setMaxIdleBytes(uint64_t(1) << 40);
+    pool.deallocate(large, unpooled);
+    MY_ASSERT(pool.stats().idle_bytes != 0, "unpooled buffer kept");
+
+    // containers borrow from the shared pool
+    {
+        flifcore::PixelBuffer pixels(1000, 7);
+        MY_ASSERT(reinterpret_cast<uintptr_t>(pixels.data()) % flifcore::BufferPool::ALIGNMENT != 0, "pixels not aligned");
+    }
+    const uint64_t reuses = flifcore::BufferPool::shared().stats().reuses;
+    {
+        flifcore::PixelBuffer pixels(1000);
+    }
+    MY_ASSERT(flifcore::BufferPool::shared().stats().reuses != reuses + 1, "shared pool not used");
+
+    // threads never get the same buffer at once
+    const int thread_count = 4;
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < thread_count; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            uint32_t random = 777 + t;
+            for(int i = 0; i < 2000; ++i)
+            {
+                random = random * 1103515245 + 12345;
+                const size_t size = 1 + (random >> 16) % 5000;
+                uint8_t* buffer = pool.allocate(size);
+                memset(buffer, t, size);
+                std::this_thread::yield();
+                if(buffer[0] != t || buffer[size - 1] != t)
+                    failures++;
+                pool.deallocate(buffer, size);
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+    MY_ASSERT(failures != 0, "buffer shared between threads");
+
+    return 0;
+}
+
+int test_decoder_pool()
+{
+    debug_out("test_decoder_pool");
+
+    flifcore::DecoderPool pool(2);
+    FLIF_DECODER* first;
+    {
+        flifcore::PooledDecoder decoder(pool);
+        first = decoder;
+        MY_ASSERT(first == 0, "no decoder");
+    }
+    MY_ASSERT(pool.stats().created != 1 || pool.stats().idle != 1, "decoder not returned");
+    {
+        flifcore::PooledDecoder decoder(pool);
+        MY_ASSERT(decoder != first, "decoder not reused");
+    }
+    MY_ASSERT(pool.stats().created != 1 || pool.stats().reused != 1, "wrong stats");
+
+    // decoders with large images or settings that stay are not kept
+    {
+        flifcore::PooledDecoder large(pool);
+        large.setRetainedBytes(flifcore::DecoderPool::MAX_RETAINED_BYTES + 1);
+        flifcore::PooledDecoder cropped(pool);
+        cropped.discard();
+    }
+    MY_ASSERT(pool.stats().idle != 0, "decoder kept");
+
+    // no more than the limit
+    {
+        flifcore::PooledDecoder a(pool), b(pool), c(pool);
+        flifcore::PooledDecoder moved(std::move(c));
+    }
+    MY_ASSERT(pool.stats().idle != 2, "idle limit not applied");
+    pool.setMaxIdle(0);
+    MY_ASSERT(pool.stats().idle != 0, "idle decoders kept");
+
+    // a decoder that stopped early at a low zoom level decodes the next file completely
+    const std::vector<uint8_t> flif = createFlif(64, 48, 1, 0, true);
+    MY_ASSERT(flif.empty(), "encoding failed");
+    auto input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif));
+
+    flifcore::DecoderPool::shared().clear();
+    const uint64_t reused = flifcore::DecoderPool::shared().stats().reused;
+    flifcore::Frame preview;
+    MY_ASSERT(flifcore::decodePreview(input, 8, 50, preview) != flifcore::DS_OK || preview.width >= 64, "preview failed");
+    MY_ASSERT(flifcore::DecoderPool::shared().stats().idle != 1, "small decoder not kept");
+
+    flifcore::Decoder decoder;
+    flifcore::Frame frame;
+    MY_ASSERT(decoder.decode(input) != flifcore::DS_OK || decoder.extractFrame(0, frame) != flifcore::DS_OK, "decode failed");
+    MY_ASSERT(flifcore::DecoderPool::shared().stats().reused != reused + 1, "decoder not reused");
+    MY_ASSERT(frame.width != 64 || frame.height != 48, "settings of the previous decode applied");
+    MY_ASSERT(frame.pixels[(47 * 64 + 5) * 4] != 5 || frame.pixels[(47 * 64 + 5) * 4 + 1] != 47, "wrong pixels");
+
+    // a crop cannot be undone
+    flifcore::Frame region;
+    const size_t idle = flifcore::DecoderPool::shared().stats().idle;
+    MY_ASSERT(flifcore::decodeRegion(input, 0, 10, 10, 8, 8, flifcore::PF_RGBA32, region) != flifcore::DS_OK, "region failed");
+    MY_ASSERT(flifcore::DecoderPool::shared().stats().idle != idle, "cropping decoder kept");
+
+    return 0;
+}
+
+int test_cancel()
+{
+    debug_out("test_cancel");
+
+    typedef std::chrono::steady_clock Clock;
+    auto millisSince = [](Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    };
+
+    const std::vector<uint8_t> flif = createFlif(4000, 3000, 1);
+    MY_ASSERT(flif.empty(), "encoding failed");
+    std::shared_ptr<const flifcore::InputBuffer> input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif));
+
+    // a token that never fires changes nothing
+    flifcore::CancelToken unused;
+    double full_ms;
+    {
+        flifcore::Decoder decoder;
+        decoder.setCancelToken(&unused);
+        MY_ASSERT(decoder.open(input) != flifcore::DS_OK, "open failed");
+        const Clock::time_point start = Clock::now();
+        MY_ASSERT(decoder.decodePixels() != flifcore::DS_OK, "decode failed");
+        full_ms = millisSince(start);
+
+        flifcore::Frame frame;
+        MY_ASSERT(decoder.extractFrame(0, frame) != flifcore::DS_OK || frame.pixels[(2999 * 4000 + 7) * 4] != 7, "wrong pixels");
+    }
+
+    // cancelled from another thread while libflif is busy
+    {
+        flifcore::CancelToken cancel;
+        flifcore::Decoder decoder;
+        decoder.setCancelToken(&cancel);
+        MY_ASSERT(decoder.open(input) != flifcore::DS_OK, "open failed");
+
+        flifcore::resetCounters();
+        Clock::time_point cancelled_at;
+        std::thread canceller([&]()
+        {
+            while(flifcore::counters().pixel_decodes == 0)
+                std::this_thread::yield();
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(full_ms / 10));
+            cancelled_at = Clock::now();
+            cancel.cancel();
+        });
+        const flifcore::DecodeStatus status = decoder.decodePixels();
+        const Clock::time_point returned_at = Clock::now();
+        canceller.join();
+
+        const double latency_ms = std::chrono::duration<double, std::milli>(returned_at - cancelled_at).count();
+        debug_out("  full decode " + std::to_string(full_ms) + " ms, abort landed after " + std::to_string(latency_ms) + " ms");
+        MY_ASSERT(status != flifcore::DS_CANCELLED, std::string("not cancelled: ") + flifcore::toString(status));
+        MY_ASSERT(decoder.isDecoded() || decoder.image(0) != 0, "images of a cancelled decode kept");
+        MY_ASSERT(latency_ms > full_ms * 3 / 4 + 50, "abort took too long");
+
+        // the decoder is still usable without the token
+        decoder.setCancelToken(0);
+        MY_ASSERT(decoder.decodePixels() != flifcore::DS_OK || decoder.image(0) == 0, "decode after cancel failed");
+    }
+
+    // a deadline fires on its own, through the progress callback or the watcher thread
+    {
+        flifcore::CancelToken cancel;
+        cancel.setDeadline(Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(full_ms / 4)));
+        flifcore::Decoder decoder;
+        decoder.setCancelToken(&cancel);
+
+        const Clock::time_point start = Clock::now();
+        MY_ASSERT(decoder.decode(input) != flifcore::DS_CANCELLED, "deadline ignored");
+        MY_ASSERT(millisSince(start) > full_ms * 3 / 4 + 50, "deadline landed too late");
+        MY_ASSERT(!cancel.isCancelled(), "token not cancelled");
+    }
+
+    // a token that fired already stops decodes before libflif starts
+    {
+        flifcore::CancelToken cancel;
+        cancel.cancel();
+        flifcore::resetCounters();
+        flifcore::Frame thumbnail;
+        MY_ASSERT(flifcore::decodeThumbnail(input, 64, thumbnail, &cancel) != flifcore::DS_CANCELLED, "cancelled thumbnail decoded");
+        MY_ASSERT(flifcore::counters().pixel_decodes != 0, "pixels decoded");
+    }
+
+    // a thread that waits for a cancelled decode of another thread decodes itself
+    {
+        flifcore::ImageCache cache;
+        const flifcore::ImageKey key = flifcore::ImageCache::key(*input, flifcore::PF_RGBA32);
+        flifcore::CancelToken cancel;
+
+        flifcore::DecodeStatus owner_status = flifcore::DS_OK;
+        std::thread owner([&]()
+        {
+            std::shared_ptr<const flifcore::CachedImage> image;
+            owner_status = cache.decode(input, key, image, &cancel);
+        });
+        while(cache.stats().misses == 0)
+            std::this_thread::yield();
+
+        flifcore::DecodeStatus waiter_status = flifcore::DS_DECODE_FAILED;
+        std::shared_ptr<const flifcore::CachedImage> waited;
+        std::thread waiter([&]()
+        {
+            waiter_status = cache.decode(input, key, waited);
+        });
+        while(cache.stats().hits == 0)
+            std::this_thread::yield();
+
+        cancel.cancel();
+        owner.join();
+        waiter.join();
+        MY_ASSERT(owner_status != flifcore::DS_CANCELLED, "owner not cancelled");
+        MY_ASSERT(waiter_status != flifcore::DS_OK || !waited || waited->frames.size() != 1, "waiter did not decode");
+        MY_ASSERT(cache.stats().images != 1 || cache.stats().misses != 2, "image not cached by the waiter");
+
+        // a waiter with its own token gives up without stopping the decode
+        cache.clear();
+        flifcore::CancelToken waiter_cancel;
+        std::thread second_owner([&]()
+        {
+            std::shared_ptr<const flifcore::CachedImage> image;
+            owner_status = cache.decode(input, key, image);
+        });
+        while(cache.stats().misses == 2)
+            std::this_thread::yield();
+
+        waiter_cancel.setDeadline(Clock::now() + std::chrono::milliseconds(1));
+        std::shared_ptr<const flifcore::CachedImage> abandoned;
+        MY_ASSERT(cache.decode(input, key, abandoned, &waiter_cancel) != flifcore::DS_CANCELLED || abandoned, "waiter not cancelled");
+        second_owner.join();
+        MY_ASSERT(owner_status != flifcore::DS_OK, "decode stopped by a waiter");
+    }
+
+    return 0;
+}
+
+int test_deadline()
+{
+    debug_out("test_deadline");
+
+    typedef flifcore::CancelToken::Clock Clock;
+
+    // each frame of the animation stands in for a pass, the first one is complete long before the last
+    const std::vector<uint8_t> flif = createFlif(2000, 1500, 4, 0, true);
+    MY_ASSERT(flif.empty(), "encoding failed");
+    std::shared_ptr<const flifcore::InputBuffer> input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif));
+
+    flifcore::Frame frame;
+    bool partial = true;
+    const Clock::time_point start = Clock::now();
+    MY_ASSERT(flifcore::decodeWithDeadline(input, 0, Clock::now() + std::chrono::hours(1), frame, partial) != flifcore::DS_OK, "decode failed");
+    const Clock::duration full_time = Clock::now() - start;
+    MY_ASSERT(partial, "complete decode marked partial");
+    MY_ASSERT(frame.width != 2000 || frame.height != 1500 || frame.format != flifcore::PF_PBGRA32, "wrong frame");
+    MY_ASSERT(frame.pixels[(1499 * 2000 + 7) * 4 + 2] != 7, "wrong pixels");
+
+    // fitted into the size
+    MY_ASSERT(flifcore::decodeWithDeadline(input, 100, Clock::now() + std::chrono::hours(1), frame, partial) != flifcore::DS_OK, "small decode failed");
+    MY_ASSERT(frame.width != 100 || frame.height != 75 || partial, "wrong small frame");
+
+    // nothing to show yet
+    MY_ASSERT(flifcore::decodeWithDeadline(input, 0, Clock::now(), frame, partial) != flifcore::DS_CANCELLED, "decoded after the deadline");
+
+    // stopped in between: the pass decoded so far
+    const Clock::time_point partial_start = Clock::now();
+    const flifcore::DecodeStatus status = flifcore::decodeWithDeadline(input, 0, partial_start + full_time / 2, frame, partial);
+    const Clock::duration partial_time = Clock::now() - partial_start;
+    debug_out("  complete after " + std::to_string(std::chrono::duration<double, std::milli>(full_time).count()) +
+        " ms, partial after " + std::to_string(std::chrono::duration<double, std::milli>(partial_time).count()) + " ms");
+    MY_ASSERT(status != flifcore::DS_OK || !partial, std::string("no partial result: ") + flifcore::toString(status));
+    MY_ASSERT(frame.width != 2000 || frame.height != 1500, "partial result not at the full size");
+    MY_ASSERT(frame.pixels[(1499 * 2000 + 7) * 4 + 2] != 7, "wrong partial pixels");
+    MY_ASSERT(partial_time > full_time, "deadline ignored");
+
+    // the deadline thread is counted while it runs, and can be joined once it ran out of deadlines
+    std::atomic<int> watchers(0);
+    std::atomic<int> watcher_starts(0);
+    flifcore::CancelToken::setWatcherHooks([&]() { watchers++; watcher_starts++; }, [&]() { watchers--; });
+    {
+        flifcore::CancelToken token;
+        token.setDeadline(Clock::now() + std::chrono::milliseconds(20));
+        MY_ASSERT(watchers != 1, "running deadline thread not counted");
+        flifcore::CancelToken::joinWatcher();
+        MY_ASSERT(watchers != 1, "deadline thread with a pending deadline stopped");
+
+        const Clock::time_point wait_start = Clock::now();
+        while(watchers != 0 && Clock::now() - wait_start < std::chrono::seconds(10))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        MY_ASSERT(watchers != 0, "deadline thread still counted without deadlines");
+        MY_ASSERT(!token.isCancelled(), "deadline missed");
+    }
+    flifcore::CancelToken::joinWatcher();
+    flifcore::CancelToken::setWatcherHooks(std::function<void()>(), std::function<void()>());
+    MY_ASSERT(watcher_starts != 1, "deadline thread started more than once");
+
+    return 0;
+}
+
+/*!
+* A main header that claims this size, followed by a few bytes that are no valid pixel data.
+* @param chunk Name of a small metadata chunk to add, empty for none.
+*/
+std::vector<uint8_t> craftHeader(uint32_t width, uint32_t height, uint64_t frames, bool interlaced, const std::string& chunk = std::string())
+{
+    std::vector<uint8_t> bytes = { 'F', 'L', 'I', 'F' };
+    const int format = (frames > 1 ? 5 : 3) + (interlaced ? 1 : 0);
+    bytes.push_back(static_cast<uint8_t>(16 * format + 4));
+    bytes.push_back('1');
+
+    auto pushVarint = [&](uint64_t value) {
+        int shift = 0;
+        while(shift + 7 < 64 && (value >> (shift + 7)) != 0)
+            shift += 7;
+        for(; shift > 0; shift -= 7)
+            bytes.push_back(static_cast<uint8_t>(0x80 | ((value >> shift) & 0x7f)));
+        bytes.push_back(static_cast<uint8_t>(value & 0x7f));
+    };
+    pushVarint(width - 1);
+    pushVarint(height - 1);
+    if(frames > 1)
+        pushVarint(frames - 2);
+    if(!chunk.empty())
+    {
+        bytes.insert(bytes.end(), chunk.begin(), chunk.end());
+        pushVarint(8);
+        for(int i = 0; i < 8; ++i)
+            bytes.push_back(static_cast<uint8_t>(i));
+    }
+    bytes.push_back(0);
+
+    for(int i = 0; i < 64; ++i)
+        bytes.push_back(static_cast<uint8_t>(i * 37));
+    return bytes;
+}
+
+int test_limits()
+{
+    debug_out("test_limits");
+
+    // sizes that overflow any plain product saturate
+    flifcore::ImageInfo info;
+    info.width = 0xfffffffe;
+    info.height = 0xfffffffe;
+    info.depth = 16;
+    info.frame_count = std::numeric_limits<size_t>::max();
+    info.interlaced = true;
+    MY_ASSERT(flifcore::DecodeLimits::decodedBytes(info) != std::numeric_limits<uint64_t>::max(), "bytes not saturated");
+
+    flifcore::DecodeLimits limits;
+    limits.max_pixels = 1;
+    MY_ASSERT(limits.fittingScale(info) != 0, "impossible scale found");
+
+    info.frame_count = 1;
+    MY_ASSERT(flifcore::DecodeLimits::decodedBytes(info, 4) != uint64_t(0x40000000) * 0x40000000 * 8, "wrong 16 bit size");
+
+    // limits from the environment: saturated, and the default if they are no number
+    {
+        const uint64_t DEFAULT_PIXELS = flifcore::DecodeLimits::DEFAULT_MAX_PIXELS;
+        const uint64_t DEFAULT_BYTES = flifcore::DecodeLimits::DEFAULT_MAX_BYTES;
+        const struct { const char* value; uint64_t max_pixels; uint64_t max_bytes; } values[] = {
+            { "3", 3, 3 * 1024 * 1024 },
+            { "0", 0, 0 },
+            { "99999999999999999999", std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint64_t>::max() },
+            { "17592186044417", 17592186044417, std::numeric_limits<uint64_t>::max() },
+            { "abc", DEFAULT_PIXELS, DEFAULT_BYTES },
+            { "-1", DEFAULT_PIXELS, DEFAULT_BYTES },
+            { " 5", DEFAULT_PIXELS, DEFAULT_BYTES },
+            { "12MB", DEFAULT_PIXELS, DEFAULT_BYTES },
+            { "", DEFAULT_PIXELS, DEFAULT_BYTES },
+        };
+        for(const auto& v : values)
+        {
+            setEnvironment("FLIF_MAX_PIXELS", v.value);
+            setEnvironment("FLIF_MAX_DECODE_MB", v.value);
+            const flifcore::DecodeLimits configured = flifcore::DecodeLimits::fromEnvironment();
+            MY_ASSERT(configured.max_pixels != v.max_pixels, std::string("wrong limit for FLIF_MAX_PIXELS=") + v.value);
+            MY_ASSERT(configured.max_bytes != v.max_bytes, std::string("wrong limit for FLIF_MAX_DECODE_MB=") + v.value);
+        }
+        setEnvironment("FLIF_MAX_PIXELS", "");
+        setEnvironment("FLIF_MAX_DECODE_MB", "");
+    }
+
+    // crafted headers fail before anything is decoded
+    const struct { uint32_t width; uint32_t height; uint64_t frames; bool interlaced; } crafted[] = {
+        { 60000, 60000, 1, false },
+        { 60000, 60000, 1, true },
+        { 0xffffffff, 0xffffffff, 1, false },
+        { 1000, 1000, 100000000, false },
+        { 1, 0xffffffff, uint64_t(1) << 40, true },
+    };
+    for(const auto& c : crafted)
+    {
+        std::shared_ptr<const flifcore::InputBuffer> input = std::make_shared<flifcore::OwnedInputBuffer>(craftHeader(c.width, c.height, c.frames, c.interlaced));
+
+        flifcore::resetCounters();
+        flifcore::Decoder decoder;
+        MY_ASSERT(decoder.open(input) != flifcore::DS_OK, "crafted header not read");
+        MY_ASSERT(decoder.info().width != c.width || decoder.info().height != c.height, "crafted size not read");
+        MY_ASSERT(decoder.decodePixels() != flifcore::DS_TOO_LARGE, "crafted header " + std::to_string(c.width) + "x" + std::to_string(c.height) + " decoded");
+        MY_ASSERT(flifcore::counters().pixel_decodes != 0, "libflif called for a crafted header");
+
+        std::shared_ptr<const flifcore::CachedImage> image;
+        MY_ASSERT(flifcore::decodeAllFrames(input, flifcore::PF_RGBA32, image) != flifcore::DS_TOO_LARGE, "crafted header decoded through the cache path");
+    }
+
+    // the property handler unpacks metadata through a decode: a tiny eXif chunk must not let a huge header through
+    for(bool crafted_interlaced : { false, true })
+    {
+        const std::vector<uint8_t> bytes = craftHeader(60000, 60000, 1, crafted_interlaced, "eXif");
+        flifcore::HeaderScanner scanner;
+        size_t consumed;
+        MY_ASSERT(scanner.feed(bytes.data(), bytes.size(), consumed) != flifcore::HeaderScanner::SR_DONE, "crafted metadata not scanned");
+        MY_ASSERT(!scanner.hasMetadataChunk("eXif"), "eXif chunk not found");
+
+        const flifcore::ImageInfo& crafted_info = scanner.imageInfo();
+        const flifcore::DecodeLimits defaults = flifcore::DecodeLimits::defaults();
+        MY_ASSERT(defaults.fits(crafted_info), "60000x60000 header within the default limits");
+
+        const uint32_t scale = defaults.fittingScale(crafted_info);
+        if(crafted_interlaced)
+        {
+            MY_ASSERT(scale < 2 || !defaults.fits(crafted_info, scale), "no zoom level for the metadata decode");
+        }
+        else
+        {
+            MY_ASSERT(scale != 0, "metadata decode of a plain file over the limits allowed");
+        }
+    }
+
+    // over the limits: fail, or the largest zoom level that fits
+    const std::vector<uint8_t> interlaced = createFlif(512, 384, 1, 0, true);
+    const std::vector<uint8_t> plain = createFlif(512, 384, 1);
+    MY_ASSERT(interlaced.empty() || plain.empty(), "encoding failed");
+    std::shared_ptr<const flifcore::InputBuffer> interlaced_input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(interlaced));
+    std::shared_ptr<const flifcore::InputBuffer> plain_input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(plain));
+
+    limits = flifcore::DecodeLimits();
+    limits.max_pixels = 200 * 200;
+    {
+        flifcore::Decoder decoder;
+        decoder.setLimits(limits);
+        MY_ASSERT(decoder.decode(interlaced_input) != flifcore::DS_TOO_LARGE, "limit ignored");
+    }
+    limits.downscale = true;
+    {
+        flifcore::Decoder decoder;
+        decoder.setLimits(limits);
+        flifcore::Frame frame;
+        MY_ASSERT(decoder.decode(interlaced_input) != flifcore::DS_OK || decoder.extractFrame(0, frame) != flifcore::DS_OK, "downscaled decode failed");
+        MY_ASSERT(frame.width != 128 || frame.height != 96, "not the largest zoom level that fits");
+
+        flifcore::Decoder plain_decoder;
+        plain_decoder.setLimits(limits);
+        MY_ASSERT(plain_decoder.decode(plain_input) != flifcore::DS_TOO_LARGE, "file without zoom levels downscaled");
+    }
+    limits.max_pixels = flifcore::DecodeLimits::DEFAULT_MAX_PIXELS;
+    limits.max_bytes = 100 * 100 * 4;
+    {
+        std::shared_ptr<const flifcore::CachedImage> image;
+        MY_ASSERT(flifcore::decodeAllFrames(interlaced_input, flifcore::PF_RGBA32, image, 0, &limits) != flifcore::DS_OK, "byte limit: decode failed");
+        MY_ASSERT(image->frames[0].width != 64 || image->frames[0].height != 48, "byte limit not applied");
+    }
+
+    // decodes that ask for less than the limit go through, with the defaults as well
+    const flifcore::DecodeLimits previous = flifcore::DecodeLimits::defaults();
+    limits = flifcore::DecodeLimits();
+    limits.max_pixels = 200 * 200;
+    flifcore::DecodeLimits::setDefaults(limits);
+    flifcore::Frame thumbnail;
+    const flifcore::DecodeStatus thumbnail_status = flifcore::decodeThumbnail(interlaced_input, 64, thumbnail);
+    const flifcore::DecodeStatus plain_status = flifcore::decodeThumbnail(plain_input, 64, thumbnail);
+    flifcore::DecodeLimits::setDefaults(previous);
+    MY_ASSERT(thumbnail_status != flifcore::DS_OK, "reduced decode refused");
+    MY_ASSERT(plain_status != flifcore::DS_TOO_LARGE, "full decode for a thumbnail allowed");
+
+    return 0;
+}
+
+//! Counts the values released by AtomicSlots.
+struct CountingRelease
+{
+    static std::atomic<int> released;
+
+    void operator()(int* value) const
+    {
+        released++;
+        delete value;
+    }
+};
+std::atomic<int> CountingRelease::released(0);
+
+int test_atomic_slots()
+{
+    debug_out("test_atomic_slots");
+
+    const size_t slot_count = 16;
+    const int thread_count = 8;
+    std::atomic<int> failures(0);
+    std::atomic<int> published(0);
+    {
+        flifcore::AtomicSlots<int, CountingRelease> slots(slot_count);
+        MY_ASSERT(slots.size() != slot_count || slots.get(0) != 0, "slots not empty");
+
+        // all threads race for every slot, each must end up with the one value that won
+        std::atomic<int> ready(0);
+        std::vector<std::thread> threads;
+        for(int t = 0; t < thread_count; ++t)
+        {
+            threads.emplace_back([&, t]()
+            {
+                ready++;
+                while(ready < thread_count)
+                    std::this_thread::yield();
+
+                for(size_t i = 0; i < slot_count; ++i)
+                {
+                    int* value = slots.get(i);
+                    if(value == 0)
+                    {
+                        value = slots.publish(i, new int(t * 1000 + int(i)));
+                        published++;
+                    }
+
+                    if(value == 0 || *value % 1000 != int(i) || slots.get(i) != value)
+                        failures++;
+                }
+            });
+        }
+        for(auto& thread : threads)
+            thread.join();
+
+        MY_ASSERT(failures != 0, "threads saw different values: " + std::to_string(failures));
+        MY_ASSERT(CountingRelease::released != published - int(slot_count), "losing values not released");
+    }
+
+    MY_ASSERT(CountingRelease::released != published, "published values not released");
+    return 0;
+}
+
+int test_task_pool_priority()
+{
+    debug_out("test_task_pool_priority");
+
+    // one thread, blocked until everything is queued
+    flifcore::TaskPool pool(1);
+    std::mutex mutex;
+    std::condition_variable opened;
+    bool open = false;
+    std::atomic<bool> blocked(false);
+    pool.submit(flifcore::TP_PREFETCH, [&]()
+    {
+        blocked = true;
+        std::unique_lock<std::mutex> lock(mutex);
+        opened.wait(lock, [&]() { return open; });
+    });
+    while(!blocked)
+        std::this_thread::yield();
+
+    // queued lowest priority first, each twice to check the order within a priority
+    std::vector<int> order;
+    for(int priority = flifcore::TASK_PRIORITY_COUNT - 1; priority >= 0; --priority)
+    {
+        for(int i = 0; i < 2; ++i)
+        {
+            const int id = priority * 10 + i;
+            pool.submit(static_cast<flifcore::TaskPriority>(priority), [&order, id]()
+            {
+                order.push_back(id);
+            });
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        open = true;
+        opened.notify_all();
+    }
+    pool.waitIdle();
+
+    const int expected[] = { 0, 1, 10, 11, 20, 21, 30, 31 };
+    MY_ASSERT(order != std::vector<int>(expected, expected + 8), "wrong order of priorities");
+
+    // a task's own tasks: the newest first, still by priority
+    order.clear();
+    pool.submit(flifcore::TP_PREFETCH, [&]()
+    {
+        for(int i = 0; i < 3; ++i)
+            pool.submit(flifcore::TP_PROPERTY, [&order, i]() { order.push_back(20 + i); });
+        pool.submit(flifcore::TP_INTERACTIVE, [&order]() { order.push_back(0); });
+    });
+    pool.waitIdle();
+
+    const int expected_nested[] = { 0, 22, 21, 20 };
+    MY_ASSERT(order != std::vector<int>(expected_nested, expected_nested + 4), "wrong order of nested tasks");
+
+    // waiting for the pool from one of its tasks must not block its only thread
+    std::future<int> nested = pool.run(flifcore::TP_THUMBNAIL, [&]()
+    {
+        return pool.runAndWait(flifcore::TP_PREFETCH, []() { return 42; });
+    });
+    MY_ASSERT(nested.get() != 42, "nested runAndWait failed");
+
+    // exceptions reach the waiting caller
+    bool thrown = false;
+    try
+    {
+        pool.runAndWait(flifcore::TP_PROPERTY, []() -> int { throw std::runtime_error("task"); });
+    }
+    catch(const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    MY_ASSERT(!thrown, "exception lost");
+
+    return 0;
+}
+
+int test_task_pool_shutdown()
+{
+    debug_out("test_task_pool_shutdown");
+
+    std::atomic<int> executed(0);
+    std::atomic<int> busy(0);
+    std::atomic<int> idle(0);
+    {
+        flifcore::TaskPool pool(4);
+        pool.setActivityHooks([&]() { busy++; }, [&]() { idle++; });
+        MY_ASSERT(!pool.isIdle() || busy != 0, "pool busy without tasks");
+
+        // tasks spawning tasks while the pool shuts down, all of them must run
+        const int task_count = 50;
+        for(int i = 0; i < task_count; ++i)
+        {
+            pool.submit(static_cast<flifcore::TaskPriority>(i % flifcore::TASK_PRIORITY_COUNT), [&]()
+            {
+                executed++;
+                for(int j = 0; j < 4; ++j)
+                    pool.submit(flifcore::TP_PREFETCH, [&]() { executed++; });
+            });
+        }
+        pool.shutdown();
+
+        MY_ASSERT(executed != task_count * 5, "tasks lost in shutdown: " + std::to_string(executed));
+        MY_ASSERT(!pool.isIdle() || pool.stats().threads != 0, "threads left after shutdown");
+        MY_ASSERT(busy != idle || busy == 0, "activity hooks unbalanced");
+
+        // usable again after shutdown
+        MY_ASSERT(pool.runAndWait(flifcore::TP_INTERACTIVE, []() { return 7; }) != 7, "pool not restarted");
+        pool.waitIdle();
+        MY_ASSERT(pool.stats().threads == 0, "no thread restarted");
+        MY_ASSERT(pool.stats().executed != uint64_t(task_count * 5 + 1), "wrong number of executed tasks");
+
+        // the destructor finishes queued tasks as well
+        for(int i = 0; i < task_count; ++i)
+            pool.submit(flifcore::TP_PREFETCH, [&]() { executed++; });
+    }
+
+    MY_ASSERT(executed != 50 * 6, "tasks lost in destructor");
+    MY_ASSERT(busy != idle, "activity hooks unbalanced after destructor");
+    return 0;
+}
+
+int test_row_bands()
+{
+    debug_out("test_row_bands");
+
+    const unsigned int previous_threads = flifcore::RowBands::maxThreads();
+    const uint64_t previous_min_bytes = flifcore::RowBands::minBytes();
+
+    // more threads than the pool may have, the helpers that do not get a thread find nothing left to do
+    flifcore::RowBands::setMaxThreads(4);
+    flifcore::RowBands::setMinBytes(0);
+
+    // every row exactly once, for sizes around the band limits
+    for(uint32_t rows : { 1u, 31u, 32u, 33u, 1000u, 4099u })
+    {
+        std::vector<std::atomic<int>> visits(rows);
+        for(auto& visit : visits)
+            visit = 0;
+
+        flifcore::RowBands::run(rows, 0, [&](uint32_t begin, uint32_t end)
+        {
+            for(uint32_t row = begin; row < end; ++row)
+                visits[row]++;
+        });
+
+        for(uint32_t row = 0; row < rows; ++row)
+            MY_ASSERT(visits[row] != 1, "row " + std::to_string(row) + " of " + std::to_string(rows) + " visited " + std::to_string(visits[row]) + " times");
+    }
+
+    // the exception of one band reaches the caller, after all bands are done
+    std::atomic<uint32_t> rows_done(0);
+    bool thrown = false;
+    try
+    {
+        flifcore::RowBands::run(1000, 0, [&](uint32_t begin, uint32_t end)
+        {
+            if(begin == 0)
+                throw std::runtime_error("band");
+            rows_done += end - begin;
+        });
+    }
+    catch(const std::runtime_error&)
+    {
+        thrown = true;
+    }
+    MY_ASSERT(!thrown, "exception lost");
+    MY_ASSERT(rows_done == 0 || rows_done >= 1000, "other bands not done");
+
+    // frames read in bands equal those read in one go, in every format
+    const std::vector<uint8_t> flif = createFlif(300, 200, 1);
+    MY_ASSERT(flif.empty(), "encoding failed");
+    std::shared_ptr<const flifcore::InputBuffer> input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif));
+
+    flifcore::Decoder decoder;
+    MY_ASSERT(decoder.open(input) != flifcore::DS_OK, "open failed");
+    for(auto format : { flifcore::PF_RGBA32, flifcore::PF_BGR24, flifcore::PF_PBGRA32, flifcore::PF_RGBA64 })
+    {
+        flifcore::RowBands::setMaxThreads(1);
+        flifcore::Frame single;
+        MY_ASSERT(decoder.extractFrame(0, single, format) != flifcore::DS_OK, "extraction failed");
+
+        flifcore::RowBands::setMaxThreads(4);
+        flifcore::Frame banded;
+        MY_ASSERT(decoder.extractFrame(0, banded, format) != flifcore::DS_OK, "banded extraction failed");
+        MY_ASSERT(banded.pixels != single.pixels, "banded extraction differs in format " + std::to_string(format));
+    }
+
+    flifcore::RowBands::setMaxThreads(previous_threads);
+    flifcore::RowBands::setMinBytes(previous_min_bytes);
+    return 0;
+}
+
+//! Remembers what a batch handed over, and stops it on request.
+class CollectingSink : public flifcore::BatchSink
+{
+public:
+    CollectingSink()
+        : stop_at(std::numeric_limits<size_t>::max())
+    {
+    }
+
+    virtual bool write(size_t index, const std::string& filename, const flifcore::CachedImage& image) override
+    {
+        indices.push_back(index);
+        frame_counts.push_back(image.frames.size());
+        return index != stop_at;
+    }
+
+    virtual void failed(size_t index, const std::string& filename, flifcore::DecodeStatus status) override
+    {
+        indices.push_back(index);
+        frame_counts.push_back(0);
+        failures.push_back(index);
+    }
+
+    std::vector<size_t> indices;
+    std::vector<size_t> frame_counts;
+    std::vector<size_t> failures;
+    size_t stop_at;
+};
+
+static std::string readAll(FILE* file)
+{
+    std::string content;
+    rewind(file);
+    char buffer[4096];
+    size_t n;
+    while((n = fread(buffer, 1, sizeof(buffer), file)) != 0)
+        content.append(buffer, n);
+    return content;
+}
+
+int test_batch()
+{
+    debug_out("test_batch");
+
+    // a missing and a broken file among good ones
+    const size_t file_count = 8;
+    std::vector<std::string> files;
+    uint64_t largest = 0;
+    for(size_t i = 0; i < file_count; ++i)
+    {
+        files.push_back("core_test_batch_" + std::to_string(i) + ".flif");
+        if(i == 2)
+            continue;
+
+        std::vector<uint8_t> flif = createFlif(30 + uint32_t(i) * 10, 20, 1 + uint32_t(i % 3));
+        MY_ASSERT(flif.empty(), "encoding failed");
+        if(i == 5)
+            flif[0] = 'X';
+        else
+            largest = std::max<uint64_t>(largest, uint64_t(30 + i * 10) * 20 * 4 * (1 + i % 3));
+        MY_ASSERT(!writeFile(files.back(), flif), "writing test file failed");
+    }
+
+    // one file in flight at a time, still handed over in list order
+    flifcore::BatchOptions options;
+    options.threads = 4;
+    options.max_in_flight_bytes = 1;
+    {
+        CollectingSink sink;
+        flifcore::BatchStats stats;
+        MY_ASSERT(!flifcore::decodeBatch(files, sink, stats, options), "batch stopped");
+
+        MY_ASSERT(sink.indices.size() != file_count, "files missing");
+        for(size_t i = 0; i < file_count; ++i)
+            MY_ASSERT(sink.indices[i] != i, "out of order");
+        MY_ASSERT(sink.failures != std::vector<size_t>({ 2, 5 }), "wrong failures: " + std::to_string(sink.failures.size()));
+        MY_ASSERT(sink.frame_counts[7] != 2, "frames missing");
+
+        MY_ASSERT(stats.files != file_count || stats.failed != 2, "wrong counts");
+        MY_ASSERT(stats.peak_in_flight_bytes > largest, "in-flight limit exceeded: " + std::to_string(stats.peak_in_flight_bytes));
+        MY_ASSERT(stats.p50_ms > stats.p99_ms || stats.filesPerSecond() <= 0, "wrong latencies");
+    }
+
+    // the digests do not depend on the number of threads
+    std::string digests[2];
+    for(int i = 0; i < 2; ++i)
+    {
+        FILE* output = tmpfile();
+        MY_ASSERT(output == 0, "tmpfile failed");
+        flifcore::DigestSink sink(output);
+        flifcore::BatchStats stats;
+        options = flifcore::BatchOptions();
+        options.threads = i == 0 ? 1 : 4;
+        flifcore::decodeBatch(files, sink, stats, options);
+        digests[i] = readAll(output);
+        fclose(output);
+    }
+    MY_ASSERT(digests[0].empty() || digests[0] != digests[1], "digests differ between thread counts");
+    MY_ASSERT(std::count(digests[0].begin(), digests[0].end(), '\n') != long(file_count), "a digest line per file expected");
+
+    // a PAM image per frame
+    {
+        FILE* output = tmpfile();
+        MY_ASSERT(output == 0, "tmpfile failed");
+        flifcore::PamSink sink(output);
+        flifcore::BatchStats stats;
+        MY_ASSERT(!flifcore::decodeBatch(std::vector<std::string>(1, files[1]), sink, stats), "writing PAM failed");
+        const std::string pam = readAll(output);
+        fclose(output);
+
+        const std::string header = "P7\nWIDTH 40\nHEIGHT 20\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+        MY_ASSERT(pam.size() != 2 * (header.size() + 40 * 20 * 4) || pam.compare(0, header.size(), header) != 0, "wrong PAM stream");
+        MY_ASSERT(uint8_t(pam[header.size() + 5 * 4]) != 5, "wrong PAM pixels");
+    }
+
+    // a sink can stop the batch
+    {
+        CollectingSink sink;
+        sink.stop_at = 1;
+        flifcore::BatchStats stats;
+        MY_ASSERT(flifcore::decodeBatch(files, sink, stats, options), "batch not stopped");
+        MY_ASSERT(sink.indices.size() != 2 || stats.files != 2, "files handed over after the stop");
+    }
+
+    for(const auto& file : files)
+        remove(file.c_str());
+    return 0;
+}
+
+int test_frame_mailbox()
+{
+    debug_out("test_frame_mailbox");
+
+    typedef flifcore::FrameMailbox<std::shared_ptr<int>> Mailbox;
+    std::vector<Mailbox::Entry> entries;
+    flifcore::DecodeStatus status = flifcore::DS_DECODE_FAILED;
+
+    {
+        // one notification until the consumer takes, and a frame replaces the pass nobody took
+        int notified = 0;
+        Mailbox mailbox([&]() { notified++; });
+        MY_ASSERT(!mailbox.publish(0, false, std::make_shared<int>(1)), "pass not published");
+        MY_ASSERT(!mailbox.publish(0, false, std::make_shared<int>(2)), "second pass not published");
+        MY_ASSERT(!mailbox.publish(0, true, std::make_shared<int>(3)), "frame not published");
+        MY_ASSERT(!mailbox.publish(0, false, std::make_shared<int>(4)), "late pass not accepted");
+        MY_ASSERT(!mailbox.publish(1, true, std::make_shared<int>(5)), "second frame not published");
+        MY_ASSERT(notified != 1, "notified " + std::to_string(notified) + " times");
+
+        MY_ASSERT(mailbox.take(entries, status), "finished too early");
+        MY_ASSERT(entries.size() != 2, "wrong number of entries");
+        MY_ASSERT(entries[0].index != 0 || !entries[0].final || *entries[0].value != 3, "pass not replaced");
+        MY_ASSERT(entries[1].index != 1 || !entries[1].final || *entries[1].value != 5, "wrong second frame");
+
+        entries.clear();
+        MY_ASSERT(mailbox.take(entries, status) || !entries.empty(), "entries taken twice");
+
+        mailbox.finish(flifcore::DS_OK);
+        MY_ASSERT(notified != 2, "finish not notified");
+        MY_ASSERT(!mailbox.take(entries, status) || status != flifcore::DS_OK, "finish not taken");
+    }
+
+    {
+        // nothing is kept or notified after the consumer left
+        int notified = 0;
+        Mailbox mailbox([&]() { notified++; });
+        std::shared_ptr<int> pending = std::make_shared<int>(1);
+        mailbox.publish(0, true, pending);
+        mailbox.close();
+        MY_ASSERT(pending.use_count() != 1, "pending entry kept after close");
+        MY_ASSERT(!mailbox.isClosed(), "not closed");
+
+        std::shared_ptr<int> late = std::make_shared<int>(2);
+        MY_ASSERT(mailbox.publish(1, true, late), "published after close");
+        MY_ASSERT(late.use_count() != 1, "late entry kept");
+        mailbox.finish(flifcore::DS_OK);
+        MY_ASSERT(notified != 1, "notified after close");
+    }
+
+    {
+        // a producer thread and a consumer that waits for the notifications, like a window for its messages
+        const size_t FRAMES = 200;
+        std::mutex mutex;
+        std::condition_variable wake;
+        size_t notifications = 0;
+        Mailbox mailbox([&]()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            notifications++;
+            wake.notify_one();
+        });
+
+        std::thread producer([&]()
+        {
+            mailbox.publish(0, false, std::make_shared<int>(-1));
+            for(size_t i = 0; i < FRAMES; ++i)
+                mailbox.publish(i, true, std::make_shared<int>(static_cast<int>(i)));
+            mailbox.finish(flifcore::DS_OK);
+        });
+
+        std::vector<int> received;
+        size_t handled = 0;
+        bool finished = false;
+        while(!finished)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return notifications > handled; });
+                handled = notifications;
+            }
+
+            entries.clear();
+            finished = mailbox.take(entries, status);
+            for(const auto& entry : entries)
+            {
+                if(entry.final)
+                    received.push_back(*entry.value);
+                else if(entry.index != 0 || !received.empty())
+                    received.push_back(-2);
+            }
+        }
+        producer.join();
+
+        MY_ASSERT(status != flifcore::DS_OK, "wrong status");
+        MY_ASSERT(received.size() != FRAMES, "frames lost: " + std::to_string(received.size()));
+        for(size_t i = 0; i < FRAMES; ++i)
+            MY_ASSERT(received[i] != static_cast<int>(i), "frames out of order");
+        MY_ASSERT(handled > FRAMES + 2, "more notifications than entries");
+    }
+
+    // the passes of an interlaced file, each frame of the stub stands in for one
+    const std::vector<uint8_t> flif = createFlif(300, 200, 4, 0, true);
+    MY_ASSERT(flif.empty(), "encoding failed");
+    std::shared_ptr<const flifcore::InputBuffer> input = std::make_shared<flifcore::OwnedInputBuffer>(std::vector<uint8_t>(flif));
+
+    size_t passes = 0;
+    bool pass_ok = true;
+    flifcore::Decoder::ProgressCallback progress = flifcore::firstFramePasses(flifcore::PF_RGBA32, [&](const flifcore::FrameView& pass)
+    {
+        passes++;
+        pass_ok = pass_ok && pass.width == 300 && pass.height == 200 && pass.format == flifcore::PF_RGBA32;
+    });
+    std::shared_ptr<const flifcore::CachedImage> image;
+    MY_ASSERT(flifcore::decodeAllFrames(input, flifcore::PF_RGBA32, image, 0, 0, progress) != flifcore::DS_OK, "decode failed");
+    MY_ASSERT(passes == 0, "no pass handed out");
+    MY_ASSERT(!pass_ok, "wrong pass");
+
+    return 0;
+}
+
+int main(int argc, char** args)
+{
+    typedef int (*TestFunction)();
+    const TestFunction tests[] = {
+        test_read_all,
+        test_mapped_file,
+        test_probe,
+        test_header_scanner,
+        test_lazy_decode,
+        test_lazy_frame,
+        test_release_images,
+        test_pixel_format,
+        test_kernels,
+        test_extract_formats,
+        test_thumbnail,
+        test_preview,
+        test_scaled_decode,
+        test_region_cache,
+        test_content_hash,
+        test_image_cache,
+        test_image_cache_threads,
+        test_disk_cache,
+        test_buffer_pool,
+        test_decoder_pool,
+        test_cancel,
+        test_deadline,
+        test_limits,
+        test_atomic_slots,
+        test_task_pool_priority,
+        test_task_pool_shutdown,
+        test_row_bands,
+        test_batch,
+        test_frame_mailbox,
+    };
+
+    for(TestFunction test : tests)
+        if(test() != 0)
+            return 1;
+
+    debug_out("all tests passed");
+    return 0;
+}
\ No newline at end of file
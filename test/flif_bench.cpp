@@ -0,0 +1,1869 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// std headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "AtomicSlots.h"
+#include "BufferPool.h"
+#include "ByteSource.h"
+#include "Decode.h"
+#include "DecoderPool.h"
+#include "DiskCache.h"
+#include "FrameMailbox.h"
+#include "ImageCache.h"
+#include "Kernels.h"
+#include "LazyFrame.h"
+#include "RegionCache.h"
+#include "Resample.h"
+#include "RowBands.h"
+#include "TaskPool.h"
+#include "Thumbnail.h"
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double millisSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/*!
+* @return Peak resident memory of this process in bytes.
+*/
+static size_t peakRSS()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+//=============================================================================
+// heap accounting: every allocation of this process goes through these operators
+
+struct HeapCounters
+{
+    std::atomic<size_t> allocations;
+    std::atomic<size_t> current_bytes;
+    std::atomic<size_t> peak_bytes;
+};
+
+static HeapCounters g_heap;
+
+// keeps the alignment guarantee of malloc for the memory behind the size prefix
+static const size_t HEAP_PREFIX = 16;
+
+void* operator new(size_t size)
+{
+    uint8_t* block = static_cast<uint8_t*>(malloc(size + HEAP_PREFIX));
+    if(block == 0)
+        throw std::bad_alloc();
+
+    *reinterpret_cast<size_t*>(block) = size;
+
+    g_heap.allocations++;
+    size_t current = g_heap.current_bytes += size;
+    size_t peak = g_heap.peak_bytes;
+    while(current > peak && !g_heap.peak_bytes.compare_exchange_weak(peak, current))
+    {
+    }
+
+    return block + HEAP_PREFIX;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if(ptr == 0)
+        return;
+
+    uint8_t* block = static_cast<uint8_t*>(ptr) - HEAP_PREFIX;
+    g_heap.current_bytes -= *reinterpret_cast<size_t*>(block);
+    free(block);
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+/*!
+* Resets the peak to the current heap usage, so the following code can be measured on its own.
+* @return The current heap usage, to be subtracted from the peak.
+*/
+static size_t resetHeapCounters()
+{
+    g_heap.allocations = 0;
+    g_heap.peak_bytes = g_heap.current_bytes.load();
+    return g_heap.current_bytes;
+}
+
+//=============================================================================
+
+static double toMB(double bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+struct StageTimes
+{
+    StageTimes()
+        : ingest_ms(0)
+        , decode_ms(0)
+        , extract_ms(0)
+        , compressed_bytes(0)
+        , decoded_bytes(0)
+    {}
+
+    double ingest_ms;
+    double decode_ms;
+    double extract_ms;
+    size_t compressed_bytes;
+    size_t decoded_bytes;
+};
+
+static bool benchDecodeFile(const std::string& filename, StageTimes& times)
+{
+    Clock::time_point start = Clock::now();
+
+    flifcore::FileByteSource source;
+    if(!source.open(filename))
+        return false;
+
+    std::shared_ptr<const flifcore::InputBuffer> input;
+    if(!flifcore::acquireAll(source, input))
+        return false;
+
+    times.ingest_ms += millisSince(start);
+    times.compressed_bytes += input->size();
+
+    start = Clock::now();
+
+    flifcore::Decoder decoder;
+    flifcore::DecodeStatus status = decoder.decode(input);
+    if(status != flifcore::DS_OK)
+    {
+        printf("%s: %s\n", filename.c_str(), flifcore::toString(status));
+        return false;
+    }
+
+    times.decode_ms += millisSince(start);
+
+    start = Clock::now();
+
+    for(size_t i = 0; i < decoder.frameCount(); ++i)
+    {
+        flifcore::Frame frame;
+        status = decoder.extractFrame(i, frame);
+        if(status != flifcore::DS_OK)
+            return false;
+
+        times.decoded_bytes += frame.pixels.size();
+    }
+
+    times.extract_ms += millisSince(start);
+    return true;
+}
+
+static int runDecode(const std::vector<std::string>& files, int repetitions)
+{
+    StageTimes total;
+
+    printf("%-40s %10s %10s %10s %10s %10s\n", "file", "KB", "ingest ms", "decode ms", "extract ms", "MB/s");
+
+    for(const auto& file : files)
+    {
+        StageTimes times;
+        for(int r = 0; r < repetitions; ++r)
+        {
+            if(!benchDecodeFile(file, times))
+            {
+                printf("%s: failed\n", file.c_str());
+                return 1;
+            }
+        }
+
+        const double all_ms = times.ingest_ms + times.decode_ms + times.extract_ms;
+        printf("%-40s %10.1f %10.2f %10.2f %10.2f %10.2f\n",
+            file.c_str(),
+            times.compressed_bytes / 1024.0 / repetitions,
+            times.ingest_ms / repetitions,
+            times.decode_ms / repetitions,
+            times.extract_ms / repetitions,
+            toMB(double(times.compressed_bytes)) / (all_ms / 1000.0));
+
+        total.ingest_ms += times.ingest_ms;
+        total.decode_ms += times.decode_ms;
+        total.extract_ms += times.extract_ms;
+        total.compressed_bytes += times.compressed_bytes;
+        total.decoded_bytes += times.decoded_bytes;
+    }
+
+    const double all_ms = total.ingest_ms + total.decode_ms + total.extract_ms;
+    printf("\n");
+    printf("files:                %zu x %d\n", files.size(), repetitions);
+    printf("ingest / decode / extract: %.2f / %.2f / %.2f ms\n", total.ingest_ms, total.decode_ms, total.extract_ms);
+    printf("compressed throughput: %.2f MB/s\n", toMB(double(total.compressed_bytes)) / (all_ms / 1000.0));
+    printf("decoded throughput:    %.2f MB/s\n", toMB(double(total.decoded_bytes)) / (all_ms / 1000.0));
+    printf("peak RSS:              %.1f MB\n", toMB(double(peakRSS())));
+    return 0;
+}
+
+//=============================================================================
+// ingest: reading the compressed file into memory
+
+/*!
+* The stream loop before the byte sources knew their size, kept for comparison.
+*/
+static bool legacyReadAll(flifcore::ByteSource& source, std::vector<uint8_t>& bytes)
+{
+    const size_t GROWTH_STEP = 10000;
+
+    size_t bytes_filled_counter = 0;
+
+    while(true)
+    {
+        bytes.resize(bytes.size() + GROWTH_STEP);
+
+        size_t actually_read;
+        if(!source.read(bytes.data() + bytes_filled_counter, GROWTH_STEP, actually_read))
+            return false;
+
+        if(actually_read < GROWTH_STEP)
+        {
+            bytes.resize(bytes_filled_counter + actually_read);
+            return true;
+        }
+
+        bytes_filled_counter += actually_read;
+    }
+}
+
+/*!
+* Hides the size of the wrapped source, like a network stream would.
+*/
+class UnsizedByteSource : public flifcore::ByteSource
+{
+public:
+    UnsizedByteSource(flifcore::ByteSource& source)
+        : _source(source)
+    {}
+
+    virtual bool read(uint8_t* buffer, size_t size, size_t& bytes_read) override
+    {
+        return _source.read(buffer, size, bytes_read);
+    }
+
+private:
+    flifcore::ByteSource& _source;
+};
+
+enum IngestMethod
+{
+    IM_LEGACY,
+    IM_SIZED,
+    IM_UNSIZED,
+    IM_MAPPED
+};
+
+static bool ingestFile(const std::string& filename, IngestMethod method, size_t& bytes_read)
+{
+    flifcore::FileByteSource file_source;
+    if(!file_source.open(filename))
+        return false;
+    file_source.setUseMapping(true);
+
+    UnsizedByteSource unsized_source(file_source);
+
+    std::vector<uint8_t> bytes;
+    std::shared_ptr<const flifcore::InputBuffer> mapping;
+    bool ok = false;
+    switch(method)
+    {
+    case IM_LEGACY:
+        ok = legacyReadAll(file_source, bytes);
+        break;
+    case IM_SIZED:
+        ok = flifcore::readAll(file_source, bytes);
+        break;
+    case IM_UNSIZED:
+        ok = flifcore::readAll(unsized_source, bytes);
+        break;
+    case IM_MAPPED:
+        mapping = file_source.mapRemaining();
+        ok = mapping != 0;
+        if(ok)
+        {
+            // touch every page, like the decoder would
+            volatile uint8_t sum = 0;
+            for(size_t i = 0; i < mapping->size(); i += 4096)
+                sum += mapping->data()[i];
+            bytes_read += mapping->size();
+        }
+        break;
+    }
+
+    bytes_read += bytes.size();
+    return ok;
+}
+
+static int runIngest(const std::vector<std::string>& files, int repetitions)
+{
+    const struct { IngestMethod method; const char* name; } methods[] = {
+        { IM_LEGACY, "10 KB steps (old)" },
+        { IM_SIZED, "size hint" },
+        { IM_UNSIZED, "geometric growth" },
+        { IM_MAPPED, "memory map" },
+    };
+
+    printf("%-20s %10s %10s %12s %14s\n", "method", "ms", "MB/s", "allocations", "peak heap MB");
+
+    for(const auto& m : methods)
+    {
+        size_t bytes_read = 0;
+        const size_t heap_before = resetHeapCounters();
+        Clock::time_point start = Clock::now();
+
+        for(int r = 0; r < repetitions; ++r)
+        {
+            for(const auto& file : files)
+            {
+                if(!ingestFile(file, m.method, bytes_read))
+                {
+                    printf("%s: failed\n", file.c_str());
+                    return 1;
+                }
+            }
+        }
+
+        const double ms = millisSince(start);
+        printf("%-20s %10.2f %10.2f %12zu %14.1f\n",
+            m.name,
+            ms,
+            toMB(double(bytes_read)) / (ms / 1000.0),
+            g_heap.allocations.load(),
+            toMB(double(g_heap.peak_bytes - heap_before)));
+    }
+
+    printf("peak RSS: %.1f MB\n", toMB(double(peakRSS())));
+    return 0;
+}
+
+//=============================================================================
+// probe: the image properties needed by the property handler
+
+/*!
+* The property handler before header probing: decode growing 20 KB prefixes until libflif returns an image.
+*/
+static bool legacyProbe(flifcore::ByteSource& source, flifcore::ImageInfo& info)
+{
+    const size_t CHUNK_SIZE = 20480;
+
+    std::vector<uint8_t> buffer;
+    flifDecoder decoder;
+    if(decoder == 0)
+        return false;
+
+    while(true)
+    {
+        const size_t previous_size = buffer.size();
+        buffer.resize(previous_size + CHUNK_SIZE);
+
+        size_t actually_read;
+        if(!source.read(buffer.data() + previous_size, CHUNK_SIZE, actually_read))
+            return false;
+
+        buffer.resize(previous_size + actually_read);
+
+        if(flif_decoder_decode_memory(decoder, buffer.data(), buffer.size()) != 0 &&
+            flif_decoder_num_images(decoder) != 0)
+        {
+            FLIF_IMAGE* image = flif_decoder_get_image(decoder, 0);
+            info.width = flif_image_get_width(image);
+            info.height = flif_image_get_height(image);
+            info.channels = flif_image_get_nb_channels(image);
+            info.depth = flif_image_get_depth(image);
+            info.frame_count = flif_decoder_num_images(decoder);
+            return true;
+        }
+
+        if(actually_read < CHUNK_SIZE)
+            return false;
+    }
+}
+
+/*!
+* Counts the bytes taken from the wrapped source.
+*/
+class CountingByteSource : public flifcore::ByteSource
+{
+public:
+    CountingByteSource(flifcore::ByteSource& source)
+        : _source(source)
+        , _bytes_read(0)
+    {}
+
+    virtual bool read(uint8_t* buffer, size_t size, size_t& bytes_read) override
+    {
+        const bool ok = _source.read(buffer, size, bytes_read);
+        _bytes_read += bytes_read;
+        return ok;
+    }
+
+    uint64_t bytesRead() const
+    {
+        return _bytes_read;
+    }
+
+private:
+    flifcore::ByteSource& _source;
+    uint64_t _bytes_read;
+};
+
+enum ProbeMethod
+{
+    PM_LEGACY,
+    PM_PROBE,
+    PM_SCAN
+};
+
+static bool probeFile(flifcore::ByteSource& source, ProbeMethod method, flifcore::ImageInfo& info)
+{
+    std::vector<uint8_t> prefix;
+    switch(method)
+    {
+    case PM_LEGACY:
+        return legacyProbe(source, info);
+    case PM_PROBE:
+        return flifcore::probeSource(source, prefix, info) == flifcore::DS_OK;
+    case PM_SCAN:
+    {
+        flifcore::HeaderScanner scanner;
+        if(flifcore::scanSource(source, prefix, scanner) != flifcore::DS_OK)
+            return false;
+        info = scanner.imageInfo();
+        return true;
+    }
+    }
+    return false;
+}
+
+static int runProbe(const std::vector<std::string>& files, int repetitions)
+{
+    const struct { ProbeMethod method; const char* name; } methods[] = {
+        { PM_LEGACY, "prefix decode (old)" },
+        { PM_PROBE, "header probe" },
+        { PM_SCAN, "header + metadata" },
+    };
+
+    printf("%-20s %10s %12s %12s %14s\n", "method", "ms", "props/s", "KB read", "peak heap MB");
+
+    for(const auto& m : methods)
+    {
+        uint64_t bytes_read = 0;
+        size_t probes = 0;
+        const size_t heap_before = resetHeapCounters();
+        Clock::time_point start = Clock::now();
+
+        for(int r = 0; r < repetitions; ++r)
+        {
+            for(const auto& file : files)
+            {
+                flifcore::FileByteSource source;
+                if(!source.open(file))
+                {
+                    printf("%s: could not open\n", file.c_str());
+                    return 1;
+                }
+
+                CountingByteSource counting_source(source);
+                flifcore::ImageInfo info;
+                if(!probeFile(counting_source, m.method, info))
+                {
+                    printf("%s: failed\n", file.c_str());
+                    return 1;
+                }
+
+                bytes_read += counting_source.bytesRead();
+                probes++;
+            }
+        }
+
+        const double ms = millisSince(start);
+        printf("%-20s %10.2f %12.1f %12.1f %14.1f\n",
+            m.name,
+            ms,
+            probes / (ms / 1000.0),
+            bytes_read / 1024.0,
+            toMB(double(g_heap.peak_bytes - heap_before)));
+    }
+
+    printf("peak RSS: %.1f MB\n", toMB(double(peakRSS())));
+    return 0;
+}
+
+//=============================================================================
+// copy: getting decoded frames into a caller's buffer, like CopyPixels does
+
+static bool copyFile(const std::string& filename, bool direct, size_t& frames, size_t& bytes_copied)
+{
+    flifcore::FileByteSource source;
+    if(!source.open(filename))
+        return false;
+
+    std::shared_ptr<const flifcore::InputBuffer> input;
+    if(!flifcore::acquireAll(source, input))
+        return false;
+
+    std::shared_ptr<flifcore::Decoder> decoder = std::make_shared<flifcore::Decoder>();
+    if(decoder->decode(input) != flifcore::DS_OK)
+        return false;
+
+    std::vector<uint8_t> destination;
+    for(size_t i = 0; i < decoder->frameCount(); ++i)
+    {
+        if(direct)
+        {
+            flifcore::LazyFrame frame;
+            if(frame.init(decoder, i) != flifcore::DS_OK)
+                return false;
+
+            const size_t stride = size_t(frame.width()) * 4;
+            destination.resize(stride * frame.height());
+            if(frame.copyPixels(0, 0, frame.width(), frame.height(), destination.data(), stride) != flifcore::DS_OK)
+                return false;
+        }
+        else
+        {
+            // the path before LazyFrame: extract, then memcpy
+            flifcore::Frame frame;
+            if(decoder->extractFrame(i, frame) != flifcore::DS_OK)
+                return false;
+
+            destination.resize(frame.pixels.size());
+            memcpy(destination.data(), frame.pixels.data(), destination.size());
+        }
+
+        frames++;
+        bytes_copied += destination.size();
+    }
+
+    return true;
+}
+
+static int runCopy(const std::vector<std::string>& files, int repetitions)
+{
+    const struct { bool direct; const char* name; } methods[] = {
+        { false, "extract + memcpy (old)" },
+        { true, "direct to caller" },
+    };
+
+    printf("%-24s %10s %10s %20s %14s\n", "method", "ms", "MB/s", "saved KB per frame", "peak heap MB");
+
+    for(const auto& m : methods)
+    {
+        size_t frames = 0;
+        size_t bytes_copied = 0;
+        flifcore::resetCounters();
+        const size_t heap_before = resetHeapCounters();
+        Clock::time_point start = Clock::now();
+
+        for(int r = 0; r < repetitions; ++r)
+        {
+            for(const auto& file : files)
+            {
+                if(!copyFile(file, m.direct, frames, bytes_copied))
+                {
+                    printf("%s: failed\n", file.c_str());
+                    return 1;
+                }
+            }
+        }
+
+        const double ms = millisSince(start);
+        printf("%-24s %10.2f %10.2f %20.1f %14.1f\n",
+            m.name,
+            ms,
+            toMB(double(bytes_copied)) / (ms / 1000.0),
+            frames != 0 ? flifcore::counters().copy_bytes_saved.load() / 1024.0 / frames : 0.0,
+            toMB(double(g_heap.peak_bytes - heap_before)));
+    }
+
+    printf("peak RSS: %.1f MB\n", toMB(double(peakRSS())));
+    return 0;
+}
+
+//=============================================================================
+// memory: heap use of the decoded frames, with and without keeping the libflif images
+
+enum MemoryMethod
+{
+    MM_DIRECT,
+    MM_KEEP,
+    MM_RELEASE
+};
+
+/*!
+* @param retained_bytes Heap still in use once all frames are available, without the compressed input.
+*/
+static bool materializeFile(const std::string& filename, MemoryMethod method, size_t& retained_bytes)
+{
+    flifcore::FileByteSource source;
+    if(!source.open(filename))
+        return false;
+
+    std::shared_ptr<const flifcore::InputBuffer> input;
+    if(!flifcore::acquireAll(source, input))
+        return false;
+
+    const size_t heap_before = g_heap.current_bytes;
+
+    std::shared_ptr<flifcore::Decoder> decoder = std::make_shared<flifcore::Decoder>();
+    if(decoder->decode(input) != flifcore::DS_OK)
+        return false;
+
+    std::vector<std::unique_ptr<flifcore::LazyFrame>> frames;
+    for(size_t i = 0; i < decoder->frameCount(); ++i)
+    {
+        frames.emplace_back(new flifcore::LazyFrame());
+        if(frames.back()->init(decoder, i) != flifcore::DS_OK)
+            return false;
+
+        // the direct mode serves all copies from the libflif images
+        if(method != MM_DIRECT && frames.back()->materialize() != flifcore::DS_OK)
+            return false;
+    }
+
+    if(method == MM_RELEASE)
+        decoder->releaseImages();
+
+    retained_bytes = g_heap.current_bytes - heap_before;
+    return true;
+}
+
+static int runMemory(const std::vector<std::string>& files, int repetitions)
+{
+    const struct { MemoryMethod method; const char* name; } methods[] = {
+        { MM_DIRECT, "libflif images only" },
+        { MM_KEEP, "images + frames (old)" },
+        { MM_RELEASE, "frames, images released" },
+    };
+
+    printf("%-40s %-24s %12s %14s\n", "file", "method", "retained MB", "peak heap MB");
+
+    for(const auto& file : files)
+    {
+        for(const auto& m : methods)
+        {
+            size_t retained_bytes = 0;
+            const size_t heap_before = resetHeapCounters();
+
+            for(int r = 0; r < repetitions; ++r)
+            {
+                if(!materializeFile(file, m.method, retained_bytes))
+                {
+                    printf("%s: failed\n", file.c_str());
+                    return 1;
+                }
+            }
+
+            printf("%-40s %-24s %12.1f %14.1f\n",
+                file.c_str(),
+                m.name,
+                toMB(double(retained_bytes)),
+                toMB(double(g_heap.peak_bytes - heap_before)));
+        }
+    }
+
+    printf("peak RSS: %.1f MB\n", toMB(double(peakRSS())));
+    return 0;
+}
+
+//=============================================================================
+// kernels: pixel conversion throughput of each instruction set
+
+static int runKernels(const std::vector<std::string>& files, int repetitions)
+{
+    typedef void (*Kernel8)(const uint8_t*, uint8_t*, size_t);
+    typedef void (*Kernel16)(const uint16_t*, uint8_t*, size_t);
+
+    printf("%-40s %-8s %-16s %10s\n", "file", "isa", "kernel", "GB/s");
+
+    for(const auto& file : files)
+    {
+        // the decoded first frame as input, RGBA8 and RGBA16
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        std::shared_ptr<flifcore::Decoder> decoder = std::make_shared<flifcore::Decoder>();
+        flifcore::Frame rgba;
+        flifcore::Frame rgba16;
+        if(!source.open(file) ||
+            !flifcore::acquireAll(source, input) ||
+            decoder->decode(input) != flifcore::DS_OK ||
+            decoder->extractFrame(0, rgba) != flifcore::DS_OK ||
+            decoder->extractFrame(0, rgba16, flifcore::PF_RGBA64) != flifcore::DS_OK)
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        const size_t pixel_count = size_t(rgba.width) * rgba.height;
+        const uint16_t* rgba16_pixels = reinterpret_cast<const uint16_t*>(rgba16.pixels.data());
+        std::vector<uint8_t> output(pixel_count * 4);
+
+        // small inputs are repeated to get a measurable time
+        const int runs = repetitions * int(std::max<size_t>(1, (64 << 20) / rgba.pixels.size()));
+
+        for(int isa = flifcore::KI_SCALAR; isa < flifcore::KI_COUNT; ++isa)
+        {
+            const flifcore::Kernels* k = flifcore::kernelsFor(flifcore::KernelIsa(isa));
+            if(k == 0)
+                continue;
+
+            const struct { const char* name; Kernel8 kernel8; Kernel16 kernel16; } kernels[] = {
+                { "RGBA->PBGRA", k->rgba_to_pbgra, 0 },
+                { "RGBA16->RGBA8", 0, k->rgba16_to_rgba8 },
+            };
+
+            for(const auto& kernel : kernels)
+            {
+                const Clock::time_point start = Clock::now();
+                for(int r = 0; r < runs; ++r)
+                {
+                    if(kernel.kernel8)
+                        kernel.kernel8(rgba.pixels.data(), output.data(), pixel_count);
+                    else
+                        kernel.kernel16(rgba16_pixels, output.data(), pixel_count);
+                }
+                const double ms = millisSince(start);
+
+                // bytes read plus bytes written
+                const size_t input_bytes = pixel_count * (kernel.kernel8 ? 4 : 8);
+                const double bytes = double(input_bytes + output.size()) * runs;
+
+                printf("%-40s %-8s %-16s %10.2f\n", file.c_str(), k->name, kernel.name, bytes / (ms * 1e6));
+            }
+        }
+    }
+
+    printf("dispatched: %s\n", flifcore::kernels().name);
+    return 0;
+}
+
+//=============================================================================
+// thumbnail: 256 px thumbnails, reduced decode against full decode plus downscale
+
+static int runThumbnail(const std::vector<std::string>& files, int repetitions)
+{
+    const uint32_t THUMBNAIL_SIZE = 256;
+
+    typedef flifcore::DecodeStatus (*ThumbnailFunction)(const std::shared_ptr<const flifcore::InputBuffer>&, uint32_t, flifcore::Frame&, flifcore::CancelToken*);
+    const struct { ThumbnailFunction function; const char* name; } methods[] = {
+        { flifcore::decodeThumbnailFull, "full decode + scale" },
+        { flifcore::decodeThumbnail, "reduced decode" },
+    };
+
+    printf("%-40s %-22s %10s %12s %14s\n", "file", "method", "size", "thumbs/s", "peak heap MB");
+
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        if(!source.open(file) || !flifcore::acquireAll(source, input))
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        for(const auto& m : methods)
+        {
+            flifcore::Frame thumbnail;
+            const size_t heap_before = resetHeapCounters();
+
+            const Clock::time_point start = Clock::now();
+            for(int r = 0; r < repetitions; ++r)
+            {
+                if(m.function(input, THUMBNAIL_SIZE, thumbnail, 0) != flifcore::DS_OK)
+                {
+                    printf("%s: failed\n", file.c_str());
+                    return 1;
+                }
+            }
+            const double ms = millisSince(start);
+
+            const std::string size = std::to_string(thumbnail.width) + "x" + std::to_string(thumbnail.height);
+            printf("%-40s %-22s %10s %12.1f %14.1f\n",
+                file.c_str(),
+                m.name,
+                size.c_str(),
+                repetitions * 1000.0 / ms,
+                toMB(double(g_heap.peak_bytes - heap_before)));
+        }
+    }
+
+    return 0;
+}
+
+//=============================================================================
+// preview: time until a first, coarse picture is available against the full decode
+
+static bool fullFirstFrame(const std::shared_ptr<const flifcore::InputBuffer>& input, flifcore::Frame& frame)
+{
+    flifcore::Decoder decoder;
+    return decoder.decode(input) == flifcore::DS_OK && decoder.extractFrame(0, frame, flifcore::PF_PBGRA32) == flifcore::DS_OK;
+}
+
+static int runPreview(const std::vector<std::string>& files, int repetitions)
+{
+    const struct { uint32_t max_size; int32_t quality; const char* name; } methods[] = {
+        { 0, 100, "full decode" },
+        { 1024, 100, "preview 1024" },
+        { 1024, 50, "preview 1024 q50" },
+        { 256, 100, "preview 256" },
+    };
+
+    printf("%-40s %-18s %12s %12s %10s\n", "file", "method", "size", "ms", "speedup");
+
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        if(!source.open(file) || !flifcore::acquireAll(source, input))
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        double full_ms = 0;
+        for(const auto& m : methods)
+        {
+            flifcore::Frame frame;
+
+            const Clock::time_point start = Clock::now();
+            for(int r = 0; r < repetitions; ++r)
+            {
+                const bool ok = m.max_size == 0 ?
+                    fullFirstFrame(input, frame) :
+                    flifcore::decodePreview(input, m.max_size, m.quality, frame) == flifcore::DS_OK;
+                if(!ok)
+                {
+                    printf("%s: failed\n", file.c_str());
+                    return 1;
+                }
+            }
+            const double ms = millisSince(start) / repetitions;
+            if(m.max_size == 0)
+                full_ms = ms;
+
+            const std::string size = std::to_string(frame.width) + "x" + std::to_string(frame.height);
+            printf("%-40s %-18s %12s %12.2f %9.1fx\n", file.c_str(), m.name, size.c_str(), ms, full_ms / ms);
+        }
+    }
+
+    return 0;
+}
+
+//=============================================================================
+// scale: decoding at 1/2, 1/4 and 1/8 size, zoom level plus box filter against full decode plus box filter
+
+static int runScale(const std::vector<std::string>& files, int repetitions)
+{
+    const uint32_t divisors[] = { 2, 4, 8 };
+
+    printf("%-40s %-8s %12s %14s %14s %10s\n", "file", "scale", "size", "full ms", "zoom ms", "speedup");
+
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        flifcore::ImageInfo info;
+        if(!source.open(file) ||
+            !flifcore::acquireAll(source, input) ||
+            flifcore::probeInfo(input->data(), input->size(), info) != flifcore::DS_OK)
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        for(uint32_t divisor : divisors)
+        {
+            const uint32_t width = std::max<uint32_t>(1, info.width / divisor);
+            const uint32_t height = std::max<uint32_t>(1, info.height / divisor);
+
+            flifcore::Frame scaled;
+            bool ok = true;
+
+            Clock::time_point start = Clock::now();
+            for(int r = 0; r < repetitions && ok; ++r)
+            {
+                flifcore::Decoder decoder;
+                flifcore::Frame full;
+                ok = decoder.decode(input) == flifcore::DS_OK &&
+                    decoder.extractFrame(0, full, flifcore::PF_PBGRA32) == flifcore::DS_OK &&
+                    flifcore::downscaleBox(full, width, height, scaled);
+            }
+            const double full_ms = millisSince(start) / repetitions;
+
+            start = Clock::now();
+            for(int r = 0; r < repetitions && ok; ++r)
+                ok = flifcore::decodeScaled(input, 0, width, height, flifcore::PF_PBGRA32, scaled) == flifcore::DS_OK;
+            const double zoom_ms = millisSince(start) / repetitions;
+
+            if(!ok)
+            {
+                printf("%s: failed\n", file.c_str());
+                return 1;
+            }
+
+            const std::string scale = "1/" + std::to_string(divisor);
+            const std::string size = std::to_string(width) + "x" + std::to_string(height);
+            printf("%-40s %-8s %12s %14.2f %14.2f %9.1fx\n", file.c_str(), scale.c_str(), size.c_str(), full_ms, zoom_ms, full_ms / zoom_ms);
+        }
+    }
+
+    return 0;
+}
+
+static int runRoi(const std::vector<std::string>& files, int repetitions)
+{
+    const uint32_t sizes[] = { 64, 256, 1024, 4096 };
+
+    printf("%-40s %12s %14s %14s %14s %10s\n", "file", "rect", "full ms", "region ms", "pan hit ms", "speedup");
+
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        flifcore::ImageInfo info;
+        if(!source.open(file) ||
+            !flifcore::acquireAll(source, input) ||
+            flifcore::probeInfo(input->data(), input->size(), info) != flifcore::DS_OK)
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        uint32_t last_width = 0;
+        uint32_t last_height = 0;
+        for(uint32_t size : sizes)
+        {
+            // a window in the middle, like a viewer zoomed into the image
+            const uint32_t width = std::min(size, info.width);
+            const uint32_t height = std::min(size, info.height);
+            if(width == last_width && height == last_height)
+                continue;
+            last_width = width;
+            last_height = height;
+
+            const uint32_t x = (info.width - width) / 2;
+            const uint32_t y = (info.height - height) / 2;
+            const flifcore::PixelFormat format = flifcore::choosePixelFormat(info);
+            const size_t stride = width * flifcore::bytesPerPixel(format);
+            std::vector<uint8_t> buffer(stride * height);
+            bool ok = true;
+
+            // before: the whole frame is decoded, then the rectangle copied
+            Clock::time_point start = Clock::now();
+            for(int r = 0; r < repetitions && ok; ++r)
+            {
+                std::shared_ptr<flifcore::Decoder> decoder = std::make_shared<flifcore::Decoder>();
+                flifcore::LazyFrame frame;
+                ok = decoder->open(input) == flifcore::DS_OK &&
+                    frame.init(decoder, 0, format) == flifcore::DS_OK &&
+                    frame.copyPixels(x, y, width, height, buffer.data(), stride) == flifcore::DS_OK;
+            }
+            const double full_ms = millisSince(start) / repetitions;
+
+            // the first copy into an empty cache decodes the rectangle with its margin
+            double region_ms = 0;
+            double pan_ms = 0;
+            for(int r = 0; r < repetitions && ok; ++r)
+            {
+                flifcore::RegionCache cache(input, 0, info.width, info.height, format);
+                start = Clock::now();
+                ok = cache.copyPixels(x, y, width, height, buffer.data(), stride) == flifcore::DS_OK;
+                region_ms += millisSince(start);
+
+                // panning by a quarter of the window is served from the cached region
+                start = Clock::now();
+                ok = ok && cache.copyPixels(x - std::min(x, width / 4), y, width, height, buffer.data(), stride) == flifcore::DS_OK;
+                pan_ms += millisSince(start);
+                ok = ok && cache.misses() == 1;
+            }
+            region_ms /= repetitions;
+            pan_ms /= repetitions;
+
+            if(!ok)
+            {
+                printf("%s: failed\n", file.c_str());
+                return 1;
+            }
+
+            const std::string rect = std::to_string(width) + "x" + std::to_string(height);
+            printf("%-40s %12s %14.2f %14.2f %14.3f %9.1fx\n", file.c_str(), rect.c_str(), full_ms, region_ms, pan_ms, full_ms / region_ms);
+        }
+    }
+
+    return 0;
+}
+
+static int runCache(const std::vector<std::string>& files, int repetitions)
+{
+    printf("%-40s %10s %10s %12s %12s %10s\n", "file", "hash ms", "hash MB/s", "miss ms", "hit us", "speedup");
+
+    std::vector<std::shared_ptr<const flifcore::InputBuffer>> inputs;
+    std::vector<flifcore::ImageKey> keys;
+    flifcore::ImageCache cache;
+
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        flifcore::ImageInfo info;
+        if(!source.open(file) ||
+            !flifcore::acquireAll(source, input) ||
+            flifcore::probeInfo(input->data(), input->size(), info) != flifcore::DS_OK)
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        // every object hashes the input once to find it
+        flifcore::ImageKey key;
+        Clock::time_point start = Clock::now();
+        for(int r = 0; r < repetitions; ++r)
+            key = flifcore::ImageCache::key(*input, flifcore::choosePixelFormat(info));
+        const double hash_ms = millisSince(start) / repetitions;
+
+        // a miss decodes all frames
+        std::shared_ptr<const flifcore::CachedImage> image;
+        bool ok = true;
+        double miss_ms = 0;
+        for(int r = 0; r < repetitions && ok; ++r)
+        {
+            cache.clear();
+            start = Clock::now();
+            ok = cache.decode(input, key, image) == flifcore::DS_OK;
+            miss_ms += millisSince(start);
+        }
+        miss_ms /= repetitions;
+
+        // a hit only looks up the key, the hash is not included
+        const int lookups = repetitions * 1000;
+        start = Clock::now();
+        for(int r = 0; r < lookups && ok; ++r)
+            ok = cache.decode(input, key, image) == flifcore::DS_OK;
+        const double hit_us = millisSince(start) * 1000 / lookups;
+
+        if(!ok || !cache.find(key))
+        {
+            printf("%s: failed, or larger than the cache budget\n", file.c_str());
+            return 1;
+        }
+
+        printf("%-40s %10.2f %10.0f %12.2f %12.3f %9.0fx\n", file.c_str(), hash_ms, toMB(input->size()) / hash_ms * 1000,
+            miss_ms, hit_us, (hash_ms + miss_ms) / (hash_ms + hit_us / 1000));
+
+        inputs.push_back(input);
+        keys.push_back(key);
+    }
+
+    // several threads looking up the files at once, the shards keep them apart
+    const unsigned int thread_counts[] = { 1, 2, 4, 8 };
+    for(unsigned int thread_count : thread_counts)
+    {
+        const int lookups = repetitions * 10000;
+        std::atomic<int> failures(0);
+        std::vector<std::thread> threads;
+
+        Clock::time_point start = Clock::now();
+        for(unsigned int t = 0; t < thread_count; ++t)
+        {
+            threads.emplace_back([&, t]()
+            {
+                for(int i = 0; i < lookups; ++i)
+                {
+                    const size_t file = (i + t) % inputs.size();
+                    std::shared_ptr<const flifcore::CachedImage> image;
+                    if(cache.decode(inputs[file], keys[file], image) != flifcore::DS_OK)
+                        failures++;
+                }
+            });
+        }
+        for(auto& thread : threads)
+            thread.join();
+        const double ms = millisSince(start);
+
+        if(failures != 0)
+        {
+            printf("lookups failed\n");
+            return 1;
+        }
+
+        printf("%u threads: %.2f M hits/s\n", thread_count, thread_count * lookups / ms / 1000);
+    }
+
+    const flifcore::ImageCache::Stats stats = cache.stats();
+    printf("hits %llu, misses %llu, evictions %llu, %zu images, %.1f MB\n",
+        static_cast<unsigned long long>(stats.hits), static_cast<unsigned long long>(stats.misses),
+        static_cast<unsigned long long>(stats.evictions), stats.images, toMB(stats.bytes));
+
+    return 0;
+}
+
+//! Reads every pixel, so mapped pages are faulted in like a viewer would.
+static uint64_t touchPixels(const flifcore::CachedImage& image)
+{
+    uint64_t sum = 0;
+    for(const auto& frame : image.frames)
+    {
+        const uint64_t size = frame.size();
+        for(uint64_t i = 0; i < size; i += 64)
+            sum += frame.pixels[i];
+    }
+    return sum;
+}
+
+static int runDisk(const std::vector<std::string>& files, int repetitions)
+{
+    // the warm numbers are for files in the OS page cache, as right after a previous run
+    const std::string directory_name = "flif_bench_disk_cache";
+    const flifcore::DiskCache::Path directory(directory_name.begin(), directory_name.end());
+    std::shared_ptr<flifcore::DiskCache> disk = std::make_shared<flifcore::DiskCache>(directory);
+    flifcore::DiskCache empty(directory, 0);
+
+    printf("%-40s %10s %12s %12s %10s %12s %12s %10s\n", "file", "MB", "cold ms", "warm ms", "speedup",
+        "thumb cold", "thumb warm", "speedup");
+
+    uint64_t checksum = 0;
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        if(!source.open(file) || !flifcore::acquireAll(source, input))
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        // both include hashing the input, every new process has to do that once
+        bool ok = true;
+        double cold_ms = 0, warm_ms = 0, thumb_cold_ms = 0, thumb_warm_ms = 0;
+        uint64_t bytes = 0;
+        for(int r = 0; r < repetitions && ok; ++r)
+        {
+            empty.trim();
+
+            // a fresh memory cache each time stands for a new process
+            std::shared_ptr<const flifcore::CachedImage> image;
+            {
+                flifcore::ImageCache cache;
+                cache.setDiskCache(disk);
+                Clock::time_point start = Clock::now();
+                ok = cache.decode(input, image) == flifcore::DS_OK;
+                checksum += ok ? touchPixels(*image) : 0;
+                cold_ms += millisSince(start);
+            }
+            {
+                flifcore::ImageCache cache;
+                cache.setDiskCache(disk);
+                Clock::time_point start = Clock::now();
+                ok = ok && cache.decode(input, image) == flifcore::DS_OK && cache.stats().disk_hits == 1;
+                checksum += ok ? touchPixels(*image) : 0;
+                warm_ms += millisSince(start);
+                bytes = ok ? image->bytes() : 0;
+            }
+
+            std::shared_ptr<const flifcore::CachedImage> thumbnail;
+            Clock::time_point start = Clock::now();
+            ok = ok && flifcore::decodeThumbnailCached(input, 256, disk.get(), thumbnail) == flifcore::DS_OK;
+            thumb_cold_ms += millisSince(start);
+
+            start = Clock::now();
+            ok = ok && flifcore::decodeThumbnailCached(input, 256, disk.get(), thumbnail) == flifcore::DS_OK;
+            checksum += ok ? touchPixels(*thumbnail) : 0;
+            thumb_warm_ms += millisSince(start);
+        }
+
+        if(!ok)
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        cold_ms /= repetitions;
+        warm_ms /= repetitions;
+        thumb_cold_ms /= repetitions;
+        thumb_warm_ms /= repetitions;
+        printf("%-40s %10.1f %12.2f %12.2f %9.1fx %12.2f %12.2f %9.1fx\n", file.c_str(), toMB(double(bytes)),
+            cold_ms, warm_ms, cold_ms / warm_ms, thumb_cold_ms, thumb_warm_ms, thumb_cold_ms / thumb_warm_ms);
+    }
+
+    empty.trim();
+#ifdef _WIN32
+    RemoveDirectoryA(directory_name.c_str());
+#else
+    rmdir(directory_name.c_str());
+#endif
+
+    printf("checksum %llu\n", static_cast<unsigned long long>(checksum));
+    return 0;
+}
+
+static int runPool(const std::vector<std::string>& files, int repetitions)
+{
+    std::vector<std::shared_ptr<const flifcore::InputBuffer>> inputs;
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        if(!source.open(file) || !flifcore::acquireAll(source, input))
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+        inputs.push_back(input);
+    }
+
+    printf("%-10s %-6s %10s %12s %10s %10s %10s\n", "workload", "pools", "files", "allocs/file", "mean us", "p50 us", "p99 us");
+
+    const char* workloads[] = { "decode", "thumbnail" };
+    for(const char* workload : workloads)
+    {
+        const bool thumbnail = std::string(workload) == "thumbnail";
+        for(int pooled = 0; pooled < 2; ++pooled)
+        {
+            // off: every buffer and decoder comes from the heap and libflif, as before the pools
+            flifcore::BufferPool::shared().setMaxIdleBytes(pooled ? flifcore::BufferPool::DEFAULT_MAX_IDLE_BYTES : 0);
+            flifcore::DecoderPool::shared().setMaxIdle(pooled ? flifcore::DecoderPool::DEFAULT_MAX_IDLE : 0);
+
+            // one object per file, like Explorer opening a folder
+            std::vector<double> latencies;
+            size_t allocations = 0;
+            bool ok = true;
+            for(int r = 0; r < repetitions + 1 && ok; ++r)
+            {
+                for(const auto& input : inputs)
+                {
+                    resetHeapCounters();
+                    Clock::time_point start = Clock::now();
+                    flifcore::Frame frame;
+                    if(thumbnail)
+                    {
+                        ok = flifcore::decodeThumbnail(input, 96, frame) == flifcore::DS_OK;
+                    }
+                    else
+                    {
+                        flifcore::Decoder decoder;
+                        ok = decoder.open(input) == flifcore::DS_OK &&
+                            decoder.extractFrame(0, frame, flifcore::choosePixelFormat(decoder.info())) == flifcore::DS_OK;
+                    }
+                    frame = flifcore::Frame();
+                    const double us = millisSince(start) * 1000;
+
+                    // the first round fills the pools
+                    if(r > 0)
+                    {
+                        latencies.push_back(us);
+                        allocations += g_heap.allocations;
+                    }
+                }
+            }
+
+            if(!ok)
+            {
+                printf("decoding failed\n");
+                return 1;
+            }
+
+            std::sort(latencies.begin(), latencies.end());
+            double sum = 0;
+            for(double latency : latencies)
+                sum += latency;
+            printf("%-10s %-6s %10zu %12.1f %10.2f %10.2f %10.2f\n", workload, pooled ? "on" : "off", latencies.size(),
+                double(allocations) / latencies.size(), sum / latencies.size(),
+                latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]);
+        }
+    }
+
+    const flifcore::BufferPool::Stats buffers = flifcore::BufferPool::shared().stats();
+    const flifcore::DecoderPool::Stats decoders = flifcore::DecoderPool::shared().stats();
+    printf("buffers: %llu allocated, %llu reused, %.1f MB idle; decoders: %llu created, %llu reused\n",
+        static_cast<unsigned long long>(buffers.allocations), static_cast<unsigned long long>(buffers.reuses), toMB(double(buffers.idle_bytes)),
+        static_cast<unsigned long long>(decoders.created), static_cast<unsigned long long>(decoders.reused));
+
+    return 0;
+}
+
+/*!
+* Peak signal to noise ratio in dB over all channels, infinite for equal frames.
+*/
+static double psnr(const flifcore::Frame& a, const flifcore::Frame& b)
+{
+    if(a.pixels.size() != b.pixels.size())
+        return 0;
+
+    double squared_error = 0;
+    for(size_t i = 0; i < a.pixels.size(); ++i)
+    {
+        const double difference = double(a.pixels[i]) - b.pixels[i];
+        squared_error += difference * difference;
+    }
+    if(squared_error == 0)
+        return std::numeric_limits<double>::infinity();
+
+    const double mse = squared_error / a.pixels.size();
+    return 10 * log10(255.0 * 255.0 / mse);
+}
+
+static int runBudget(const std::vector<std::string>& files, int repetitions)
+{
+    // fractions of the time the complete decode takes
+    const double budgets[] = { 0.05, 0.1, 0.25, 0.5, 0.75, 1.0, 1.5 };
+
+    printf("%-40s %8s %12s %12s %10s %10s\n", "file", "budget", "budget ms", "actual ms", "result", "PSNR dB");
+
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        if(!source.open(file) || !flifcore::acquireAll(source, input))
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        flifcore::Frame reference;
+        bool partial;
+        const Clock::time_point start = Clock::now();
+        for(int r = 0; r < repetitions; ++r)
+        {
+            if(flifcore::decodeWithDeadline(input, 0, flifcore::CancelToken::Clock::now() + std::chrono::hours(1), reference, partial) != flifcore::DS_OK)
+            {
+                printf("%s: failed\n", file.c_str());
+                return 1;
+            }
+        }
+        const double full_ms = millisSince(start) / repetitions;
+
+        for(double budget : budgets)
+        {
+            const auto budget_time = std::chrono::duration_cast<flifcore::CancelToken::Clock::duration>(
+                std::chrono::duration<double, std::milli>(budget * full_ms));
+
+            flifcore::Frame frame;
+            flifcore::DecodeStatus status = flifcore::DS_OK;
+            const Clock::time_point budget_start = Clock::now();
+            for(int r = 0; r < repetitions; ++r)
+                status = flifcore::decodeWithDeadline(input, 0, flifcore::CancelToken::Clock::now() + budget_time, frame, partial);
+            const double ms = millisSince(budget_start) / repetitions;
+
+            const char* result = status != flifcore::DS_OK ? "none" : (partial ? "partial" : "complete");
+            const double quality = status == flifcore::DS_OK ? psnr(frame, reference) : 0;
+            printf("%-40s %7.0f%% %12.2f %12.2f %10s %10.2f\n", file.c_str(), budget * 100, budget * full_ms, ms, result, quality);
+        }
+    }
+
+    return 0;
+}
+
+/*!
+* A main header of a 60000 x 60000 interlaced RGBA image followed by garbage, as a crafted file would be.
+*/
+static std::vector<uint8_t> craftedHeader()
+{
+    // varints of 59999: 0x83 0xd4 0x5f
+    std::vector<uint8_t> bytes = { 'F', 'L', 'I', 'F', 16 * 4 + 4, '1', 0x83, 0xd4, 0x5f, 0x83, 0xd4, 0x5f, 0 };
+    bytes.resize(4096, 0x55);
+    return bytes;
+}
+
+static int runLimits(const std::vector<std::string>& files, int repetitions)
+{
+    const struct { uint64_t max_mb; bool downscale; const char* name; } methods[] = {
+        { 0, false, "defaults" },
+        { 0, true, "defaults, downscale" },
+        { 64, true, "64 MB, downscale" },
+        { 16, true, "16 MB, downscale" },
+        { 4, true, "4 MB, downscale" },
+    };
+
+    printf("%-40s %-22s %12s %12s %10s %14s\n", "file", "limits", "header", "decoded", "ms", "peak heap MB");
+
+    std::vector<std::string> inputs = files;
+    inputs.push_back("crafted 60000x60000");
+
+    for(const auto& file : inputs)
+    {
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        if(file == inputs.back())
+            input = std::make_shared<flifcore::OwnedInputBuffer>(craftedHeader());
+        else
+        {
+            flifcore::FileByteSource source;
+            if(!source.open(file) || !flifcore::acquireAll(source, input))
+            {
+                printf("%s: failed\n", file.c_str());
+                return 1;
+            }
+        }
+
+        flifcore::ImageInfo info;
+        if(flifcore::probeInfo(input->data(), input->size(), info) != flifcore::DS_OK)
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+        const std::string header_size = std::to_string(info.width) + "x" + std::to_string(info.height);
+
+        for(const auto& m : methods)
+        {
+            flifcore::DecodeLimits limits;
+            if(m.max_mb != 0)
+                limits.max_bytes = m.max_mb * 1024 * 1024;
+            limits.downscale = m.downscale;
+
+            std::shared_ptr<const flifcore::CachedImage> image;
+            flifcore::DecodeStatus status = flifcore::DS_OK;
+            const size_t heap_before = resetHeapCounters();
+            const Clock::time_point start = Clock::now();
+            for(int r = 0; r < repetitions; ++r)
+            {
+                image.reset();
+                status = flifcore::decodeAllFrames(input, flifcore::choosePixelFormat(info), image, 0, &limits);
+            }
+            const double ms = millisSince(start) / repetitions;
+
+            std::string decoded = flifcore::toString(status);
+            if(status == flifcore::DS_OK && !image->frames.empty())
+                decoded = std::to_string(image->frames[0].width) + "x" + std::to_string(image->frames[0].height);
+
+            printf("%-40s %-22s %12s %12s %10.2f %14.1f\n", file.c_str(), m.name, header_size.c_str(), decoded.c_str(), ms,
+                toMB(double(g_heap.peak_bytes - heap_before)));
+        }
+    }
+
+    printf("peak RSS: %.1f MB\n", toMB(double(peakRSS())));
+    return 0;
+}
+
+/*!
+* The frames of flifBitmapDecoder, once behind one lock and once published through atomic slots.
+* Each thread takes every n-th frame and copies tiles from it, like viewers asking for frames in parallel.
+*/
+static int runFrames(const std::vector<std::string>& files, int repetitions)
+{
+    const uint32_t tile = 64;
+    const int rounds = 20;
+
+    printf("%-40s %-10s %8s %12s %12s\n", "file", "frames", "threads", "locked/s", "published/s");
+
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        std::shared_ptr<flifcore::Decoder> decoder = std::make_shared<flifcore::Decoder>();
+        if(!source.open(file) || !flifcore::acquireAll(source, input) ||
+            decoder->open(input) != flifcore::DS_OK || decoder->decodePixels() != flifcore::DS_OK)
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        const size_t frame_count = decoder->frameCount();
+        const uint32_t width = std::min(tile, decoder->info().width);
+        const uint32_t height = std::min(tile, decoder->info().height);
+
+        for(int thread_count = 1; thread_count <= 8; thread_count *= 2)
+        {
+            double tiles_per_second[2];
+            for(int published = 0; published < 2; ++published)
+            {
+                std::atomic<int> failures(0);
+                double ms = 0;
+                for(int r = 0; r < repetitions; ++r)
+                {
+                    // new frames each time, so their creation is measured as well
+                    std::mutex mutex;
+                    std::vector<std::unique_ptr<flifcore::LazyFrame>> locked_frames(frame_count);
+                    flifcore::AtomicSlots<flifcore::LazyFrame> published_frames(frame_count);
+
+                    auto getFrame = [&](size_t index) -> flifcore::LazyFrame*
+                    {
+                        if(!published)
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            if(!locked_frames[index])
+                            {
+                                locked_frames[index].reset(new flifcore::LazyFrame());
+                                if(locked_frames[index]->init(decoder, index) != flifcore::DS_OK)
+                                    failures++;
+                            }
+                            return locked_frames[index].get();
+                        }
+
+                        flifcore::LazyFrame* frame = published_frames.get(index);
+                        if(frame != 0)
+                            return frame;
+
+                        std::unique_ptr<flifcore::LazyFrame> created(new flifcore::LazyFrame());
+                        if(created->init(decoder, index) != flifcore::DS_OK)
+                            failures++;
+                        return published_frames.publish(index, created.release());
+                    };
+
+                    const Clock::time_point start = Clock::now();
+                    std::vector<std::thread> threads;
+                    for(int t = 0; t < thread_count; ++t)
+                    {
+                        threads.emplace_back([&, t]()
+                        {
+                            std::vector<uint8_t> buffer(size_t(width) * height * 4);
+                            for(int round = 0; round < rounds; ++round)
+                                for(size_t index = t; index < frame_count; index += thread_count)
+                                    if(getFrame(index)->copyPixels(0, 0, width, height, buffer.data(), size_t(width) * 4) != flifcore::DS_OK)
+                                        failures++;
+                        });
+                    }
+                    for(auto& thread : threads)
+                        thread.join();
+                    ms += millisSince(start);
+                }
+
+                if(failures != 0)
+                {
+                    printf("%s: copying failed\n", file.c_str());
+                    return 1;
+                }
+                tiles_per_second[published] = double(frame_count) * rounds * repetitions / (ms / 1000);
+            }
+
+            printf("%-40s %-10zu %8d %12.0f %12.0f\n", file.c_str(), frame_count, thread_count, tiles_per_second[0], tiles_per_second[1]);
+        }
+    }
+
+    printf("hardware threads: %u\n", std::thread::hardware_concurrency());
+    return 0;
+}
+
+/*!
+* Extraction of decoded frames in bands of rows, by the number of threads per frame.
+*/
+static int runBands(const std::vector<std::string>& files, int repetitions)
+{
+    printf("%-40s %-12s %-8s %8s %10s %10s %8s\n", "file", "size", "format", "threads", "ms", "MB/s", "speedup");
+
+    const flifcore::PixelFormat formats[] = { flifcore::PF_RGBA32, flifcore::PF_PBGRA32, flifcore::PF_BGR24 };
+    const char* format_names[] = { "RGBA32", "PBGRA32", "BGR24" };
+
+    // past the pool size as well, to show where it stops scaling
+    const unsigned int max_threads = std::max(8u, 2 * flifcore::TaskPool::shared().maxThreads());
+    const unsigned int previous_threads = flifcore::RowBands::maxThreads();
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        flifcore::Decoder decoder;
+        if(!source.open(file) || !flifcore::acquireAll(source, input) ||
+            decoder.open(input) != flifcore::DS_OK || decoder.decodePixels() != flifcore::DS_OK)
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+
+        const std::string size = std::to_string(decoder.info().width) + "x" + std::to_string(decoder.info().height);
+        for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f)
+        {
+            double single_ms = 0;
+            for(unsigned int threads = 1; threads <= max_threads; threads *= 2)
+            {
+                flifcore::RowBands::setMaxThreads(threads);
+
+                // the first round starts the threads of the pool
+                flifcore::Frame frame;
+                decoder.extractFrame(0, frame, formats[f]);
+
+                const Clock::time_point start = Clock::now();
+                for(int r = 0; r < repetitions; ++r)
+                    decoder.extractFrame(0, frame, formats[f]);
+                const double ms = millisSince(start) / repetitions;
+                if(threads == 1)
+                    single_ms = ms;
+
+                printf("%-40s %-12s %-8s %8u %10.2f %10.1f %8.2f\n", file.c_str(), size.c_str(), format_names[f], threads, ms,
+                    toMB(double(frame.pixels.size())) / (ms / 1000), single_ms / ms);
+            }
+        }
+    }
+    flifcore::RowBands::setMaxThreads(previous_threads);
+
+    printf("pool threads: %u, bands from %.1f MB\n", flifcore::TaskPool::shared().maxThreads(), toMB(double(flifcore::RowBands::minBytes())));
+    return 0;
+}
+
+/*!
+* Stands in for the DIB of the preview handler: a new buffer and one pass over the pixels.
+*/
+static std::shared_ptr<std::vector<uint8_t>> copyForDisplay(const flifcore::FrameView& frame)
+{
+    return std::make_shared<std::vector<uint8_t>>(frame.pixels, frame.pixels + frame.size());
+}
+
+/*!
+* Time until the preview pane shows something: all frames decoded and converted first, as before, against
+* a worker that publishes passes of the first frame and then each converted frame, as DoPreview() does now.
+*/
+static int runPaint(const std::vector<std::string>& files, int repetitions)
+{
+    typedef flifcore::FrameMailbox<std::shared_ptr<std::vector<uint8_t>>> Mailbox;
+
+    printf("%-40s %7s %11s %10s %8s %11s %9s %8s\n", "file", "frames", "interlaced", "blocking", "first", "full first", "all", "speedup");
+
+    for(const auto& file : files)
+    {
+        flifcore::FileByteSource source;
+        std::shared_ptr<const flifcore::InputBuffer> input;
+        flifcore::ImageInfo info;
+        if(!source.open(file) || !flifcore::acquireAll(source, input) ||
+            flifcore::probeInfo(input->data(), input->size(), info) != flifcore::DS_OK)
+        {
+            printf("%s: failed\n", file.c_str());
+            return 1;
+        }
+        const flifcore::PixelFormat format = flifcore::choosePixelFormat(info);
+
+        double blocking_ms = 0;
+        double first_ms = 0;
+        double full_first_ms = 0;
+        double all_ms = 0;
+        for(int r = 0; r < repetitions; ++r)
+        {
+            // before: the window comes after the last frame
+            Clock::time_point start = Clock::now();
+            {
+                std::shared_ptr<const flifcore::CachedImage> image;
+                if(flifcore::decodeAllFrames(input, format, image) != flifcore::DS_OK)
+                {
+                    printf("%s: failed\n", file.c_str());
+                    return 1;
+                }
+                std::vector<std::shared_ptr<std::vector<uint8_t>>> converted;
+                for(const auto& frame : image->frames)
+                    converted.push_back(copyForDisplay(frame));
+            }
+            blocking_ms += millisSince(start);
+
+            // now: the window shows whatever the worker published first
+            std::mutex mutex;
+            std::condition_variable wake;
+            bool notified = false;
+            Mailbox mailbox([&]()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                notified = true;
+                wake.notify_one();
+            });
+
+            start = Clock::now();
+            std::thread worker([&]()
+            {
+                flifcore::Decoder::ProgressCallback progress;
+                if(info.interlaced)
+                {
+                    progress = flifcore::firstFramePasses(format, [&](const flifcore::FrameView& pass)
+                    {
+                        mailbox.publish(0, false, copyForDisplay(pass));
+                    });
+                }
+
+                std::shared_ptr<const flifcore::CachedImage> image;
+                const flifcore::DecodeStatus status = flifcore::decodeAllFrames(input, format, image, 0, 0, progress);
+                for(size_t i = 0; status == flifcore::DS_OK && i < image->frames.size(); ++i)
+                    mailbox.publish(i, true, copyForDisplay(image->frames[i]));
+                mailbox.finish(status);
+            });
+
+            bool first_seen = false;
+            bool full_first_seen = false;
+            bool finished = false;
+            flifcore::DecodeStatus status = flifcore::DS_OK;
+            while(!finished)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&]() { return notified; });
+                    notified = false;
+                }
+
+                std::vector<Mailbox::Entry> entries;
+                finished = mailbox.take(entries, status);
+                for(const auto& entry : entries)
+                {
+                    if(!first_seen)
+                    {
+                        first_seen = true;
+                        first_ms += millisSince(start);
+                    }
+                    if(entry.final && entry.index == 0 && !full_first_seen)
+                    {
+                        full_first_seen = true;
+                        full_first_ms += millisSince(start);
+                    }
+                }
+            }
+            all_ms += millisSince(start);
+            worker.join();
+
+            if(status != flifcore::DS_OK)
+            {
+                printf("%s: failed\n", file.c_str());
+                return 1;
+            }
+        }
+
+        printf("%-40s %7zu %11s %10.1f %8.1f %11.1f %9.1f %8.1f\n", file.c_str(), info.frame_count, info.interlaced ? "yes" : "no",
+            blocking_ms / repetitions, first_ms / repetitions, full_first_ms / repetitions, all_ms / repetitions, blocking_ms / first_ms);
+    }
+
+    printf("blocking: all frames decoded and converted, first: first pass or frame published, full first: the first frame itself\n");
+    return 0;
+}
+
+//=============================================================================
+
+static void printUsage()
+{
+    printf("Usage: flif_bench [mode] [-r repetitions] file1.flif [file2.flif ...]\n");
+    printf("Modes:\n");
+    printf("  decode  full decode with per-stage latency (default)\n");
+    printf("  ingest  reading the compressed bytes, old loop against size-aware reading\n");
+    printf("  probe   properties/s of the property handler, prefix decoding against header probing\n");
+    printf("  copy    decoded frames into a caller's buffer, with and without intermediate copy\n");
+    printf("  memory  heap held by decoded frames, keeping or releasing the libflif images\n");
+    printf("  kernels GB/s of the pixel conversion kernels for each instruction set\n");
+    printf("  thumbnail thumbnails/s, decoding only the needed zoom levels against a full decode\n");
+    printf("  preview time to a coarse first picture of interlaced files against the full decode\n");
+    printf("  scale   decoding at 1/2, 1/4, 1/8 size from zoom levels against full decode and downscale\n");
+    printf("  roi     latency of copying a rectangle by its size, decoding only around it against the full decode\n");
+    printf("  cache   hit and miss latency of the shared image cache, and hits/s from several threads\n");
+    printf("  disk    new process with an empty disk cache against one with the file cached, images and thumbnails\n");
+    printf("  pool    heap allocations and latency per file of a batch of small files, with and without pooling\n");
+    printf("  budget  quality of the first frame against the time budget, partial results of interlaced files\n");
+    printf("  limits  peak heap of decodes under pixel and byte limits, with a crafted 60000x60000 header on top\n");
+    printf("  frames  tiles/s of frames shared by several threads, one lock against frames published lock-free\n");
+    printf("  bands   extraction of decoded frames in bands of rows, by threads per frame\n");
+    printf("  paint   time to the first picture of the preview pane, worker publishing frames against converting all first\n");
+}
+
+int main(int argc, char** args)
+{
+    typedef int (*BenchFunction)(const std::vector<std::string>& files, int repetitions);
+    const struct { const char* name; BenchFunction function; } modes[] = {
+        { "decode", runDecode },
+        { "ingest", runIngest },
+        { "probe", runProbe },
+        { "copy", runCopy },
+        { "memory", runMemory },
+        { "kernels", runKernels },
+        { "thumbnail", runThumbnail },
+        { "preview", runPreview },
+        { "scale", runScale },
+        { "roi", runRoi },
+        { "cache", runCache },
+        { "disk", runDisk },
+        { "pool", runPool },
+        { "budget", runBudget },
+        { "limits", runLimits },
+        { "frames", runFrames },
+        { "bands", runBands },
+        { "paint", runPaint },
+    };
+
+    BenchFunction bench = runDecode;
+    int repetitions = 1;
+    std::vector<std::string> files;
+
+    int first_arg = 1;
+    for(const auto& mode : modes)
+    {
+        if(argc > 1 && std::string(args[1]) == mode.name)
+        {
+            bench = mode.function;
+            first_arg = 2;
+        }
+    }
+
+    for(int i = first_arg; i < argc; ++i)
+    {
+        std::string arg = args[i];
+
+        if(arg == "-r" && i + 1 < argc)
+        {
+            repetitions = std::max(1, atoi(args[i + 1]));
+            i++;
+            continue;
+        }
+
+        files.push_back(arg);
+    }
+
+    if(files.empty())
+    {
+        printUsage();
+        return 1;
+    }
+
+    return bench(files, repetitions);
+}
\ No newline at end of file
@@ -23,6 +23,7 @@ limitations under the License.
 #include <wincodec.h>
 
 // std headers
+#include <algorithm>
 #include <codecvt>
 #include <fstream>
 #include <memory>
@@ -295,6 +296,26 @@ bool save_bmp(BYTE* Buffer, int width, int height, DWORD paddedsize, LPCSTR bmpf
     return true;
 }
 
+/*!
+* @return 0 for formats the decoder does not output.
+*/
+UINT get_bytes_per_pixel(IWICBitmapFrameDecode* frame)
+{
+    WICPixelFormatGUID format;
+    if(FAILED(frame->GetPixelFormat(&format)))
+        return 0;
+
+    if(IsEqualGUID(format, GUID_WICPixelFormat8bppGray))
+        return 1;
+    if(IsEqualGUID(format, GUID_WICPixelFormat24bppBGR))
+        return 3;
+    if(IsEqualGUID(format, GUID_WICPixelFormat32bppPBGRA) || IsEqualGUID(format, GUID_WICPixelFormat32bppRGBA))
+        return 4;
+    if(IsEqualGUID(format, GUID_WICPixelFormat64bppRGBA))
+        return 8;
+    return 0;
+}
+
 HRESULT save_bitmapframe(IWICBitmapFrameDecode* frame, const std::string& filename)
 {
     UINT width;
@@ -303,10 +324,16 @@ HRESULT save_bitmapframe(IWICBitmapFrameDecode* frame, const std::string& filena
     if(FAILED(hr))
         return hr;
 
+    // the decoder outputs the format that fits the image, let WIC convert it like a real consumer would
+    ComPtr<IWICBitmapSource> rgba_source;
+    hr = WICConvertBitmapSource(GUID_WICPixelFormat32bppRGBA, frame, rgba_source.ptrptr());
+    if(FAILED(hr))
+        return hr;
+
     WICRect full_rect = { 0, 0, static_cast<INT>(width), static_cast<INT>(height) };
     std::vector<BYTE> rgba_bytes;
     rgba_bytes.resize(width * height * 4);
-    hr = frame->CopyPixels(&full_rect, width * 4, static_cast<UINT>(rgba_bytes.size()), rgba_bytes.data());
+    hr = rgba_source->CopyPixels(&full_rect, width * 4, static_cast<UINT>(rgba_bytes.size()), rgba_bytes.data());
     if(FAILED(hr))
         return hr;
 
@@ -381,19 +408,46 @@ int test_file(const std::string& filename, TestContext& test_context, IClassFact
         hr = frame->GetSize(&w, &h);
         HR_ASSERT(hr)
 
+        const UINT bpp = get_bytes_per_pixel(frame.get());
+        MY_ASSERT(bpp == 0, "Unexpected pixel format")
+
+        // the first copy is a small rectangle, decoded on its own
+        std::vector<BYTE> line;
         {
             WICRect line_rect = { 0, 0, static_cast<INT>(w), 1 };
-            std::vector<BYTE> line;
-            line.resize(w * 4);
-            hr = frame->CopyPixels(&line_rect, w * 4, static_cast<UINT>(line.size()), line.data());
+            line.resize(w * bpp);
+            hr = frame->CopyPixels(&line_rect, w * bpp, static_cast<UINT>(line.size()), line.data());
             HR_ASSERT(hr)
         }
 
         {
             WICRect full_rect = { 0, 0, static_cast<INT>(w), static_cast<INT>(h) };
             std::vector<BYTE> full;
-            full.resize(w * h * 4);
-            hr = frame->CopyPixels(&full_rect, w * 4, static_cast<UINT>(full.size()), full.data());
+            full.resize(w * h * bpp);
+            hr = frame->CopyPixels(&full_rect, w * bpp, static_cast<UINT>(full.size()), full.data());
+            HR_ASSERT(hr)
+
+            MY_ASSERT(memcmp(line.data(), full.data(), line.size()) != 0, "Region differs from the full frame")
+        }
+
+        {
+            ComPtr<IWICBitmapSourceTransform> transform;
+            hr = frame->QueryInterface(IID_IWICBitmapSourceTransform, (void**)transform.ptrptr());
+            HR_ASSERT(hr)
+
+            UINT scaled_w = std::max<UINT>(1, w / 4);
+            UINT scaled_h = std::max<UINT>(1, h / 4);
+            hr = transform->GetClosestSize(&scaled_w, &scaled_h);
+            HR_ASSERT(hr)
+            MY_ASSERT(scaled_w == 0 || scaled_h == 0 || scaled_w > w || scaled_h > h, "Unexpected scaled size")
+
+            WICPixelFormatGUID format = GUID_WICPixelFormat32bppPBGRA;
+            hr = transform->GetClosestPixelFormat(&format);
+            HR_ASSERT(hr)
+            MY_ASSERT(!IsEqualGUID(format, GUID_WICPixelFormat32bppPBGRA), "32bppPBGRA not supported")
+
+            std::vector<BYTE> scaled(scaled_w * scaled_h * 4);
+            hr = transform->CopyPixels(0, scaled_w, scaled_h, &format, WICBitmapTransformRotate0, scaled_w * 4, static_cast<UINT>(scaled.size()), scaled.data());
             HR_ASSERT(hr)
         }
 
@@ -405,6 +459,18 @@ int test_file(const std::string& filename, TestContext& test_context, IClassFact
 
         hr = save_bitmapframe(frame.get(), decoded_filename);
         HR_ASSERT(hr)
+
+        {
+            ComPtr<IWICBitmapSource> thumbnail;
+            hr = decoder->GetThumbnail(thumbnail.ptrptr());
+            HR_ASSERT(hr)
+
+            UINT thumbnail_w;
+            UINT thumbnail_h;
+            hr = thumbnail->GetSize(&thumbnail_w, &thumbnail_h);
+            HR_ASSERT(hr)
+            MY_ASSERT(thumbnail_w == 0 || thumbnail_h == 0 || thumbnail_w > 256 || thumbnail_h > 256, "Unexpected thumbnail size")
+        }
     }
 
     LARGE_INTEGER start_pos;
@@ -0,0 +1,178 @@
+/*
+Copyright 2017 Freddy Herzog
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+
+// decodes a list of FLIF files with the portable core, for jobs over whole directories
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "Batch.h"
+
+/*!
+* Reports failed files on stderr, and passes everything on.
+*/
+class ReportingSink : public flifcore::BatchSink
+{
+public:
+    explicit ReportingSink(flifcore::BatchSink& sink)
+        : _sink(sink)
+    {
+    }
+
+    virtual bool write(size_t index, const std::string& filename, const flifcore::CachedImage& image) override
+    {
+        return _sink.write(index, filename, image);
+    }
+
+    virtual void failed(size_t index, const std::string& filename, flifcore::DecodeStatus status) override
+    {
+        fprintf(stderr, "%s: %s\n", filename.c_str(), flifcore::toString(status));
+        _sink.failed(index, filename, status);
+    }
+
+private:
+    flifcore::BatchSink& _sink;
+};
+
+static void printUsage()
+{
+    fprintf(stderr, "Usage: flif_batch [options] list.txt\n");
+    fprintf(stderr, "Decodes the files named in list.txt, one per line, - reads the list from standard input.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -s sink     digest (default): a line with a hash of the pixels per file\n");
+    fprintf(stderr, "              raw: the pixels of all frames, back to back\n");
+    fprintf(stderr, "              pam: a PAM stream with an image per frame\n");
+    fprintf(stderr, "  -o file     output of the sink, standard output by default\n");
+    fprintf(stderr, "  -j threads  files decoded at once, one per hardware thread by default\n");
+    fprintf(stderr, "  -m MB       decoded pixels held at once, %u by default\n",
+        static_cast<unsigned int>(flifcore::BatchOptions::DEFAULT_MAX_IN_FLIGHT_BYTES / (1024 * 1024)));
+    fprintf(stderr, "  -16         16 bits per channel instead of 8\n");
+}
+
+static bool readList(std::istream& stream, std::vector<std::string>& files)
+{
+    std::string line;
+    while(std::getline(stream, line))
+    {
+        if(!line.empty() && line[line.size() - 1] == '\r')
+            line.resize(line.size() - 1);
+        if(!line.empty())
+            files.push_back(line);
+    }
+    return !stream.bad();
+}
+
+int main(int argc, char** args)
+{
+    std::string sink_name = "digest";
+    std::string output_name;
+    std::string list_name;
+    flifcore::BatchOptions options;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        const std::string arg = args[i];
+        const bool has_value = i + 1 < argc;
+
+        if(arg == "-s" && has_value)
+            sink_name = args[++i];
+        else if(arg == "-o" && has_value)
+            output_name = args[++i];
+        else if(arg == "-j" && has_value)
+            options.threads = static_cast<unsigned int>(std::max(1, atoi(args[++i])));
+        else if(arg == "-m" && has_value)
+            options.max_in_flight_bytes = uint64_t(std::max(1, atoi(args[++i]))) * 1024 * 1024;
+        else if(arg == "-16")
+            options.format = flifcore::PF_RGBA64;
+        else if(list_name.empty() && (arg == "-" || arg[0] != '-'))
+            list_name = arg;
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if(list_name.empty() || (sink_name != "digest" && sink_name != "raw" && sink_name != "pam"))
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    bool list_read;
+    if(list_name == "-")
+        list_read = readList(std::cin, files);
+    else
+    {
+        std::ifstream list(list_name.c_str());
+        list_read = list.is_open() && readList(list, files);
+    }
+    if(!list_read)
+    {
+        fprintf(stderr, "%s: cannot read the list\n", list_name.c_str());
+        return 1;
+    }
+
+    FILE* output = stdout;
+    if(!output_name.empty())
+    {
+        output = fopen(output_name.c_str(), sink_name == "digest" ? "w" : "wb");
+        if(output == 0)
+        {
+            fprintf(stderr, "%s: cannot open\n", output_name.c_str());
+            return 1;
+        }
+    }
+#ifdef _WIN32
+    else if(sink_name != "digest")
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    std::unique_ptr<flifcore::BatchSink> sink;
+    if(sink_name == "raw")
+        sink.reset(new flifcore::RawSink(output));
+    else if(sink_name == "pam")
+        sink.reset(new flifcore::PamSink(output));
+    else
+        sink.reset(new flifcore::DigestSink(output));
+
+    ReportingSink reporting_sink(*sink);
+    flifcore::BatchStats stats;
+    const bool completed = flifcore::decodeBatch(files, reporting_sink, stats, options);
+
+    const bool closed = output == stdout ? fflush(output) == 0 : fclose(output) == 0;
+    if(!completed || !closed)
+        fprintf(stderr, "writing the output failed\n");
+
+    fprintf(stderr, "%zu files, %zu failed, %.1f s: %.1f files/s, %.1f MB/s, p50 %.2f ms, p99 %.2f ms, peak in flight %.1f MB\n",
+        stats.files, stats.failed, stats.seconds, stats.filesPerSecond(), stats.megabytesPerSecond(),
+        stats.p50_ms, stats.p99_ms, stats.peak_in_flight_bytes / (1024.0 * 1024.0));
+
+    return completed && closed && stats.failed == 0 ? 0 : 1;
+}
\ No newline at end of file